@@ -1015,6 +1015,29 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
 
 #endif
 
+#if (NGX_HAVE_UDP_GRO)
+
+        if (ls[i].quic) {
+            value = ls[i].gro;
+
+            /*
+             * UDP_GRO is also reset on inherited sockets,
+             * failures are only reported if "quic_gro" is enabled
+             */
+
+            if (setsockopt(ls[i].fd, SOL_UDP, UDP_GRO,
+                           (const void *) &value, sizeof(int))
+                == -1
+                && value)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(UDP_GRO) %d for %V failed, ignored",
+                              value, &ls[i].addr_text);
+            }
+        }
+
+#endif
+
 #if (NGX_HAVE_IP_MTU_DISCOVER)
 
         if (ls[i].quic && ls[i].sockaddr->sa_family == AF_INET) {
@@ -1253,9 +1276,12 @@ ngx_free_connection(ngx_connection_t *c)
 void
 ngx_close_connection(ngx_connection_t *c)
 {
-    ngx_err_t     err;
-    ngx_uint_t    log_error, level;
-    ngx_socket_t  fd;
+    ngx_err_t       err;
+    ngx_uint_t      log_error, level;
+    ngx_socket_t    fd;
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    struct linger   linger;
+#endif
 
     if (c->fd == (ngx_socket_t) -1) {
         ngx_log_error(NGX_LOG_ALERT, c->log, 0, "connection already closed");
@@ -1270,6 +1296,28 @@ ngx_close_connection(ngx_connection_t *c)
         ngx_del_timer(c->write);
     }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+    if (c->zerocopy && c->zerocopy->pending) {
+
+        /*
+         * buffers of the pending zerocopy sends are going to be freed,
+         * so the data not yet sent are discarded with a reset
+         */
+
+        linger.l_onoff = 1;
+        linger.l_linger = 0;
+
+        if (setsockopt(c->fd, SOL_SOCKET, SO_LINGER,
+                       (const void *) &linger, sizeof(struct linger)) == -1)
+        {
+            ngx_log_error(NGX_LOG_CRIT, c->log, ngx_socket_errno,
+                          "setsockopt(SO_LINGER) failed");
+        }
+    }
+
+#endif
+
     if (!c->shared) {
         if (ngx_del_conn) {
             ngx_del_conn(c, NGX_CLOSE_EVENT);
@@ -74,6 +74,7 @@ struct ngx_listening_s {
     unsigned            add_reuseport:1;
     unsigned            keepalive:2;
     unsigned            quic:1;
+    unsigned            gro:1;
 
     unsigned            deferred_accept:1;
     unsigned            delete_deferred:1;
@@ -200,6 +201,10 @@ struct ngx_connection_s {
 #if (NGX_THREADS || NGX_COMPAT)
     ngx_thread_task_t  *sendfile_task;
 #endif
+
+#if (NGX_HAVE_MSG_ZEROCOPY || NGX_COMPAT)
+    ngx_zerocopy_t     *zerocopy;
+#endif
 };
 
 
@@ -9,10 +9,15 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_sse42;
+ngx_uint_t  ngx_cpu_avx2;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
 static ngx_inline void ngx_cpuid(uint32_t i, uint32_t *buf);
+static ngx_inline uint32_t ngx_xgetbv(void);
 
 
 #if ( __i386__ )
@@ -30,6 +35,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
     __asm__ (
 
     "    mov    %%ebx, %%esi;  "
+    "    xor    %%ecx, %%ecx;  "
 
     "    cpuid;                "
     "    mov    %%eax, (%1);   "
@@ -55,7 +61,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
         "cpuid"
 
-    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i) );
+    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i), "c" (0) );
 
     buf[0] = eax;
     buf[1] = ebx;
@@ -67,7 +73,25 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 #endif
 
 
-/* auto detect the L2 cache line size of modern and widespread CPUs */
+static ngx_inline uint32_t
+ngx_xgetbv(void)
+{
+    uint32_t  eax, edx;
+
+    __asm__ (
+
+        "xgetbv"
+
+    : "=a" (eax), "=d" (edx) : "c" (0) );
+
+    return eax;
+}
+
+
+/*
+ * auto detect the L2 cache line size of modern and widespread CPUs,
+ * and the SIMD extensions used by the HTTP parser
+ */
 
 void
 ngx_cpuinfo(void)
@@ -125,6 +149,25 @@ ngx_cpuinfo(void)
     } else if (ngx_strcmp(vendor, "AuthenticAMD") == 0) {
         ngx_cacheline_size = 64;
     }
+
+    /* SSE4.2 */
+
+    if (cpu[3] & 0x00100000) {
+        ngx_cpu_sse42 = 1;
+    }
+
+    /* AVX2 requires AVX and the YMM registers state saved by OS */
+
+    if (vbuf[0] >= 7
+        && (cpu[3] & 0x18000000) == 0x18000000
+        && (ngx_xgetbv() & 0x6) == 0x6)
+    {
+        ngx_cpuid(7, cpu);
+
+        if (cpu[1] & 0x00000020) {
+            ngx_cpu_avx2 = 1;
+        }
+    }
 }
 
 #else
@@ -19,6 +19,7 @@ ngx_int_t
 ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 {
     mtx->lock = &addr->lock;
+    mtx->contention = &addr->contention;
 
     if (mtx->spin == (ngx_uint_t) -1) {
         return NGX_OK;
@@ -73,6 +74,14 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx lock");
 
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        return;
+    }
+
+    /* count the lock contention */
+
+    (void) ngx_atomic_fetch_add(mtx->contention, 1);
+
     for ( ;; ) {
 
         if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
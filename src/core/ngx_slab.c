@@ -69,6 +69,26 @@
 
 #endif
 
+/* the magazines are used by workers in zones of 4M and more */
+#define NGX_SLAB_CACHES           128
+#define NGX_SLAB_CACHE_MAX_SHIFT  9
+#define NGX_SLAB_CACHE_MIN_PAGES  1024
+
+#if (NGX_WIN32)
+#define ngx_slab_cache_slot()     NGX_SLAB_CACHES
+#else
+#define ngx_slab_cache_slot()     (ngx_uint_t) ngx_process_slot
+#endif
+
+
+static void *ngx_slab_alloc_direct(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_free_direct(ngx_slab_pool_t *pool, void *p);
+static ngx_slab_cache_t *ngx_slab_get_cache(ngx_slab_pool_t *pool);
+static ngx_slab_cache_t *ngx_slab_claim_cache(ngx_slab_pool_t *pool);
+static ngx_uint_t ngx_slab_flush_cache(ngx_slab_pool_t *pool,
+    ngx_slab_cache_t *cache);
+static ngx_int_t ngx_slab_size_index(ngx_slab_pool_t *pool, size_t size);
+static ngx_int_t ngx_slab_chunk_index(ngx_slab_pool_t *pool, void *p);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -162,13 +182,51 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
+
+    pool->caches = NULL;
+    pool->drain = 0;
+    pool->reclaim = 0;
+
+    pool->locks = NULL;
+    pool->nlocks = 0;
+
+    if (pages >= NGX_SLAB_CACHE_MIN_PAGES
+        && pool->min_shift <= NGX_SLAB_CACHE_MAX_SHIFT)
+    {
+        pool->caches = ngx_slab_alloc_direct(pool,
+                                 NGX_SLAB_CACHES * sizeof(ngx_slab_cache_t *));
+        if (pool->caches) {
+            ngx_memzero(pool->caches,
+                        NGX_SLAB_CACHES * sizeof(ngx_slab_cache_t *));
+        }
+    }
 }
 
 
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
-    void  *p;
+    void                 *p;
+    ngx_int_t             n;
+    ngx_slab_cache_t     *cache;
+    ngx_slab_magazine_t  *mag;
+
+    cache = ngx_slab_get_cache(pool);
+
+    if (cache && cache->drain == pool->drain) {
+        n = ngx_slab_size_index(pool, size);
+
+        if (n != NGX_ERROR && cache->magazines[n].count) {
+            mag = &cache->magazines[n];
+
+            p = mag->chunks[--mag->count];
+
+            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                           "slab alloc: %p from magazine", p);
+
+            return p;
+        }
+    }
 
     ngx_shmtx_lock(&pool->mutex);
 
@@ -182,6 +240,84 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    void                 *p;
+    ngx_int_t             n;
+    ngx_uint_t            nomem;
+    ngx_slab_cache_t     *cache;
+    ngx_slab_magazine_t  *mag;
+
+    n = ngx_slab_size_index(pool, size);
+
+    if (n == NGX_ERROR) {
+        return ngx_slab_alloc_direct(pool, size);
+    }
+
+    cache = ngx_slab_get_cache(pool);
+
+    if (cache == NULL) {
+        cache = ngx_slab_claim_cache(pool);
+
+        if (cache == NULL) {
+            return ngx_slab_alloc_direct(pool, size);
+        }
+    }
+
+    if (cache->drain != pool->drain) {
+        (void) ngx_slab_flush_cache(pool, cache);
+    }
+
+    mag = &cache->magazines[n];
+
+    if (mag->count) {
+        p = mag->chunks[--mag->count];
+
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab alloc: %p from magazine", p);
+
+        return p;
+    }
+
+    p = ngx_slab_alloc_direct(pool, size);
+
+    if (p == NULL) {
+
+        /* return the chunks kept in magazines of all workers */
+
+        pool->drain++;
+
+        if (ngx_slab_flush_cache(pool, cache)) {
+            p = ngx_slab_alloc_direct(pool, size);
+        }
+
+        return p;
+    }
+
+    /* refill the magazine in a batch */
+
+    size = (size_t) 1 << (n + pool->min_shift);
+
+    nomem = pool->log_nomem;
+    pool->log_nomem = 0;
+
+    while (mag->count < NGX_SLAB_MAGAZINE_BATCH - 1) {
+        mag->chunks[mag->count] = ngx_slab_alloc_direct(pool, size);
+
+        if (mag->chunks[mag->count] == NULL) {
+            break;
+        }
+
+        mag->count++;
+    }
+
+    pool->log_nomem = nomem;
+
+    return p;
+}
+
+
+static void *
+ngx_slab_alloc_direct(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, m, mask, *bitmap;
@@ -449,6 +585,28 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+    ngx_int_t             n;
+    ngx_slab_cache_t     *cache;
+    ngx_slab_magazine_t  *mag;
+
+    cache = ngx_slab_get_cache(pool);
+
+    if (cache && cache->drain == pool->drain) {
+        n = ngx_slab_chunk_index(pool, p);
+
+        if (n != NGX_ERROR
+            && cache->magazines[n].count < NGX_SLAB_MAGAZINE_SIZE)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                           "slab free: %p to magazine", p);
+
+            mag = &cache->magazines[n];
+            mag->chunks[mag->count++] = p;
+
+            return;
+        }
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
     ngx_slab_free_locked(pool, p);
@@ -459,6 +617,53 @@ ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_int_t             n;
+    ngx_slab_cache_t     *cache;
+    ngx_slab_magazine_t  *mag;
+
+    n = ngx_slab_chunk_index(pool, p);
+
+    if (n == NGX_ERROR) {
+        ngx_slab_free_direct(pool, p);
+        return;
+    }
+
+    cache = ngx_slab_get_cache(pool);
+
+    if (cache == NULL) {
+        cache = ngx_slab_claim_cache(pool);
+
+        if (cache == NULL) {
+            ngx_slab_free_direct(pool, p);
+            return;
+        }
+    }
+
+    if (cache->drain != pool->drain) {
+        (void) ngx_slab_flush_cache(pool, cache);
+    }
+
+    mag = &cache->magazines[n];
+
+    if (mag->count == NGX_SLAB_MAGAZINE_SIZE) {
+
+        /* drain the magazine in a batch */
+
+        while (mag->count > NGX_SLAB_MAGAZINE_SIZE - NGX_SLAB_MAGAZINE_BATCH) {
+            ngx_slab_free_direct(pool, mag->chunks[--mag->count]);
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab free: %p to magazine", p);
+
+    mag->chunks[mag->count++] = p;
+}
+
+
+static void
+ngx_slab_free_direct(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
@@ -674,6 +879,241 @@ fail:
 }
 
 
+void
+ngx_slab_flush(ngx_slab_pool_t *pool)
+{
+    ngx_slab_cache_t  *cache;
+
+    cache = ngx_slab_get_cache(pool);
+
+    if (cache == NULL) {
+        return;
+    }
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    (void) ngx_slab_flush_cache(pool, cache);
+
+    cache->pid = 0;
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+void
+ngx_slab_reclaim(ngx_slab_pool_t *pool, ngx_pid_t pid)
+{
+    ngx_uint_t         i;
+    ngx_slab_cache_t  *cache;
+
+    /*
+     * called by the master process when a worker has exited abnormally:
+     * the magazines of the worker are marked to be flushed by any worker
+     * which holds the lock
+     */
+
+    if (pool->caches == NULL) {
+        return;
+    }
+
+    for (i = 0; i < NGX_SLAB_CACHES; i++) {
+        cache = pool->caches[i];
+
+        if (cache && cache->pid == pid) {
+            cache->pid = 0;
+            pool->reclaim = 1;
+        }
+    }
+}
+
+
+ngx_atomic_uint_t
+ngx_slab_contention(ngx_slab_pool_t *pool)
+{
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    ngx_uint_t         i;
+    ngx_atomic_uint_t  contention;
+
+    /* the lock contention of the zone, including its additional locks */
+
+    contention = *pool->mutex.contention;
+
+    for (i = 0; i < pool->nlocks; i++) {
+        contention += *pool->locks[i].contention;
+    }
+
+    return contention;
+
+#else
+
+    return 0;
+
+#endif
+}
+
+
+static ngx_slab_cache_t *
+ngx_slab_get_cache(ngx_slab_pool_t *pool)
+{
+    ngx_slab_cache_t  *cache;
+
+    if (pool->caches == NULL
+        || ngx_process != NGX_PROCESS_WORKER
+        || ngx_slab_cache_slot() >= NGX_SLAB_CACHES)
+    {
+        return NULL;
+    }
+
+    cache = pool->caches[ngx_slab_cache_slot()];
+
+    if (cache == NULL || cache->pid != ngx_pid) {
+        return NULL;
+    }
+
+    return cache;
+}
+
+
+static ngx_slab_cache_t *
+ngx_slab_claim_cache(ngx_slab_pool_t *pool)
+{
+    size_t             size;
+    ngx_uint_t         i;
+    ngx_slab_cache_t  *cache;
+
+    if (pool->caches == NULL
+        || ngx_process != NGX_PROCESS_WORKER
+        || ngx_slab_cache_slot() >= NGX_SLAB_CACHES)
+    {
+        return NULL;
+    }
+
+    if (pool->reclaim) {
+        pool->reclaim = 0;
+
+        for (i = 0; i < NGX_SLAB_CACHES; i++) {
+            cache = pool->caches[i];
+
+            if (cache && cache->pid == 0) {
+                (void) ngx_slab_flush_cache(pool, cache);
+            }
+        }
+    }
+
+    cache = pool->caches[ngx_slab_cache_slot()];
+
+    if (cache == NULL) {
+        size = sizeof(ngx_slab_cache_t)
+               + (NGX_SLAB_CACHE_MAX_SHIFT - pool->min_shift)
+                 * sizeof(ngx_slab_magazine_t);
+
+        cache = ngx_slab_alloc_direct(pool, size);
+        if (cache == NULL) {
+            return NULL;
+        }
+
+        ngx_memzero(cache, size);
+
+        pool->caches[ngx_slab_cache_slot()] = cache;
+
+    } else {
+        /* the previous process in the slot has exited */
+        (void) ngx_slab_flush_cache(pool, cache);
+    }
+
+    cache->pid = ngx_pid;
+    cache->drain = pool->drain;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab cache: %p slot: %ui", cache, ngx_slab_cache_slot());
+
+    return cache;
+}
+
+
+static ngx_uint_t
+ngx_slab_flush_cache(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache)
+{
+    ngx_uint_t            i, n;
+    ngx_slab_magazine_t  *mag;
+
+    n = 0;
+
+    for (i = 0; i <= NGX_SLAB_CACHE_MAX_SHIFT - pool->min_shift; i++) {
+        mag = &cache->magazines[i];
+
+        while (mag->count) {
+            ngx_slab_free_direct(pool, mag->chunks[--mag->count]);
+            n++;
+        }
+    }
+
+    cache->drain = pool->drain;
+
+    return n;
+}
+
+
+static ngx_int_t
+ngx_slab_size_index(ngx_slab_pool_t *pool, size_t size)
+{
+    size_t      s;
+    ngx_uint_t  shift;
+
+    if (size > (size_t) 1 << NGX_SLAB_CACHE_MAX_SHIFT) {
+        return NGX_ERROR;
+    }
+
+    if (size > pool->min_size) {
+        shift = 1;
+        for (s = size - 1; s >>= 1; shift++) { /* void */ }
+
+    } else {
+        shift = pool->min_shift;
+    }
+
+    return shift - pool->min_shift;
+}
+
+
+static ngx_int_t
+ngx_slab_chunk_index(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_uint_t        shift;
+    ngx_slab_page_t  *page;
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end) {
+        return NGX_ERROR;
+    }
+
+    page = &pool->pages[((u_char *) p - pool->start) >> ngx_pagesize_shift];
+
+    switch (ngx_slab_page_type(page)) {
+
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default:
+        return NGX_ERROR;
+    }
+
+    if (shift > NGX_SLAB_CACHE_MAX_SHIFT
+        || ((uintptr_t) p & (((uintptr_t) 1 << shift) - 1)))
+    {
+        return NGX_ERROR;
+    }
+
+    return shift - pool->min_shift;
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
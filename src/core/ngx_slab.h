@@ -31,6 +31,28 @@ typedef struct {
 } ngx_slab_stat_t;
 
 
+#define NGX_SLAB_MAGAZINE_SIZE    8
+#define NGX_SLAB_MAGAZINE_BATCH   4
+
+
+typedef struct {
+    ngx_uint_t        count;
+    void             *chunks[NGX_SLAB_MAGAZINE_SIZE];
+} ngx_slab_magazine_t;
+
+
+/*
+ * the per-worker magazines of free chunks of small sizes, used by
+ * the owner worker without locking
+ */
+
+typedef struct {
+    ngx_pid_t             pid;
+    ngx_uint_t            drain;
+    ngx_slab_magazine_t   magazines[1];
+} ngx_slab_cache_t;
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -44,11 +66,19 @@ typedef struct {
     ngx_slab_stat_t  *stats;
     ngx_uint_t        pfree;
 
+    ngx_slab_cache_t **caches;
+    ngx_uint_t        drain;
+    ngx_atomic_t      reclaim;
+
     u_char           *start;
     u_char           *end;
 
     ngx_shmtx_t       mutex;
 
+    /* the additional locks of the zone, such as lock stripes */
+    ngx_shmtx_t      *locks;
+    ngx_uint_t        nlocks;
+
     u_char           *log_ctx;
     u_char            zero;
 
@@ -67,6 +97,9 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_flush(ngx_slab_pool_t *pool);
+void ngx_slab_reclaim(ngx_slab_pool_t *pool, ngx_pid_t pid);
+ngx_atomic_uint_t ngx_slab_contention(ngx_slab_pool_t *pool);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
@@ -0,0 +1,2249 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module uses io_uring as a readiness notification mechanism.
+ * Every connection has at most one poll request in the submission ring:
+ * a multishot edge-triggered one for NGX_CLEAR_EVENT, or a oneshot one,
+ * rearmed after each completion, for level-triggered events (listening
+ * sockets).  Poll requests, their removals and the wait timeout are
+ * batched and passed to the kernel with a single io_uring_enter() call
+ * per event loop iteration, instead of an epoll_ctl() call per change.
+ *
+ * Where the kernel supports it (Linux 6.0), accept and recv are moved
+ * into the ring too:
+ *
+ * TCP listening sockets have a multishot accept request instead of
+ * a poll one.  The accepted sockets are queued and then handed out to
+ * ngx_event_accept() by ngx_io_uring_accept(), which only calls
+ * getpeername() to obtain the client address.
+ *
+ * A client connection, once its socket has been drained by recv(),
+ * stops polling for the read event and gets a multishot recv request
+ * which reads the data into buffers of the "io_uring_buffers" ring.
+ * ngx_io_uring_recv() and ngx_io_uring_recv_chain() then copy the data
+ * from these buffers without syscalls.  If the buffers are exhausted,
+ * or a connection holds NGX_IO_URING_RECV_BUFS buffers that are not read,
+ * the recv request is stopped and the connection returns to the poll
+ * request and recv() until the socket is drained again.
+ *
+ * Data read by the ring is not available to the code that reads the
+ * socket directly, so ring reads are only used for client connections
+ * of the plain recv() path: SSL connections, upstream connections,
+ * which are checked with MSG_PEEK while cached, and mail connections
+ * with STARTTLS are read with syscalls.  Writes are not moved to the
+ * ring.
+ *
+ * Completion user data contains the connection index, the request type,
+ * the event instance and a generation number that allows to ignore
+ * completions of requests that were already removed.
+ */
+
+
+#define NGX_IO_URING_CONTROL     0
+#define NGX_IO_URING_NOTIFY      ((uint64_t) -1)
+
+#define NGX_IO_URING_POLL        0
+#define NGX_IO_URING_ACCEPT      1
+#define NGX_IO_URING_RECV        2
+
+#define NGX_IO_URING_RECV_BUFS   4
+
+#define ngx_io_uring_data(index, gen, type, instance)                        \
+    ((uint64_t) (gen) << 32 | (uint64_t) (index) << 3 | (type) << 1          \
+     | (instance))
+
+
+typedef struct {
+    ngx_uint_t        entries;
+    ngx_bufs_t        buffers;
+} ngx_io_uring_conf_t;
+
+
+typedef struct {
+    ngx_queue_t       queue;
+    ngx_connection_t *connection;
+    ngx_socket_t     *sockets;
+    ngx_uint_t        pos;
+    ngx_uint_t        nelts;
+    ngx_uint_t        nalloc;
+    ngx_err_t         error;
+    unsigned          queued:1;
+} ngx_io_uring_accept_t;
+
+
+typedef struct {
+    uint32_t          gen;
+    uint32_t          events;
+    uint32_t          io_gen;
+    uint32_t          nbufs;
+    uint16_t          first;
+    uint16_t          last;
+    ngx_err_t         error;
+    ngx_io_uring_accept_t  *accept;
+    unsigned          armed:1;
+    unsigned          level:1;
+    unsigned          io:1;
+    unsigned          eof:1;
+} ngx_io_uring_conn_t;
+
+
+typedef struct {
+    uint32_t          pos;
+    uint32_t          last;
+    uint16_t          next;
+} ngx_io_uring_buf_t;
+
+
+typedef struct {
+    uint32_t         *head;
+    uint32_t         *tail;
+    uint32_t          mask;
+    uint32_t          entries;
+    uint32_t         *flags;
+    uint32_t         *array;
+    uint32_t          local_tail;
+    uint32_t          pending;
+    u_char           *ring;
+    size_t            ring_size;
+    struct io_uring_sqe  *sqes;
+    size_t            sqes_size;
+} ngx_io_uring_sq_t;
+
+
+typedef struct {
+    uint32_t         *head;
+    uint32_t         *tail;
+    uint32_t          mask;
+    uint32_t          entries;
+    struct io_uring_cqe  *cqes;
+    u_char           *ring;
+    size_t            ring_size;
+} ngx_io_uring_cq_t;
+
+
+static ngx_int_t ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_io_uring_setup(ngx_cycle_t *cycle,
+    ngx_io_uring_conf_t *urcf);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify_init(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_notify_arm(ngx_log_t *log);
+static void ngx_io_uring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_io_uring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_io_uring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+static ngx_io_uring_conn_t *ngx_io_uring_conn(ngx_connection_t *c,
+    ngx_log_t *log);
+static ngx_int_t ngx_io_uring_arm(ngx_connection_t *c,
+    ngx_io_uring_conn_t *p, uint32_t events, ngx_uint_t level);
+static ngx_int_t ngx_io_uring_cancel(ngx_connection_t *c,
+    ngx_io_uring_conn_t *p);
+static struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_log_t *log);
+static int ngx_io_uring_enter(unsigned to_submit, unsigned min_complete,
+    unsigned flags, struct io_uring_getevents_arg *arg);
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+static ngx_int_t ngx_io_uring_buffers_init(ngx_cycle_t *cycle,
+    ngx_io_uring_conf_t *urcf);
+static void ngx_io_uring_free_buf(uint16_t bid);
+static ngx_int_t ngx_io_uring_cancel_io(ngx_connection_t *c,
+    ngx_io_uring_conn_t *p, ngx_uint_t type);
+
+static ngx_int_t ngx_io_uring_accept_arm(ngx_connection_t *c,
+    ngx_io_uring_conn_t *p);
+static void ngx_io_uring_accept_complete(ngx_cycle_t *cycle, ngx_uint_t i,
+    uint32_t gen, struct io_uring_cqe *cqe);
+static void ngx_io_uring_accept_post(ngx_uint_t flags);
+static void ngx_io_uring_accept_close(ngx_io_uring_accept_t *a);
+
+static ssize_t ngx_io_uring_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_io_uring_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *chain, off_t limit);
+static ngx_io_uring_conn_t *ngx_io_uring_recv_conn(ngx_connection_t *c);
+static ssize_t ngx_io_uring_recv_buffered(ngx_connection_t *c,
+    ngx_io_uring_conn_t *p, u_char *buf, size_t size);
+static ngx_int_t ngx_io_uring_recv_start(ngx_connection_t *c,
+    ngx_io_uring_conn_t *p);
+static void ngx_io_uring_recv_stop(ngx_connection_t *c,
+    ngx_io_uring_conn_t *p);
+static void ngx_io_uring_recv_complete(ngx_cycle_t *cycle, ngx_uint_t i,
+    uint32_t gen, ngx_uint_t instance, struct io_uring_cqe *cqe,
+    ngx_uint_t flags);
+static void ngx_io_uring_recv_free(ngx_io_uring_conn_t *p);
+#endif
+
+static void *ngx_io_uring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                   ring = -1;
+static ngx_io_uring_sq_t     sq;
+static ngx_io_uring_cq_t     cq;
+
+static ngx_io_uring_conn_t  *conns;
+static ngx_uint_t            connection_n;
+
+#if (NGX_HAVE_EVENTFD)
+static int                   notify_fd = -1;
+static ngx_event_t           notify_event;
+static ngx_connection_t      notify_conn;
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+static ngx_uint_t            ring_accept;
+static ngx_uint_t            ring_recv;
+
+static struct io_uring_buf_ring  *buf_ring;
+static ngx_io_uring_buf_t   *bufs;
+static u_char               *buf_base;
+static size_t                buf_size;
+static uint32_t              buf_n;
+static uint16_t              buf_tail;
+
+static ngx_uint_t            buf_exhausted;
+static time_t                buf_exhausted_time;
+
+static ngx_queue_t           accepted;
+#endif
+
+
+static ngx_str_t      io_uring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_io_uring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, entries),
+      NULL },
+
+    { ngx_string("io_uring_buffers"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE2,
+      ngx_conf_set_bufs_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, buffers),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_io_uring_module_ctx = {
+    &io_uring_name,
+    ngx_io_uring_create_conf,            /* create configuration */
+    ngx_io_uring_init_conf,              /* init configuration */
+
+    {
+        ngx_io_uring_add_event,          /* add an event */
+        ngx_io_uring_del_event,          /* delete an event */
+        ngx_io_uring_add_event,          /* enable an event */
+        ngx_io_uring_del_event,          /* disable an event */
+        ngx_io_uring_add_connection,     /* add an connection */
+        ngx_io_uring_del_connection,     /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_io_uring_notify,             /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_io_uring_process_events,     /* process the events */
+        ngx_io_uring_init,               /* init the events */
+        ngx_io_uring_done,               /* done the events */
+    }
+};
+
+ngx_module_t  ngx_io_uring_module = {
+    NGX_MODULE_V1,
+    &ngx_io_uring_module_ctx,            /* module context */
+    ngx_io_uring_commands,               /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly
+ * as syscalls instead of liburing usage
+ */
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+static int
+io_uring_register(unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(SYS_io_uring_register, ring, opcode, arg, nr_args);
+}
+
+#endif
+
+
+static int
+ngx_io_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+    struct io_uring_getevents_arg *arg)
+{
+    if (arg == NULL) {
+        return syscall(SYS_io_uring_enter, ring, to_submit, min_complete,
+                       flags, NULL, 0);
+    }
+
+    return syscall(SYS_io_uring_enter, ring, to_submit, min_complete,
+                   flags | IORING_ENTER_EXT_ARG, arg,
+                   sizeof(struct io_uring_getevents_arg));
+}
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    if (ring == -1) {
+        if (ngx_io_uring_setup(cycle, urcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_io_uring_notify_init(cycle->log) != NGX_OK) {
+            ngx_io_uring_module_ctx.actions.notify = NULL;
+        }
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+        ngx_queue_init(&accepted);
+
+        if (ngx_io_uring_buffers_init(cycle, urcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+
+        /* Linux AIO completions are reported via the epoll eventfd */
+
+        ngx_file_aio = 0;
+#endif
+    }
+
+    if (connection_n < cycle->connection_n) {
+        if (conns) {
+            ngx_free(conns);
+        }
+
+        conns = ngx_calloc(sizeof(ngx_io_uring_conn_t) * cycle->connection_n,
+                           cycle->log);
+        if (conns == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    connection_n = cycle->connection_n;
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_io_uring_module_ctx.actions;
+
+    /*
+     * poll requests follow epoll semantics, including EPOLLRDHUP
+     * reporting, so the epoll code paths are used for connections
+     */
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT;
+
+#if (NGX_HAVE_EPOLLRDHUP)
+    ngx_use_epoll_rdhup = 1;
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (ring_accept) {
+        ngx_event_flags |= NGX_USE_IO_URING_EVENT;
+    }
+
+    if (ring_recv) {
+        ngx_io.recv = ngx_io_uring_recv;
+        ngx_io.recv_chain = ngx_io_uring_recv_chain;
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_setup(ngx_cycle_t *cycle, ngx_io_uring_conf_t *urcf)
+{
+    uint32_t                i;
+    struct io_uring_params  p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    p.flags = IORING_SETUP_CQSIZE
+#if defined(IORING_SETUP_SUBMIT_ALL)
+              |IORING_SETUP_SUBMIT_ALL
+#endif
+#if defined(IORING_SETUP_COOP_TASKRUN)
+              |IORING_SETUP_COOP_TASKRUN
+#endif
+              ;
+    p.cq_entries = urcf->entries * 4;
+
+    ring = io_uring_setup(urcf->entries, &p);
+
+    if (ring == -1 && ngx_errno == NGX_EINVAL) {
+
+        /* the optional flags are not supported by the kernel */
+
+        ngx_memzero(&p, sizeof(struct io_uring_params));
+
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = urcf->entries * 4;
+
+        ring = io_uring_setup(urcf->entries, &p);
+    }
+
+    if (ring == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    if (!(p.features & IORING_FEAT_EXT_ARG)
+        || !(p.features & IORING_FEAT_NODROP)
+        || !(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring is not supported by the kernel, "
+                      "features: %08XD", p.features);
+        goto failed;
+    }
+
+    sq.ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq.ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (cq.ring_size > sq.ring_size) {
+        sq.ring_size = cq.ring_size;
+    }
+
+    cq.ring_size = sq.ring_size;
+
+    sq.ring = mmap(NULL, sq.ring_size, PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+    if (sq.ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        goto failed;
+    }
+
+    cq.ring = sq.ring;
+
+    sq.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    sq.sqes = mmap(NULL, sq.sqes_size, PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES);
+
+    if (sq.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+
+        if (munmap(sq.ring, sq.ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap() failed");
+        }
+
+        goto failed;
+    }
+
+    sq.head = (uint32_t *) (sq.ring + p.sq_off.head);
+    sq.tail = (uint32_t *) (sq.ring + p.sq_off.tail);
+    sq.mask = *(uint32_t *) (sq.ring + p.sq_off.ring_mask);
+    sq.entries = *(uint32_t *) (sq.ring + p.sq_off.ring_entries);
+    sq.flags = (uint32_t *) (sq.ring + p.sq_off.flags);
+    sq.array = (uint32_t *) (sq.ring + p.sq_off.array);
+    sq.local_tail = *sq.tail;
+    sq.pending = 0;
+
+    for (i = 0; i < sq.entries; i++) {
+        sq.array[i] = i;
+    }
+
+    cq.head = (uint32_t *) (cq.ring + p.cq_off.head);
+    cq.tail = (uint32_t *) (cq.ring + p.cq_off.tail);
+    cq.mask = *(uint32_t *) (cq.ring + p.cq_off.ring_mask);
+    cq.entries = *(uint32_t *) (cq.ring + p.cq_off.ring_entries);
+    cq.cqes = (struct io_uring_cqe *) (cq.ring + p.cq_off.cqes);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   ring, sq.entries, cq.entries);
+
+    return NGX_OK;
+
+failed:
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    return NGX_ERROR;
+}
+
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+static ngx_int_t
+ngx_io_uring_buffers_init(ngx_cycle_t *cycle, ngx_io_uring_conf_t *urcf)
+{
+    uint32_t                 i;
+    struct io_uring_buf_reg  reg;
+
+    buf_n = urcf->buffers.num;
+    buf_size = urcf->buffers.size;
+
+    buf_ring = ngx_memalign(ngx_pagesize,
+                            buf_n * sizeof(struct io_uring_buf), cycle->log);
+    if (buf_ring == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(buf_ring, buf_n * sizeof(struct io_uring_buf));
+
+    ngx_memzero(&reg, sizeof(struct io_uring_buf_reg));
+
+    reg.ring_addr = (uintptr_t) buf_ring;
+    reg.ring_entries = buf_n;
+    reg.bgid = 0;
+
+    if (io_uring_register(IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+
+        /*
+         * provided buffer rings and multishot accept
+         * appeared in Linux 5.19
+         */
+
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_errno,
+                      "io_uring_register(IORING_REGISTER_PBUF_RING) failed, "
+                      "accept and recv are not done by io_uring");
+
+        ngx_free(buf_ring);
+        buf_ring = NULL;
+
+        return NGX_OK;
+    }
+
+    bufs = ngx_alloc(buf_n * sizeof(ngx_io_uring_buf_t), cycle->log);
+    if (bufs == NULL) {
+        return NGX_ERROR;
+    }
+
+    buf_base = ngx_memalign(ngx_pagesize, buf_n * buf_size, cycle->log);
+    if (buf_base == NULL) {
+        return NGX_ERROR;
+    }
+
+    buf_tail = 0;
+
+    for (i = 0; i < buf_n; i++) {
+        ngx_io_uring_free_buf((uint16_t) i);
+    }
+
+    ring_accept = 1;
+    ring_recv = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring buffers: %uD of %uz", buf_n, buf_size);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_free_buf(uint16_t bid)
+{
+    struct io_uring_buf  *b;
+
+    b = &buf_ring->bufs[buf_tail & (buf_n - 1)];
+
+    b->addr = (uintptr_t) (buf_base + bid * buf_size);
+    b->len = buf_size;
+    b->bid = bid;
+
+    buf_tail++;
+
+    ngx_memory_barrier();
+    buf_ring->tail = buf_tail;
+}
+
+#endif
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_io_uring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.log = log;
+
+    if (ngx_io_uring_notify_arm(log) != NGX_OK) {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_notify_arm(ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = notify_fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = EPOLLIN;
+    sqe->user_data = NGX_IO_URING_NOTIFY;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    if (++ev->index == NGX_MAX_UINT32_VALUE) {
+        ev->index = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_io_uring_done(ngx_cycle_t *cycle)
+{
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+    ngx_uint_t  i;
+#endif
+
+    if (munmap(sq.sqes, sq.sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap() failed");
+    }
+
+    if (munmap(sq.ring, sq.ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap() failed");
+    }
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    ngx_memzero(&sq, sizeof(ngx_io_uring_sq_t));
+    ngx_memzero(&cq, sizeof(ngx_io_uring_cq_t));
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1 && close(notify_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "eventfd close() failed");
+    }
+
+    notify_fd = -1;
+
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    for (i = 0; i < connection_n; i++) {
+        if (conns[i].accept) {
+            ngx_io_uring_accept_close(conns[i].accept);
+            ngx_free(conns[i].accept->sockets);
+            ngx_free(conns[i].accept);
+        }
+    }
+
+    if (buf_ring) {
+        ngx_free(buf_ring);
+        ngx_free(bufs);
+        ngx_free(buf_base);
+
+        buf_ring = NULL;
+        bufs = NULL;
+        buf_base = NULL;
+    }
+
+    ring_accept = 0;
+    ring_recv = 0;
+
+#endif
+
+    ngx_free(conns);
+
+    conns = NULL;
+    connection_n = 0;
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t              events;
+    ngx_uint_t            level;
+    ngx_event_t          *e;
+    ngx_connection_t     *c;
+    ngx_io_uring_conn_t  *p;
+
+    c = ev->data;
+
+    p = ngx_io_uring_conn(c, ev->log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (ev->accept && ring_accept && c->type == SOCK_STREAM) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring add accept: fd:%d io:%d", c->fd, p->io);
+
+        if (!p->io && ngx_io_uring_accept_arm(c, p) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ev->active = 1;
+
+        return NGX_OK;
+    }
+
+    if (event == NGX_READ_EVENT && p->io && ev->active) {
+
+        /* the read event is reported by the recv request */
+
+        return NGX_OK;
+    }
+
+#endif
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        events = EPOLLIN|EPOLLRDHUP;
+
+    } else {
+        e = c->read;
+        events = EPOLLOUT;
+    }
+
+    level = (flags & NGX_CLEAR_EVENT) ? 0 : 1;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d ev:%08XD armed:%d level:%ui",
+                   c->fd, events, p->armed, level);
+
+    if (p->armed) {
+
+        if (ev->active && (p->events & events) == events) {
+            return NGX_OK;
+        }
+
+        /*
+         * rearm the poll request to add the event to the mask
+         * and to recheck the readiness like EPOLL_CTL_MOD does
+         */
+
+        if (e->active) {
+            events |= p->events;
+            level = p->level;
+        }
+
+        if (ngx_io_uring_cancel(c, p) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (!level) {
+        events = EPOLLIN|EPOLLOUT|EPOLLRDHUP;
+    }
+
+    if (ngx_io_uring_arm(c, p, events, level) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (event == NGX_READ_EVENT && (p->nbufs || p->eof || p->error)) {
+
+        /* the data read ahead are not reported by the poll request */
+
+        ev->ready = 1;
+        ev->available = -1;
+
+        ngx_post_event(ev, &ngx_posted_events);
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_event_t          *e;
+    ngx_connection_t     *c;
+    ngx_io_uring_conn_t  *p;
+
+    /*
+     * unlike epoll, a pending poll request holds a reference to the file,
+     * so it is removed even if the file descriptor is going to be closed
+     */
+
+    c = ev->data;
+
+    ev->active = 0;
+
+    p = ngx_io_uring_conn(c, ev->log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (event == NGX_READ_EVENT && p->io) {
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring del %s: fd:%d flags:%ui",
+                       ev->accept ? "accept" : "recv", c->fd, flags);
+
+        if (ev->accept) {
+
+            /* the sockets already accepted are still handed out */
+
+            if (ngx_io_uring_cancel_io(c, p, NGX_IO_URING_ACCEPT) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            p->io = 0;
+
+            return NGX_OK;
+        }
+
+        if (ngx_io_uring_cancel_io(c, p, NGX_IO_URING_RECV) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (flags & NGX_CLOSE_EVENT) {
+            p->io_gen++;
+            p->io = 0;
+
+            ngx_io_uring_recv_free(p);
+        }
+    }
+
+#endif
+
+    e = (event == NGX_READ_EVENT) ? c->write : c->read;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d ev:%i armed:%d",
+                   c->fd, event, p->armed);
+
+    if (e->active && !(flags & NGX_CLOSE_EVENT)) {
+
+        /* events of the inactive direction are ignored */
+
+        return NGX_OK;
+    }
+
+    if (p->armed) {
+        return ngx_io_uring_cancel(c, p);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_connection(ngx_connection_t *c)
+{
+    ngx_io_uring_conn_t  *p;
+
+    p = ngx_io_uring_conn(c, c->log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring add connection: fd:%d armed:%d",
+                   c->fd, p->armed);
+
+    if (p->armed && ngx_io_uring_cancel(c, p) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_io_uring_arm(c, p, EPOLLIN|EPOLLOUT|EPOLLRDHUP, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 1;
+    c->write->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    ngx_io_uring_conn_t  *p;
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    p = ngx_io_uring_conn(c, c->log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring del connection: fd:%d armed:%d io:%d",
+                   c->fd, p->armed, p->io);
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (p->io) {
+        if (ngx_io_uring_cancel_io(c, p, NGX_IO_URING_RECV) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p->io = 0;
+    }
+
+    if (flags & NGX_CLOSE_EVENT) {
+
+        /* the data read ahead are discarded */
+
+        p->io_gen++;
+
+        ngx_io_uring_recv_free(p);
+    }
+
+#endif
+
+    if (p->armed) {
+        return ngx_io_uring_cancel(c, p);
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_io_uring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                            rc;
+    uint32_t                       head, tail, revents, gen;
+    uint64_t                       data;
+    ngx_int_t                      instance;
+    ngx_uint_t                     level, i, more;
+    ngx_err_t                      err;
+    ngx_event_t                   *rev, *wev;
+    ngx_queue_t                   *queue;
+    ngx_connection_t              *c;
+    ngx_io_uring_conn_t           *p;
+    struct io_uring_cqe           *cqe;
+    struct __kernel_timespec       ts;
+    struct io_uring_getevents_arg  arg;
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+    ngx_uint_t                     type;
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (!ngx_queue_empty(&accepted)) {
+
+        /* the accepted sockets are not handed out yet */
+
+        timer = 0;
+    }
+
+#endif
+
+    /* NGX_TIMER_INFINITE == INFTIM */
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M, submit: %uD", timer, sq.pending);
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+    }
+
+    ngx_memory_barrier();
+    *sq.tail = sq.local_tail;
+
+    rc = ngx_io_uring_enter(sq.pending, timer ? 1 : 0,
+                            IORING_ENTER_GETEVENTS, &arg);
+
+    err = (rc == -1) ? ngx_errno : 0;
+
+    if (rc > 0) {
+        sq.pending -= ngx_min((uint32_t) rc, sq.pending);
+    }
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err && err != ETIME && err != NGX_EBUSY && err != NGX_EAGAIN) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    head = *cq.head;
+    tail = *cq.tail;
+    ngx_memory_barrier();
+
+    for ( /* void */ ; head != tail; head++) {
+        cqe = &cq.cqes[head & cq.mask];
+
+        data = cqe->user_data;
+        more = cqe->flags & IORING_CQE_F_MORE;
+
+        if (data == NGX_IO_URING_CONTROL) {
+
+            if (cqe->res < 0 && cqe->res != -NGX_ENOENT
+                && cqe->res != -EALREADY)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, -cqe->res,
+                              "io_uring cancel failed");
+            }
+
+            continue;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+
+        if (data == NGX_IO_URING_NOTIFY) {
+
+            if (!more) {
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring notify rearm: %d", cqe->res);
+
+                (void) ngx_io_uring_notify_arm(cycle->log);
+            }
+
+            if (cqe->res > 0) {
+                notify_event.ready = 1;
+
+                if (flags & NGX_POST_EVENTS) {
+                    ngx_post_event(&notify_event, &ngx_posted_events);
+
+                } else {
+                    notify_event.handler(&notify_event);
+                }
+            }
+
+            continue;
+        }
+
+#endif
+
+        instance = data & 1;
+        i = (data >> 3) & 0x1fffffff;
+        gen = (uint32_t) (data >> 32);
+
+        if (i >= connection_n) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                          "io_uring: invalid completion %uL", data);
+            continue;
+        }
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+        type = (data >> 1) & 3;
+
+        if (type == NGX_IO_URING_ACCEPT) {
+            ngx_io_uring_accept_complete(cycle, i, gen, cqe);
+            continue;
+        }
+
+        if (type == NGX_IO_URING_RECV) {
+            ngx_io_uring_recv_complete(cycle, i, gen, instance, cqe, flags);
+            continue;
+        }
+
+#endif
+
+        p = &conns[i];
+
+        if (gen != p->gen || !p->armed) {
+
+            /* the completion of a removed poll request */
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale completion %uL res:%d",
+                           data, cqe->res);
+            continue;
+        }
+
+        if (!more) {
+            p->armed = 0;
+        }
+
+        c = &ngx_cycle->connections[i];
+
+        rev = c->read;
+
+        if (c->fd == -1 || rev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            continue;
+        }
+
+        if (cqe->res < 0) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, -cqe->res,
+                           "io_uring poll error on fd:%d res:%d",
+                           c->fd, cqe->res);
+
+            revents = EPOLLERR;
+
+        } else {
+            revents = (uint32_t) cqe->res;
+        }
+
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04XD more:%ui d:%uL",
+                       c->fd, revents, more, data);
+
+        if (revents & (EPOLLERR|EPOLLHUP)) {
+
+            /*
+             * if the error events were returned, add EPOLLIN and EPOLLOUT
+             * to handle the events at least in one active handler
+             */
+
+            revents |= EPOLLIN|EPOLLOUT;
+        }
+
+        if (!more && cqe->res >= 0 && (rev->active || c->write->active)) {
+
+            /*
+             * oneshot poll requests for level-triggered events, and
+             * multishot ones terminated by the kernel, are rearmed
+             */
+
+            if (ngx_io_uring_arm(c, p, p->events, p->level) != NGX_OK) {
+                revents |= EPOLLIN|EPOLLOUT;
+            }
+        }
+
+        if ((revents & EPOLLIN) && rev->active) {
+
+            if (revents & EPOLLRDHUP) {
+                rev->pending_eof = 1;
+            }
+
+            rev->ready = 1;
+            rev->available = -1;
+
+            if (flags & NGX_POST_EVENTS) {
+                queue = rev->accept ? &ngx_posted_accept_events
+                                    : &ngx_posted_events;
+
+                ngx_post_event(rev, queue);
+
+            } else {
+                rev->handler(rev);
+            }
+        }
+
+        wev = c->write;
+
+        if ((revents & EPOLLOUT) && wev->active) {
+
+            if (c->fd == -1 || wev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            wev->ready = 1;
+#if (NGX_THREADS)
+            wev->complete = 1;
+#endif
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(wev, &ngx_posted_events);
+
+            } else {
+                wev->handler(wev);
+            }
+        }
+    }
+
+    ngx_memory_barrier();
+    *cq.head = head;
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+    ngx_io_uring_accept_post(flags);
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_io_uring_conn_t *
+ngx_io_uring_conn(ngx_connection_t *c, ngx_log_t *log)
+{
+    ngx_uint_t  index;
+
+    /* the connections array is allocated after the event module init */
+
+    index = c - ngx_cycle->connections;
+
+    if (c < ngx_cycle->connections || index >= connection_n) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "io_uring: connection %p is not in the connections "
+                      "array", c);
+        return NULL;
+    }
+
+    return &conns[index];
+}
+
+
+static ngx_int_t
+ngx_io_uring_arm(ngx_connection_t *c, ngx_io_uring_conn_t *p,
+    uint32_t events, ngx_uint_t level)
+{
+    uint32_t              mask;
+    struct io_uring_sqe  *sqe;
+
+    if (p->io) {
+
+        /* the read event is reported by the recv request */
+
+        events &= ~(EPOLLIN|EPOLLRDHUP);
+
+        if (events == 0) {
+            return NGX_OK;
+        }
+    }
+
+    sqe = ngx_io_uring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (++p->gen == 0) {
+        p->gen = 1;
+    }
+
+    p->events = events;
+    p->level = level;
+    p->armed = 1;
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+    mask = events;
+#else
+    mask = (events << 16) | (events >> 16);
+#endif
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->len = level ? 0 : IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = mask;
+    sqe->user_data = ngx_io_uring_data(c - ngx_cycle->connections, p->gen,
+                                       NGX_IO_URING_POLL, c->read->instance);
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring poll add: fd:%d ev:%08XD level:%ui gen:%uD",
+                   c->fd, events, level, p->gen);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_cancel(ngx_connection_t *c, ngx_io_uring_conn_t *p)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring poll remove: fd:%d gen:%uD", c->fd, p->gen);
+
+    sqe = ngx_io_uring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = ngx_io_uring_data(c - ngx_cycle->connections, p->gen,
+                                  NGX_IO_URING_POLL, c->read->instance);
+    sqe->user_data = NGX_IO_URING_CONTROL;
+
+    p->armed = 0;
+
+    return NGX_OK;
+}
+
+
+static struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_log_t *log)
+{
+    int                   rc;
+    struct io_uring_sqe  *sqe;
+
+    if (sq.local_tail - *sq.head >= sq.entries) {
+
+        /* the submission queue is full, submit without waiting */
+
+        ngx_memory_barrier();
+        *sq.tail = sq.local_tail;
+
+        rc = ngx_io_uring_enter(sq.pending, 0, 0, NULL);
+
+        if (rc == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "io_uring_enter() failed");
+            return NULL;
+        }
+
+        sq.pending -= ngx_min((uint32_t) rc, sq.pending);
+
+        if (sq.local_tail - *sq.head >= sq.entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue is full");
+            return NULL;
+        }
+    }
+
+    sqe = &sq.sqes[sq.local_tail & sq.mask];
+
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sq.local_tail++;
+    sq.pending++;
+
+    return sqe;
+}
+
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+static ngx_int_t
+ngx_io_uring_cancel_io(ngx_connection_t *c, ngx_io_uring_conn_t *p,
+    ngx_uint_t type)
+{
+    struct io_uring_sqe  *sqe;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring cancel: fd:%d gen:%uD", c->fd, p->io_gen);
+
+    sqe = ngx_io_uring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = ngx_io_uring_data(c - ngx_cycle->connections, p->io_gen,
+                                  type, c->read->instance);
+    sqe->user_data = NGX_IO_URING_CONTROL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_accept_arm(ngx_connection_t *c, ngx_io_uring_conn_t *p)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (p->accept == NULL) {
+        p->accept = ngx_calloc(sizeof(ngx_io_uring_accept_t), c->log);
+        if (p->accept == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    p->accept->connection = c;
+
+    sqe = ngx_io_uring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (++p->io_gen == 0) {
+        p->io_gen = 1;
+    }
+
+    p->io = 1;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = ngx_io_uring_data(c - ngx_cycle->connections, p->io_gen,
+                                       NGX_IO_URING_ACCEPT, c->read->instance);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring accept: fd:%d gen:%uD", c->fd, p->io_gen);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_accept_complete(ngx_cycle_t *cycle, ngx_uint_t i, uint32_t gen,
+    struct io_uring_cqe *cqe)
+{
+    ngx_uint_t              n;
+    ngx_socket_t           *sockets;
+    ngx_connection_t       *c;
+    ngx_io_uring_conn_t    *p;
+    ngx_io_uring_accept_t  *a;
+
+    p = &conns[i];
+    c = &ngx_cycle->connections[i];
+    a = p->accept;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring accept: fd:%d res:%d gen:%uD more:%d",
+                   c->fd, cqe->res, gen,
+                   cqe->flags & IORING_CQE_F_MORE);
+
+    if (a == NULL || a->connection != c || c->fd == -1 || !c->read->accept) {
+
+        /* the listening socket was closed */
+
+        if (cqe->res >= 0 && close(cqe->res) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        return;
+    }
+
+    /*
+     * the sockets accepted by a cancelled request are still valid,
+     * while the request state is only updated by the current one
+     */
+
+    if (cqe->res >= 0) {
+
+        if (a->nelts == a->nalloc) {
+            n = a->nalloc ? a->nalloc * 2 : 64;
+
+            sockets = ngx_alloc(n * sizeof(ngx_socket_t), cycle->log);
+
+            if (sockets == NULL) {
+                if (close(cqe->res) == -1) {
+                    ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                                  ngx_close_socket_n " failed");
+                }
+
+                goto done;
+            }
+
+            if (a->sockets) {
+                ngx_memcpy(sockets, a->sockets,
+                           a->nelts * sizeof(ngx_socket_t));
+                ngx_free(a->sockets);
+            }
+
+            a->sockets = sockets;
+            a->nalloc = n;
+        }
+
+        a->sockets[a->nelts++] = cqe->res;
+
+    } else if (gen == p->io_gen && cqe->res != -ECANCELED) {
+
+        if (cqe->res == -EINVAL) {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "io_uring multishot accept is not supported");
+
+            ring_accept = 0;
+
+        } else {
+            a->error = -cqe->res;
+        }
+    }
+
+done:
+
+    if (gen == p->io_gen && !(cqe->flags & IORING_CQE_F_MORE) && p->io) {
+        p->io = 0;
+
+        if (c->read->active) {
+
+            if (ring_accept) {
+                (void) ngx_io_uring_accept_arm(c, p);
+
+            } else {
+                (void) ngx_io_uring_arm(c, p, EPOLLIN, 1);
+            }
+        }
+    }
+
+    if (!a->queued && (a->pos < a->nelts || a->error)) {
+        ngx_queue_insert_tail(&accepted, &a->queue);
+        a->queued = 1;
+    }
+}
+
+
+static void
+ngx_io_uring_accept_post(ngx_uint_t flags)
+{
+    ngx_queue_t            *q, *next;
+    ngx_event_t            *rev;
+    ngx_connection_t       *c;
+    ngx_io_uring_accept_t  *a;
+
+    for (q = ngx_queue_head(&accepted);
+         q != ngx_queue_sentinel(&accepted);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        a = ngx_queue_data(q, ngx_io_uring_accept_t, queue);
+        c = a->connection;
+
+        if (c->fd == -1 || !c->read->accept) {
+            ngx_io_uring_accept_close(a);
+            continue;
+        }
+
+        rev = c->read;
+        rev->ready = 1;
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(rev, &ngx_posted_accept_events);
+
+        } else {
+            rev->handler(rev);
+        }
+    }
+}
+
+
+static void
+ngx_io_uring_accept_close(ngx_io_uring_accept_t *a)
+{
+    while (a->pos < a->nelts) {
+        if (close(a->sockets[a->pos++]) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+    }
+
+    a->pos = 0;
+    a->nelts = 0;
+    a->error = 0;
+
+    if (a->queued) {
+        ngx_queue_remove(&a->queue);
+        a->queued = 0;
+    }
+}
+
+
+ngx_socket_t
+ngx_io_uring_accept(ngx_event_t *ev, struct sockaddr *sa, socklen_t *socklen)
+{
+    ngx_err_t               err;
+    ngx_socket_t            s;
+    ngx_connection_t       *lc;
+    ngx_io_uring_conn_t    *p;
+    ngx_io_uring_accept_t  *a;
+
+    lc = ev->data;
+
+    p = ngx_io_uring_conn(lc, ev->log);
+    if (p == NULL) {
+        ngx_set_socket_errno(NGX_EINVAL);
+        return (ngx_socket_t) -1;
+    }
+
+    a = p->accept;
+
+    if (a == NULL || (a->pos == a->nelts && !a->error && !p->io)) {
+
+        /* the listening socket is polled */
+
+        return accept4(lc->fd, sa, socklen, SOCK_NONBLOCK);
+    }
+
+    if (a->pos == a->nelts) {
+        err = a->error ? a->error : NGX_EAGAIN;
+
+        a->pos = 0;
+        a->nelts = 0;
+        a->error = 0;
+
+        if (a->queued) {
+            ngx_queue_remove(&a->queue);
+            a->queued = 0;
+        }
+
+        ngx_set_socket_errno(err);
+        return (ngx_socket_t) -1;
+    }
+
+    s = a->sockets[a->pos++];
+
+    if (getpeername(s, sa, socklen) == -1) {
+        err = ngx_socket_errno;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, err,
+                       "getpeername() of accepted socket %d failed", s);
+
+        if (close(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        /* the connection was reset before it was handed out */
+
+        ngx_set_socket_errno(NGX_ECONNABORTED);
+        return (ngx_socket_t) -1;
+    }
+
+    return s;
+}
+
+
+static ssize_t
+ngx_io_uring_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ssize_t               n;
+    ngx_io_uring_conn_t  *p;
+
+    p = ngx_io_uring_recv_conn(c);
+
+    if (p == NULL) {
+        return ngx_unix_recv(c, buf, size);
+    }
+
+    if (p->nbufs || p->io || p->eof || p->error) {
+        return ngx_io_uring_recv_buffered(c, p, buf, size);
+    }
+
+    n = ngx_unix_recv(c, buf, size);
+
+    if ((n > 0 || n == NGX_AGAIN) && !c->read->ready) {
+        (void) ngx_io_uring_recv_start(c, p);
+    }
+
+    return n;
+}
+
+
+static ssize_t
+ngx_io_uring_recv_chain(ngx_connection_t *c, ngx_chain_t *chain, off_t limit)
+{
+    size_t                size;
+    ssize_t               n, total;
+    ngx_io_uring_conn_t  *p;
+
+    p = ngx_io_uring_recv_conn(c);
+
+    if (p == NULL) {
+        return ngx_readv_chain(c, chain, limit);
+    }
+
+    if (!(p->nbufs || p->io || p->eof || p->error)) {
+        n = ngx_readv_chain(c, chain, limit);
+
+        if ((n > 0 || n == NGX_AGAIN) && !c->read->ready) {
+            (void) ngx_io_uring_recv_start(c, p);
+        }
+
+        return n;
+    }
+
+    total = 0;
+
+    for ( /* void */ ; chain; chain = chain->next) {
+
+        size = chain->buf->end - chain->buf->last;
+
+        if (limit) {
+            if (total >= limit) {
+                break;
+            }
+
+            if ((off_t) size > limit - total) {
+                size = (size_t) (limit - total);
+            }
+        }
+
+        if (size == 0) {
+            continue;
+        }
+
+        n = ngx_io_uring_recv_buffered(c, p, chain->buf->last, size);
+
+        if (n <= 0) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if ((size_t) n < size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+ngx_int_t
+ngx_io_uring_disable_recv(ngx_connection_t *c)
+{
+    ngx_io_uring_conn_t  *p;
+
+    /*
+     * switches the connection to recv() syscalls, e.g. before
+     * the socket is passed to splice(); fails if data were read ahead
+     */
+
+    p = ngx_io_uring_recv_conn(c);
+
+    if (p && (p->io || p->nbufs || p->eof || p->error)) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "io_uring recv is in use: fd:%d", c->fd);
+        return NGX_DECLINED;
+    }
+
+    if (c->recv == ngx_io_uring_recv) {
+        c->recv = ngx_os_io.recv;
+    }
+
+    if (c->recv_chain == ngx_io_uring_recv_chain) {
+        c->recv_chain = ngx_os_io.recv_chain;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_io_uring_conn_t *
+ngx_io_uring_recv_conn(ngx_connection_t *c)
+{
+    ngx_uint_t  index;
+
+    /* HTTP/2 and other fake connections are not in the array */
+
+    index = c - ngx_cycle->connections;
+
+    if (c < ngx_cycle->connections || index >= connection_n) {
+        return NULL;
+    }
+
+    return &conns[index];
+}
+
+
+static ssize_t
+ngx_io_uring_recv_buffered(ngx_connection_t *c, ngx_io_uring_conn_t *p,
+    u_char *buf, size_t size)
+{
+    size_t               len;
+    ssize_t              n;
+    ngx_event_t         *rev;
+    ngx_io_uring_buf_t  *b;
+
+    rev = c->read;
+
+    n = 0;
+
+    while (p->nbufs && size) {
+        b = &bufs[p->first];
+
+        len = ngx_min(size, b->last - b->pos);
+
+        buf = ngx_cpymem(buf, buf_base + p->first * buf_size + b->pos, len);
+
+        b->pos += len;
+        n += len;
+        size -= len;
+
+        if (b->pos == b->last) {
+            ngx_io_uring_free_buf(p->first);
+
+            p->first = b->next;
+            p->nbufs--;
+        }
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv: fd:%d %z bufs:%uD io:%d",
+                   c->fd, n, p->nbufs, p->io);
+
+    if (p->nbufs) {
+        return n;
+    }
+
+    if (p->io) {
+        rev->ready = 0;
+        rev->available = 0;
+
+        return n ? n : NGX_AGAIN;
+    }
+
+    if (n) {
+
+        /* the data may follow in the socket or with eof */
+
+        rev->available = -1;
+
+        return n;
+    }
+
+    if (p->eof) {
+        rev->ready = 0;
+        rev->eof = 1;
+
+        return 0;
+    }
+
+    if (p->error) {
+        rev->ready = 0;
+        rev->error = 1;
+
+        ngx_set_socket_errno(p->error);
+
+        return ngx_connection_error(c, p->error, "recv() failed");
+    }
+
+    /* the recv request was stopped, the socket is read again */
+
+    rev->available = -1;
+
+    n = ngx_unix_recv(c, buf, size);
+
+    if ((n > 0 || n == NGX_AGAIN) && !rev->ready) {
+        (void) ngx_io_uring_recv_start(c, p);
+    }
+
+    return n;
+}
+
+
+static ngx_int_t
+ngx_io_uring_recv_start(ngx_connection_t *c, ngx_io_uring_conn_t *p)
+{
+    struct io_uring_sqe  *sqe;
+
+    /*
+     * read ahead is only used for client connections, since cached
+     * upstream connections are checked with MSG_PEEK
+     */
+
+    if (!ring_recv
+        || c->listening == NULL
+        || c->type != SOCK_STREAM
+        || c->ssl
+        || !c->read->active
+        || c->read->pending_eof
+        || !p->armed
+        || p->level
+        || p->io
+        || p->nbufs
+        || p->eof
+        || p->error)
+    {
+        return NGX_DECLINED;
+    }
+
+    sqe = ngx_io_uring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (++p->io_gen == 0) {
+        p->io_gen = 1;
+    }
+
+    p->io = 1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = ngx_io_uring_data(c - ngx_cycle->connections, p->io_gen,
+                                       NGX_IO_URING_RECV, c->read->instance);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv start: fd:%d gen:%uD", c->fd, p->io_gen);
+
+    /* stop polling for the read event */
+
+    if (ngx_io_uring_cancel(c, p) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_io_uring_arm(c, p, EPOLLOUT, 0);
+}
+
+
+static void
+ngx_io_uring_recv_stop(ngx_connection_t *c, ngx_io_uring_conn_t *p)
+{
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv stop: fd:%d gen:%uD", c->fd, p->io_gen);
+
+    p->io = 0;
+
+    if (!c->read->active) {
+        return;
+    }
+
+    /* poll for the read event again */
+
+    if (p->armed && ngx_io_uring_cancel(c, p) != NGX_OK) {
+        return;
+    }
+
+    (void) ngx_io_uring_arm(c, p, EPOLLIN|EPOLLOUT|EPOLLRDHUP, 0);
+}
+
+
+static void
+ngx_io_uring_recv_complete(ngx_cycle_t *cycle, ngx_uint_t i, uint32_t gen,
+    ngx_uint_t instance, struct io_uring_cqe *cqe, ngx_uint_t flags)
+{
+    uint16_t              bid;
+    ngx_uint_t            more;
+    ngx_event_t          *rev;
+    ngx_connection_t     *c;
+    ngx_io_uring_buf_t   *b;
+    ngx_io_uring_conn_t  *p;
+
+    p = &conns[i];
+    c = &ngx_cycle->connections[i];
+    rev = c->read;
+
+    more = cqe->flags & IORING_CQE_F_MORE;
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    if (gen != p->io_gen || !p->io
+        || c->fd == -1 || rev->instance != instance)
+    {
+        /* the completion of a removed recv request */
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: stale recv completion gen:%uD res:%d",
+                       gen, cqe->res);
+
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            ngx_io_uring_free_buf(bid);
+        }
+
+        return;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring recv: fd:%d res:%d bid:%uD more:%ui",
+                   c->fd, cqe->res, (uint32_t) bid, more);
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        b = &bufs[bid];
+
+        b->pos = 0;
+        b->last = cqe->res > 0 ? cqe->res : 0;
+
+        if (p->nbufs) {
+            bufs[p->last].next = bid;
+
+        } else {
+            p->first = bid;
+        }
+
+        p->last = bid;
+        p->nbufs++;
+
+        if (more && p->nbufs == NGX_IO_URING_RECV_BUFS) {
+
+            /* the data are not read, stop reading ahead */
+
+            (void) ngx_io_uring_cancel_io(c, p, NGX_IO_URING_RECV);
+        }
+
+    } else if (cqe->res == 0) {
+        p->eof = 1;
+        rev->pending_eof = 1;
+
+    } else if (cqe->res == -EINVAL) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "io_uring multishot recv is not supported");
+
+        ring_recv = 0;
+
+    } else if (cqe->res == -ENOBUFS) {
+
+        /* the connection is read with recv() until the request is rearmed */
+
+        buf_exhausted++;
+
+        if (ngx_time() - buf_exhausted_time >= 60) {
+            ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                          "io_uring provided buffers exhausted %ui times, "
+                          "consider increasing io_uring_buffers",
+                          buf_exhausted);
+
+            buf_exhausted = 0;
+            buf_exhausted_time = ngx_time();
+        }
+
+    } else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        p->error = -cqe->res;
+    }
+
+    if (!more) {
+        ngx_io_uring_recv_stop(c, p);
+    }
+
+    if (!rev->active) {
+        return;
+    }
+
+    rev->ready = 1;
+    rev->available = -1;
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(rev, &ngx_posted_events);
+
+    } else {
+        rev->handler(rev);
+    }
+}
+
+
+static void
+ngx_io_uring_recv_free(ngx_io_uring_conn_t *p)
+{
+    while (p->nbufs) {
+        ngx_io_uring_free_buf(p->first);
+
+        p->first = bufs[p->first].next;
+        p->nbufs--;
+    }
+
+    p->eof = 0;
+    p->error = 0;
+}
+
+#endif
+
+
+static void *
+ngx_io_uring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_pcalloc(cycle->pool, sizeof(ngx_io_uring_conf_t));
+    if (urcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     urcf->buffers = { 0, 0 };
+     */
+
+    urcf->entries = NGX_CONF_UNSET;
+
+    return urcf;
+}
+
+
+static char *
+ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_io_uring_conf_t *urcf = conf;
+
+    ngx_conf_init_uint_value(urcf->entries, 1024);
+
+    if (urcf->buffers.num == 0) {
+        urcf->buffers.num = 256;
+        urcf->buffers.size = 4096;
+    }
+
+    if (urcf->buffers.num > 32768
+        || (urcf->buffers.num & (urcf->buffers.num - 1)))
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "the number of \"io_uring_buffers\" must be "
+                      "a power of two not greater than 32768");
+        return NGX_CONF_ERROR;
+    }
+
+    if (urcf->buffers.size > 0x7fffffff) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "\"io_uring_buffers\" size is too big");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
@@ -74,6 +74,11 @@ static ngx_atomic_t   ngx_stat_writing0;
 ngx_atomic_t         *ngx_stat_writing = &ngx_stat_writing0;
 static ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t         *ngx_stat_waiting = &ngx_stat_waiting0;
+static ngx_atomic_t   ngx_stat_zerocopy_completed0;
+ngx_atomic_t         *ngx_stat_zerocopy_completed =
+                                                &ngx_stat_zerocopy_completed0;
+static ngx_atomic_t   ngx_stat_zerocopy_copied0;
+ngx_atomic_t         *ngx_stat_zerocopy_copied = &ngx_stat_zerocopy_copied0;
 
 #endif
 
@@ -261,6 +266,10 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
     ngx_event_expire_timers();
 
     ngx_event_process_posted(cycle, &ngx_posted_events);
+
+#if (NGX_QUIC && NGX_HAVE_SENDMMSG)
+    (void) ngx_quic_flush_datagrams();
+#endif
 }
 
 
@@ -563,7 +572,9 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_active */
            + cl          /* ngx_stat_reading */
            + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+           + cl          /* ngx_stat_waiting */
+           + cl          /* ngx_stat_zerocopy_completed */
+           + cl;         /* ngx_stat_zerocopy_copied */
 
 #endif
 
@@ -610,6 +621,8 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
+    ngx_stat_zerocopy_completed = (ngx_atomic_t *) (shared + 10 * cl);
+    ngx_stat_zerocopy_copied = (ngx_atomic_t *) (shared + 11 * cl);
 
 #endif
 
@@ -27,6 +27,13 @@ typedef struct {
 #endif
 
 
+typedef struct {
+    ngx_msec_t       key;
+    ngx_queue_t      queue;
+    ngx_uint_t       slot;
+} ngx_event_timer_t;
+
+
 struct ngx_event_s {
     void            *data;
 
@@ -111,7 +118,7 @@ struct ngx_event_s {
 
     ngx_log_t       *log;
 
-    ngx_rbtree_node_t   timer;
+    ngx_event_timer_t   timer;
 
     /* the posted queue */
     ngx_queue_t      queue;
@@ -267,6 +274,11 @@ extern ngx_uint_t            ngx_use_epoll_rdhup;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter accepts connections itself: io_uring multishot accept.
+ */
+#define NGX_USE_IO_URING_EVENT   0x00004000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -474,6 +486,8 @@ extern ngx_atomic_t  *ngx_stat_active;
 extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
+extern ngx_atomic_t  *ngx_stat_zerocopy_completed;
+extern ngx_atomic_t  *ngx_stat_zerocopy_copied;
 
 #endif
 
@@ -494,6 +508,11 @@ extern ngx_module_t           ngx_event_core_module;
 
 
 void ngx_event_accept(ngx_event_t *ev);
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+ngx_socket_t ngx_io_uring_accept(ngx_event_t *ev, struct sockaddr *sa,
+    socklen_t *socklen);
+ngx_int_t ngx_io_uring_disable_recv(ngx_connection_t *c);
+#endif
 ngx_int_t ngx_trylock_accept_mutex(ngx_cycle_t *cycle);
 ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
 u_char *ngx_accept_log_error(ngx_log_t *log, u_char *buf, size_t len);
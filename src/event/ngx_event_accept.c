@@ -10,28 +10,44 @@
 #include <ngx_event.h>
 
 
+#define NGX_EVENT_ACCEPT_BATCH  64
+
+
+typedef struct {
+    ngx_socket_t     fd;
+    socklen_t        socklen;
+    ngx_sockaddr_t   sockaddr;
+} ngx_event_accepted_t;
+
+
+static ngx_int_t ngx_event_accept_connection(ngx_event_t *ev,
+    ngx_event_conf_t *ecf, ngx_event_accepted_t *a);
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all);
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+static void ngx_event_accept_check_queue(ngx_event_t *ev, ngx_listening_t *ls,
+    ngx_uint_t n);
+#endif
 #if (NGX_HAVE_EPOLLEXCLUSIVE)
 static void ngx_reorder_accept_events(ngx_listening_t *ls);
 #endif
 static void ngx_close_accepted_connection(ngx_connection_t *c);
 
 
+static ngx_event_accepted_t  ngx_event_accepted[NGX_EVENT_ACCEPT_BATCH];
+
+
 void
 ngx_event_accept(ngx_event_t *ev)
 {
-    socklen_t          socklen;
-    ngx_err_t          err;
-    ngx_log_t         *log;
-    ngx_uint_t         level;
-    ngx_socket_t       s;
-    ngx_event_t       *rev, *wev;
-    ngx_sockaddr_t     sa;
-    ngx_listening_t   *ls;
-    ngx_connection_t  *c, *lc;
-    ngx_event_conf_t  *ecf;
+    ngx_err_t              err;
+    ngx_uint_t             i, n, batch, level, failed;
+    ngx_socket_t           s;
+    ngx_listening_t       *ls;
+    ngx_connection_t      *lc;
+    ngx_event_conf_t      *ecf;
+    ngx_event_accepted_t  *a;
 #if (NGX_HAVE_ACCEPT4)
-    static ngx_uint_t  use_accept4 = 1;
+    static ngx_uint_t      use_accept4 = 1;
 #endif
 
     if (ev->timedout) {
@@ -56,271 +72,365 @@ ngx_event_accept(ngx_event_t *ev)
                    "accept on %V, ready: %d", &ls->addr_text, ev->available);
 
     do {
-        socklen = sizeof(ngx_sockaddr_t);
 
-#if (NGX_HAVE_ACCEPT4)
-        if (use_accept4) {
-            s = accept4(lc->fd, &sa.sockaddr, &socklen, SOCK_NONBLOCK);
-        } else {
-            s = accept(lc->fd, &sa.sockaddr, &socklen);
-        }
-#else
-        s = accept(lc->fd, &sa.sockaddr, &socklen);
-#endif
+        /*
+         * with multi_accept, the listen queue is drained in batches:
+         * the pending connections are accepted first, and only then
+         * the connection structures are set up and the handlers are run,
+         * so the accept queue is emptied as fast as possible
+         */
 
-        if (s == (ngx_socket_t) -1) {
-            err = ngx_socket_errno;
+        batch = 1;
 
-            if (err == NGX_EAGAIN) {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
-                               "accept() not ready");
-                return;
+        if (ev->available) {
+            batch = ngx_min(NGX_EVENT_ACCEPT_BATCH,
+                            ngx_cycle->free_connection_n);
+
+            if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+                batch = ngx_min(batch, (ngx_uint_t) ev->available);
+            }
+
+            if (batch == 0) {
+                batch = 1;
             }
+        }
 
-            level = NGX_LOG_ALERT;
+        n = 0;
+        err = 0;
 
-            if (err == NGX_ECONNABORTED) {
-                level = NGX_LOG_ERR;
+        while (n < batch) {
+            a = &ngx_event_accepted[n];
 
-            } else if (err == NGX_EMFILE || err == NGX_ENFILE) {
-                level = NGX_LOG_CRIT;
-            }
+            a->socklen = sizeof(ngx_sockaddr_t);
 
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+            if (ngx_event_flags & NGX_USE_IO_URING_EVENT) {
+                s = ngx_io_uring_accept(ev, &a->sockaddr.sockaddr,
+                                        &a->socklen);
+            } else
+#endif
 #if (NGX_HAVE_ACCEPT4)
-            ngx_log_error(level, ev->log, err,
-                          use_accept4 ? "accept4() failed" : "accept() failed");
-
-            if (use_accept4 && err == NGX_ENOSYS) {
-                use_accept4 = 0;
-                ngx_inherited_nonblocking = 0;
-                continue;
+            if (use_accept4) {
+                s = accept4(lc->fd, &a->sockaddr.sockaddr, &a->socklen,
+                            SOCK_NONBLOCK);
+            } else {
+                s = accept(lc->fd, &a->sockaddr.sockaddr, &a->socklen);
             }
 #else
-            ngx_log_error(level, ev->log, err, "accept() failed");
+            s = accept(lc->fd, &a->sockaddr.sockaddr, &a->socklen);
 #endif
 
-            if (err == NGX_ECONNABORTED) {
-                if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
-                    ev->available--;
+            if (s == (ngx_socket_t) -1) {
+                err = ngx_socket_errno;
+
+                if (err == NGX_EAGAIN) {
+                    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
+                                   "accept() not ready");
+                    break;
                 }
 
-                if (ev->available) {
-                    continue;
+                level = NGX_LOG_ALERT;
+
+                if (err == NGX_ECONNABORTED) {
+                    level = NGX_LOG_ERR;
+
+                } else if (err == NGX_EMFILE || err == NGX_ENFILE) {
+                    level = NGX_LOG_CRIT;
                 }
-            }
 
-            if (err == NGX_EMFILE || err == NGX_ENFILE) {
-                if (ngx_disable_accept_events((ngx_cycle_t *) ngx_cycle, 1)
-                    != NGX_OK)
-                {
-                    return;
+#if (NGX_HAVE_ACCEPT4)
+                ngx_log_error(level, ev->log, err,
+                              use_accept4 ? "accept4() failed"
+                                          : "accept() failed");
+
+                if (use_accept4 && err == NGX_ENOSYS) {
+                    use_accept4 = 0;
+                    ngx_inherited_nonblocking = 0;
+                    err = 0;
+                    continue;
                 }
+#else
+                ngx_log_error(level, ev->log, err, "accept() failed");
+#endif
 
-                if (ngx_use_accept_mutex) {
-                    if (ngx_accept_mutex_held) {
-                        ngx_shmtx_unlock(&ngx_accept_mutex);
-                        ngx_accept_mutex_held = 0;
+                if (err == NGX_ECONNABORTED) {
+                    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+                        ev->available--;
                     }
 
-                    ngx_accept_disabled = 1;
-
-                } else {
-                    ngx_add_timer(ev, ecf->accept_mutex_delay);
+                    if (ev->available) {
+                        err = 0;
+                        continue;
+                    }
                 }
+
+                break;
             }
 
-            return;
-        }
+            a->fd = s;
+            n++;
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+            (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
 #endif
+        }
 
-        ngx_accept_disabled = ngx_cycle->connection_n / 8
-                              - ngx_cycle->free_connection_n;
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "accept batch: %ui of %ui", n, batch);
 
-        c = ngx_get_connection(s, ev->log);
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+        if (n > 1 && (n == batch || n > (ngx_uint_t) ls->backlog)) {
+            ngx_event_accept_check_queue(ev, ls, n);
+        }
+#endif
 
-        if (c == NULL) {
-            if (ngx_close_socket(s) == -1) {
-                ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
-                              ngx_close_socket_n " failed");
+        failed = 0;
+
+        for (i = 0; i < n; i++) {
+            a = &ngx_event_accepted[i];
+
+            /*
+             * a connection which failed to be set up is already closed,
+             * the rest of the batch is handled anyway
+             */
+
+            if (ngx_event_accept_connection(ev, ecf, a) != NGX_OK) {
+                failed = 1;
             }
 
-            return;
+            if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+                ev->available--;
+            }
         }
 
-        c->type = SOCK_STREAM;
+        if (err == NGX_EMFILE || err == NGX_ENFILE) {
+            if (ngx_disable_accept_events((ngx_cycle_t *) ngx_cycle, 1)
+                != NGX_OK)
+            {
+                return;
+            }
 
-#if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
-#endif
+            if (ngx_use_accept_mutex) {
+                if (ngx_accept_mutex_held) {
+                    ngx_shmtx_unlock(&ngx_accept_mutex);
+                    ngx_accept_mutex_held = 0;
+                }
 
-        c->pool = ngx_create_pool(ls->pool_size, ev->log);
-        if (c->pool == NULL) {
-            ngx_close_accepted_connection(c);
-            return;
-        }
+                ngx_accept_disabled = 1;
 
-        if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
-            socklen = sizeof(ngx_sockaddr_t);
+            } else {
+                ngx_add_timer(ev, ecf->accept_mutex_delay);
+            }
+
+            return;
         }
 
-        c->sockaddr = ngx_palloc(c->pool, socklen);
-        if (c->sockaddr == NULL) {
-            ngx_close_accepted_connection(c);
+        if (err || failed) {
             return;
         }
 
-        ngx_memcpy(c->sockaddr, &sa, socklen);
+    } while (ev->available);
 
-        log = ngx_palloc(c->pool, sizeof(ngx_log_t));
-        if (log == NULL) {
-            ngx_close_accepted_connection(c);
-            return;
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+    ngx_reorder_accept_events(ls);
+#endif
+}
+
+
+static ngx_int_t
+ngx_event_accept_connection(ngx_event_t *ev, ngx_event_conf_t *ecf,
+    ngx_event_accepted_t *a)
+{
+    socklen_t          socklen;
+    ngx_log_t         *log;
+    ngx_socket_t       s;
+    ngx_event_t       *rev, *wev;
+    ngx_listening_t   *ls;
+    ngx_connection_t  *c, *lc;
+
+    lc = ev->data;
+    ls = lc->listening;
+
+    s = a->fd;
+    socklen = a->socklen;
+
+    ngx_accept_disabled = ngx_cycle->connection_n / 8
+                          - ngx_cycle->free_connection_n;
+
+    c = ngx_get_connection(s, ev->log);
+
+    if (c == NULL) {
+        if (ngx_close_socket(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
         }
 
-        /* set a blocking mode for iocp and non-blocking mode for others */
+        return NGX_ERROR;
+    }
 
-        if (ngx_inherited_nonblocking) {
-            if (ngx_event_flags & NGX_USE_IOCP_EVENT) {
-                if (ngx_blocking(s) == -1) {
-                    ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
-                                  ngx_blocking_n " failed");
-                    ngx_close_accepted_connection(c);
-                    return;
-                }
+    c->type = SOCK_STREAM;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+#endif
+
+    c->pool = ngx_create_pool(ls->pool_size, ev->log);
+    if (c->pool == NULL) {
+        ngx_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
+
+    if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
+        socklen = sizeof(ngx_sockaddr_t);
+    }
+
+    c->sockaddr = ngx_palloc(c->pool, socklen);
+    if (c->sockaddr == NULL) {
+        ngx_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(c->sockaddr, &a->sockaddr, socklen);
+
+    log = ngx_palloc(c->pool, sizeof(ngx_log_t));
+    if (log == NULL) {
+        ngx_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
+
+    /* set a blocking mode for iocp and non-blocking mode for others */
+
+    if (ngx_inherited_nonblocking) {
+        if (ngx_event_flags & NGX_USE_IOCP_EVENT) {
+            if (ngx_blocking(s) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
+                              ngx_blocking_n " failed");
+                ngx_close_accepted_connection(c);
+                return NGX_ERROR;
             }
+        }
 
-        } else {
-            if (!(ngx_event_flags & NGX_USE_IOCP_EVENT)) {
-                if (ngx_nonblocking(s) == -1) {
-                    ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
-                                  ngx_nonblocking_n " failed");
-                    ngx_close_accepted_connection(c);
-                    return;
-                }
+    } else {
+        if (!(ngx_event_flags & NGX_USE_IOCP_EVENT)) {
+            if (ngx_nonblocking(s) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
+                              ngx_nonblocking_n " failed");
+                ngx_close_accepted_connection(c);
+                return NGX_ERROR;
             }
         }
+    }
 
-        *log = ls->log;
+    *log = ls->log;
 
-        c->recv = ngx_recv;
-        c->send = ngx_send;
-        c->recv_chain = ngx_recv_chain;
-        c->send_chain = ngx_send_chain;
+    c->recv = ngx_recv;
+    c->send = ngx_send;
+    c->recv_chain = ngx_recv_chain;
+    c->send_chain = ngx_send_chain;
 
-        c->log = log;
-        c->pool->log = log;
+    c->log = log;
+    c->pool->log = log;
 
-        c->socklen = socklen;
-        c->listening = ls;
-        c->local_sockaddr = ls->sockaddr;
-        c->local_socklen = ls->socklen;
+    c->socklen = socklen;
+    c->listening = ls;
+    c->local_sockaddr = ls->sockaddr;
+    c->local_socklen = ls->socklen;
 
 #if (NGX_HAVE_UNIX_DOMAIN)
-        if (c->sockaddr->sa_family == AF_UNIX) {
-            c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
-            c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+    if (c->sockaddr->sa_family == AF_UNIX) {
+        c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+        c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
 #if (NGX_SOLARIS)
-            /* Solaris's sendfilev() supports AF_NCA, AF_INET, and AF_INET6 */
-            c->sendfile = 0;
+        /* Solaris's sendfilev() supports AF_NCA, AF_INET, and AF_INET6 */
+        c->sendfile = 0;
 #endif
-        }
+    }
 #endif
 
-        rev = c->read;
-        wev = c->write;
+    rev = c->read;
+    wev = c->write;
 
-        wev->ready = 1;
+    wev->ready = 1;
 
-        if (ngx_event_flags & NGX_USE_IOCP_EVENT) {
-            rev->ready = 1;
-        }
+    if (ngx_event_flags & NGX_USE_IOCP_EVENT) {
+        rev->ready = 1;
+    }
 
-        if (ev->deferred_accept) {
-            rev->ready = 1;
+    if (ev->deferred_accept) {
+        rev->ready = 1;
 #if (NGX_HAVE_KQUEUE || NGX_HAVE_EPOLLRDHUP)
-            rev->available = 1;
+        rev->available = 1;
 #endif
-        }
+    }
 
-        rev->log = log;
-        wev->log = log;
+    rev->log = log;
+    wev->log = log;
 
-        /*
-         * TODO: MT: - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         *
-         * TODO: MP: - allocated in a shared memory
-         *           - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         */
+    /*
+     * TODO: MT: - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     *
+     * TODO: MP: - allocated in a shared memory
+     *           - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     */
 
-        c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
 
-        c->start_time = ngx_current_msec;
+    c->start_time = ngx_current_msec;
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
 #endif
 
-        if (ls->addr_ntop) {
-            c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
-            if (c->addr_text.data == NULL) {
-                ngx_close_accepted_connection(c);
-                return;
-            }
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_close_accepted_connection(c);
+            return NGX_ERROR;
+        }
 
-            c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
-                                             c->addr_text.data,
-                                             ls->addr_text_max_len, 0);
-            if (c->addr_text.len == 0) {
-                ngx_close_accepted_connection(c);
-                return;
-            }
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
+            ngx_close_accepted_connection(c);
+            return NGX_ERROR;
         }
+    }
 
 #if (NGX_DEBUG)
-        {
-        ngx_str_t  addr;
-        u_char     text[NGX_SOCKADDR_STRLEN];
+    {
+    ngx_str_t  addr;
+    u_char     text[NGX_SOCKADDR_STRLEN];
 
-        ngx_debug_accepted_connection(ecf, c);
+    ngx_debug_accepted_connection(ecf, c);
 
-        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
-            addr.data = text;
-            addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
-                                     NGX_SOCKADDR_STRLEN, 1);
+    if (log->log_level & NGX_LOG_DEBUG_EVENT) {
+        addr.data = text;
+        addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
+                                 NGX_SOCKADDR_STRLEN, 1);
 
-            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
-                           "*%uA accept: %V fd:%d", c->number, &addr, s);
-        }
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "*%uA accept: %V fd:%d", c->number, &addr, s);
+    }
 
-        }
+    }
 #endif
 
-        if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
-            if (ngx_add_conn(c) == NGX_ERROR) {
-                ngx_close_accepted_connection(c);
-                return;
-            }
+    if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            ngx_close_accepted_connection(c);
+            return NGX_ERROR;
         }
+    }
 
-        log->data = NULL;
-        log->handler = NULL;
-
-        ls->handler(c);
-
-        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
-            ev->available--;
-        }
+    log->data = NULL;
+    log->handler = NULL;
 
-    } while (ev->available);
+    ls->handler(c);
 
-#if (NGX_HAVE_EPOLLEXCLUSIVE)
-    ngx_reorder_accept_events(ls);
-#endif
+    return NGX_OK;
 }
 
 
@@ -478,6 +588,50 @@ ngx_reorder_accept_events(ngx_listening_t *ls)
 #endif
 
 
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+
+static void
+ngx_event_accept_check_queue(ngx_event_t *ev, ngx_listening_t *ls,
+    ngx_uint_t n)
+{
+    socklen_t        len;
+    struct tcp_info  ti;
+
+    static time_t    logged;
+
+    /*
+     * a full batch means that more connections are pending, and
+     * a batch larger than the backlog means that the queue was full;
+     * for a listening socket, Linux reports the accept queue length
+     * and its limit in tcpi_unacked and tcpi_sacked
+     */
+
+    len = sizeof(struct tcp_info);
+
+    if (getsockopt(ls->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "accept queue: %uD of %uD", ti.tcpi_unacked, ti.tcpi_sacked);
+
+    if ((ti.tcpi_unacked < ti.tcpi_sacked && n <= ti.tcpi_sacked)
+        || logged == ngx_time())
+    {
+        return;
+    }
+
+    logged = ngx_time();
+
+    ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                  "listen queue of %V is full (%uD connections), "
+                  "new connections may be dropped",
+                  &ls->addr_text, ti.tcpi_sacked);
+}
+
+#endif
+
+
 static void
 ngx_close_accepted_connection(ngx_connection_t *c)
 {
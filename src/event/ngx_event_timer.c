@@ -10,41 +10,161 @@
 #include <ngx_event.h>
 
 
-ngx_rbtree_t              ngx_event_timer_rbtree;
-static ngx_rbtree_node_t  ngx_event_timer_sentinel;
-
 /*
- * the event timer rbtree may contain the duplicate keys, however,
- * it should not be a problem, because we use the rbtree to find
- * a minimum timer value only
+ * The event timers are kept in a hierarchical timer wheel.  The first level
+ * has 256 slots of 1 millisecond, the next levels have 64 slots each, and
+ * every slot of a level spans the whole previous level: 256 milliseconds,
+ * 16 seconds, 17 minutes, and 18 hours.  A timer is placed into the lowest
+ * level which covers its remaining time, and when the wheel time reaches
+ * a slot of an upper level, the slot timers are cascaded to lower levels.
+ *
+ * The timers beyond the last level are placed into its farthest slot and
+ * are cascaded until they fit into the wheel, and the already expired
+ * timers are placed into a separate slot.
  */
 
+
+#define NGX_TIMER_WHEEL_BITS0   8
+#define NGX_TIMER_WHEEL_BITS    6
+#define NGX_TIMER_WHEEL_LEVELS  5
+
+#define NGX_TIMER_WHEEL_SIZE0   (1 << NGX_TIMER_WHEEL_BITS0)
+#define NGX_TIMER_WHEEL_SIZE    (1 << NGX_TIMER_WHEEL_BITS)
+
+#define NGX_TIMER_WHEEL_SLOTS                                                 \
+    (NGX_TIMER_WHEEL_SIZE0 + (NGX_TIMER_WHEEL_LEVELS - 1) * NGX_TIMER_WHEEL_SIZE)
+
+#define NGX_TIMER_WHEEL_EXPIRED  NGX_TIMER_WHEEL_SLOTS
+
+#define ngx_timer_wheel_shift(level)                                          \
+    (NGX_TIMER_WHEEL_BITS0 + ((level) - 1) * NGX_TIMER_WHEEL_BITS)
+
+#define ngx_timer_wheel_base(level)                                           \
+    (NGX_TIMER_WHEEL_SIZE0 + ((level) - 1) * NGX_TIMER_WHEEL_SIZE)
+
+#define ngx_timer_wheel_set(slot)                                             \
+    ngx_event_timer_bitmap[(slot) >> 6] |= (uint64_t) 1 << ((slot) & 63)
+
+#define ngx_timer_wheel_clear(slot)                                           \
+    ngx_event_timer_bitmap[(slot) >> 6] &= ~((uint64_t) 1 << ((slot) & 63))
+
+#define ngx_timer_wheel_test(slot)                                            \
+    (ngx_event_timer_bitmap[(slot) >> 6] & ((uint64_t) 1 << ((slot) & 63)))
+
+
+static void ngx_event_timer_cascade(void);
+static ngx_int_t ngx_event_timer_next_due(ngx_msec_t *next);
+static ngx_uint_t ngx_event_timer_next(ngx_uint_t base, ngx_uint_t size,
+    ngx_uint_t index);
+
+
+/* the next wheel time to process */
+static ngx_msec_t   ngx_event_timer_time;
+
+static ngx_queue_t  ngx_event_timer_wheel[NGX_TIMER_WHEEL_SLOTS + 1];
+
+/* the bitmap of non-empty slots */
+static uint64_t     ngx_event_timer_bitmap[NGX_TIMER_WHEEL_SLOTS / 64 + 1];
+
+
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
-    ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
-                    ngx_rbtree_insert_timer_value);
+    ngx_uint_t  i;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_SLOTS + 1; i++) {
+        ngx_queue_init(&ngx_event_timer_wheel[i]);
+    }
+
+    ngx_memzero(ngx_event_timer_bitmap, sizeof(ngx_event_timer_bitmap));
+
+    ngx_event_timer_time = ngx_current_msec;
 
     return NGX_OK;
 }
 
 
+ngx_uint_t
+ngx_event_timer_slot(ngx_msec_t key)
+{
+    ngx_uint_t  level, shift;
+    ngx_msec_t  delta;
+
+    delta = key - ngx_event_timer_time;
+
+    if ((ngx_msec_int_t) delta < 0) {
+        return NGX_TIMER_WHEEL_EXPIRED;
+    }
+
+    if (delta < NGX_TIMER_WHEEL_SIZE0) {
+        return key & (NGX_TIMER_WHEEL_SIZE0 - 1);
+    }
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+        shift = ngx_timer_wheel_shift(level);
+
+        if (delta < (ngx_msec_t) 1 << (shift + NGX_TIMER_WHEEL_BITS)) {
+            return ngx_timer_wheel_base(level)
+                   + ((key >> shift) & (NGX_TIMER_WHEEL_SIZE - 1));
+        }
+    }
+
+#if (NGX_PTR_SIZE > 4)
+
+    if (delta > 0xffffffff) {
+        key = ngx_event_timer_time + 0xffffffff;
+    }
+
+#endif
+
+    shift = ngx_timer_wheel_shift(level);
+
+    return ngx_timer_wheel_base(level)
+           + ((key >> shift) & (NGX_TIMER_WHEEL_SIZE - 1));
+}
+
+
+void
+ngx_event_timer_insert(ngx_event_t *ev, ngx_uint_t slot)
+{
+    ngx_queue_insert_tail(&ngx_event_timer_wheel[slot], &ev->timer.queue);
+
+    ev->timer.slot = slot;
+
+    ngx_timer_wheel_set(slot);
+}
+
+
+void
+ngx_event_timer_delete(ngx_event_t *ev)
+{
+    ngx_uint_t  slot;
+
+    ngx_queue_remove(&ev->timer.queue);
+
+    slot = ev->timer.slot;
+
+    if (ngx_queue_empty(&ngx_event_timer_wheel[slot])) {
+        ngx_timer_wheel_clear(slot);
+    }
+}
+
+
 ngx_msec_t
 ngx_event_find_timer(void)
 {
-    ngx_msec_int_t      timer;
-    ngx_rbtree_node_t  *node, *root, *sentinel;
+    ngx_msec_t      next;
+    ngx_msec_int_t  timer;
 
-    if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
-        return NGX_TIMER_INFINITE;
+    if (ngx_timer_wheel_test(NGX_TIMER_WHEEL_EXPIRED)) {
+        return 0;
     }
 
-    root = ngx_event_timer_rbtree.root;
-    sentinel = ngx_event_timer_rbtree.sentinel;
-
-    node = ngx_rbtree_min(root, sentinel);
+    if (ngx_event_timer_next_due(&next) != NGX_OK) {
+        return NGX_TIMER_INFINITE;
+    }
 
-    timer = (ngx_msec_int_t) (node->key - ngx_current_msec);
+    timer = (ngx_msec_int_t) (next - ngx_current_msec);
 
     return (ngx_msec_t) (timer > 0 ? timer : 0);
 }
@@ -53,70 +173,215 @@ ngx_event_find_timer(void)
 void
 ngx_event_expire_timers(void)
 {
-    ngx_event_t        *ev;
-    ngx_rbtree_node_t  *node, *root, *sentinel;
-
-    sentinel = ngx_event_timer_rbtree.sentinel;
+    ngx_uint_t    index;
+    ngx_msec_t    next;
+    ngx_queue_t   expired, *q;
+    ngx_event_t  *ev;
 
     for ( ;; ) {
-        root = ngx_event_timer_rbtree.root;
 
-        if (root == sentinel) {
+        if (ngx_timer_wheel_test(NGX_TIMER_WHEEL_EXPIRED)) {
+            index = NGX_TIMER_WHEEL_EXPIRED;
+            goto expire;
+        }
+
+        /* ngx_event_timer_time > ngx_current_msec */
+
+        if ((ngx_msec_int_t) (ngx_event_timer_time - ngx_current_msec) > 0) {
             return;
         }
 
-        node = ngx_rbtree_min(root, sentinel);
+        index = ngx_event_timer_time & (NGX_TIMER_WHEEL_SIZE0 - 1);
+
+        if (index == 0) {
+            ngx_event_timer_cascade();
+        }
+
+        if (!ngx_timer_wheel_test(index)) {
+
+            /* skip to the next expiration or cascade */
+
+            if (ngx_event_timer_next_due(&next) != NGX_OK
+                || (ngx_msec_int_t) (next - ngx_current_msec) > 0)
+            {
+                next = ngx_current_msec + 1;
+            }
+
+            ngx_event_timer_time = next;
+
+            continue;
+        }
+
+        ngx_event_timer_time++;
+
+    expire:
+
+        ngx_queue_init(&expired);
+        ngx_queue_add(&expired, &ngx_event_timer_wheel[index]);
+        ngx_queue_init(&ngx_event_timer_wheel[index]);
+        ngx_timer_wheel_clear(index);
+
+        while (!ngx_queue_empty(&expired)) {
+            q = ngx_queue_head(&expired);
+            ngx_queue_remove(q);
+
+            ev = ngx_queue_data(q, ngx_event_t, timer.queue);
+
+            if ((ngx_msec_int_t) (ev->timer.key - ngx_current_msec) > 0) {
+                /* a timer beyond the wheel */
+                ngx_event_timer_insert(ev,
+                                       ngx_event_timer_slot(ev->timer.key));
+                continue;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ev->timer_set = 0;
+
+            ev->timedout = 1;
+
+            ev->handler(ev);
+        }
+    }
+}
+
+
+static void
+ngx_event_timer_cascade(void)
+{
+    ngx_uint_t    level, index, slot;
+    ngx_queue_t   timers, *q;
+    ngx_event_t  *ev;
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        index = (ngx_event_timer_time >> ngx_timer_wheel_shift(level))
+                & (NGX_TIMER_WHEEL_SIZE - 1);
 
-        /* node->key > ngx_current_msec */
+        slot = ngx_timer_wheel_base(level) + index;
 
-        if ((ngx_msec_int_t) (node->key - ngx_current_msec) > 0) {
+        if (ngx_timer_wheel_test(slot)) {
+            ngx_queue_init(&timers);
+            ngx_queue_add(&timers, &ngx_event_timer_wheel[slot]);
+            ngx_queue_init(&ngx_event_timer_wheel[slot]);
+            ngx_timer_wheel_clear(slot);
+
+            while (!ngx_queue_empty(&timers)) {
+                q = ngx_queue_head(&timers);
+                ngx_queue_remove(q);
+
+                ev = ngx_queue_data(q, ngx_event_t, timer.queue);
+
+                ngx_event_timer_insert(ev,
+                                       ngx_event_timer_slot(ev->timer.key));
+            }
+        }
+
+        if (index != 0) {
             return;
         }
+    }
+}
+
 
-        ev = ngx_rbtree_data(node, ngx_event_t, timer);
+static ngx_int_t
+ngx_event_timer_next_due(ngx_msec_t *next)
+{
+    ngx_uint_t  level, shift, index, n, i, found;
+    ngx_msec_t  time, due;
 
-        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
-                       "event timer del: %d: %M",
-                       ngx_event_ident(ev->data), ev->timer.key);
+    /* the earliest time when a timer is to be expired or cascaded */
 
-        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    time = ngx_event_timer_time;
 
-#if (NGX_DEBUG)
-        ev->timer.left = NULL;
-        ev->timer.right = NULL;
-        ev->timer.parent = NULL;
-#endif
+    n = ngx_event_timer_next(0, NGX_TIMER_WHEEL_SIZE0,
+                             time & (NGX_TIMER_WHEEL_SIZE0 - 1));
+
+    found = (n < NGX_TIMER_WHEEL_SIZE0);
+    *next = time + n;
+
+    /*
+     * an upper level slot is due when it is cascaded, and the slot of
+     * the current wheel time is cascaded on the level boundary only
+     */
 
-        ev->timer_set = 0;
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        shift = ngx_timer_wheel_shift(level);
+        index = (time >> shift) & (NGX_TIMER_WHEEL_SIZE - 1);
 
-        ev->timedout = 1;
+        i = (time & (((ngx_msec_t) 1 << shift) - 1)) ? 1 : 0;
 
-        ev->handler(ev);
+        n = ngx_event_timer_next(ngx_timer_wheel_base(level),
+                                 NGX_TIMER_WHEEL_SIZE,
+                                 (index + i) & (NGX_TIMER_WHEEL_SIZE - 1));
+
+        if (n == NGX_TIMER_WHEEL_SIZE) {
+            continue;
+        }
+
+        due = ((time >> shift) + i + n) << shift;
+
+        if (!found || (ngx_msec_int_t) (due - *next) < 0) {
+            found = 1;
+            *next = due;
+        }
     }
+
+    return found ? NGX_OK : NGX_DONE;
 }
 
 
-ngx_int_t
-ngx_event_no_timers_left(void)
+static ngx_uint_t
+ngx_event_timer_next(ngx_uint_t base, ngx_uint_t size, ngx_uint_t index)
 {
-    ngx_event_t        *ev;
-    ngx_rbtree_node_t  *node, *root, *sentinel;
+    uint64_t    bits;
+    ngx_uint_t  n, slot;
 
-    sentinel = ngx_event_timer_rbtree.sentinel;
-    root = ngx_event_timer_rbtree.root;
+    /* the distance to the next non-empty slot of a level, or size if none */
 
-    if (root == sentinel) {
-        return NGX_OK;
+    n = 0;
+
+    while (n < size) {
+        slot = base + ((index + n) & (size - 1));
+
+        bits = ngx_event_timer_bitmap[slot >> 6] >> (slot & 63);
+
+        if (bits == 0) {
+            n += 64 - (slot & 63);
+            continue;
+        }
+
+        while (!(bits & 1)) {
+            bits >>= 1;
+            n++;
+        }
+
+        break;
     }
 
-    for (node = ngx_rbtree_min(root, sentinel);
-         node;
-         node = ngx_rbtree_next(&ngx_event_timer_rbtree, node))
-    {
-        ev = ngx_rbtree_data(node, ngx_event_t, timer);
+    return ngx_min(n, size);
+}
+
+
+ngx_int_t
+ngx_event_no_timers_left(void)
+{
+    ngx_uint_t    i;
+    ngx_queue_t  *q;
+    ngx_event_t  *ev;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_SLOTS + 1; i++) {
+
+        for (q = ngx_queue_head(&ngx_event_timer_wheel[i]);
+             q != ngx_queue_sentinel(&ngx_event_timer_wheel[i]);
+             q = ngx_queue_next(q))
+        {
+            ev = ngx_queue_data(q, ngx_event_t, timer.queue);
 
-        if (!ev->cancelable) {
-            return NGX_AGAIN;
+            if (!ev->cancelable) {
+                return NGX_AGAIN;
+            }
         }
     }
 
@@ -24,8 +24,9 @@ ngx_msec_t ngx_event_find_timer(void);
 void ngx_event_expire_timers(void);
 ngx_int_t ngx_event_no_timers_left(void);
 
-
-extern ngx_rbtree_t  ngx_event_timer_rbtree;
+ngx_uint_t ngx_event_timer_slot(ngx_msec_t key);
+void ngx_event_timer_insert(ngx_event_t *ev, ngx_uint_t slot);
+void ngx_event_timer_delete(ngx_event_t *ev);
 
 
 static ngx_inline void
@@ -35,13 +36,7 @@ ngx_event_del_timer(ngx_event_t *ev)
                    "event timer del: %d: %M",
                     ngx_event_ident(ev->data), ev->timer.key);
 
-    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
-
-#if (NGX_DEBUG)
-    ev->timer.left = NULL;
-    ev->timer.right = NULL;
-    ev->timer.parent = NULL;
-#endif
+    ngx_event_timer_delete(ev);
 
     ev->timer_set = 0;
 }
@@ -51,16 +46,18 @@ static ngx_inline void
 ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
 {
     ngx_msec_t      key;
+    ngx_uint_t      slot;
     ngx_msec_int_t  diff;
 
     key = ngx_current_msec + timer;
+    slot = ngx_event_timer_slot(key);
 
     if (ev->timer_set) {
 
         /*
          * Use a previous timer value if difference between it and a new
          * value is less than NGX_TIMER_LAZY_DELAY milliseconds: this allows
-         * to minimize the rbtree operations for fast connections.
+         * to minimize the timer wheel operations for fast connections.
          */
 
         diff = (ngx_msec_int_t) (key - ev->timer.key);
@@ -72,6 +69,20 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
             return;
         }
 
+        /*
+         * A timer which stays in the same wheel slot, usually a long
+         * keepalive or lingering timeout, only needs its key updated.
+         */
+
+        if (slot == ev->timer.slot) {
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer: %d, slot: %ui, new: %M",
+                            ngx_event_ident(ev->data), slot, key);
+
+            ev->timer.key = key;
+            return;
+        }
+
         ngx_del_timer(ev);
     }
 
@@ -81,7 +92,7 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
                    "event timer add: %d: %M:%M",
                     ngx_event_ident(ev->data), timer, ev->timer.key);
 
-    ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    ngx_event_timer_insert(ev, slot);
 
     ev->timer_set = 1;
 }
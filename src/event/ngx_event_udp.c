@@ -12,6 +12,34 @@
 
 #if !(NGX_WIN32)
 
+#if (NGX_HAVE_RECVMMSG)
+#define NGX_UDP_RECV_BATCH  16
+#else
+#define NGX_UDP_RECV_BATCH  1
+#endif
+
+#define NGX_UDP_RECV_BUFFER_SIZE  65535
+
+#if (NGX_HAVE_ADDRINFO_CMSG && NGX_HAVE_UDP_GRO)
+#define NGX_UDP_RECV_CMSG_SIZE                                                \
+    (CMSG_SPACE(sizeof(ngx_addrinfo_t)) + CMSG_SPACE(sizeof(int)))
+#elif (NGX_HAVE_ADDRINFO_CMSG)
+#define NGX_UDP_RECV_CMSG_SIZE  CMSG_SPACE(sizeof(ngx_addrinfo_t))
+#elif (NGX_HAVE_UDP_GRO)
+#define NGX_UDP_RECV_CMSG_SIZE  CMSG_SPACE(sizeof(int))
+#endif
+
+
+typedef struct {
+    ngx_sockaddr_t     sockaddr;
+    struct iovec       iov;
+    size_t             len;
+#ifdef NGX_UDP_RECV_CMSG_SIZE
+    u_char             control[NGX_UDP_RECV_CMSG_SIZE];
+#endif
+} ngx_udp_recv_slot_t;
+
+
 static void ngx_close_accepted_udp_connection(ngx_connection_t *c);
 static ssize_t ngx_udp_shared_recv(ngx_connection_t *c, u_char *buf,
     size_t size);
@@ -21,27 +49,33 @@ static ngx_connection_t *ngx_lookup_udp_connection(ngx_listening_t *ls,
     struct sockaddr *local_sockaddr, socklen_t local_socklen);
 
 
+static ngx_udp_recv_slot_t  ngx_udp_recv_slots[NGX_UDP_RECV_BATCH];
+static u_char  ngx_udp_recv_buffers[NGX_UDP_RECV_BATCH]
+                                   [NGX_UDP_RECV_BUFFER_SIZE];
+
+#if (NGX_HAVE_RECVMMSG)
+static struct mmsghdr  ngx_udp_recv_msgs[NGX_UDP_RECV_BATCH];
+#else
+static struct msghdr   ngx_udp_recv_msgs[NGX_UDP_RECV_BATCH];
+#endif
+
+
 void
 ngx_event_recvmsg(ngx_event_t *ev)
 {
     ssize_t            n;
+    u_char            *buffer;
     ngx_buf_t          buf;
     ngx_log_t         *log;
-    ngx_err_t          err;
     socklen_t          socklen, local_socklen;
     ngx_event_t       *rev, *wev;
-    struct iovec       iov[1];
-    struct msghdr      msg;
+    struct msghdr     *msg;
     ngx_sockaddr_t     sa, lsa;
+    ngx_udp_recv_t     r;
     struct sockaddr   *sockaddr, *local_sockaddr;
     ngx_listening_t   *ls;
     ngx_event_conf_t  *ecf;
     ngx_connection_t  *c, *lc;
-    static u_char      buffer[65535];
-
-#if (NGX_HAVE_ADDRINFO_CMSG)
-    u_char             msg_control[CMSG_SPACE(sizeof(ngx_addrinfo_t))];
-#endif
 
     if (ev->timedout) {
         if (ngx_enable_accept_events((ngx_cycle_t *) ngx_cycle) != NGX_OK) {
@@ -64,52 +98,23 @@ ngx_event_recvmsg(ngx_event_t *ev)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "recvmsg on %V, ready: %d", &ls->addr_text, ev->available);
 
-    do {
-        ngx_memzero(&msg, sizeof(struct msghdr));
-
-        iov[0].iov_base = (void *) buffer;
-        iov[0].iov_len = sizeof(buffer);
-
-        msg.msg_name = &sa;
-        msg.msg_namelen = sizeof(ngx_sockaddr_t);
-        msg.msg_iov = iov;
-        msg.msg_iovlen = 1;
+    ngx_memzero(&r, sizeof(ngx_udp_recv_t));
 
-#if (NGX_HAVE_ADDRINFO_CMSG)
-        if (ls->wildcard) {
-            msg.msg_control = &msg_control;
-            msg.msg_controllen = sizeof(msg_control);
+    do {
+        n = ngx_udp_recvmsg(ev, &r, &buffer);
 
-            ngx_memzero(&msg_control, sizeof(msg_control));
+        if (n == NGX_DECLINED) {
+            continue;
         }
-#endif
-
-        n = recvmsg(lc->fd, &msg, 0);
-
-        if (n == -1) {
-            err = ngx_socket_errno;
-
-            if (err == NGX_EAGAIN) {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
-                               "recvmsg() not ready");
-                return;
-            }
-
-            ngx_log_error(NGX_LOG_ALERT, ev->log, err, "recvmsg() failed");
 
+        if (n == NGX_AGAIN || n == NGX_ERROR) {
             return;
         }
 
-#if (NGX_HAVE_ADDRINFO_CMSG)
-        if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
-            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
-                          "recvmsg() truncated data");
-            continue;
-        }
-#endif
+        msg = r.msg;
 
-        sockaddr = msg.msg_name;
-        socklen = msg.msg_namelen;
+        sockaddr = msg->msg_name;
+        socklen = msg->msg_namelen;
 
         if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
             socklen = sizeof(ngx_sockaddr_t);
@@ -123,6 +128,7 @@ ngx_event_recvmsg(ngx_event_t *ev)
              */
 
             socklen = sizeof(struct sockaddr);
+            sockaddr = &sa.sockaddr;
             ngx_memzero(&sa, sizeof(struct sockaddr));
             sa.sockaddr.sa_family = ls->sockaddr->sa_family;
         }
@@ -138,9 +144,9 @@ ngx_event_recvmsg(ngx_event_t *ev)
             ngx_memcpy(&lsa, local_sockaddr, local_socklen);
             local_sockaddr = &lsa.sockaddr;
 
-            for (cmsg = CMSG_FIRSTHDR(&msg);
+            for (cmsg = CMSG_FIRSTHDR(msg);
                  cmsg != NULL;
-                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+                 cmsg = CMSG_NXTHDR(msg, cmsg))
             {
                 if (ngx_get_srcaddr_cmsg(cmsg, local_sockaddr) == NGX_OK) {
                     break;
@@ -344,7 +350,165 @@ ngx_event_recvmsg(ngx_event_t *ev)
             ev->available -= n;
         }
 
-    } while (ev->available);
+    } while (ev->available || ngx_udp_recv_pending(&r));
+}
+
+
+ssize_t
+ngx_udp_recvmsg(ngx_event_t *ev, ngx_udp_recv_t *r, u_char **buf)
+{
+    ssize_t               n;
+    ngx_err_t             err;
+    ngx_uint_t            i, batch;
+    struct msghdr        *msg;
+    ngx_connection_t     *lc;
+    ngx_udp_recv_slot_t  *slot;
+
+    /*
+     * datagrams are received into a static ring, up to NGX_UDP_RECV_BATCH
+     * datagrams per recvmmsg() call if multi_accept is enabled; datagrams
+     * coalesced by UDP GRO are returned as separate segments
+     */
+
+    if (r->pos < r->last) {
+        goto segment;
+    }
+
+    if (r->next == r->nmsgs) {
+
+        lc = ev->data;
+
+        batch = 1;
+
+#if (NGX_HAVE_RECVMMSG)
+        if (ev->available && !(ngx_event_flags & NGX_USE_KQUEUE_EVENT)) {
+            batch = NGX_UDP_RECV_BATCH;
+        }
+#endif
+
+        for (i = 0; i < batch; i++) {
+            slot = &ngx_udp_recv_slots[i];
+
+#if (NGX_HAVE_RECVMMSG)
+            msg = &ngx_udp_recv_msgs[i].msg_hdr;
+#else
+            msg = &ngx_udp_recv_msgs[i];
+#endif
+
+            ngx_memzero(msg, sizeof(struct msghdr));
+
+            slot->iov.iov_base = ngx_udp_recv_buffers[i];
+            slot->iov.iov_len = NGX_UDP_RECV_BUFFER_SIZE;
+
+            msg->msg_name = &slot->sockaddr;
+            msg->msg_namelen = sizeof(ngx_sockaddr_t);
+            msg->msg_iov = &slot->iov;
+            msg->msg_iovlen = 1;
+
+#ifdef NGX_UDP_RECV_CMSG_SIZE
+            msg->msg_control = slot->control;
+            msg->msg_controllen = sizeof(slot->control);
+
+            ngx_memzero(slot->control, sizeof(slot->control));
+#endif
+        }
+
+#if (NGX_HAVE_RECVMMSG)
+        if (batch > 1) {
+            n = recvmmsg(lc->fd, ngx_udp_recv_msgs, batch, 0, NULL);
+
+            if (n > 0) {
+                for (i = 0; i < (ngx_uint_t) n; i++) {
+                    ngx_udp_recv_slots[i].len = ngx_udp_recv_msgs[i].msg_len;
+                }
+            }
+
+        } else {
+            n = recvmsg(lc->fd, &ngx_udp_recv_msgs[0].msg_hdr, 0);
+        }
+#else
+        n = recvmsg(lc->fd, &ngx_udp_recv_msgs[0], 0);
+#endif
+
+        if (n != -1 && batch == 1) {
+            ngx_udp_recv_slots[0].len = n;
+            n = 1;
+        }
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
+                               "recvmsg() not ready");
+                return NGX_AGAIN;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err, "recvmsg() failed");
+
+            return NGX_ERROR;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "recvmsg: %z of %ui datagrams", n, batch);
+
+        r->nmsgs = n;
+        r->next = 0;
+    }
+
+    i = r->next++;
+
+#if (NGX_HAVE_RECVMMSG)
+    msg = &ngx_udp_recv_msgs[i].msg_hdr;
+#else
+    msg = &ngx_udp_recv_msgs[i];
+#endif
+
+    n = ngx_udp_recv_slots[i].len;
+
+    if (msg->msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0, "recvmsg() truncated data");
+        return NGX_DECLINED;
+    }
+
+    r->msg = msg;
+    r->pos = ngx_udp_recv_buffers[i];
+    r->last = r->pos + n;
+    r->segment = n;
+
+#if (NGX_HAVE_UDP_GRO)
+    {
+    struct cmsghdr  *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg);
+         cmsg != NULL;
+         cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            r->segment = *(int *) CMSG_DATA(cmsg);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "recvmsg: gro n:%z segment:%uz", n, r->segment);
+            break;
+        }
+    }
+    }
+#endif
+
+    if (n == 0 || r->segment == 0) {
+        r->pos = r->last;
+        *buf = r->last;
+        return n;
+    }
+
+segment:
+
+    n = ngx_min((size_t) (r->last - r->pos), r->segment);
+
+    *buf = r->pos;
+    r->pos += n;
+
+    return n;
 }
 
 
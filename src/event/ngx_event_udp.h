@@ -23,6 +23,20 @@
 #endif
 
 
+typedef struct {
+    struct msghdr      *msg;
+    u_char             *pos;
+    u_char             *last;
+    size_t              segment;
+    ngx_uint_t          nmsgs;
+    ngx_uint_t          next;
+} ngx_udp_recv_t;
+
+
+#define ngx_udp_recv_pending(r)                                               \
+    ((r)->pos < (r)->last || (r)->next < (r)->nmsgs)
+
+
 struct ngx_udp_connection_s {
     ngx_rbtree_node_t   node;
     ngx_connection_t   *connection;
@@ -55,6 +69,7 @@ ngx_int_t ngx_get_srcaddr_cmsg(struct cmsghdr *cmsg,
 #endif
 
 void ngx_event_recvmsg(ngx_event_t *ev);
+ssize_t ngx_udp_recvmsg(ngx_event_t *ev, ngx_udp_recv_t *r, u_char **buf);
 ssize_t ngx_sendmsg(ngx_connection_t *c, struct msghdr *msg, int flags);
 void ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
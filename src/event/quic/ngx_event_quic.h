@@ -27,6 +27,8 @@
 #define NGX_QUIC_STREAM_SERVER_INITIATED     0x01
 #define NGX_QUIC_STREAM_UNIDIRECTIONAL       0x02
 
+#define NGX_QUIC_DEFAULT_URGENCY             3
+
 
 typedef ngx_int_t (*ngx_quic_init_pt)(ngx_connection_t *c);
 typedef void (*ngx_quic_shutdown_pt)(ngx_connection_t *c);
@@ -61,11 +63,20 @@ typedef struct {
 } ngx_quic_buffer_t;
 
 
+typedef struct {
+    uint64_t                       batches;
+    uint64_t                       datagrams;
+    uint64_t                       flush_time;  /* microseconds */
+} ngx_quic_send_stats_t;
+
+
 typedef struct {
     ngx_ssl_t                     *ssl;
 
     ngx_flag_t                     retry;
     ngx_flag_t                     gso_enabled;
+    ngx_flag_t                     gro_enabled;
+    ngx_flag_t                     sendmmsg_enabled;
     ngx_flag_t                     disable_active_migration;
     ngx_msec_t                     handshake_timeout;
     ngx_msec_t                     idle_timeout;
@@ -108,10 +119,18 @@ struct ngx_quic_stream_s {
     ngx_quic_stream_recv_state_e   recv_state;
     unsigned                       cancelable:1;
     unsigned                       fin_acked:1;
+    unsigned                       urgency:3;
+    unsigned                       incremental:1;
 };
 
 
+extern ngx_quic_send_stats_t  ngx_quic_send_stats;
+
+
 void ngx_quic_recvmsg(ngx_event_t *ev);
+#if (NGX_HAVE_SENDMMSG)
+ngx_int_t ngx_quic_flush_datagrams(void);
+#endif
 void ngx_quic_run(ngx_connection_t *c, ngx_quic_conf_t *conf);
 ngx_connection_t *ngx_quic_open_stream(ngx_connection_t *c, ngx_uint_t bidi);
 void ngx_quic_finalize_connection(ngx_connection_t *c, ngx_uint_t err,
@@ -121,6 +140,8 @@ void ngx_quic_shutdown_connection(ngx_connection_t *c, ngx_uint_t err,
 ngx_int_t ngx_quic_reset_stream(ngx_connection_t *c, ngx_uint_t err);
 ngx_int_t ngx_quic_shutdown_stream(ngx_connection_t *c, int how);
 void ngx_quic_cancelable_stream(ngx_connection_t *c);
+ngx_int_t ngx_quic_set_stream_priority(ngx_connection_t *c, uint64_t id,
+    ngx_uint_t urgency, ngx_uint_t incremental);
 ngx_int_t ngx_quic_get_packet_dcid(ngx_log_t *log, u_char *data, size_t len,
     ngx_str_t *dcid);
 ngx_int_t ngx_quic_derive_key(ngx_log_t *log, const char *label,
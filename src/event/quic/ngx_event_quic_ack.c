@@ -635,7 +635,8 @@ ngx_quic_resend_frames(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx)
                 }
             }
 
-            /* fall through */
+            ngx_quic_queue_frame(qc, f);
+            break;
 
         default:
             ngx_queue_insert_tail(&ctx->frames, &f->queue);
@@ -298,11 +298,43 @@ ngx_quic_free_frames(ngx_connection_t *c, ngx_queue_t *frames)
 void
 ngx_quic_queue_frame(ngx_quic_connection_t *qc, ngx_quic_frame_t *frame)
 {
+    ngx_queue_t          *q;
+    ngx_quic_frame_t     *f;
     ngx_quic_send_ctx_t  *ctx;
 
     ctx = ngx_quic_get_send_ctx(qc, frame->level);
 
-    ngx_queue_insert_tail(&ctx->frames, &frame->queue);
+    q = ngx_queue_last(&ctx->frames);
+
+    if (frame->type == NGX_QUIC_FT_STREAM) {
+
+        /*
+         * RFC 9218: stream data of more urgent streams is sent first,
+         * non-incremental streams of the same urgency are sent sequentially
+         */
+
+        while (q != ngx_queue_sentinel(&ctx->frames)) {
+            f = ngx_queue_data(q, ngx_quic_frame_t, queue);
+
+            if (f->type != NGX_QUIC_FT_STREAM
+                || f->u.stream.stream_id == frame->u.stream.stream_id
+                || f->u.stream.urgency < frame->u.stream.urgency)
+            {
+                break;
+            }
+
+            if (f->u.stream.urgency == frame->u.stream.urgency
+                && (f->u.stream.incremental || frame->u.stream.incremental
+                    || f->u.stream.stream_id < frame->u.stream.stream_id))
+            {
+                break;
+            }
+
+            q = ngx_queue_prev(q);
+        }
+    }
+
+    ngx_queue_insert_after(q, &frame->queue);
 
     frame->len = ngx_quic_create_frame(NULL, frame);
     /* always succeeds */
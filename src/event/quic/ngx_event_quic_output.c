@@ -34,6 +34,35 @@
 
 #define NGX_QUIC_SOCKET_RETRY_DELAY      10 /* ms, for NGX_AGAIN on write */
 
+#define NGX_QUIC_SEND_BATCH              64
+#define NGX_QUIC_SEND_BUFFER_SIZE    262144
+
+
+#if (NGX_HAVE_SENDMMSG)
+
+typedef struct {
+    ngx_sockaddr_t                sockaddr;
+    struct iovec                  iov;
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    char                          msg_control[CMSG_SPACE(
+                                                  sizeof(ngx_addrinfo_t))];
+#endif
+} ngx_quic_send_entry_t;
+
+
+typedef struct {
+    ngx_socket_t                  fd;
+    ngx_uint_t                    first;
+    ngx_uint_t                    nmsgs;
+    u_char                       *last;
+    struct timeval                start;
+    struct mmsghdr                msgs[NGX_QUIC_SEND_BATCH];
+    ngx_quic_send_entry_t         entries[NGX_QUIC_SEND_BATCH];
+    u_char                        buffer[NGX_QUIC_SEND_BUFFER_SIZE];
+} ngx_quic_send_queue_t;
+
+#endif
+
 
 static ngx_int_t ngx_quic_create_datagrams(ngx_connection_t *c);
 static void ngx_quic_commit_send(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx);
@@ -52,12 +81,26 @@ static void ngx_quic_init_packet(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx,
 static ngx_uint_t ngx_quic_get_padding_level(ngx_connection_t *c);
 static ssize_t ngx_quic_send(ngx_connection_t *c, u_char *buf, size_t len,
     struct sockaddr *sockaddr, socklen_t socklen);
+#if (NGX_HAVE_SENDMMSG)
+static ssize_t ngx_quic_send_deferred(ngx_connection_t *c, u_char *buf,
+    size_t len, struct sockaddr *sockaddr, socklen_t socklen);
+static void ngx_quic_flush_handler(ngx_event_t *ev);
+#endif
 static void ngx_quic_set_packet_number(ngx_quic_header_t *pkt,
     ngx_quic_send_ctx_t *ctx);
 static size_t ngx_quic_path_limit(ngx_connection_t *c, ngx_quic_path_t *path,
     size_t size);
 
 
+ngx_quic_send_stats_t  ngx_quic_send_stats;
+
+#if (NGX_HAVE_SENDMMSG)
+static ngx_quic_send_queue_t  ngx_quic_send_queue;
+static ngx_event_t            ngx_quic_flush_event;
+static ngx_connection_t       ngx_quic_flush_dumb;
+#endif
+
+
 ngx_int_t
 ngx_quic_output(ngx_connection_t *c)
 {
@@ -166,7 +209,15 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
             break;
         }
 
-        n = ngx_quic_send(c, dst, len, path->sockaddr, path->socklen);
+#if (NGX_HAVE_SENDMMSG)
+        if (qc->conf->sendmmsg_enabled) {
+            n = ngx_quic_send_deferred(c, dst, len, path->sockaddr,
+                                       path->socklen);
+        } else
+#endif
+        {
+            n = ngx_quic_send(c, dst, len, path->sockaddr, path->socklen);
+        }
 
         if (n == NGX_ERROR) {
             return NGX_ERROR;
@@ -435,6 +486,15 @@ ngx_quic_send_segments(ngx_connection_t *c, u_char *buf, size_t len,
 
     msg.msg_controllen = clen;
 
+#if (NGX_HAVE_SENDMMSG)
+    /* keep packets of a connection in order */
+    if (ngx_quic_flush_datagrams() == NGX_AGAIN
+        && ngx_quic_send_queue.fd == c->fd)
+    {
+        return NGX_AGAIN;
+    }
+#endif
+
     n = ngx_sendmsg(c, &msg, 0);
     if (n < 0) {
         return n;
@@ -714,6 +774,190 @@ ngx_quic_send(ngx_connection_t *c, u_char *buf, size_t len,
 }
 
 
+#if (NGX_HAVE_SENDMMSG)
+
+static ssize_t
+ngx_quic_send_deferred(ngx_connection_t *c, u_char *buf, size_t len,
+    struct sockaddr *sockaddr, socklen_t socklen)
+{
+    struct msghdr          *msg;
+    ngx_quic_send_entry_t  *e;
+    ngx_quic_send_queue_t  *q;
+
+    /*
+     * datagrams from all connections are collected in a per-worker queue
+     * and sent with sendmmsg() at the end of the event loop iteration;
+     * a datagram is considered sent once it is queued, and datagrams
+     * the socket cannot take yet stay queued until the next flush;
+     * if the queue cannot be emptied, the caller gets NGX_AGAIN
+     */
+
+    q = &ngx_quic_send_queue;
+
+    if (len > NGX_QUIC_SEND_BUFFER_SIZE) {
+        return ngx_quic_send(c, buf, len, sockaddr, socklen);
+    }
+
+    if (q->nmsgs
+        && (q->fd != c->fd
+            || q->nmsgs == NGX_QUIC_SEND_BATCH
+            || (size_t) (q->buffer + NGX_QUIC_SEND_BUFFER_SIZE - q->last)
+               < len))
+    {
+        if (ngx_quic_flush_datagrams() == NGX_AGAIN) {
+
+            if (q->fd != c->fd) {
+                /* the queue is blocked by another socket */
+                return ngx_quic_send(c, buf, len, sockaddr, socklen);
+            }
+
+            return NGX_AGAIN;
+        }
+    }
+
+    if (q->nmsgs == 0) {
+        q->fd = c->fd;
+        q->last = q->buffer;
+        ngx_gettimeofday(&q->start);
+    }
+
+    e = &q->entries[q->nmsgs];
+    msg = &q->msgs[q->nmsgs].msg_hdr;
+
+    e->iov.iov_base = q->last;
+    e->iov.iov_len = len;
+
+    q->last = ngx_cpymem(q->last, buf, len);
+
+    ngx_memcpy(&e->sockaddr, sockaddr, socklen);
+
+    ngx_memzero(msg, sizeof(struct msghdr));
+
+    msg->msg_iov = &e->iov;
+    msg->msg_iovlen = 1;
+
+    msg->msg_name = &e->sockaddr;
+    msg->msg_namelen = socklen;
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    if (c->listening && c->listening->wildcard && c->local_sockaddr) {
+
+        msg->msg_control = e->msg_control;
+        msg->msg_controllen = sizeof(e->msg_control);
+        ngx_memzero(e->msg_control, sizeof(e->msg_control));
+
+        msg->msg_controllen = ngx_set_srcaddr_cmsg(CMSG_FIRSTHDR(msg),
+                                                   c->local_sockaddr);
+    }
+#endif
+
+    q->nmsgs++;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic send queued: %uz, %ui in queue", len, q->nmsgs);
+
+    c->sent += len;
+
+    return len;
+}
+
+
+ngx_int_t
+ngx_quic_flush_datagrams(void)
+{
+    int                     n;
+    ngx_err_t               err;
+    ngx_uint_t              sent;
+    ngx_event_t            *ev;
+    struct timeval          tv;
+    ngx_quic_send_queue_t  *q;
+
+    q = &ngx_quic_send_queue;
+
+    if (q->nmsgs == 0) {
+        return NGX_OK;
+    }
+
+    ev = &ngx_quic_flush_event;
+
+    sent = q->first;
+
+    while (sent < q->nmsgs) {
+
+        n = sendmmsg(q->fd, &q->msgs[sent], q->nmsgs - sent, 0);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err == NGX_EAGAIN) {
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, err,
+                               "sendmmsg() not ready, %ui datagrams queued",
+                               q->nmsgs - sent);
+
+                q->first = sent;
+
+                if (!ev->timer_set) {
+                    ev->handler = ngx_quic_flush_handler;
+                    ev->log = ngx_cycle->log;
+                    ev->data = &ngx_quic_flush_dumb;
+                    ev->cancelable = 1;
+
+                    ngx_quic_flush_dumb.fd = (ngx_socket_t) -1;
+
+                    ngx_add_timer(ev, NGX_QUIC_SOCKET_RETRY_DELAY);
+                }
+
+                return NGX_AGAIN;
+            }
+
+            /* the first datagram cannot be sent, skip it */
+
+            ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, err,
+                          "sendmmsg() failed");
+            sent++;
+            continue;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                       "sendmmsg: %d of %ui", n, q->nmsgs - sent);
+
+        sent += n;
+
+        ngx_quic_send_stats.batches++;
+        ngx_quic_send_stats.datagrams += n;
+    }
+
+    ngx_gettimeofday(&tv);
+
+    ngx_quic_send_stats.flush_time += (tv.tv_sec - q->start.tv_sec) * 1000000
+                                      + tv.tv_usec - q->start.tv_usec;
+
+    q->first = 0;
+    q->nmsgs = 0;
+
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_quic_flush_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0, "quic flush handler");
+
+    (void) ngx_quic_flush_datagrams();
+}
+
+#endif
+
+
 static void
 ngx_quic_set_packet_number(ngx_quic_header_t *pkt, ngx_quic_send_ctx_t *ctx)
 {
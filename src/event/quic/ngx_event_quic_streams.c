@@ -681,6 +681,8 @@ ngx_quic_create_stream(ngx_connection_t *c, uint64_t id)
     qs->id = id;
     qs->send_final_size = (uint64_t) -1;
     qs->recv_final_size = (uint64_t) -1;
+    qs->urgency = NGX_QUIC_DEFAULT_URGENCY;
+    qs->incremental = 1;
 
     pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, c->log);
     if (pool == NULL) {
@@ -834,6 +836,70 @@ ngx_quic_cancelable_stream(ngx_connection_t *c)
 }
 
 
+ngx_int_t
+ngx_quic_set_stream_priority(ngx_connection_t *c, uint64_t id,
+    ngx_uint_t urgency, ngx_uint_t incremental)
+{
+    ngx_queue_t             frames, *q, *next;
+    ngx_quic_frame_t       *f;
+    ngx_quic_stream_t      *qs;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c->quic->parent);
+
+    qs = ngx_quic_find_stream(&qc->streams.tree, id);
+    if (qs == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic stream id:0x%xL priority urgency:%ui incremental:%ui",
+                   id, urgency, incremental);
+
+    if (qs->urgency == urgency && qs->incremental == incremental) {
+        return NGX_OK;
+    }
+
+    qs->urgency = urgency;
+    qs->incremental = incremental;
+
+    /* requeue stream data not yet sent */
+
+    ngx_queue_init(&frames);
+
+    ctx = ngx_quic_get_send_ctx(qc, ssl_encryption_application);
+
+    for (q = ngx_queue_head(&ctx->frames);
+         q != ngx_queue_sentinel(&ctx->frames);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        f = ngx_queue_data(q, ngx_quic_frame_t, queue);
+
+        if (f->type == NGX_QUIC_FT_STREAM && f->u.stream.stream_id == id) {
+            ngx_queue_remove(q);
+            ngx_queue_insert_tail(&frames, q);
+        }
+    }
+
+    while (!ngx_queue_empty(&frames)) {
+        q = ngx_queue_head(&frames);
+        ngx_queue_remove(q);
+
+        f = ngx_queue_data(q, ngx_quic_frame_t, queue);
+
+        f->u.stream.urgency = urgency;
+        f->u.stream.incremental = incremental;
+
+        ngx_quic_queue_frame(qc, f);
+    }
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_quic_empty_handler(ngx_event_t *ev)
 {
@@ -1065,6 +1131,8 @@ ngx_quic_stream_flush(ngx_quic_stream_t *qs)
     frame->u.stream.stream_id = qs->id;
     frame->u.stream.offset = qs->send_offset;
     frame->u.stream.length = len;
+    frame->u.stream.urgency = qs->urgency;
+    frame->u.stream.incremental = qs->incremental;
 
     ngx_quic_queue_frame(qc, frame);
 
@@ -191,6 +191,8 @@ typedef struct {
     unsigned                                    off:1;
     unsigned                                    len:1;
     unsigned                                    fin:1;
+    unsigned                                    urgency:3;
+    unsigned                                    incremental:1;
 } ngx_quic_stream_frame_t;
 
 
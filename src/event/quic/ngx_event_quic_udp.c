@@ -20,25 +20,20 @@ void
 ngx_quic_recvmsg(ngx_event_t *ev)
 {
     ssize_t             n;
+    u_char             *buffer;
     ngx_str_t           key;
     ngx_buf_t           buf;
     ngx_log_t          *log;
-    ngx_err_t           err;
     socklen_t           socklen, local_socklen;
     ngx_event_t        *rev, *wev;
-    struct iovec        iov[1];
-    struct msghdr       msg;
-    ngx_sockaddr_t      sa, lsa;
+    struct msghdr      *msg;
+    ngx_sockaddr_t      lsa;
+    ngx_udp_recv_t      r;
     struct sockaddr    *sockaddr, *local_sockaddr;
     ngx_listening_t    *ls;
     ngx_event_conf_t   *ecf;
     ngx_connection_t   *c, *lc;
     ngx_quic_socket_t  *qsock;
-    static u_char       buffer[NGX_QUIC_MAX_UDP_PAYLOAD_SIZE];
-
-#if (NGX_HAVE_ADDRINFO_CMSG)
-    u_char             msg_control[CMSG_SPACE(sizeof(ngx_addrinfo_t))];
-#endif
 
     if (ev->timedout) {
         if (ngx_enable_accept_events((ngx_cycle_t *) ngx_cycle) != NGX_OK) {
@@ -62,52 +57,23 @@ ngx_quic_recvmsg(ngx_event_t *ev)
                    "quic recvmsg on %V, ready: %d",
                    &ls->addr_text, ev->available);
 
-    do {
-        ngx_memzero(&msg, sizeof(struct msghdr));
-
-        iov[0].iov_base = (void *) buffer;
-        iov[0].iov_len = sizeof(buffer);
-
-        msg.msg_name = &sa;
-        msg.msg_namelen = sizeof(ngx_sockaddr_t);
-        msg.msg_iov = iov;
-        msg.msg_iovlen = 1;
+    ngx_memzero(&r, sizeof(ngx_udp_recv_t));
 
-#if (NGX_HAVE_ADDRINFO_CMSG)
-        if (ls->wildcard) {
-            msg.msg_control = &msg_control;
-            msg.msg_controllen = sizeof(msg_control);
+    do {
+        n = ngx_udp_recvmsg(ev, &r, &buffer);
 
-            ngx_memzero(&msg_control, sizeof(msg_control));
+        if (n == NGX_DECLINED) {
+            continue;
         }
-#endif
-
-        n = recvmsg(lc->fd, &msg, 0);
-
-        if (n == -1) {
-            err = ngx_socket_errno;
-
-            if (err == NGX_EAGAIN) {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
-                               "quic recvmsg() not ready");
-                return;
-            }
-
-            ngx_log_error(NGX_LOG_ALERT, ev->log, err, "quic recvmsg() failed");
 
+        if (n == NGX_AGAIN || n == NGX_ERROR) {
             return;
         }
 
-#if (NGX_HAVE_ADDRINFO_CMSG)
-        if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
-            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
-                          "quic recvmsg() truncated data");
-            continue;
-        }
-#endif
+        msg = r.msg;
 
-        sockaddr = msg.msg_name;
-        socklen = msg.msg_namelen;
+        sockaddr = msg->msg_name;
+        socklen = msg->msg_namelen;
 
         if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
             socklen = sizeof(ngx_sockaddr_t);
@@ -140,9 +106,9 @@ ngx_quic_recvmsg(ngx_event_t *ev)
             ngx_memcpy(&lsa, local_sockaddr, local_socklen);
             local_sockaddr = &lsa.sockaddr;
 
-            for (cmsg = CMSG_FIRSTHDR(&msg);
+            for (cmsg = CMSG_FIRSTHDR(msg);
                  cmsg != NULL;
-                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+                 cmsg = CMSG_NXTHDR(msg, cmsg))
             {
                 if (ngx_get_srcaddr_cmsg(cmsg, local_sockaddr) == NGX_OK) {
                     break;
@@ -179,7 +145,7 @@ ngx_quic_recvmsg(ngx_event_t *ev)
             buf.pos = buffer;
             buf.last = buffer + n;
             buf.start = buf.pos;
-            buf.end = buffer + sizeof(buffer);
+            buf.end = buf.last;
 
             qsock = ngx_quic_get_socket(c);
 
@@ -344,7 +310,7 @@ ngx_quic_recvmsg(ngx_event_t *ev)
             ev->available -= n;
         }
 
-    } while (ev->available);
+    } while (ev->available || ngx_udp_recv_pending(&r));
 }
 
 
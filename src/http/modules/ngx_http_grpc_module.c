@@ -10,12 +10,19 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_GRPC_MUX_BUFFER_SIZE  16384
+
+
 typedef struct {
-    ngx_array_t               *flushes;
-    ngx_array_t               *lengths;
-    ngx_array_t               *values;
-    ngx_hash_t                 hash;
-} ngx_http_grpc_headers_t;
+    ngx_uint_t                 streams;
+    size_t                     window;
+    ngx_msec_t                 timeout;
+
+    ngx_queue_t                connections;
+
+    ngx_http_upstream_init_pt       original_init_upstream;
+    ngx_http_upstream_init_peer_pt  original_init_peer;
+} ngx_http_grpc_srv_conf_t;
 
 
 typedef struct {
@@ -61,7 +68,9 @@ typedef struct {
     size_t                     init_window;
     size_t                     send_window;
     size_t                     recv_window;
+    size_t                     stream_window;
     ngx_uint_t                 last_stream_id;
+    unsigned                   shared:1;
 } ngx_http_grpc_conn_t;
 
 
@@ -125,7 +134,9 @@ typedef struct {
 
     ngx_http_request_t        *request;
 
+    ngx_http_grpc_headers_t   *headers;
     ngx_str_t                  host;
+    unsigned                   host_set:1;
 } ngx_http_grpc_ctx_t;
 
 
@@ -142,9 +153,94 @@ typedef struct {
 } ngx_http_grpc_frame_t;
 
 
+typedef struct ngx_http_grpc_mux_s  ngx_http_grpc_mux_t;
+
+
+typedef struct {
+    ngx_connection_t           connection;
+    ngx_event_t                read;
+    ngx_event_t                write;
+
+    ngx_queue_t                queue;
+    ngx_http_grpc_mux_t       *mux;
+    ngx_http_grpc_ctx_t       *ctx;
+    ngx_uint_t                 id;
+
+    ngx_chain_t               *in;
+    ngx_chain_t               *last;
+    ngx_chain_t               *free;
+
+    unsigned                   reset:1;
+    unsigned                   eof:1;
+    unsigned                   error:1;
+} ngx_http_grpc_stream_t;
+
+
+struct ngx_http_grpc_mux_s {
+    ngx_queue_t                queue;
+    ngx_http_grpc_srv_conf_t  *conf;
+    ngx_http_upstream_conf_t  *upstream;
+
+    ngx_pool_t                *pool;
+    ngx_log_t                  log;
+    ngx_connection_t          *connection;
+    ngx_peer_connection_t      peer;
+
+    socklen_t                  socklen;
+    ngx_sockaddr_t             sockaddr;
+    ngx_str_t                  name;
+
+#if (NGX_HTTP_SSL)
+    ngx_str_t                  ssl_name;
+    ngx_str_t                  ssl_host;
+#endif
+
+    ngx_http_grpc_conn_t       conn;
+
+    ngx_queue_t                streams;
+    ngx_uint_t                 nstreams;
+    ngx_uint_t                 max_streams;
+    ngx_uint_t                 next_id;
+
+    u_char                    *buffer;
+    u_char                    *payload;
+
+    ngx_chain_t               *out;
+    ngx_chain_t               *last;
+    ngx_chain_t               *free;
+
+    u_char                     head[NGX_HTTP_V2_FRAME_HEADER_SIZE];
+    size_t                     received;
+    size_t                     length;
+    size_t                     rest;
+    ngx_uint_t                 stream_id;
+    ngx_uint_t                 type;
+    ngx_uint_t                 flags;
+    ngx_http_grpc_stream_t    *stream;
+
+    unsigned                   ssl:1;
+    unsigned                   ready:1;
+    unsigned                   goaway:1;
+    unsigned                   eof:1;
+};
+
+
+typedef struct {
+    ngx_http_grpc_srv_conf_t  *conf;
+    ngx_http_request_t        *request;
+    ngx_http_grpc_stream_t    *stream;
+
+    void                      *data;
+
+    ngx_event_get_peer_pt      original_get_peer;
+    ngx_event_free_peer_pt     original_free_peer;
+} ngx_http_grpc_mux_peer_data_t;
+
+
 static ngx_int_t ngx_http_grpc_eval(ngx_http_request_t *r,
-    ngx_http_grpc_ctx_t *ctx, ngx_http_grpc_loc_conf_t *glcf);
+    ngx_str_t *host, ngx_http_grpc_loc_conf_t *glcf);
 static ngx_int_t ngx_http_grpc_create_request(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_grpc_method_indexed(ngx_str_t *method);
 static ngx_int_t ngx_http_grpc_reinit_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_grpc_body_output_filter(void *data, ngx_chain_t *in);
 static ngx_int_t ngx_http_grpc_process_header(ngx_http_request_t *r);
@@ -190,10 +286,62 @@ static void ngx_http_grpc_abort_request(ngx_http_request_t *r);
 static void ngx_http_grpc_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
 
+static ngx_int_t ngx_http_grpc_init_multiplex(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_grpc_init_multiplex_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_grpc_get_multiplex_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_grpc_free_multiplex_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_int_t ngx_http_grpc_mux_connect(ngx_http_request_t *r,
+    ngx_peer_connection_t *pc, ngx_http_grpc_srv_conf_t *conf,
+    ngx_str_t *ssl_name, ngx_http_grpc_mux_t **muxp);
+static void ngx_http_grpc_mux_connect_handler(ngx_event_t *ev);
+#if (NGX_HTTP_SSL)
+static void ngx_http_grpc_mux_ssl_handshake_handler(ngx_connection_t *c);
+#endif
+static void ngx_http_grpc_mux_init(ngx_http_grpc_mux_t *mux);
+static void ngx_http_grpc_mux_read_handler(ngx_event_t *rev);
+static void ngx_http_grpc_mux_write_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_grpc_mux_process(ngx_http_grpc_mux_t *mux,
+    u_char *p, size_t size);
+static ngx_int_t ngx_http_grpc_mux_frame_start(ngx_http_grpc_mux_t *mux);
+static ngx_int_t ngx_http_grpc_mux_frame_end(ngx_http_grpc_mux_t *mux);
+static ngx_int_t ngx_http_grpc_mux_settings(ngx_http_grpc_mux_t *mux);
+static ngx_int_t ngx_http_grpc_mux_window_update(ngx_http_grpc_mux_t *mux);
+static ngx_int_t ngx_http_grpc_mux_goaway(ngx_http_grpc_mux_t *mux);
+static ngx_int_t ngx_http_grpc_mux_send_frame(ngx_http_grpc_mux_t *mux,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid, u_char *payload,
+    size_t len);
+static ngx_int_t ngx_http_grpc_mux_queue(ngx_http_grpc_mux_t *mux, u_char *p,
+    size_t size);
+static ngx_buf_t *ngx_http_grpc_mux_get_buf(ngx_http_grpc_mux_t *mux);
+static ngx_int_t ngx_http_grpc_mux_send(ngx_http_grpc_mux_t *mux);
+static void ngx_http_grpc_mux_close(ngx_http_grpc_mux_t *mux);
+static u_char *ngx_http_grpc_mux_log_error(ngx_log_t *log, u_char *buf,
+    size_t len);
+static ngx_http_grpc_stream_t *ngx_http_grpc_mux_create_stream(
+    ngx_http_grpc_mux_t *mux, ngx_log_t *log);
+static ngx_int_t ngx_http_grpc_mux_open_stream(ngx_http_request_t *r,
+    ngx_http_grpc_ctx_t *ctx, ngx_http_grpc_stream_t *stream);
+static ngx_http_grpc_stream_t *ngx_http_grpc_mux_find_stream(
+    ngx_http_grpc_mux_t *mux, ngx_uint_t id);
+static ngx_int_t ngx_http_grpc_mux_stream_input(
+    ngx_http_grpc_stream_t *stream, u_char *p, size_t size);
+static void ngx_http_grpc_mux_fail_stream(ngx_http_grpc_stream_t *stream);
+static void ngx_http_grpc_mux_close_stream(ngx_http_grpc_stream_t *stream,
+    ngx_uint_t reset);
+static ssize_t ngx_http_grpc_mux_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ngx_chain_t *ngx_http_grpc_mux_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+
 static ngx_int_t ngx_http_grpc_internal_trailers_variable(
     ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
 
 static ngx_int_t ngx_http_grpc_add_variables(ngx_conf_t *cf);
+static void *ngx_http_grpc_create_srv_conf(ngx_conf_t *cf);
 static void *ngx_http_grpc_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_grpc_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -203,6 +351,8 @@ static ngx_int_t ngx_http_grpc_init_headers(ngx_conf_t *cf,
 
 static char *ngx_http_grpc_pass(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_grpc_multiplex(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 #if (NGX_HTTP_SSL)
 static char *ngx_http_grpc_ssl_password_file(ngx_conf_t *cf,
@@ -260,6 +410,13 @@ static ngx_command_t  ngx_http_grpc_commands[] = {
       0,
       NULL },
 
+    { ngx_string("multiplex"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      ngx_http_grpc_multiplex,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("grpc_bind"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
       ngx_http_upstream_bind_set_slot,
@@ -464,7 +621,7 @@ static ngx_http_module_t  ngx_http_grpc_module_ctx = {
     NULL,                                  /* create main configuration */
     NULL,                                  /* init main configuration */
 
-    NULL,                                  /* create server configuration */
+    ngx_http_grpc_create_srv_conf,         /* create server configuration */
     NULL,                                  /* merge server configuration */
 
     ngx_http_grpc_create_loc_conf,         /* create location configuration */
@@ -539,29 +696,20 @@ static ngx_int_t
 ngx_http_grpc_handler(ngx_http_request_t *r)
 {
     ngx_int_t                  rc;
+    ngx_str_t                  host;
     ngx_http_upstream_t       *u;
-    ngx_http_grpc_ctx_t       *ctx;
     ngx_http_grpc_loc_conf_t  *glcf;
 
     if (ngx_http_upstream_create(r) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_grpc_ctx_t));
-    if (ctx == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
-
-    ctx->request = r;
-
-    ngx_http_set_ctx(r, ctx, ngx_http_grpc_module);
-
     glcf = ngx_http_get_module_loc_conf(r, ngx_http_grpc_module);
 
     u = r->upstream;
 
     if (glcf->grpc_lengths == NULL) {
-        ctx->host = glcf->host;
+        host = glcf->host;
 
 #if (NGX_HTTP_SSL)
         u->ssl = glcf->ssl;
@@ -577,7 +725,7 @@ ngx_http_grpc_handler(ngx_http_request_t *r)
 #endif
 
     } else {
-        if (ngx_http_grpc_eval(r, ctx, glcf) != NGX_OK) {
+        if (ngx_http_grpc_eval(r, &host, glcf) != NGX_OK) {
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
     }
@@ -586,15 +734,12 @@ ngx_http_grpc_handler(ngx_http_request_t *r)
 
     u->conf = &glcf->upstream;
 
-    u->create_request = ngx_http_grpc_create_request;
-    u->reinit_request = ngx_http_grpc_reinit_request;
-    u->process_header = ngx_http_grpc_process_header;
-    u->abort_request = ngx_http_grpc_abort_request;
-    u->finalize_request = ngx_http_grpc_finalize_request;
-
-    u->input_filter_init = ngx_http_grpc_filter_init;
-    u->input_filter = ngx_http_grpc_filter;
-    u->input_filter_ctx = ctx;
+    if (ngx_http_grpc_init_upstream(r, &glcf->headers,
+                                    glcf->host_set ? NULL : &host)
+        != NGX_OK)
+    {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
 
     r->request_body_no_buffering = 1;
 
@@ -608,8 +753,48 @@ ngx_http_grpc_handler(ngx_http_request_t *r)
 }
 
 
+ngx_int_t
+ngx_http_grpc_init_upstream(ngx_http_request_t *r,
+    ngx_http_grpc_headers_t *headers, ngx_str_t *host)
+{
+    ngx_http_upstream_t  *u;
+    ngx_http_grpc_ctx_t  *ctx;
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_grpc_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->request = r;
+    ctx->headers = headers;
+
+    if (host) {
+        ctx->host = *host;
+
+    } else {
+        ctx->host_set = 1;
+    }
+
+    ngx_http_set_ctx(r, ctx, ngx_http_grpc_module);
+
+    u = r->upstream;
+
+    u->create_request = ngx_http_grpc_create_request;
+    u->reinit_request = ngx_http_grpc_reinit_request;
+    u->process_header = ngx_http_grpc_process_header;
+    u->abort_request = ngx_http_grpc_abort_request;
+    u->finalize_request = ngx_http_grpc_finalize_request;
+
+    u->input_filter_init = ngx_http_grpc_filter_init;
+    u->input_filter = ngx_http_grpc_filter;
+    u->input_filter_ctx = ctx;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
-ngx_http_grpc_eval(ngx_http_request_t *r, ngx_http_grpc_ctx_t *ctx,
+ngx_http_grpc_eval(ngx_http_request_t *r, ngx_str_t *host,
     ngx_http_grpc_loc_conf_t *glcf)
 {
     size_t                add;
@@ -690,15 +875,15 @@ ngx_http_grpc_eval(ngx_http_request_t *r, ngx_http_grpc_ctx_t *ctx,
     if (url.family != AF_UNIX) {
 
         if (url.no_port) {
-            ctx->host = url.host;
+            *host = url.host;
 
         } else {
-            ctx->host.len = url.host.len + 1 + url.port_text.len;
-            ctx->host.data = url.host.data;
+            host->len = url.host.len + 1 + url.port_text.len;
+            host->data = url.host.data;
         }
 
     } else {
-        ngx_str_set(&ctx->host, "localhost");
+        ngx_str_set(host, "localhost");
     }
 
     return NGX_OK;
@@ -707,6 +892,14 @@ ngx_http_grpc_eval(ngx_http_request_t *r, ngx_http_grpc_ctx_t *ctx,
 
 static ngx_int_t
 ngx_http_grpc_create_request(ngx_http_request_t *r)
+{
+    return ngx_http_grpc_create_upstream_request(r, NULL, NULL);
+}
+
+
+ngx_int_t
+ngx_http_grpc_create_upstream_request(ngx_http_request_t *r,
+    ngx_str_t *method, ngx_str_t *path)
 {
     u_char                       *p, *tmp, *key_tmp, *val_tmp, *headers_frame;
     size_t                        len, tmp_len, key_len, val_len, uri_len;
@@ -720,28 +913,36 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
     ngx_http_upstream_t          *u;
     ngx_http_grpc_frame_t        *f;
     ngx_http_script_code_pt       code;
-    ngx_http_grpc_loc_conf_t     *glcf;
+    ngx_http_grpc_headers_t      *headers;
     ngx_http_script_engine_t      e, le;
     ngx_http_script_len_code_pt   lcode;
 
     u = r->upstream;
 
-    glcf = ngx_http_get_module_loc_conf(r, ngx_http_grpc_module);
-
     ctx = ngx_http_get_module_ctx(r, ngx_http_grpc_module);
 
+    headers = ctx->headers;
+
+    if (method == NULL) {
+        method = &r->method_name;
+    }
+
+    if (path == NULL && r->valid_unparsed_uri) {
+        path = &r->unparsed_uri;
+    }
+
     len = sizeof(ngx_http_grpc_connection_start) - 1
           + sizeof(ngx_http_grpc_frame_t);             /* headers frame */
 
     /* :method header */
 
-    if (r->method == NGX_HTTP_GET || r->method == NGX_HTTP_POST) {
+    if (ngx_http_grpc_method_indexed(method)) {
         len += 1;
         tmp_len = 0;
 
     } else {
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->method_name.len;
-        tmp_len = r->method_name.len;
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + method->len;
+        tmp_len = method->len;
     }
 
     /* :scheme header */
@@ -750,9 +951,9 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 
     /* :path header */
 
-    if (r->valid_unparsed_uri) {
+    if (path) {
         escape = 0;
-        uri_len = r->unparsed_uri.len;
+        uri_len = path->len;
 
     } else {
         escape = 2 * ngx_escape_uri(NULL, r->uri.data, r->uri.len,
@@ -768,7 +969,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 
     /* :authority header */
 
-    if (!glcf->host_set) {
+    if (!ctx->host_set) {
         len += 1 + NGX_HTTP_V2_INT_OCTETS + ctx->host.len;
 
         if (tmp_len < ctx->host.len) {
@@ -778,10 +979,10 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 
     /* other headers */
 
-    ngx_http_script_flush_no_cacheable_variables(r, glcf->headers.flushes);
+    ngx_http_script_flush_no_cacheable_variables(r, headers->flushes);
     ngx_memzero(&le, sizeof(ngx_http_script_engine_t));
 
-    le.ip = glcf->headers.lengths->elts;
+    le.ip = headers->lengths->elts;
     le.request = r;
     le.flushed = 1;
 
@@ -811,7 +1012,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
         }
     }
 
-    if (glcf->upstream.pass_request_headers) {
+    if (u->conf->pass_request_headers) {
         part = &r->headers_in.headers.part;
         header = part->elts;
 
@@ -827,7 +1028,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
                 i = 0;
             }
 
-            if (ngx_hash_find(&glcf->headers.hash, header[i].hash,
+            if (ngx_hash_find(&headers->hash, header[i].hash,
                               header[i].lowcase_key, header[i].key.len))
             {
                 continue;
@@ -895,25 +1096,29 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
     f->stream_id_2 = 0;
     f->stream_id_3 = 1;
 
-    if (r->method == NGX_HTTP_GET) {
+    switch (ngx_http_grpc_method_indexed(method)) {
+
+    case NGX_HTTP_GET:
         *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_METHOD_GET_INDEX);
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "grpc header: \":method: GET\"");
+        break;
 
-    } else if (r->method == NGX_HTTP_POST) {
+    case NGX_HTTP_POST:
         *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_METHOD_POST_INDEX);
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "grpc header: \":method: POST\"");
+        break;
 
-    } else {
+    default:
         *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_METHOD_INDEX);
-        b->last = ngx_http_v2_write_value(b->last, r->method_name.data,
-                                          r->method_name.len, tmp);
+        b->last = ngx_http_v2_write_value(b->last, method->data,
+                                          method->len, tmp);
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "grpc header: \":method: %V\"", &r->method_name);
+                       "grpc header: \":method: %V\"", method);
     }
 
 #if (NGX_HTTP_SSL)
@@ -931,19 +1136,19 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
                        "grpc header: \":scheme: http\"");
     }
 
-    if (r->valid_unparsed_uri) {
+    if (path) {
 
-        if (r->unparsed_uri.len == 1 && r->unparsed_uri.data[0] == '/') {
+        if (path->len == 1 && path->data[0] == '/') {
             *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_PATH_ROOT_INDEX);
 
         } else {
             *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_PATH_INDEX);
-            b->last = ngx_http_v2_write_value(b->last, r->unparsed_uri.data,
-                                              r->unparsed_uri.len, tmp);
+            b->last = ngx_http_v2_write_value(b->last, path->data,
+                                              path->len, tmp);
         }
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "grpc header: \":path: %V\"", &r->unparsed_uri);
+                       "grpc header: \":path: %V\"", path);
 
     } else if (escape || r->args.len > 0) {
         p = val_tmp;
@@ -976,7 +1181,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
                        "grpc header: \":path: %V\"", &r->uri);
     }
 
-    if (!glcf->host_set) {
+    if (!ctx->host_set) {
         *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_AUTHORITY_INDEX);
         b->last = ngx_http_v2_write_value(b->last, ctx->host.data,
                                           ctx->host.len, tmp);
@@ -987,11 +1192,11 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
-    e.ip = glcf->headers.values->elts;
+    e.ip = headers->values->elts;
     e.request = r;
     e.flushed = 1;
 
-    le.ip = glcf->headers.lengths->elts;
+    le.ip = headers->lengths->elts;
 
     while (*(uintptr_t *) le.ip) {
 
@@ -1047,7 +1252,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 #endif
     }
 
-    if (glcf->upstream.pass_request_headers) {
+    if (u->conf->pass_request_headers) {
         part = &r->headers_in.headers.part;
         header = part->elts;
 
@@ -1063,7 +1268,7 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
                 i = 0;
             }
 
-            if (ngx_hash_find(&glcf->headers.hash, header[i].hash,
+            if (ngx_hash_find(&headers->hash, header[i].hash,
                               header[i].lowcase_key, header[i].key.len))
             {
                 continue;
@@ -1193,6 +1398,21 @@ ngx_http_grpc_create_request(ngx_http_request_t *r)
 }
 
 
+static ngx_uint_t
+ngx_http_grpc_method_indexed(ngx_str_t *method)
+{
+    if (method->len == 3 && ngx_strncmp(method->data, "GET", 3) == 0) {
+        return NGX_HTTP_GET;
+    }
+
+    if (method->len == 4 && ngx_strncmp(method->data, "POST", 4) == 0) {
+        return NGX_HTTP_POST;
+    }
+
+    return 0;
+}
+
+
 static ngx_int_t
 ngx_http_grpc_reinit_request(ngx_http_request_t *r)
 {
@@ -1262,10 +1482,10 @@ ngx_http_grpc_body_output_filter(void *data, ngx_chain_t *in)
 
         ctx->header_sent = 1;
 
-        if (ctx->id != 1) {
+        if (ctx->id != 1 || ctx->connection->shared) {
             /*
-             * keepalive connection: skip connection preface,
-             * update stream identifiers
+             * keepalive or multiplexed connection: skip connection
+             * preface, update stream identifiers
              */
 
             b = ctx->in->buf;
@@ -2092,19 +2312,29 @@ ngx_http_grpc_filter(void *data, ssize_t bytes)
                     return NGX_ERROR;
                 }
 
-                if (ctx->rest > ctx->connection->recv_window) {
-                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                  "upstream violated connection flow control, "
-                                  "received %uz data frame with window %uz",
-                                  ctx->rest, ctx->connection->recv_window);
-                    return NGX_ERROR;
+                /*
+                 * connection window of a multiplexed connection
+                 * is maintained by the connection itself
+                 */
+
+                if (!ctx->connection->shared) {
+
+                    if (ctx->rest > ctx->connection->recv_window) {
+                        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                      "upstream violated connection flow "
+                                      "control, received %uz data frame "
+                                      "with window %uz",
+                                      ctx->rest, ctx->connection->recv_window);
+                        return NGX_ERROR;
+                    }
+
+                    ctx->connection->recv_window -= ctx->rest;
                 }
 
                 ctx->recv_window -= ctx->rest;
-                ctx->connection->recv_window -= ctx->rest;
 
                 if (ctx->connection->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4
-                    || ctx->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4)
+                    || ctx->recv_window < ctx->connection->stream_window / 4)
                 {
                     if (ngx_http_grpc_send_window_update(r, ctx) != NGX_OK) {
                         return NGX_ERROR;
@@ -4078,26 +4308,28 @@ ngx_http_grpc_send_window_update(ngx_http_request_t *r,
         return NGX_ERROR;
     }
 
-    f = (ngx_http_grpc_frame_t *) cl->buf->last;
-    cl->buf->last += sizeof(ngx_http_grpc_frame_t);
+    if (!ctx->connection->shared) {
+        f = (ngx_http_grpc_frame_t *) cl->buf->last;
+        cl->buf->last += sizeof(ngx_http_grpc_frame_t);
 
-    f->length_0 = 0;
-    f->length_1 = 0;
-    f->length_2 = 4;
-    f->type = NGX_HTTP_V2_WINDOW_UPDATE_FRAME;
-    f->flags = 0;
-    f->stream_id_0 = 0;
-    f->stream_id_1 = 0;
-    f->stream_id_2 = 0;
-    f->stream_id_3 = 0;
+        f->length_0 = 0;
+        f->length_1 = 0;
+        f->length_2 = 4;
+        f->type = NGX_HTTP_V2_WINDOW_UPDATE_FRAME;
+        f->flags = 0;
+        f->stream_id_0 = 0;
+        f->stream_id_1 = 0;
+        f->stream_id_2 = 0;
+        f->stream_id_3 = 0;
 
-    n = NGX_HTTP_V2_MAX_WINDOW - ctx->connection->recv_window;
-    ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+        n = NGX_HTTP_V2_MAX_WINDOW - ctx->connection->recv_window;
+        ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
 
-    *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
-    *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
-    *cl->buf->last++ = (u_char) ((n >> 8) & 0xff);
-    *cl->buf->last++ = (u_char) (n & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
+        *cl->buf->last++ = (u_char) ((n >> 8) & 0xff);
+        *cl->buf->last++ = (u_char) (n & 0xff);
+    }
 
     f = (ngx_http_grpc_frame_t *) cl->buf->last;
     cl->buf->last += sizeof(ngx_http_grpc_frame_t);
@@ -4112,8 +4344,8 @@ ngx_http_grpc_send_window_update(ngx_http_request_t *r,
     f->stream_id_2 = (u_char) ((ctx->id >> 8) & 0xff);
     f->stream_id_3 = (u_char) (ctx->id & 0xff);
 
-    n = NGX_HTTP_V2_MAX_WINDOW - ctx->recv_window;
-    ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    n = ctx->connection->stream_window - ctx->recv_window;
+    ctx->recv_window = ctx->connection->stream_window;
 
     *cl->buf->last++ = (u_char) ((n >> 24) & 0xff);
     *cl->buf->last++ = (u_char) ((n >> 16) & 0xff);
@@ -4199,6 +4431,11 @@ ngx_http_grpc_get_connection_data(ngx_http_request_t *r,
 
     c = pc->connection;
 
+    if (c->send_chain == ngx_http_grpc_mux_send_chain) {
+        return ngx_http_grpc_mux_open_stream(r, ctx,
+                                             (ngx_http_grpc_stream_t *) c);
+    }
+
     if (pc->cached) {
 
         /*
@@ -4221,7 +4458,7 @@ ngx_http_grpc_get_connection_data(ngx_http_request_t *r,
         }
 
         ctx->send_window = ctx->connection->init_window;
-        ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+        ctx->recv_window = ctx->connection->stream_window;
 
         ctx->connection->last_stream_id += 2;
         ctx->id = ctx->connection->last_stream_id;
@@ -4240,6 +4477,8 @@ ngx_http_grpc_get_connection_data(ngx_http_request_t *r,
     ctx->connection->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->connection->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->connection->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    ctx->connection->stream_window = NGX_HTTP_V2_MAX_WINDOW;
+    ctx->connection->shared = 0;
 
     ctx->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
     ctx->recv_window = NGX_HTTP_V2_MAX_WINDOW;
@@ -4281,107 +4520,1838 @@ ngx_http_grpc_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 
 
 static ngx_int_t
-ngx_http_grpc_internal_trailers_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
+ngx_http_grpc_init_multiplex(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_table_elt_t  *te;
+    ngx_http_grpc_srv_conf_t  *gscf;
 
-    te = r->headers_in.te;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init grpc multiplex");
 
-    if (te == NULL) {
-        v->not_found = 1;
-        return NGX_OK;
+    gscf = ngx_http_conf_upstream_srv_conf(us, ngx_http_grpc_module);
+
+    if (us->peer.init_upstream != ngx_http_grpc_init_multiplex) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "\"multiplex\" must be the last balancing directive "
+                      "in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
     }
 
-    if (ngx_strlcasestrn(te->value.data, te->value.data + te->value.len,
-                         (u_char *) "trailers", 8 - 1)
-        == NULL)
-    {
-        v->not_found = 1;
-        return NGX_OK;
+    ngx_conf_init_size_value(gscf->window, 65536);
+    ngx_conf_init_msec_value(gscf->timeout, 60000);
+
+    if (gscf->original_init_upstream(cf, us) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+    gscf->original_init_peer = us->peer.init;
 
-    v->data = (u_char *) "trailers";
-    v->len = sizeof("trailers") - 1;
+    us->peer.init = ngx_http_grpc_init_multiplex_peer;
+
+    ngx_queue_init(&gscf->connections);
 
     return NGX_OK;
 }
 
 
 static ngx_int_t
-ngx_http_grpc_add_variables(ngx_conf_t *cf)
+ngx_http_grpc_init_multiplex_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_http_variable_t  *var, *v;
+    ngx_http_upstream_t            *u;
+    ngx_http_grpc_srv_conf_t       *gscf;
+    ngx_http_grpc_mux_peer_data_t  *mp;
 
-    for (v = ngx_http_grpc_vars; v->name.len; v++) {
-        var = ngx_http_add_variable(cf, &v->name, v->flags);
-        if (var == NULL) {
-            return NGX_ERROR;
-        }
+    gscf = ngx_http_conf_upstream_srv_conf(us, ngx_http_grpc_module);
 
-        var->get_handler = v->get_handler;
-        var->data = v->data;
+    if (gscf->original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    return NGX_OK;
-}
+    u = r->upstream;
 
+    /*
+     * only http/2 requests are multiplexed; streams use fake events
+     * which are never added to the event method, so the method must
+     * not require events to be deleted once they are reported
+     */
 
-static void *
-ngx_http_grpc_create_loc_conf(ngx_conf_t *cf)
-{
-    ngx_http_grpc_loc_conf_t  *conf;
+    if (u->input_filter != ngx_http_grpc_filter
+        || !(ngx_event_flags & NGX_USE_CLEAR_EVENT))
+    {
+        return NGX_OK;
+    }
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_grpc_loc_conf_t));
-    if (conf == NULL) {
-        return NULL;
+#if (NGX_HTTP_SSL)
+
+    if (u->ssl
+        && u->conf->ssl_certificate
+        && u->conf->ssl_certificate->value.len
+        && (u->conf->ssl_certificate->lengths
+            || u->conf->ssl_certificate_key->lengths))
+    {
+        /* per-request client certificates cannot share a connection */
+        return NGX_OK;
     }
 
-    /*
-     * set by ngx_pcalloc():
-     *
-     *     conf->upstream.ignore_headers = 0;
-     *     conf->upstream.next_upstream = 0;
-     *     conf->upstream.hide_headers_hash = { NULL, 0 };
-     *
-     *     conf->headers.lengths = NULL;
-     *     conf->headers.values = NULL;
-     *     conf->headers.hash = { NULL, 0 };
-     *     conf->host = { 0, NULL };
-     *     conf->host_set = 0;
-     *     conf->ssl = 0;
-     *     conf->ssl_protocols = 0;
-     *     conf->ssl_ciphers = { 0, NULL };
-     *     conf->ssl_trusted_certificate = { 0, NULL };
-     *     conf->ssl_crl = { 0, NULL };
-     */
+#endif
 
-    conf->upstream.local = NGX_CONF_UNSET_PTR;
-    conf->upstream.socket_keepalive = NGX_CONF_UNSET;
-    conf->upstream.next_upstream_tries = NGX_CONF_UNSET_UINT;
-    conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.next_upstream_timeout = NGX_CONF_UNSET_MSEC;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init grpc multiplex peer");
 
-    conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
+    mp = ngx_palloc(r->pool, sizeof(ngx_http_grpc_mux_peer_data_t));
+    if (mp == NULL) {
+        return NGX_ERROR;
+    }
 
-    conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
-    conf->upstream.pass_headers = NGX_CONF_UNSET_PTR;
+    mp->conf = gscf;
+    mp->request = r;
+    mp->stream = NULL;
+    mp->data = u->peer.data;
+    mp->original_get_peer = u->peer.get;
+    mp->original_free_peer = u->peer.free;
 
-    conf->upstream.intercept_errors = NGX_CONF_UNSET;
+    u->peer.data = mp;
+    u->peer.get = ngx_http_grpc_get_multiplex_peer;
+    u->peer.free = ngx_http_grpc_free_multiplex_peer;
 
-#if (NGX_HTTP_SSL)
-    conf->upstream.ssl_session_reuse = NGX_CONF_UNSET;
-    conf->upstream.ssl_name = NGX_CONF_UNSET_PTR;
-    conf->upstream.ssl_server_name = NGX_CONF_UNSET;
-    conf->upstream.ssl_verify = NGX_CONF_UNSET;
-    conf->ssl_verify_depth = NGX_CONF_UNSET_UINT;
-    conf->upstream.ssl_certificate = NGX_CONF_UNSET_PTR;
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_get_multiplex_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_grpc_mux_peer_data_t  *mp = data;
+
+    ngx_int_t                rc;
+    ngx_str_t                name;
+    ngx_queue_t             *q;
+    ngx_http_request_t      *r;
+    ngx_http_upstream_t     *u;
+    ngx_http_grpc_mux_t     *mux;
+    ngx_http_grpc_stream_t  *stream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get grpc multiplex peer");
+
+    /* ask balancer */
+
+    rc = mp->original_get_peer(pc, mp->data);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r = mp->request;
+    u = r->upstream;
+
+    ngx_str_null(&name);
+
+#if (NGX_HTTP_SSL)
+
+    if (u->ssl && (u->conf->ssl_server_name || u->conf->ssl_verify)) {
+
+        if (u->conf->ssl_name) {
+            if (ngx_http_complex_value(r, u->conf->ssl_name, &name)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+        } else {
+            name = u->ssl_name;
+        }
+    }
+
+#endif
+
+    /* search for a connection with a free stream slot */
+
+    for (q = ngx_queue_head(&mp->conf->connections);
+         q != ngx_queue_sentinel(&mp->conf->connections);
+         q = ngx_queue_next(q))
+    {
+        mux = ngx_queue_data(q, ngx_http_grpc_mux_t, queue);
+
+        if (mux->goaway
+            || mux->nstreams >= mux->max_streams
+            || mux->upstream != u->conf
+            || ngx_memn2cmp((u_char *) &mux->sockaddr, (u_char *) pc->sockaddr,
+                            mux->socklen, pc->socklen)
+               != 0)
+        {
+            continue;
+        }
+
+#if (NGX_HTTP_SSL)
+
+        if (mux->ssl != u->ssl
+            || ngx_memn2cmp(mux->ssl_name.data, name.data,
+                            mux->ssl_name.len, name.len)
+               != 0)
+        {
+            continue;
+        }
+
+#endif
+
+        goto found;
+    }
+
+    rc = ngx_http_grpc_mux_connect(r, pc, mp->conf, &name, &mux);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    pc->cached = 0;
+
+    goto stream;
+
+found:
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get grpc multiplex peer: using connection %p, "
+                   "streams: %ui", mux->connection, mux->nstreams);
+
+    pc->cached = 1;
+
+stream:
+
+    stream = ngx_http_grpc_mux_create_stream(mux, pc->log);
+
+    if (stream == NULL) {
+        if (mux->nstreams == 0) {
+            ngx_http_grpc_mux_close(mux);
+        }
+
+        return NGX_ERROR;
+    }
+
+    mp->stream = stream;
+    pc->connection = &stream->connection;
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_grpc_free_multiplex_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_grpc_mux_peer_data_t  *mp = data;
+
+    ngx_http_upstream_t  *u;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free grpc multiplex peer");
+
+    if (mp->stream) {
+        u = mp->request->upstream;
+
+        ngx_http_grpc_mux_close_stream(mp->stream, !u->keepalive);
+
+        mp->stream = NULL;
+        pc->connection = NULL;
+    }
+
+    mp->original_free_peer(pc, mp->data, state);
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_connect(ngx_http_request_t *r, ngx_peer_connection_t *pc,
+    ngx_http_grpc_srv_conf_t *conf, ngx_str_t *ssl_name,
+    ngx_http_grpc_mux_t **muxp)
+{
+    u_char               *p, preface[sizeof(ngx_http_grpc_connection_start)];
+    ngx_int_t             rc;
+    ngx_pool_t           *pool;
+    ngx_connection_t     *c;
+    ngx_http_upstream_t  *u;
+    ngx_http_grpc_mux_t  *mux;
+
+    u = r->upstream;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    mux = ngx_pcalloc(pool, sizeof(ngx_http_grpc_mux_t));
+    if (mux == NULL) {
+        goto failed;
+    }
+
+    mux->conf = conf;
+    mux->upstream = u->conf;
+    mux->pool = pool;
+
+    mux->log = *ngx_cycle->log;
+    mux->log.handler = ngx_http_grpc_mux_log_error;
+    mux->log.data = mux;
+    mux->log.action = "connecting to upstream";
+
+    pool->log = &mux->log;
+
+    ngx_memcpy(&mux->sockaddr, pc->sockaddr, pc->socklen);
+    mux->socklen = pc->socklen;
+
+    mux->name.data = ngx_pstrdup(pool, pc->name);
+    if (mux->name.data == NULL) {
+        goto failed;
+    }
+
+    mux->name.len = pc->name->len;
+
+#if (NGX_HTTP_SSL)
+
+    mux->ssl = u->ssl;
+
+    if (ssl_name->len) {
+        mux->ssl_name.data = ngx_pstrdup(pool, ssl_name);
+        if (mux->ssl_name.data == NULL) {
+            goto failed;
+        }
+
+        mux->ssl_name.len = ssl_name->len;
+    }
+
+#endif
+
+    ngx_queue_init(&mux->streams);
+
+    mux->max_streams = conf->streams;
+    mux->next_id = 1;
+
+    mux->conn.init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    mux->conn.send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    mux->conn.recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    mux->conn.stream_window = conf->window;
+    mux->conn.shared = 1;
+
+    mux->buffer = ngx_palloc(pool, NGX_HTTP_GRPC_MUX_BUFFER_SIZE);
+    if (mux->buffer == NULL) {
+        goto failed;
+    }
+
+    mux->payload = ngx_palloc(pool, NGX_HTTP_V2_DEFAULT_FRAME_SIZE);
+    if (mux->payload == NULL) {
+        goto failed;
+    }
+
+    /* connection preface with the configured stream window */
+
+    ngx_memcpy(preface, ngx_http_grpc_connection_start,
+               sizeof(ngx_http_grpc_connection_start) - 1);
+
+    p = preface + sizeof("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") - 1
+        + sizeof(ngx_http_grpc_frame_t) + 2 * 6 + 2;
+
+    (void) ngx_http_v2_write_uint32(p, conf->window);
+
+    if (ngx_http_grpc_mux_queue(mux, preface,
+                                sizeof(ngx_http_grpc_connection_start) - 1)
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    mux->peer.sockaddr = (struct sockaddr *) &mux->sockaddr;
+    mux->peer.socklen = mux->socklen;
+    mux->peer.name = &mux->name;
+    mux->peer.get = ngx_event_get_peer;
+    mux->peer.log = &mux->log;
+    mux->peer.log_error = pc->log_error;
+    mux->peer.local = pc->local;
+    mux->peer.type = pc->type;
+    mux->peer.rcvbuf = pc->rcvbuf;
+    mux->peer.so_keepalive = pc->so_keepalive;
+    mux->peer.transparent = pc->transparent;
+
+    rc = ngx_event_connect_peer(&mux->peer);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "grpc multiplex connect: %i", rc);
+
+    if (rc != NGX_OK && rc != NGX_AGAIN) {
+        ngx_destroy_pool(pool);
+        return rc;
+    }
+
+    c = mux->peer.connection;
+
+    c->data = mux;
+    c->pool = pool;
+    c->log = &mux->log;
+    c->read->log = &mux->log;
+    c->write->log = &mux->log;
+
+    c->read->handler = ngx_http_grpc_mux_connect_handler;
+    c->write->handler = ngx_http_grpc_mux_connect_handler;
+
+    mux->connection = c;
+
+#if (NGX_HTTP_SSL)
+
+    if (mux->ssl) {
+        if (ngx_ssl_create_connection(u->conf->ssl, c,
+                                      NGX_SSL_BUFFER|NGX_SSL_CLIENT)
+            != NGX_OK)
+        {
+            goto close;
+        }
+
+        if (u->conf->ssl_server_name || u->conf->ssl_verify) {
+            if (ngx_http_upstream_ssl_name(r, u, c) != NGX_OK) {
+                goto close;
+            }
+
+            mux->ssl_host.data = ngx_pstrdup(pool, &u->ssl_name);
+            if (mux->ssl_host.data == NULL) {
+                goto close;
+            }
+
+            mux->ssl_host.len = u->ssl_name.len;
+        }
+    }
+
+#endif
+
+    ngx_queue_insert_head(&conf->connections, &mux->queue);
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, u->conf->connect_timeout);
+
+    } else {
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+
+    *muxp = mux;
+
+    return NGX_OK;
+
+#if (NGX_HTTP_SSL)
+
+close:
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        (void) ngx_ssl_shutdown(c);
+    }
+
+    ngx_close_connection(c);
+
+#endif
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_grpc_mux_connect_handler(ngx_event_t *ev)
+{
+    ngx_err_t             err;
+    socklen_t             len;
+    ngx_connection_t     *c;
+    ngx_http_grpc_mux_t  *mux;
+
+    c = ev->data;
+    mux = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "grpc multiplex connect handler");
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT, "upstream timed out");
+        ngx_http_grpc_mux_close(mux);
+        return;
+    }
+
+    if (!ev->write) {
+        /* read events are handled once the connection is established */
+        return;
+    }
+
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
+    err = 0;
+    len = sizeof(ngx_err_t);
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+        err = ngx_socket_errno;
+    }
+
+    if (err) {
+        (void) ngx_connection_error(c, err, "connect() failed");
+        ngx_http_grpc_mux_close(mux);
+        return;
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (mux->ssl) {
+        mux->log.action = "SSL handshaking to upstream";
+
+        if (ngx_ssl_handshake(c) == NGX_AGAIN) {
+            ngx_add_timer(c->write, mux->upstream->connect_timeout);
+            c->ssl->handler = ngx_http_grpc_mux_ssl_handshake_handler;
+            return;
+        }
+
+        ngx_http_grpc_mux_ssl_handshake_handler(c);
+        return;
+    }
+
+#endif
+
+    ngx_http_grpc_mux_init(mux);
+}
+
+
+#if (NGX_HTTP_SSL)
+
+static void
+ngx_http_grpc_mux_ssl_handshake_handler(ngx_connection_t *c)
+{
+    long                  rc;
+    ngx_http_grpc_mux_t  *mux;
+
+    mux = c->data;
+
+    if (!c->ssl->handshaked) {
+
+        if (c->write->timedout) {
+            ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                          "upstream timed out");
+        }
+
+        ngx_http_grpc_mux_close(mux);
+        return;
+    }
+
+    if (mux->upstream->ssl_verify) {
+        rc = SSL_get_verify_result(c->ssl->connection);
+
+        if (rc != X509_V_OK) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream SSL certificate verify error: (%l:%s)",
+                          rc, X509_verify_cert_error_string(rc));
+            ngx_http_grpc_mux_close(mux);
+            return;
+        }
+
+        if (ngx_ssl_check_host(c, &mux->ssl_host) != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream SSL certificate does not match \"%V\"",
+                          &mux->ssl_host);
+            ngx_http_grpc_mux_close(mux);
+            return;
+        }
+    }
+
+    ngx_http_grpc_mux_init(mux);
+}
+
+#endif
+
+
+static void
+ngx_http_grpc_mux_init(ngx_http_grpc_mux_t *mux)
+{
+    ngx_connection_t  *c;
+
+    c = mux->connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "grpc multiplex connection established");
+
+    mux->log.action = "processing http2 connection to upstream";
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->read->handler = ngx_http_grpc_mux_read_handler;
+    c->write->handler = ngx_http_grpc_mux_write_handler;
+
+    mux->ready = 1;
+
+    ngx_post_event(c->write, &ngx_posted_events);
+    ngx_post_event(c->read, &ngx_posted_events);
+}
+
+
+static void
+ngx_http_grpc_mux_read_handler(ngx_event_t *rev)
+{
+    ssize_t               n;
+    ngx_connection_t     *c;
+    ngx_http_grpc_mux_t  *mux;
+
+    c = rev->data;
+    mux = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "grpc multiplex read handler");
+
+    if (rev->timedout || c->close) {
+        /* idle timeout or graceful shutdown */
+        ngx_http_grpc_mux_close(mux);
+        return;
+    }
+
+    for ( ;; ) {
+
+        n = c->recv(c, mux->buffer, NGX_HTTP_GRPC_MUX_BUFFER_SIZE);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "grpc multiplex connection closed");
+
+            mux->eof = (n == 0);
+
+            ngx_http_grpc_mux_close(mux);
+            return;
+        }
+
+        if (ngx_http_grpc_mux_process(mux, mux->buffer, n) != NGX_OK) {
+            ngx_http_grpc_mux_close(mux);
+            return;
+        }
+    }
+
+    if (mux->goaway && mux->nstreams == 0) {
+        ngx_http_grpc_mux_close(mux);
+        return;
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_grpc_mux_close(mux);
+    }
+}
+
+
+static void
+ngx_http_grpc_mux_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t     *c;
+    ngx_http_grpc_mux_t  *mux;
+
+    c = wev->data;
+    mux = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "grpc multiplex write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT, "upstream timed out");
+        ngx_http_grpc_mux_close(mux);
+        return;
+    }
+
+    if (ngx_http_grpc_mux_send(mux) != NGX_OK) {
+        ngx_http_grpc_mux_close(mux);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_process(ngx_http_grpc_mux_t *mux, u_char *p, size_t size)
+{
+    u_char  *last;
+    size_t   n;
+
+    last = p + size;
+
+    while (p < last) {
+
+        if (mux->received < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+
+            n = ngx_min((size_t) (last - p),
+                        NGX_HTTP_V2_FRAME_HEADER_SIZE - mux->received);
+
+            ngx_memcpy(mux->head + mux->received, p, n);
+
+            mux->received += n;
+            p += n;
+
+            if (mux->received < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+                break;
+            }
+
+            if (ngx_http_grpc_mux_frame_start(mux) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+        } else {
+
+            n = ngx_min((size_t) (last - p), mux->rest);
+
+            if (mux->stream_id == 0) {
+                ngx_memcpy(mux->payload + mux->length - mux->rest, p, n);
+
+            } else if (mux->stream) {
+                if (ngx_http_grpc_mux_stream_input(mux->stream, p, n)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+
+            mux->rest -= n;
+            p += n;
+        }
+
+        if (mux->rest) {
+            continue;
+        }
+
+        mux->received = 0;
+
+        if (ngx_http_grpc_mux_frame_end(mux) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_frame_start(ngx_http_grpc_mux_t *mux)
+{
+    u_char                  *h, window[4];
+    ngx_http_grpc_stream_t  *stream;
+
+    h = mux->head;
+
+    mux->length = (h[0] << 16) + (h[1] << 8) + h[2];
+    mux->type = h[3];
+    mux->flags = h[4];
+    mux->stream_id = ngx_http_v2_parse_sid(&h[5]);
+
+    mux->rest = mux->length;
+    mux->stream = NULL;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, mux->connection->log, 0,
+                   "grpc multiplex frame: %ui, len: %uz, f:%ui, i:%ui",
+                   mux->type, mux->length, mux->flags, mux->stream_id);
+
+    if (mux->length > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                      "upstream sent too large http2 frame: %uz",
+                      mux->length);
+        return NGX_ERROR;
+    }
+
+    if (mux->stream_id == 0) {
+        return NGX_OK;
+    }
+
+    if (mux->type == NGX_HTTP_V2_DATA_FRAME) {
+
+        if (mux->length > mux->conn.recv_window) {
+            ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                          "upstream violated connection flow control, "
+                          "received %uz data frame with window %uz",
+                          mux->length, mux->conn.recv_window);
+            return NGX_ERROR;
+        }
+
+        mux->conn.recv_window -= mux->length;
+
+        if (mux->conn.recv_window < NGX_HTTP_V2_MAX_WINDOW / 4) {
+            (void) ngx_http_v2_write_uint32(window, NGX_HTTP_V2_MAX_WINDOW
+                                                    - mux->conn.recv_window);
+            mux->conn.recv_window = NGX_HTTP_V2_MAX_WINDOW;
+
+            if (ngx_http_grpc_mux_send_frame(mux,
+                                             NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                             0, 0, window, 4)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    stream = ngx_http_grpc_mux_find_stream(mux, mux->stream_id);
+
+    if (stream == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mux->connection->log, 0,
+                       "grpc multiplex skipping frame for stream %ui",
+                       mux->stream_id);
+        return NGX_OK;
+    }
+
+    if (mux->type == NGX_HTTP_V2_RST_STREAM_FRAME) {
+        stream->reset = 1;
+    }
+
+    mux->stream = stream;
+
+    return ngx_http_grpc_mux_stream_input(stream, h,
+                                          NGX_HTTP_V2_FRAME_HEADER_SIZE);
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_frame_end(ngx_http_grpc_mux_t *mux)
+{
+    mux->stream = NULL;
+
+    if (mux->stream_id) {
+        return NGX_OK;
+    }
+
+    switch (mux->type) {
+
+    case NGX_HTTP_V2_SETTINGS_FRAME:
+        return ngx_http_grpc_mux_settings(mux);
+
+    case NGX_HTTP_V2_PING_FRAME:
+
+        if (mux->flags & NGX_HTTP_V2_ACK_FLAG) {
+            return NGX_OK;
+        }
+
+        if (mux->length != 8) {
+            ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                          "upstream sent ping frame "
+                          "with invalid length: %uz",
+                          mux->length);
+            return NGX_ERROR;
+        }
+
+        return ngx_http_grpc_mux_send_frame(mux, NGX_HTTP_V2_PING_FRAME,
+                                            NGX_HTTP_V2_ACK_FLAG, 0,
+                                            mux->payload, 8);
+
+    case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+        return ngx_http_grpc_mux_window_update(mux);
+
+    case NGX_HTTP_V2_GOAWAY_FRAME:
+        return ngx_http_grpc_mux_goaway(mux);
+
+    case NGX_HTTP_V2_DATA_FRAME:
+    case NGX_HTTP_V2_HEADERS_FRAME:
+    case NGX_HTTP_V2_PRIORITY_FRAME:
+    case NGX_HTTP_V2_RST_STREAM_FRAME:
+    case NGX_HTTP_V2_PUSH_PROMISE_FRAME:
+    case NGX_HTTP_V2_CONTINUATION_FRAME:
+        ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                      "upstream sent http2 frame %ui with zero stream id",
+                      mux->type);
+        return NGX_ERROR;
+    }
+
+    /* unknown frames are ignored */
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_settings(ngx_http_grpc_mux_t *mux)
+{
+    u_char                  *p, *last;
+    ssize_t                  window_update;
+    ngx_uint_t               id, value;
+    ngx_queue_t             *q;
+    ngx_http_grpc_ctx_t     *ctx;
+    ngx_http_grpc_stream_t  *stream;
+
+    if (mux->flags & NGX_HTTP_V2_ACK_FLAG) {
+
+        if (mux->length != 0) {
+            ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                          "upstream sent settings frame "
+                          "with ack flag and non-zero length: %uz",
+                          mux->length);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    if (mux->length % 6 != 0) {
+        ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                      "upstream sent settings frame "
+                      "with invalid length: %uz",
+                      mux->length);
+        return NGX_ERROR;
+    }
+
+    last = mux->payload + mux->length;
+
+    for (p = mux->payload; p < last; p += 6) {
+        id = ngx_http_v2_parse_uint16(p);
+        value = ngx_http_v2_parse_uint32(p + 2);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, mux->connection->log, 0,
+                       "grpc multiplex setting: %ui %ui", id, value);
+
+        switch (id) {
+
+        case 0x03:
+            /* SETTINGS_MAX_CONCURRENT_STREAMS */
+
+            mux->max_streams = ngx_min(value, mux->conf->streams);
+            break;
+
+        case 0x04:
+            /* SETTINGS_INITIAL_WINDOW_SIZE */
+
+            if (value > NGX_HTTP_V2_MAX_WINDOW) {
+                ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                              "upstream sent settings frame "
+                              "with too large initial window size: %ui",
+                              value);
+                return NGX_ERROR;
+            }
+
+            window_update = value - mux->conn.init_window;
+            mux->conn.init_window = value;
+
+            for (q = ngx_queue_head(&mux->streams);
+                 q != ngx_queue_sentinel(&mux->streams);
+                 q = ngx_queue_next(q))
+            {
+                stream = ngx_queue_data(q, ngx_http_grpc_stream_t, queue);
+                ctx = stream->ctx;
+
+                if (ctx == NULL) {
+                    continue;
+                }
+
+                if (ctx->send_window > 0
+                    && window_update > (ssize_t) NGX_HTTP_V2_MAX_WINDOW
+                                       - ctx->send_window)
+                {
+                    ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                                  "upstream sent settings frame "
+                                  "with too large initial window size: %ui",
+                                  value);
+                    return NGX_ERROR;
+                }
+
+                ctx->send_window += window_update;
+
+                if (window_update > 0 && ctx->in) {
+                    ngx_post_event(&stream->write, &ngx_posted_events);
+                }
+            }
+
+            break;
+        }
+    }
+
+    return ngx_http_grpc_mux_send_frame(mux, NGX_HTTP_V2_SETTINGS_FRAME,
+                                        NGX_HTTP_V2_ACK_FLAG, 0, NULL, 0);
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_window_update(ngx_http_grpc_mux_t *mux)
+{
+    size_t                   window;
+    ngx_queue_t             *q;
+    ngx_http_grpc_stream_t  *stream;
+
+    if (mux->length != 4) {
+        ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                      "upstream sent window update frame "
+                      "with invalid length: %uz",
+                      mux->length);
+        return NGX_ERROR;
+    }
+
+    window = ngx_http_v2_parse_window(mux->payload);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mux->connection->log, 0,
+                   "grpc multiplex window update: %uz", window);
+
+    if (window > NGX_HTTP_V2_MAX_WINDOW - mux->conn.send_window) {
+        ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                      "upstream sent too large window update");
+        return NGX_ERROR;
+    }
+
+    mux->conn.send_window += window;
+
+    /* resume streams blocked by the connection window */
+
+    for (q = ngx_queue_head(&mux->streams);
+         q != ngx_queue_sentinel(&mux->streams);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_grpc_stream_t, queue);
+
+        if (stream->ctx && stream->ctx->in) {
+            ngx_post_event(&stream->write, &ngx_posted_events);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_goaway(ngx_http_grpc_mux_t *mux)
+{
+    ngx_uint_t               last, error;
+    ngx_queue_t             *q;
+    ngx_http_grpc_stream_t  *stream;
+
+    if (mux->length < 8) {
+        ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                      "upstream sent goaway frame "
+                      "with invalid length: %uz",
+                      mux->length);
+        return NGX_ERROR;
+    }
+
+    last = ngx_http_v2_parse_sid(mux->payload);
+    error = ngx_http_v2_parse_uint32(mux->payload + 4);
+
+    if (error) {
+        ngx_log_error(NGX_LOG_ERR, mux->connection->log, 0,
+                      "upstream sent goaway with error %ui, last stream %ui",
+                      error, last);
+
+    } else {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mux->connection->log, 0,
+                       "grpc multiplex goaway, last stream %ui", last);
+    }
+
+    mux->goaway = 1;
+
+    /*
+     * streams above the last stream identifier were not processed
+     * by the upstream and can be safely retried
+     */
+
+    for (q = ngx_queue_head(&mux->streams);
+         q != ngx_queue_sentinel(&mux->streams);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_grpc_stream_t, queue);
+
+        if (stream->id == 0 || stream->id > last) {
+            ngx_http_grpc_mux_fail_stream(stream);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_send_frame(ngx_http_grpc_mux_t *mux, ngx_uint_t type,
+    ngx_uint_t flags, ngx_uint_t sid, u_char *payload, size_t len)
+{
+    ngx_http_grpc_frame_t  f;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, mux->connection->log, 0,
+                   "grpc multiplex send frame: %ui, len: %uz, f:%ui, i:%ui",
+                   type, len, flags, sid);
+
+    f.length_0 = (u_char) ((len >> 16) & 0xff);
+    f.length_1 = (u_char) ((len >> 8) & 0xff);
+    f.length_2 = (u_char) (len & 0xff);
+    f.type = (u_char) type;
+    f.flags = (u_char) flags;
+    f.stream_id_0 = (u_char) ((sid >> 24) & 0xff);
+    f.stream_id_1 = (u_char) ((sid >> 16) & 0xff);
+    f.stream_id_2 = (u_char) ((sid >> 8) & 0xff);
+    f.stream_id_3 = (u_char) (sid & 0xff);
+
+    if (ngx_http_grpc_mux_queue(mux, (u_char *) &f, sizeof(f)) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    return ngx_http_grpc_mux_queue(mux, payload, len);
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_queue(ngx_http_grpc_mux_t *mux, u_char *p, size_t size)
+{
+    size_t      n;
+    ngx_buf_t  *b;
+
+    while (size) {
+
+        b = ngx_http_grpc_mux_get_buf(mux);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        n = ngx_min(size, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, p, n);
+
+        p += n;
+        size -= n;
+    }
+
+    if (mux->ready) {
+        ngx_post_event(mux->connection->write, &ngx_posted_events);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_buf_t *
+ngx_http_grpc_mux_get_buf(ngx_http_grpc_mux_t *mux)
+{
+    ngx_chain_t  *cl;
+
+    /* returns the last output buffer with some free space */
+
+    cl = mux->last;
+
+    if (cl && cl->buf->last < cl->buf->end) {
+        return cl->buf;
+    }
+
+    if (mux->free) {
+        cl = mux->free;
+        mux->free = cl->next;
+
+    } else {
+        cl = ngx_alloc_chain_link(mux->pool);
+        if (cl == NULL) {
+            return NULL;
+        }
+
+        cl->buf = ngx_create_temp_buf(mux->pool,
+                                      NGX_HTTP_GRPC_MUX_BUFFER_SIZE);
+        if (cl->buf == NULL) {
+            return NULL;
+        }
+
+        cl->buf->flush = 1;
+    }
+
+    cl->next = NULL;
+
+    if (mux->last) {
+        mux->last->next = cl;
+
+    } else {
+        mux->out = cl;
+    }
+
+    mux->last = cl;
+
+    return cl->buf;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_send(ngx_http_grpc_mux_t *mux)
+{
+    ngx_chain_t       *cl, *sent;
+    ngx_event_t       *wev;
+    ngx_connection_t  *c;
+
+    c = mux->connection;
+    wev = c->write;
+
+    if ((mux->out == NULL && !c->buffered) || !wev->ready) {
+        return NGX_OK;
+    }
+
+    sent = c->send_chain(c, mux->out, 0);
+
+    if (sent == NGX_CHAIN_ERROR) {
+        return NGX_ERROR;
+    }
+
+    while (mux->out != sent) {
+        cl = mux->out;
+        mux->out = cl->next;
+
+        if (cl == mux->last) {
+            mux->last = NULL;
+        }
+
+        cl->buf->pos = cl->buf->start;
+        cl->buf->last = cl->buf->start;
+
+        cl->next = mux->free;
+        mux->free = cl;
+    }
+
+    if (mux->out || c->buffered) {
+        if (!wev->timer_set) {
+            ngx_add_timer(wev, mux->upstream->send_timeout);
+        }
+
+        return ngx_handle_write_event(wev, 0);
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_grpc_mux_close(ngx_http_grpc_mux_t *mux)
+{
+    ngx_queue_t             *q;
+    ngx_connection_t        *c;
+    ngx_http_grpc_stream_t  *stream;
+
+    c = mux->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "grpc multiplex close: %p, streams: %ui",
+                   c, mux->nstreams);
+
+    ngx_queue_remove(&mux->queue);
+
+    mux->connection = NULL;
+    mux->ready = 0;
+
+    for (q = ngx_queue_head(&mux->streams);
+         q != ngx_queue_sentinel(&mux->streams);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_grpc_stream_t, queue);
+
+        stream->connection.fd = (ngx_socket_t) -1;
+
+        ngx_http_grpc_mux_fail_stream(stream);
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        (void) ngx_ssl_shutdown(c);
+    }
+
+#endif
+
+    ngx_close_connection(c);
+
+    /* streams refer to the connection data, see ngx_http_grpc_get_ctx() */
+
+    if (mux->nstreams == 0) {
+        ngx_destroy_pool(mux->pool);
+    }
+}
+
+
+static u_char *
+ngx_http_grpc_mux_log_error(ngx_log_t *log, u_char *buf, size_t len)
+{
+    u_char               *p;
+    ngx_http_grpc_mux_t  *mux;
+
+    mux = log->data;
+    p = buf;
+
+    if (log->action) {
+        p = ngx_snprintf(buf, len, " while %s", log->action);
+        len -= p - buf;
+        buf = p;
+    }
+
+    return ngx_snprintf(buf, len, ", upstream: %V", &mux->name);
+}
+
+
+static ngx_http_grpc_stream_t *
+ngx_http_grpc_mux_create_stream(ngx_http_grpc_mux_t *mux, ngx_log_t *log)
+{
+    ngx_pool_t              *pool;
+    ngx_connection_t        *c, *fc;
+    ngx_http_grpc_stream_t  *stream;
+
+    c = mux->connection;
+
+    pool = ngx_create_pool(1024, log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    stream = ngx_pcalloc(pool, sizeof(ngx_http_grpc_stream_t));
+    if (stream == NULL) {
+        ngx_destroy_pool(pool);
+        return NULL;
+    }
+
+    stream->mux = mux;
+
+    /*
+     * the fake connection passed to the upstream module: it reads
+     * frames demultiplexed for the stream and queues frames sent
+     * to the real connection; fake events are always active, so
+     * they are never added to the event method
+     */
+
+    fc = &stream->connection;
+
+    fc->fd = c->fd;
+    fc->pool = pool;
+    fc->log = log;
+    fc->read = &stream->read;
+    fc->write = &stream->write;
+    fc->recv = ngx_http_grpc_mux_recv;
+    fc->send_chain = ngx_http_grpc_mux_send_chain;
+    fc->sockaddr = c->sockaddr;
+    fc->socklen = c->socklen;
+    fc->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+
+#if (NGX_HTTP_SSL)
+    fc->ssl = c->ssl;
+#endif
+
+    stream->read.data = fc;
+    stream->read.log = log;
+    stream->read.active = 1;
+
+    stream->write.data = fc;
+    stream->write.log = log;
+    stream->write.write = 1;
+    stream->write.active = 1;
+    stream->write.ready = 1;
+
+    ngx_queue_insert_tail(&mux->streams, &stream->queue);
+    mux->nstreams++;
+
+    if (c->idle) {
+        c->idle = 0;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+    }
+
+    return stream;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_open_stream(ngx_http_request_t *r, ngx_http_grpc_ctx_t *ctx,
+    ngx_http_grpc_stream_t *stream)
+{
+    ngx_http_grpc_mux_t  *mux;
+
+    mux = stream->mux;
+
+    if (stream->error || stream->eof || mux->goaway) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "upstream http2 connection is closed");
+        return NGX_ERROR;
+    }
+
+    /*
+     * stream identifiers are assigned when the request is sent,
+     * so HEADERS frames are always queued in the identifier order
+     */
+
+    stream->id = mux->next_id;
+    stream->ctx = ctx;
+
+    mux->next_id += 2;
+
+    if (mux->next_id > 0x7fffffff) {
+        /* stream identifiers exhausted, close once idle */
+        mux->goaway = 1;
+    }
+
+    ctx->connection = &mux->conn;
+    ctx->id = stream->id;
+    ctx->send_window = mux->conn.init_window;
+    ctx->recv_window = mux->conn.stream_window;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "grpc multiplex stream: %ui, streams: %ui",
+                   stream->id, mux->nstreams);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_grpc_stream_t *
+ngx_http_grpc_mux_find_stream(ngx_http_grpc_mux_t *mux, ngx_uint_t id)
+{
+    ngx_queue_t             *q;
+    ngx_http_grpc_stream_t  *stream;
+
+    for (q = ngx_queue_head(&mux->streams);
+         q != ngx_queue_sentinel(&mux->streams);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_grpc_stream_t, queue);
+
+        if (stream->id == id) {
+            return stream;
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_mux_stream_input(ngx_http_grpc_stream_t *stream, u_char *p,
+    size_t size)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    while (size) {
+
+        cl = stream->last;
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+
+            if (stream->free) {
+                cl = stream->free;
+                stream->free = cl->next;
+
+            } else {
+                cl = ngx_alloc_chain_link(stream->connection.pool);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                cl->buf = ngx_create_temp_buf(stream->connection.pool,
+                                              NGX_HTTP_GRPC_MUX_BUFFER_SIZE);
+                if (cl->buf == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            cl->next = NULL;
+
+            if (stream->last) {
+                stream->last->next = cl;
+
+            } else {
+                stream->in = cl;
+            }
+
+            stream->last = cl;
+        }
+
+        b = cl->buf;
+
+        n = ngx_min(size, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, p, n);
+
+        p += n;
+        size -= n;
+    }
+
+    stream->read.ready = 1;
+
+    ngx_post_event(&stream->read, &ngx_posted_events);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_grpc_mux_fail_stream(ngx_http_grpc_stream_t *stream)
+{
+    if (stream->mux->eof) {
+        stream->eof = 1;
+
+    } else {
+        stream->error = 1;
+    }
+
+    stream->read.ready = 1;
+
+    ngx_post_event(&stream->read, &ngx_posted_events);
+    ngx_post_event(&stream->write, &ngx_posted_events);
+}
+
+
+static void
+ngx_http_grpc_mux_close_stream(ngx_http_grpc_stream_t *stream,
+    ngx_uint_t reset)
+{
+    u_char                rst[4];
+    ngx_uint_t            id;
+    ngx_connection_t     *c;
+    ngx_http_grpc_mux_t  *mux;
+
+    mux = stream->mux;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, stream->connection.log, 0,
+                   "grpc multiplex close stream: %ui, reset: %ui",
+                   stream->id, reset);
+
+    /* streams reset by the upstream do not need another reset */
+
+    id = (reset && !stream->reset) ? stream->id : 0;
+
+    if (stream->read.timer_set) {
+        ngx_del_timer(&stream->read);
+    }
+
+    if (stream->write.timer_set) {
+        ngx_del_timer(&stream->write);
+    }
+
+    if (stream->read.posted) {
+        ngx_delete_posted_event(&stream->read);
+    }
+
+    if (stream->write.posted) {
+        ngx_delete_posted_event(&stream->write);
+    }
+
+    if (mux->stream == stream) {
+        mux->stream = NULL;
+    }
+
+    ngx_queue_remove(&stream->queue);
+    mux->nstreams--;
+
+    ngx_destroy_pool(stream->connection.pool);
+
+    c = mux->connection;
+
+    if (c == NULL) {
+        if (mux->nstreams == 0) {
+            ngx_destroy_pool(mux->pool);
+        }
+
+        return;
+    }
+
+    if (id) {
+        /* CANCEL */
+        (void) ngx_http_v2_write_uint32(rst, 0x8);
+
+        if (ngx_http_grpc_mux_send_frame(mux, NGX_HTTP_V2_RST_STREAM_FRAME, 0,
+                                         id, rst, 4)
+            != NGX_OK)
+        {
+            ngx_http_grpc_mux_close(mux);
+            return;
+        }
+    }
+
+    if (mux->nstreams) {
+        return;
+    }
+
+    if (mux->goaway || ngx_terminate || ngx_exiting) {
+        ngx_http_grpc_mux_close(mux);
+        return;
+    }
+
+    c->idle = 1;
+
+    ngx_add_timer(c->read, mux->conf->timeout);
+}
+
+
+static ssize_t
+ngx_http_grpc_mux_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t                   n;
+    u_char                  *p;
+    ngx_buf_t               *b;
+    ngx_chain_t             *cl;
+    ngx_http_grpc_stream_t  *stream;
+
+    stream = (ngx_http_grpc_stream_t *) c;
+
+    p = buf;
+
+    while (stream->in && size) {
+        cl = stream->in;
+        b = cl->buf;
+
+        n = ngx_min(size, (size_t) (b->last - b->pos));
+
+        p = ngx_cpymem(p, b->pos, n);
+
+        b->pos += n;
+        size -= n;
+
+        if (b->pos == b->last) {
+            stream->in = cl->next;
+
+            if (stream->in == NULL) {
+                stream->last = NULL;
+            }
+
+            b->pos = b->start;
+            b->last = b->start;
+
+            cl->next = stream->free;
+            stream->free = cl;
+        }
+    }
+
+    if (p != buf) {
+        c->read->ready = (stream->in || stream->error || stream->eof);
+        return p - buf;
+    }
+
+    if (stream->error) {
+        c->read->error = 1;
+        return NGX_ERROR;
+    }
+
+    c->read->ready = 0;
+
+    if (stream->eof) {
+        c->read->eof = 1;
+        return 0;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_chain_t *
+ngx_http_grpc_mux_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    off_t                    size;
+    ssize_t                  n;
+    ngx_buf_t               *b, *out;
+    ngx_http_grpc_mux_t     *mux;
+    ngx_http_grpc_stream_t  *stream;
+
+    stream = (ngx_http_grpc_stream_t *) c;
+    mux = stream->mux;
+
+    if (stream->error || stream->eof || mux->connection == NULL) {
+        c->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    /*
+     * data are copied to the output queue of the real connection
+     * at once, so the fake connection is never blocked
+     */
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        if (ngx_buf_special(b)) {
+            continue;
+        }
+
+        if (ngx_buf_in_memory(b)) {
+            size = b->last - b->pos;
+
+            if (ngx_http_grpc_mux_queue(mux, b->pos, size) != NGX_OK) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            b->pos = b->last;
+
+            if (b->in_file) {
+                b->file_pos = b->file_last;
+            }
+
+            c->sent += size;
+            continue;
+        }
+
+        while (b->file_pos < b->file_last) {
+
+            out = ngx_http_grpc_mux_get_buf(mux);
+            if (out == NULL) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            size = ngx_min(b->file_last - b->file_pos,
+                           (off_t) (out->end - out->last));
+
+            n = ngx_read_file(b->file, out->last, (size_t) size, b->file_pos);
+
+            if (n == NGX_ERROR) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (n == 0) {
+                ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                              "file \"%V\" was truncated", &b->file->name);
+                return NGX_CHAIN_ERROR;
+            }
+
+            out->last += n;
+            b->file_pos += n;
+            c->sent += n;
+        }
+
+        if (mux->ready) {
+            ngx_post_event(mux->connection->write, &ngx_posted_events);
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_internal_trailers_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_table_elt_t  *te;
+
+    te = r->headers_in.te;
+
+    if (te == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    if (ngx_strlcasestrn(te->value.data, te->value.data + te->value.len,
+                         (u_char *) "trailers", 8 - 1)
+        == NULL)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    v->data = (u_char *) "trailers";
+    v->len = sizeof("trailers") - 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_grpc_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_grpc_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_grpc_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_grpc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_grpc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->streams = 0;
+     *     conf->original_init_upstream = NULL;
+     *     conf->original_init_peer = NULL;
+     */
+
+    conf->window = NGX_CONF_UNSET_SIZE;
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static void *
+ngx_http_grpc_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_grpc_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_grpc_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->upstream.ignore_headers = 0;
+     *     conf->upstream.next_upstream = 0;
+     *     conf->upstream.hide_headers_hash = { NULL, 0 };
+     *
+     *     conf->headers.lengths = NULL;
+     *     conf->headers.values = NULL;
+     *     conf->headers.hash = { NULL, 0 };
+     *     conf->host = { 0, NULL };
+     *     conf->host_set = 0;
+     *     conf->ssl = 0;
+     *     conf->ssl_protocols = 0;
+     *     conf->ssl_ciphers = { 0, NULL };
+     *     conf->ssl_trusted_certificate = { 0, NULL };
+     *     conf->ssl_crl = { 0, NULL };
+     */
+
+    conf->upstream.local = NGX_CONF_UNSET_PTR;
+    conf->upstream.socket_keepalive = NGX_CONF_UNSET;
+    conf->upstream.next_upstream_tries = NGX_CONF_UNSET_UINT;
+    conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.next_upstream_timeout = NGX_CONF_UNSET_MSEC;
+
+    conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
+
+    conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
+    conf->upstream.pass_headers = NGX_CONF_UNSET_PTR;
+
+    conf->upstream.intercept_errors = NGX_CONF_UNSET;
+
+#if (NGX_HTTP_SSL)
+    conf->upstream.ssl_session_reuse = NGX_CONF_UNSET;
+    conf->upstream.ssl_name = NGX_CONF_UNSET_PTR;
+    conf->upstream.ssl_server_name = NGX_CONF_UNSET;
+    conf->upstream.ssl_verify = NGX_CONF_UNSET;
+    conf->ssl_verify_depth = NGX_CONF_UNSET_UINT;
+    conf->upstream.ssl_certificate = NGX_CONF_UNSET_PTR;
     conf->upstream.ssl_certificate_key = NGX_CONF_UNSET_PTR;
     conf->upstream.ssl_passwords = NGX_CONF_UNSET_PTR;
     conf->ssl_conf_commands = NGX_CONF_UNSET_PTR;
@@ -4844,6 +6814,96 @@ ngx_http_grpc_pass(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_grpc_multiplex(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_grpc_srv_conf_t *gscf = conf;
+
+    ssize_t                        size;
+    ngx_int_t                      n;
+    ngx_str_t                     *value, s;
+    ngx_msec_t                     timeout;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (gscf->streams) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    gscf->streams = n;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "window=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = &value[i].data[7];
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR
+                || size < NGX_HTTP_V2_DEFAULT_FRAME_SIZE
+                || size > NGX_HTTP_V2_MAX_WINDOW)
+            {
+                goto invalid;
+            }
+
+            gscf->window = size;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            timeout = ngx_parse_time(&s, 0);
+
+            if (timeout == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            gscf->timeout = timeout;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    /* init upstream handler */
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    gscf->original_init_upstream = uscf->peer.init_upstream
+                                   ? uscf->peer.init_upstream
+                                   : ngx_http_upstream_init_round_robin;
+
+    uscf->peer.init_upstream = ngx_http_grpc_init_multiplex;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 #if (NGX_HTTP_SSL)
 
 static char *
@@ -0,0 +1,31 @@
+
+/*
+ * Copyright (C) Maxim Dounin
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HTTP_GRPC_H_INCLUDED_
+#define _NGX_HTTP_GRPC_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_array_t               *flushes;
+    ngx_array_t               *lengths;
+    ngx_array_t               *values;
+    ngx_hash_t                 hash;
+} ngx_http_grpc_headers_t;
+
+
+ngx_int_t ngx_http_grpc_init_upstream(ngx_http_request_t *r,
+    ngx_http_grpc_headers_t *headers, ngx_str_t *host);
+ngx_int_t ngx_http_grpc_create_upstream_request(ngx_http_request_t *r,
+    ngx_str_t *method, ngx_str_t *path);
+
+
+#endif /* _NGX_HTTP_GRPC_H_INCLUDED_ */
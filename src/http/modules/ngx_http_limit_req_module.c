@@ -37,13 +37,21 @@ typedef struct {
 } ngx_http_limit_req_shctx_t;
 
 
+/*
+ * A zone is split into shards by the key hash, each shard has its own
+ * rbtree, queue, and lock.  A single shard is protected by the zone mutex.
+ */
+
 typedef struct {
     ngx_http_limit_req_shctx_t  *sh;
     ngx_slab_pool_t             *shpool;
+    ngx_shmtx_t                 *mutex;
+    ngx_uint_t                   shards;
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
     ngx_http_complex_value_t     key;
     ngx_http_limit_req_node_t   *node;
+    ngx_uint_t                   shard;
 } ngx_http_limit_req_ctx_t;
 
 
@@ -72,7 +80,12 @@ static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
 static void ngx_http_limit_req_unlock(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
-    ngx_uint_t n);
+    ngx_http_limit_req_shctx_t *sh, ngx_uint_t n);
+
+static void *ngx_http_limit_req_expire_shards(ngx_http_limit_req_ctx_t *ctx,
+    ngx_uint_t shard, size_t size);
+static ngx_shmtx_t *ngx_http_limit_req_mutex(ngx_http_limit_req_ctx_t *ctx,
+    ngx_uint_t shard);
 
 static ngx_int_t ngx_http_limit_req_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -104,7 +117,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3|NGX_CONF_TAKE4,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -199,6 +212,7 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
     ngx_int_t                    rc;
     ngx_uint_t                   n, excess;
     ngx_msec_t                   delay;
+    ngx_shmtx_t                 *mutex;
     ngx_http_limit_req_ctx_t    *ctx;
     ngx_http_limit_req_conf_t   *lrcf;
     ngx_http_limit_req_limit_t  *limit, *limits;
@@ -243,12 +257,14 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(key.data, key.len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        mutex = ngx_http_limit_req_mutex(ctx, hash % ctx->shards);
+
+        ngx_shmtx_lock(mutex);
 
         rc = ngx_http_limit_req_lookup(limit, hash, &key, &excess,
                                        (n == lrcf->limits.nelts - 1));
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(mutex);
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -408,17 +424,22 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     size_t                      size;
     ngx_int_t                   rc, excess;
     ngx_msec_t                  now;
+    ngx_uint_t                  shard;
     ngx_msec_int_t              ms;
     ngx_rbtree_node_t          *node, *sentinel;
     ngx_http_limit_req_ctx_t   *ctx;
     ngx_http_limit_req_node_t  *lr;
+    ngx_http_limit_req_shctx_t *sh;
 
     now = ngx_current_msec;
 
     ctx = limit->shm_zone->data;
 
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    shard = hash % ctx->shards;
+    sh = &ctx->sh[shard];
+
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -440,7 +461,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
         if (rc == 0) {
             ngx_queue_remove(&lr->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+            ngx_queue_insert_head(&sh->queue, &lr->queue);
 
             ms = (ngx_msec_int_t) (now - lr->last);
 
@@ -476,6 +497,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
             lr->count++;
 
             ctx->node = lr;
+            ctx->shard = shard;
 
             return NGX_AGAIN;
         }
@@ -489,21 +511,43 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
            + offsetof(ngx_http_limit_req_node_t, data)
            + key->len;
 
-    ngx_http_limit_req_expire(ctx, 1);
+    /*
+     * the shards share the zone memory, so the zone mutex is also held
+     * while nodes are freed and allocated
+     */
+
+    if (ctx->mutex) {
+        ngx_shmtx_lock(&ctx->shpool->mutex);
+    }
+
+    ngx_http_limit_req_expire(ctx, sh, 1);
 
     node = ngx_slab_alloc_locked(ctx->shpool, size);
 
     if (node == NULL) {
-        ngx_http_limit_req_expire(ctx, 0);
+        ngx_http_limit_req_expire(ctx, sh, 0);
 
         node = ngx_slab_alloc_locked(ctx->shpool, size);
+
+        if (node == NULL && ctx->mutex) {
+            node = ngx_http_limit_req_expire_shards(ctx, shard, size);
+        }
+
         if (node == NULL) {
+            if (ctx->mutex) {
+                ngx_shmtx_unlock(&ctx->shpool->mutex);
+            }
+
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                           "could not allocate node%s", ctx->shpool->log_ctx);
             return NGX_ERROR;
         }
     }
 
+    if (ctx->mutex) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+    }
+
     node->key = hash;
 
     lr = (ngx_http_limit_req_node_t *) &node->color;
@@ -513,9 +557,9 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     ngx_memcpy(lr->data, key->data, key->len);
 
-    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_rbtree_insert(&sh->rbtree, node);
 
-    ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+    ngx_queue_insert_head(&sh->queue, &lr->queue);
 
     if (account) {
         lr->last = now;
@@ -527,6 +571,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     lr->count = 1;
 
     ctx->node = lr;
+    ctx->shard = shard;
 
     return NGX_AGAIN;
 }
@@ -538,6 +583,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 {
     ngx_int_t                   excess;
     ngx_msec_t                  now, delay, max_delay;
+    ngx_shmtx_t                *mutex;
     ngx_msec_int_t              ms;
     ngx_http_limit_req_ctx_t   *ctx;
     ngx_http_limit_req_node_t  *lr;
@@ -560,7 +606,9 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        mutex = ngx_http_limit_req_mutex(ctx, ctx->shard);
+
+        ngx_shmtx_lock(mutex);
 
         now = ngx_current_msec;
         ms = (ngx_msec_int_t) (now - lr->last);
@@ -585,7 +633,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
         lr->excess = excess;
         lr->count--;
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(mutex);
 
         ctx->node = NULL;
 
@@ -609,6 +657,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 static void
 ngx_http_limit_req_unlock(ngx_http_limit_req_limit_t *limits, ngx_uint_t n)
 {
+    ngx_shmtx_t               *mutex;
     ngx_http_limit_req_ctx_t  *ctx;
 
     while (n--) {
@@ -618,11 +667,13 @@ ngx_http_limit_req_unlock(ngx_http_limit_req_limit_t *limits, ngx_uint_t n)
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        mutex = ngx_http_limit_req_mutex(ctx, ctx->shard);
+
+        ngx_shmtx_lock(mutex);
 
         ctx->node->count--;
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(mutex);
 
         ctx->node = NULL;
     }
@@ -630,7 +681,8 @@ ngx_http_limit_req_unlock(ngx_http_limit_req_limit_t *limits, ngx_uint_t n)
 
 
 static void
-ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
+ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shctx_t *sh, ngx_uint_t n)
 {
     ngx_int_t                   excess;
     ngx_msec_t                  now;
@@ -649,11 +701,11 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&ctx->sh->queue)) {
+        if (ngx_queue_empty(&sh->queue)) {
             return;
         }
 
-        q = ngx_queue_last(&ctx->sh->queue);
+        q = ngx_queue_last(&sh->queue);
 
         lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
 
@@ -688,19 +740,65 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
         node = (ngx_rbtree_node_t *)
                    ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
 
-        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+        ngx_rbtree_delete(&sh->rbtree, node);
 
         ngx_slab_free_locked(ctx->shpool, node);
     }
 }
 
 
+static void *
+ngx_http_limit_req_expire_shards(ngx_http_limit_req_ctx_t *ctx,
+    ngx_uint_t shard, size_t size)
+{
+    void        *p;
+    ngx_uint_t   i, n;
+
+    /*
+     * the zone mutex is held; the locks of other shards are only tried,
+     * as their owners may be waiting for the zone mutex
+     */
+
+    for (i = 1; i < ctx->shards; i++) {
+        n = (shard + i) % ctx->shards;
+
+        if (!ngx_shmtx_trylock(&ctx->mutex[n])) {
+            continue;
+        }
+
+        ngx_http_limit_req_expire(ctx, &ctx->sh[n], 0);
+
+        ngx_shmtx_unlock(&ctx->mutex[n]);
+
+        p = ngx_slab_alloc_locked(ctx->shpool, size);
+        if (p) {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_shmtx_t *
+ngx_http_limit_req_mutex(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t shard)
+{
+    if (ctx->mutex) {
+        return &ctx->mutex[shard];
+    }
+
+    return &ctx->shpool->mutex;
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_req_ctx_t  *octx = data;
 
     size_t                     len;
+    ngx_uint_t                 i;
+    ngx_shmtx_sh_t            *lock;
     ngx_http_limit_req_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -719,8 +817,17 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->shards != octx->shards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->shards, octx->shards);
+            return NGX_ERROR;
+        }
+
         ctx->sh = octx->sh;
         ctx->shpool = octx->shpool;
+        ctx->mutex = octx->mutex;
 
         return NGX_OK;
     }
@@ -729,21 +836,48 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     if (shm_zone->shm.exists) {
         ctx->sh = ctx->shpool->data;
+        ctx->mutex = ctx->shpool->locks;
 
         return NGX_OK;
     }
 
-    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
+    ctx->sh = ngx_slab_alloc(ctx->shpool,
+                             ctx->shards * sizeof(ngx_http_limit_req_shctx_t));
     if (ctx->sh == NULL) {
         return NGX_ERROR;
     }
 
     ctx->shpool->data = ctx->sh;
 
-    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
-                    ngx_http_limit_req_rbtree_insert_value);
+    for (i = 0; i < ctx->shards; i++) {
+        ngx_rbtree_init(&ctx->sh[i].rbtree, &ctx->sh[i].sentinel,
+                        ngx_http_limit_req_rbtree_insert_value);
+
+        ngx_queue_init(&ctx->sh[i].queue);
+    }
+
+    if (ctx->shards > 1) {
+        ctx->mutex = ngx_slab_calloc(ctx->shpool,
+                                     ctx->shards * sizeof(ngx_shmtx_t));
+        if (ctx->mutex == NULL) {
+            return NGX_ERROR;
+        }
+
+        lock = ngx_slab_calloc(ctx->shpool,
+                               ctx->shards * sizeof(ngx_shmtx_sh_t));
+        if (lock == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < ctx->shards; i++) {
+            if (ngx_shmtx_create(&ctx->mutex[i], &lock[i], NULL) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
 
-    ngx_queue_init(&ctx->sh->queue);
+        ctx->shpool->locks = ctx->mutex;
+        ctx->shpool->nlocks = ctx->shards;
+    }
 
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
@@ -836,7 +970,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                             len;
     ssize_t                            size;
     ngx_str_t                         *value, name, s;
-    ngx_int_t                          rate, scale;
+    ngx_int_t                          rate, scale, shards;
     ngx_uint_t                         i;
     ngx_shm_zone_t                    *shm_zone;
     ngx_http_limit_req_ctx_t          *ctx;
@@ -862,6 +996,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     rate = 1;
     scale = 1;
+    shards = 1;
     name.len = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
@@ -924,6 +1059,29 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" is not supported "
+                                   "on this platform", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#endif
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -937,6 +1095,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->rate = rate * 1000 / scale;
+    ctx->shards = shards;
 
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
@@ -78,6 +78,9 @@ typedef struct {
 } ngx_http_proxy_headers_t;
 
 
+#define ngx_http_proxy_v2(conf)  ((conf)->http_version == NGX_HTTP_VERSION_20)
+
+
 typedef struct {
     ngx_http_upstream_conf_t       upstream;
 
@@ -89,6 +92,10 @@ typedef struct {
     ngx_http_proxy_headers_t       headers;
 #if (NGX_HTTP_CACHE)
     ngx_http_proxy_headers_t       headers_cache;
+#endif
+#if (NGX_HTTP_GRPC)
+    ngx_http_grpc_headers_t        headers_v2;
+    ngx_uint_t                     host_set;
 #endif
     ngx_array_t                   *headers_source;
 
@@ -151,6 +158,9 @@ static ngx_int_t ngx_http_proxy_create_key(ngx_http_request_t *r);
 #endif
 static ngx_int_t ngx_http_proxy_create_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_proxy_reinit_request(ngx_http_request_t *r);
+#if (NGX_HTTP_GRPC)
+static ngx_int_t ngx_http_proxy_create_v2_request(ngx_http_request_t *r);
+#endif
 static ngx_int_t ngx_http_proxy_body_output_filter(void *data, ngx_chain_t *in);
 static ngx_int_t ngx_http_proxy_process_status_line(ngx_http_request_t *r);
 static ngx_int_t ngx_http_proxy_process_header(ngx_http_request_t *r);
@@ -287,6 +297,9 @@ static ngx_conf_post_t  ngx_http_proxy_ssl_conf_command_post =
 static ngx_conf_enum_t  ngx_http_proxy_http_version[] = {
     { ngx_string("1.0"), NGX_HTTP_VERSION_10 },
     { ngx_string("1.1"), NGX_HTTP_VERSION_11 },
+#if (NGX_HTTP_GRPC)
+    { ngx_string("2"), NGX_HTTP_VERSION_20 },
+#endif
     { ngx_null_string, 0 }
 };
 
@@ -380,6 +393,27 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, upstream.socket_keepalive),
       NULL },
 
+    { ngx_string("proxy_collapse"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_collapse_set_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream),
+      NULL },
+
+    { ngx_string("proxy_collapse_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.collapse_timeout),
+      NULL },
+
+    { ngx_string("proxy_collapse_max_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.collapse_max_size),
+      NULL },
+
     { ngx_string("proxy_connect_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -832,6 +866,24 @@ static ngx_keyval_t  ngx_http_proxy_headers[] = {
 };
 
 
+#if (NGX_HTTP_GRPC)
+
+static ngx_keyval_t  ngx_http_proxy_v2_headers[] = {
+    { ngx_string("Host"), ngx_string("") },
+    { ngx_string("Connection"), ngx_string("") },
+    { ngx_string("Content-Length"), ngx_string("$proxy_internal_body_length") },
+    { ngx_string("Transfer-Encoding"), ngx_string("") },
+    { ngx_string("TE"), ngx_string("") },
+    { ngx_string("Keep-Alive"), ngx_string("") },
+    { ngx_string("Expect"), ngx_string("") },
+    { ngx_string("Upgrade"), ngx_string("") },
+    { ngx_string("Proxy-Connection"), ngx_string("") },
+    { ngx_null_string, ngx_null_string }
+};
+
+#endif
+
+
 static ngx_str_t  ngx_http_proxy_hide_headers[] = {
     ngx_string("Date"),
     ngx_string("Server"),
@@ -1012,10 +1064,33 @@ ngx_http_proxy_handler(ngx_http_request_t *r)
 
     u->accel = 1;
 
+#if (NGX_HTTP_GRPC)
+
+    if (ngx_http_proxy_v2(plcf)) {
+
+        /*
+         * HTTP/2 framing and response parsing are provided by the grpc
+         * module; responses are passed to the client without buffering
+         */
+
+        if (ngx_http_grpc_init_upstream(r, &plcf->headers_v2,
+                                        plcf->host_set
+                                        ? NULL : &ctx->vars.host_header)
+            != NGX_OK)
+        {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        u->create_request = ngx_http_proxy_create_v2_request;
+        u->buffering = 0;
+    }
+
+#endif
+
     if (!plcf->upstream.request_buffering
         && plcf->body_values == NULL && plcf->upstream.pass_request_body
         && (!r->headers_in.chunked
-            || plcf->http_version == NGX_HTTP_VERSION_11))
+            || plcf->http_version >= NGX_HTTP_VERSION_11))
     {
         r->request_body_no_buffering = 1;
     }
@@ -1605,6 +1680,164 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HTTP_GRPC)
+
+static ngx_int_t
+ngx_http_proxy_create_v2_request(ngx_http_request_t *r)
+{
+    u_char                       *p;
+    size_t                        len, loc_len;
+    uintptr_t                     escape;
+    ngx_buf_t                    *b;
+    ngx_str_t                     method, uri;
+    ngx_chain_t                  *cl;
+    ngx_http_upstream_t          *u;
+    ngx_http_proxy_ctx_t         *ctx;
+    ngx_http_script_code_pt       code;
+    ngx_http_script_engine_t      e, le;
+    ngx_http_proxy_loc_conf_t    *plcf;
+    ngx_http_script_len_code_pt   lcode;
+
+    u = r->upstream;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_proxy_module);
+
+    if (u->method.len) {
+        /* HEAD was changed to GET to cache response */
+        method = u->method;
+
+    } else if (plcf->method) {
+        if (ngx_http_complex_value(r, plcf->method, &method) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+    } else {
+        method = r->method_name;
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (plcf->proxy_lengths && ctx->vars.uri.len) {
+        uri = ctx->vars.uri;
+
+    } else if (ctx->vars.uri.len == 0 && r->valid_unparsed_uri) {
+        uri = r->unparsed_uri;
+
+    } else {
+        escape = 0;
+        loc_len = (r->valid_location && ctx->vars.uri.len) ?
+                      plcf->location.len : 0;
+
+        if (r->quoted_uri || r->internal) {
+            escape = 2 * ngx_escape_uri(NULL, r->uri.data + loc_len,
+                                        r->uri.len - loc_len, NGX_ESCAPE_URI);
+        }
+
+        len = ctx->vars.uri.len + r->uri.len - loc_len + escape
+              + sizeof("?") - 1 + r->args.len;
+
+        p = ngx_pnalloc(r->pool, len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        uri.data = p;
+
+        if (r->valid_location) {
+            p = ngx_copy(p, ctx->vars.uri.data, ctx->vars.uri.len);
+        }
+
+        if (escape) {
+            p = (u_char *) ngx_escape_uri(p, r->uri.data + loc_len,
+                                          r->uri.len - loc_len,
+                                          NGX_ESCAPE_URI);
+
+        } else {
+            p = ngx_copy(p, r->uri.data + loc_len, r->uri.len - loc_len);
+        }
+
+        if (r->args.len > 0) {
+            *p++ = '?';
+            p = ngx_copy(p, r->args.data, r->args.len);
+        }
+
+        uri.len = p - uri.data;
+    }
+
+    if (uri.len == 0) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "zero length URI to proxy");
+        return NGX_ERROR;
+    }
+
+    u->uri = uri;
+
+    if (plcf->body_lengths) {
+        ngx_http_script_flush_no_cacheable_variables(r, plcf->body_flushes);
+
+        ngx_memzero(&le, sizeof(ngx_http_script_engine_t));
+
+        le.ip = plcf->body_lengths->elts;
+        le.request = r;
+        le.flushed = 1;
+        len = 0;
+
+        while (*(uintptr_t *) le.ip) {
+            lcode = *(ngx_http_script_len_code_pt *) le.ip;
+            len += lcode(&le);
+        }
+
+        ctx->internal_body_length = len;
+        u->request_bufs = NULL;
+
+        if (len) {
+            b = ngx_create_temp_buf(r->pool, len);
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
+
+            e.ip = plcf->body_values->elts;
+            e.pos = b->last;
+            e.request = r;
+            e.flushed = 1;
+
+            while (*(uintptr_t *) e.ip) {
+                code = *(ngx_http_script_code_pt *) e.ip;
+                code((ngx_http_script_engine_t *) &e);
+            }
+
+            b->last = e.pos;
+
+            cl = ngx_alloc_chain_link(r->pool);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl->buf = b;
+            cl->next = NULL;
+
+            u->request_bufs = cl;
+        }
+
+    } else if (!plcf->upstream.pass_request_body) {
+        ctx->internal_body_length = -1;
+        u->request_bufs = NULL;
+
+    } else if (r->headers_in.chunked && r->reading_body) {
+        ctx->internal_body_length = -1;
+
+    } else {
+        ctx->internal_body_length = r->headers_in.content_length_n;
+    }
+
+    return ngx_http_grpc_create_upstream_request(r, &method, &uri);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_proxy_reinit_request(ngx_http_request_t *r)
 {
@@ -3333,6 +3566,7 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
      *     conf->upstream.hide_headers_hash = { NULL, 0 };
      *     conf->upstream.store_lengths = NULL;
      *     conf->upstream.store_values = NULL;
+     *     conf->upstream.collapse_zone = NULL;
      *
      *     conf->location = NULL;
      *     conf->url = { 0, NULL };
@@ -3364,6 +3598,10 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.local = NGX_CONF_UNSET_PTR;
     conf->upstream.socket_keepalive = NGX_CONF_UNSET;
 
+    conf->upstream.collapse = NGX_CONF_UNSET_PTR;
+    conf->upstream.collapse_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.collapse_max_size = NGX_CONF_UNSET_SIZE;
+
     conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
     conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
     conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
@@ -3451,6 +3689,10 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_core_loc_conf_t   *clcf;
     ngx_http_proxy_rewrite_t   *pr;
     ngx_http_script_compile_t   sc;
+#if (NGX_HTTP_GRPC)
+    ngx_uint_t                  i;
+    ngx_keyval_t               *kv;
+#endif
 
 #if (NGX_HTTP_CACHE)
 
@@ -3496,6 +3738,20 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.socket_keepalive,
                               prev->upstream.socket_keepalive, 0);
 
+    if (conf->upstream.collapse == NGX_CONF_UNSET_PTR) {
+        conf->upstream.collapse_zone = prev->upstream.collapse_zone;
+    }
+
+    ngx_conf_merge_ptr_value(conf->upstream.collapse,
+                              prev->upstream.collapse, NULL);
+
+    ngx_conf_merge_msec_value(conf->upstream.collapse_timeout,
+                              prev->upstream.collapse_timeout, 5000);
+
+    ngx_conf_merge_size_value(conf->upstream.collapse_max_size,
+                              prev->upstream.collapse_max_size,
+                              256 * 1024);
+
     ngx_conf_merge_msec_value(conf->upstream.connect_timeout,
                               prev->upstream.connect_timeout, 60000);
 
@@ -3724,6 +3980,17 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.intercept_errors,
                               prev->upstream.intercept_errors, 0);
 
+    ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
+                              NGX_HTTP_VERSION_10);
+
+    if (ngx_http_proxy_v2(conf)) {
+        /* HTTP/2 control frames are sent after the request */
+        conf->upstream.preserve_output = 1;
+
+        /* responses are not kept in the HTTP/1.x form */
+        conf->upstream.collapse = NULL;
+    }
+
 #if (NGX_HTTP_SSL)
 
     if (ngx_http_proxy_merge_ssl(cf, conf, prev) != NGX_OK) {
@@ -3828,9 +4095,6 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_ptr_value(conf->cookie_flags, prev->cookie_flags, NULL);
 
-    ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
-                              NGX_HTTP_VERSION_10);
-
     ngx_conf_merge_uint_value(conf->headers_hash_max_size,
                               prev->headers_hash_max_size, 512);
 
@@ -3900,17 +4164,51 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_ptr_value(conf->headers_source, prev->headers_source, NULL);
 
-    if (conf->headers_source == prev->headers_source) {
+    if (conf->headers_source == prev->headers_source
+        && ngx_http_proxy_v2(conf) == ngx_http_proxy_v2(prev))
+    {
         conf->headers = prev->headers;
 #if (NGX_HTTP_CACHE)
         conf->headers_cache = prev->headers_cache;
 #endif
     }
 
-    rc = ngx_http_proxy_init_headers(cf, conf, &conf->headers,
-                                     ngx_http_proxy_headers);
-    if (rc != NGX_OK) {
-        return NGX_CONF_ERROR;
+#if (NGX_HTTP_GRPC)
+
+    if (ngx_http_proxy_v2(conf)) {
+        rc = ngx_http_proxy_init_headers(cf, conf, &conf->headers,
+                                         ngx_http_proxy_v2_headers);
+        if (rc != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        conf->headers_v2.flushes = conf->headers.flushes;
+        conf->headers_v2.lengths = conf->headers.lengths;
+        conf->headers_v2.values = conf->headers.values;
+        conf->headers_v2.hash = conf->headers.hash;
+
+        conf->host_set = 0;
+
+        if (conf->headers_source) {
+            kv = conf->headers_source->elts;
+            for (i = 0; i < conf->headers_source->nelts; i++) {
+                if (kv[i].key.len == sizeof("Host") - 1
+                    && ngx_strcasecmp(kv[i].key.data, (u_char *) "Host") == 0)
+                {
+                    conf->host_set = 1;
+                    break;
+                }
+            }
+        }
+
+    } else
+#endif
+    {
+        rc = ngx_http_proxy_init_headers(cf, conf, &conf->headers,
+                                         ngx_http_proxy_headers);
+        if (rc != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
     }
 
 #if (NGX_HTTP_CACHE)
@@ -3931,7 +4229,8 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
      */
 
     if (prev->headers.hash.buckets == NULL
-        && conf->headers_source == prev->headers_source)
+        && conf->headers_source == prev->headers_source
+        && ngx_http_proxy_v2(conf) == ngx_http_proxy_v2(prev))
     {
         prev->headers = conf->headers;
 #if (NGX_HTTP_CACHE)
@@ -4945,7 +5244,8 @@ ngx_http_proxy_merge_ssl(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *conf,
         && conf->ssl_trusted_certificate.data == NULL
         && conf->ssl_crl.data == NULL
         && conf->upstream.ssl_session_reuse == NGX_CONF_UNSET
-        && conf->ssl_conf_commands == NGX_CONF_UNSET_PTR)
+        && conf->ssl_conf_commands == NGX_CONF_UNSET_PTR
+        && ngx_http_proxy_v2(conf) == ngx_http_proxy_v2(prev))
     {
         if (prev->upstream.ssl) {
             conf->upstream.ssl = prev->upstream.ssl;
@@ -5067,6 +5367,20 @@ ngx_http_proxy_set_ssl(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *plcf)
         return NGX_ERROR;
     }
 
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+
+    if (ngx_http_proxy_v2(plcf)
+        && SSL_CTX_set_alpn_protos(plcf->upstream.ssl->ctx,
+                                   (u_char *) "\x02h2", 3)
+           != 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, cf->log, 0,
+                      "SSL_CTX_set_alpn_protos() failed");
+        return NGX_ERROR;
+    }
+
+#endif
+
     if (ngx_ssl_conf_commands(cf, plcf->upstream.ssl, plcf->ssl_conf_commands)
         != NGX_OK)
     {
@@ -13,6 +13,8 @@
 static ngx_int_t ngx_http_stub_status_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_stub_status_contention_variable(
+    ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
 static char *ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -76,6 +78,16 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
     { ngx_string("connections_waiting"), NULL, ngx_http_stub_status_variable,
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("zerocopy_completed"), NULL, ngx_http_stub_status_variable,
+      4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("zerocopy_copied"), NULL, ngx_http_stub_status_variable,
+      5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("shm_contention_"), NULL,
+      ngx_http_stub_status_contention_variable,
+      0, NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_PREFIX, 0 },
+
       ngx_http_null_variable
 };
 
@@ -179,6 +191,14 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
         value = *ngx_stat_waiting;
         break;
 
+    case 4:
+        value = *ngx_stat_zerocopy_completed;
+        break;
+
+    case 5:
+        value = *ngx_stat_zerocopy_copied;
+        break;
+
     /* suppress warning */
     default:
         value = 0;
@@ -195,6 +215,63 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_stub_status_contention_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_str_t *name = (ngx_str_t *) data;
+
+    u_char             *p;
+    ngx_str_t           zone;
+    ngx_uint_t          i;
+    ngx_shm_zone_t     *shm_zone;
+    ngx_list_part_t    *part;
+    ngx_atomic_uint_t   contention;
+
+    zone.len = name->len - (sizeof("shm_contention_") - 1);
+    zone.data = name->data + sizeof("shm_contention_") - 1;
+
+    part = &((ngx_cycle_t *) ngx_cycle)->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                v->not_found = 1;
+                return NGX_OK;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (zone.len == shm_zone[i].shm.name.len
+            && ngx_strncmp(zone.data, shm_zone[i].shm.name.data, zone.len)
+               == 0)
+        {
+            break;
+        }
+    }
+
+    contention = ngx_slab_contention((ngx_slab_pool_t *) shm_zone[i].shm.addr);
+
+    p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%uA", contention) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_stub_status_add_variables(ngx_conf_t *cf)
 {
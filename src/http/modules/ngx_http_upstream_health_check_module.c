@@ -0,0 +1,845 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_HC_BUFFER_SIZE  1024
+
+
+typedef struct {
+    ngx_msec_t                        interval;
+    ngx_msec_t                        timeout;
+    ngx_uint_t                        fails;
+    ngx_uint_t                        passes;
+    ngx_str_t                         uri;
+    in_port_t                         port;
+    ngx_uint_t                        http;     /* unsigned  http:1; */
+    ngx_str_t                         request;
+} ngx_http_upstream_hc_srv_conf_t;
+
+
+typedef struct ngx_http_upstream_hc_probe_s  ngx_http_upstream_hc_probe_t;
+
+struct ngx_http_upstream_hc_probe_s {
+    ngx_pool_t                       *pool;
+    ngx_http_upstream_srv_conf_t     *uscf;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_str_t                         name;
+    ngx_sockaddr_t                    sockaddr;
+
+    ngx_peer_connection_t             pc;
+    ngx_buf_t                        *buf;
+
+    ngx_http_upstream_hc_probe_t     *next;
+
+    unsigned                          connected:1;
+    unsigned                          sent:1;
+};
+
+
+static void ngx_http_upstream_hc_timer_handler(ngx_event_t *ev);
+static ngx_http_upstream_hc_probe_t *ngx_http_upstream_hc_create_probe(
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_rr_peer_t *peer);
+static void ngx_http_upstream_hc_start_probe(
+    ngx_http_upstream_hc_probe_t *probe);
+static void ngx_http_upstream_hc_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_hc_test_connect(ngx_connection_t *c);
+static ngx_int_t ngx_http_upstream_hc_send(
+    ngx_http_upstream_hc_probe_t *probe);
+static ngx_int_t ngx_http_upstream_hc_read(
+    ngx_http_upstream_hc_probe_t *probe);
+static void ngx_http_upstream_hc_finalize(ngx_http_upstream_hc_probe_t *probe,
+    ngx_uint_t passed);
+
+static void *ngx_http_upstream_hc_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_health_check(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_upstream_hc_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_hc_init_worker(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_health_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_health_check_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_upstream_hc_init,             /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_hc_create_conf,      /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_health_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_health_check_module_ctx, /* module context */
+    ngx_http_upstream_hc_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_hc_init_worker,      /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void
+ngx_http_upstream_hc_timer_handler(ngx_event_t *ev)
+{
+    ngx_msec_t                        now;
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_http_upstream_rr_peers_t     *peers, *list;
+    ngx_http_upstream_hc_probe_t     *probe, *probes;
+    ngx_http_upstream_srv_conf_t     *uscf;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    uscf = ev->data;
+    hcf = ngx_http_conf_upstream_srv_conf(uscf,
+                                        ngx_http_upstream_health_check_module);
+
+    peers = uscf->peer.data;
+    now = ngx_current_msec;
+    probes = NULL;
+
+    /*
+     * the timer runs in each worker process, and a peer is probed
+     * by the worker which is the first to see that the peer is due
+     */
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (list = peers; list; list = list->next) {
+
+        for (peer = list->peer; peer; peer = peer->next) {
+
+            if (peer->down) {
+                continue;
+            }
+
+            ngx_http_upstream_rr_peer_lock(list, peer);
+
+            if (peer->probed
+                && (ngx_msec_int_t) (now - peer->probed)
+                   < (ngx_msec_int_t) hcf->interval)
+            {
+                ngx_http_upstream_rr_peer_unlock(list, peer);
+                continue;
+            }
+
+            peer->probed = now ? now : 1;
+
+            ngx_http_upstream_rr_peer_unlock(list, peer);
+
+            probe = ngx_http_upstream_hc_create_probe(uscf, peer);
+            if (probe == NULL) {
+                continue;
+            }
+
+            probe->next = probes;
+            probes = probe;
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    while (probes) {
+        probe = probes;
+        probes = probe->next;
+
+        ngx_http_upstream_hc_start_probe(probe);
+    }
+
+    ngx_add_timer(ev, ngx_min(hcf->interval, 1000));
+}
+
+
+static ngx_http_upstream_hc_probe_t *
+ngx_http_upstream_hc_create_probe(ngx_http_upstream_srv_conf_t *uscf,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_pool_t                       *pool;
+    ngx_http_upstream_hc_probe_t     *probe;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    /* the peers are locked */
+
+    hcf = ngx_http_conf_upstream_srv_conf(uscf,
+                                        ngx_http_upstream_health_check_module);
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    probe = ngx_pcalloc(pool, sizeof(ngx_http_upstream_hc_probe_t));
+    if (probe == NULL) {
+        goto failed;
+    }
+
+    probe->pool = pool;
+    probe->uscf = uscf;
+    probe->hcf = hcf;
+    probe->peer = peer;
+
+    probe->name.data = ngx_pstrdup(pool, &peer->name);
+    if (probe->name.data == NULL) {
+        goto failed;
+    }
+
+    probe->name.len = peer->name.len;
+
+    ngx_memcpy(&probe->sockaddr, peer->sockaddr, peer->socklen);
+
+    if (hcf->port) {
+        ngx_inet_set_port(&probe->sockaddr.sockaddr, hcf->port);
+    }
+
+    probe->pc.sockaddr = &probe->sockaddr.sockaddr;
+    probe->pc.socklen = peer->socklen;
+    probe->pc.name = &probe->name;
+
+    return probe;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NULL;
+}
+
+
+static void
+ngx_http_upstream_hc_start_probe(ngx_http_upstream_hc_probe_t *probe)
+{
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "health check of %V in upstream \"%V\"",
+                   &probe->name, &probe->uscf->host);
+
+    probe->pc.get = ngx_event_get_peer;
+    probe->pc.log = ngx_cycle->log;
+    probe->pc.log_error = NGX_ERROR_INFO;
+
+    rc = ngx_event_connect_peer(&probe->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_hc_finalize(probe, 0);
+        return;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN */
+
+    c = probe->pc.connection;
+
+    c->data = probe;
+    c->pool = probe->pool;
+
+    c->read->handler = ngx_http_upstream_hc_handler;
+    c->write->handler = ngx_http_upstream_hc_handler;
+
+    ngx_add_timer(c->read, probe->hcf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_hc_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_handler(ngx_event_t *ev)
+{
+    ngx_int_t                      rc;
+    ngx_connection_t              *c;
+    ngx_http_upstream_hc_probe_t  *probe;
+
+    c = ev->data;
+    probe = c->data;
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "health check of %V in upstream \"%V\" timed out",
+                      &probe->name, &probe->uscf->host);
+        ngx_http_upstream_hc_finalize(probe, 0);
+        return;
+    }
+
+    if (!probe->connected) {
+
+        if (!c->write->ready && !c->read->ready) {
+            return;
+        }
+
+        if (ngx_http_upstream_hc_test_connect(c) != NGX_OK) {
+            ngx_http_upstream_hc_finalize(probe, 0);
+            return;
+        }
+
+        probe->connected = 1;
+
+        if (!probe->hcf->http) {
+            ngx_http_upstream_hc_finalize(probe, 1);
+            return;
+        }
+    }
+
+    if (!probe->sent) {
+        rc = ngx_http_upstream_hc_send(probe);
+
+        if (rc == NGX_AGAIN) {
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_http_upstream_hc_finalize(probe, 0);
+            return;
+        }
+
+        probe->sent = 1;
+    }
+
+    rc = ngx_http_upstream_hc_read(probe);
+
+    if (rc == NGX_AGAIN) {
+        return;
+    }
+
+    ngx_http_upstream_hc_finalize(probe, rc == NGX_OK);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_send(ngx_http_upstream_hc_probe_t *probe)
+{
+    ssize_t            n;
+    ngx_buf_t         *b;
+    ngx_connection_t  *c;
+
+    c = probe->pc.connection;
+    b = probe->buf;
+
+    if (b == NULL) {
+        b = ngx_create_temp_buf(probe->pool, NGX_HTTP_UPSTREAM_HC_BUFFER_SIZE);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        probe->buf = b;
+
+        /* the request is sent from the configuration */
+
+        b->pos = probe->hcf->request.data;
+        b->last = b->pos + probe->hcf->request.len;
+    }
+
+    while (b->pos < b->last) {
+
+        n = c->send(c, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            return NGX_AGAIN;
+        }
+
+        b->pos += n;
+    }
+
+    b->pos = b->start;
+    b->last = b->start;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_read(ngx_http_upstream_hc_probe_t *probe)
+{
+    u_char            *p;
+    ssize_t            n;
+    ngx_buf_t         *b;
+    ngx_uint_t         status;
+    ngx_connection_t  *c;
+
+    c = probe->pc.connection;
+    b = probe->buf;
+
+    for ( ;; ) {
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            return NGX_AGAIN;
+        }
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        b->last += n;
+
+        /* "HTTP/1.1 200 " */
+
+        if (n == 0 || b->last - b->pos >= 13 || b->last == b->end) {
+            break;
+        }
+    }
+
+    p = b->pos;
+
+    if (b->last - p < 13
+        || ngx_strncmp(p, "HTTP/1.", 7) != 0
+        || p[8] != ' '
+        || p[9] < '1' || p[9] > '9'
+        || p[10] < '0' || p[10] > '9'
+        || p[11] < '0' || p[11] > '9')
+    {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "health check of %V in upstream \"%V\": "
+                      "invalid response", &probe->name, &probe->uscf->host);
+        return NGX_ERROR;
+    }
+
+    status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "health check of %V status: %ui", &probe->name, status);
+
+    if (status < 200 || status >= 400) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "health check of %V in upstream \"%V\": "
+                      "status %ui", &probe->name, &probe->uscf->host, status);
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hc_finalize(ngx_http_upstream_hc_probe_t *probe,
+    ngx_uint_t passed)
+{
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_http_upstream_rr_peers_t     *peers, *list;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    if (probe->pc.connection) {
+        ngx_close_connection(probe->pc.connection);
+        probe->pc.connection = NULL;
+    }
+
+    hcf = probe->hcf;
+    peers = probe->uscf->peer.data;
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    /* the peer might have been removed while it was probed */
+
+    for (list = peers; list; list = list->next) {
+        for (peer = list->peer; peer; peer = peer->next) {
+            if (peer == probe->peer
+                && peer->name.len == probe->name.len
+                && ngx_strncmp(peer->name.data, probe->name.data,
+                               probe->name.len)
+                   == 0)
+            {
+                goto found;
+            }
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    ngx_destroy_pool(probe->pool);
+
+    return;
+
+found:
+
+    ngx_http_upstream_rr_peer_lock(list, peer);
+
+    if (passed) {
+        peer->probe_fails = 0;
+        peer->probe_passes++;
+
+        if (peer->unhealthy && peer->probe_passes >= hcf->passes) {
+            peer->unhealthy = 0;
+            peer->fails = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "passed health checks",
+                          &probe->name, &probe->uscf->host);
+        }
+
+    } else {
+        peer->probe_passes = 0;
+        peer->probe_fails++;
+
+        if (!peer->unhealthy && peer->probe_fails >= hcf->fails) {
+            peer->unhealthy = 1;
+
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "failed health checks",
+                          &probe->name, &probe->uscf->host);
+        }
+    }
+
+    ngx_http_upstream_rr_peer_unlock(list, peer);
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    ngx_destroy_pool(probe->pool);
+}
+
+
+static void *
+ngx_http_upstream_hc_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->interval = 0;
+     *     conf->uri = { 0, NULL };
+     *     conf->port = 0;
+     *     conf->http = 0;
+     *     conf->request = { 0, NULL };
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_health_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *hcf = conf;
+
+    u_char                        *p;
+    ngx_int_t                      n;
+    ngx_str_t                     *value, s;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (hcf->interval) {
+        return "is duplicate";
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    hcf->interval = 5000;
+    hcf->timeout = 5000;
+    hcf->fails = 1;
+    hcf->passes = 1;
+    hcf->http = 1;
+    ngx_str_set(&hcf->uri, "/");
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            hcf->interval = ngx_parse_time(&s, 0);
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR || hcf->timeout == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "port=", 5) == 0) {
+
+            n = ngx_atoi(&value[i].data[5], value[i].len - 5);
+            if (n == NGX_ERROR || n < 1 || n > 65535) {
+                goto invalid;
+            }
+
+            hcf->port = (in_port_t) n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+
+            hcf->uri.len = value[i].len - 4;
+            hcf->uri.data = &value[i].data[4];
+
+            if (hcf->uri.len == 0 || hcf->uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=http") == 0) {
+            hcf->http = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=tcp") == 0) {
+            hcf->http = 0;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (!hcf->http) {
+        return NGX_CONF_OK;
+    }
+
+    hcf->request.len = sizeof("GET  HTTP/1.0" CRLF) - 1 + hcf->uri.len
+                       + sizeof("Host: " CRLF) - 1 + uscf->host.len
+                       + sizeof("User-Agent: nginx health check" CRLF) - 1
+                       + sizeof(CRLF) - 1;
+
+    p = ngx_pnalloc(cf->pool, hcf->request.len);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    hcf->request.data = p;
+
+    p = ngx_sprintf(p, "GET %V HTTP/1.0" CRLF "Host: %V" CRLF
+                    "User-Agent: nginx health check" CRLF CRLF,
+                    &hcf->uri, &uscf->host);
+
+    hcf->request.len = p - hcf->request.data;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                        i;
+    ngx_http_upstream_srv_conf_t    **uscfp;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+    ngx_http_upstream_main_conf_t    *umcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                        ngx_http_upstream_health_check_module);
+
+        if (hcf->interval && uscfp[i]->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "health checks require upstream \"%V\" "
+                          "in %s:%ui to be in shared memory",
+                          &uscfp[i]->host, uscfp[i]->file_name,
+                          uscfp[i]->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                        i;
+    ngx_event_t                      *ev;
+    ngx_http_upstream_srv_conf_t    **uscfp;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+    ngx_http_upstream_main_conf_t    *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                        ngx_http_upstream_health_check_module);
+
+        if (hcf->interval == 0) {
+            continue;
+        }
+
+        ev = ngx_pcalloc(cycle->pool, sizeof(ngx_event_t));
+        if (ev == NULL) {
+            return NGX_ERROR;
+        }
+
+        ev->handler = ngx_http_upstream_hc_timer_handler;
+        ev->data = uscfp[i];
+        ev->log = cycle->log;
+        ev->cancelable = 1;
+
+        /* the workers are spread over the first second */
+
+        ngx_add_timer(ev, 1 + ngx_random() % 1000);
+    }
+
+    return NGX_OK;
+}
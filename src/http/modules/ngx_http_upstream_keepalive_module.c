@@ -15,9 +15,11 @@ typedef struct {
     ngx_uint_t                         requests;
     ngx_msec_t                         time;
     ngx_msec_t                         timeout;
+    ngx_flag_t                         adaptive;
 
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
+    ngx_queue_t                        peers;
 
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
@@ -25,11 +27,27 @@ typedef struct {
 } ngx_http_upstream_keepalive_srv_conf_t;
 
 
+typedef struct {
+    ngx_queue_t                        queue;
+
+    ngx_uint_t                         active;
+    ngx_uint_t                         cached;
+    ngx_uint_t                         size;
+    ngx_msec_t                         busy;
+    ngx_msec_t                         start;
+
+    socklen_t                          socklen;
+    ngx_sockaddr_t                     sockaddr;
+
+} ngx_http_upstream_keepalive_peer_t;
+
+
 typedef struct {
     ngx_http_upstream_keepalive_srv_conf_t  *conf;
 
     ngx_queue_t                        queue;
     ngx_connection_t                  *connection;
+    ngx_http_upstream_keepalive_peer_t  *peer;
 
     socklen_t                          socklen;
     ngx_sockaddr_t                     sockaddr;
@@ -41,6 +59,8 @@ typedef struct {
     ngx_http_upstream_keepalive_srv_conf_t  *conf;
 
     ngx_http_upstream_t               *upstream;
+    ngx_http_upstream_keepalive_peer_t  *peer;
+    ngx_msec_t                         start;
 
     void                              *data;
 
@@ -66,6 +86,15 @@ static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
 
+static ngx_http_upstream_keepalive_peer_t *
+    ngx_http_upstream_keepalive_get_peer(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_peer_connection_t *pc);
+static ngx_uint_t ngx_http_upstream_keepalive_peer_size(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_peer_t *peer);
+static void ngx_http_upstream_keepalive_release_peer(
+    ngx_http_upstream_keepalive_peer_t *peer);
+
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
     ngx_peer_connection_t *pc, void *data);
@@ -108,6 +137,13 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
       offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
       NULL },
 
+    { ngx_string("keepalive_adaptive"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, adaptive),
+      NULL },
+
       ngx_null_command
 };
 
@@ -160,6 +196,7 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     ngx_conf_init_msec_value(kcf->time, 3600000);
     ngx_conf_init_msec_value(kcf->timeout, 60000);
     ngx_conf_init_uint_value(kcf->requests, 1000);
+    ngx_conf_init_value(kcf->adaptive, 0);
 
     if (kcf->original_init_upstream(cf, us) != NGX_OK) {
         return NGX_ERROR;
@@ -179,6 +216,7 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
 
     ngx_queue_init(&kcf->cache);
     ngx_queue_init(&kcf->free);
+    ngx_queue_init(&kcf->peers);
 
     for (i = 0; i < kcf->max_cached; i++) {
         ngx_queue_insert_head(&kcf->free, &cached[i].queue);
@@ -213,6 +251,7 @@ ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r,
 
     kp->conf = kcf;
     kp->upstream = r->upstream;
+    kp->peer = NULL;
     kp->data = r->upstream->peer.data;
     kp->original_get_peer = r->upstream->peer.get;
     kp->original_free_peer = r->upstream->peer.free;
@@ -253,6 +292,15 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
         return rc;
     }
 
+    if (kp->conf->adaptive) {
+        kp->peer = ngx_http_upstream_keepalive_get_peer(kp->conf, pc);
+
+        if (kp->peer) {
+            kp->peer->active++;
+            kp->start = ngx_current_msec;
+        }
+    }
+
     /* search cache for suitable connection */
 
     cache = &kp->conf->cache;
@@ -271,6 +319,10 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
             ngx_queue_remove(q);
             ngx_queue_insert_head(&kp->conf->free, q);
 
+            if (item->peer) {
+                item->peer->cached--;
+            }
+
             goto found;
         }
     }
@@ -308,13 +360,33 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
     ngx_http_upstream_keepalive_cache_t      *item;
 
-    ngx_queue_t          *q;
-    ngx_connection_t     *c;
-    ngx_http_upstream_t  *u;
+    ngx_msec_t                           ms;
+    ngx_uint_t                           size;
+    ngx_queue_t                         *q;
+    ngx_connection_t                    *c;
+    ngx_http_upstream_t                 *u;
+    ngx_http_upstream_keepalive_peer_t  *peer;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer");
 
+    peer = kp->peer;
+
+#if (NGX_SUPPRESS_WARN)
+    size = 0;
+#endif
+
+    if (peer) {
+        kp->peer = NULL;
+
+        ms = ngx_current_msec - kp->start;
+
+        peer->active--;
+        peer->busy += ngx_max(ms, 1);
+
+        size = ngx_http_upstream_keepalive_peer_size(kp->conf, peer);
+    }
+
     /* cache valid connections */
 
     u = kp->upstream;
@@ -351,6 +423,13 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         goto invalid;
     }
 
+    if (peer && peer->active + peer->cached >= size) {
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "free keepalive peer: not saving, %ui+%ui of %ui",
+                       peer->active, peer->cached, size);
+        goto invalid;
+    }
+
     if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
         goto invalid;
     }
@@ -367,6 +446,14 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
 
         ngx_http_upstream_keepalive_close(item->connection);
 
+        if (item->peer) {
+            item->peer->cached--;
+
+            if (item->peer != peer) {
+                ngx_http_upstream_keepalive_release_peer(item->peer);
+            }
+        }
+
     } else {
         q = ngx_queue_head(&kp->conf->free);
         ngx_queue_remove(q);
@@ -377,6 +464,11 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_queue_insert_head(&kp->conf->cache, q);
 
     item->connection = c;
+    item->peer = peer;
+
+    if (peer) {
+        peer->cached++;
+    }
 
     pc->connection = NULL;
 
@@ -406,6 +498,10 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
 
 invalid:
 
+    if (peer) {
+        ngx_http_upstream_keepalive_release_peer(peer);
+    }
+
     kp->original_free_peer(pc, kp->data, state);
 }
 
@@ -458,6 +554,11 @@ close:
 
     ngx_queue_remove(&item->queue);
     ngx_queue_insert_head(&conf->free, &item->queue);
+
+    if (item->peer) {
+        item->peer->cached--;
+        ngx_http_upstream_keepalive_release_peer(item->peer);
+    }
 }
 
 
@@ -484,6 +585,94 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+static ngx_http_upstream_keepalive_peer_t *
+ngx_http_upstream_keepalive_get_peer(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_peer_connection_t *pc)
+{
+    ngx_queue_t                         *q;
+    ngx_http_upstream_keepalive_peer_t  *peer;
+
+    for (q = ngx_queue_head(&kcf->peers);
+         q != ngx_queue_sentinel(&kcf->peers);
+         q = ngx_queue_next(q))
+    {
+        peer = ngx_queue_data(q, ngx_http_upstream_keepalive_peer_t, queue);
+
+        if (ngx_memn2cmp((u_char *) &peer->sockaddr, (u_char *) pc->sockaddr,
+                         peer->socklen, pc->socklen)
+            == 0)
+        {
+            return peer;
+        }
+    }
+
+    peer = ngx_alloc(sizeof(ngx_http_upstream_keepalive_peer_t), pc->log);
+    if (peer == NULL) {
+        return NULL;
+    }
+
+    peer->active = 0;
+    peer->cached = 0;
+    peer->size = kcf->max_cached;
+    peer->busy = 0;
+    peer->start = ngx_current_msec;
+
+    peer->socklen = pc->socklen;
+    ngx_memcpy(&peer->sockaddr, pc->sockaddr, pc->socklen);
+
+    ngx_queue_insert_head(&kcf->peers, &peer->queue);
+
+    return peer;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_keepalive_peer_size(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_peer_t *peer)
+{
+    ngx_uint_t      size;
+    ngx_msec_int_t  elapsed;
+
+    /*
+     * the number of connections to a peer kept by the worker is
+     * the average number of connections used at once, that is,
+     * the request rate multiplied by the average request time;
+     * the estimate of the previous keepalive_timeout period is used
+     * unless the current one is higher
+     */
+
+    elapsed = ngx_current_msec - peer->start;
+
+    if (elapsed >= (ngx_msec_int_t) kcf->timeout) {
+        peer->size = (peer->busy + elapsed - 1) / elapsed;
+        peer->busy = 0;
+        peer->start = ngx_current_msec;
+
+        elapsed = 0;
+    }
+
+    size = elapsed ? (peer->busy + elapsed - 1) / elapsed : 0;
+
+    size = ngx_max(size, peer->size);
+
+    return ngx_max(size, 1);
+}
+
+
+static void
+ngx_http_upstream_keepalive_release_peer(
+    ngx_http_upstream_keepalive_peer_t *peer)
+{
+    if (peer->active || peer->cached) {
+        return;
+    }
+
+    ngx_queue_remove(&peer->queue);
+    ngx_free(peer);
+}
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -529,6 +718,7 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
     conf->time = NGX_CONF_UNSET_MSEC;
     conf->timeout = NGX_CONF_UNSET_MSEC;
     conf->requests = NGX_CONF_UNSET_UINT;
+    conf->adaptive = NGX_CONF_UNSET;
 
     return conf;
 }
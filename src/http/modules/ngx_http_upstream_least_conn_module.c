@@ -124,6 +124,14 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (ngx_http_upstream_update_round_robin_peer(rrp) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        pc->name = peers->name;
+        return NGX_BUSY;
+    }
+#endif
+
     best = NULL;
     total = 0;
 
@@ -143,7 +151,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
             continue;
         }
 
-        if (peer->down) {
+        if (peer->down || peer->unhealthy) {
             continue;
         }
 
@@ -198,7 +206,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
-            if (peer->down) {
+            if (peer->down || peer->unhealthy) {
                 continue;
             }
 
@@ -308,7 +316,8 @@ ngx_http_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_HTTP_UPSTREAM_MAX_FAILS
                   |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
                   |NGX_HTTP_UPSTREAM_DOWN
-                  |NGX_HTTP_UPSTREAM_BACKUP;
+                  |NGX_HTTP_UPSTREAM_BACKUP
+                  |NGX_HTTP_UPSTREAM_MODIFY;
 
     return NGX_CONF_OK;
 }
@@ -0,0 +1,604 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_LT_HEADER     0
+#define NGX_HTTP_UPSTREAM_LT_LAST_BYTE  1
+
+
+typedef struct {
+    ngx_uint_t                               mode;
+} ngx_http_upstream_least_time_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t         rrp;
+
+    ngx_http_upstream_least_time_srv_conf_t  *conf;
+    ngx_http_request_t                       *request;
+    ngx_array_t                              *times;
+    u_char                                   tries;
+} ngx_http_upstream_least_time_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_least_time_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_least_time_peer(
+    ngx_peer_connection_t *pc, void *data);
+static ngx_int_t ngx_http_upstream_peek_least_time_peer(
+    ngx_http_upstream_least_time_peer_data_t *lp,
+    ngx_http_upstream_rr_peer_t **peerp, time_t now);
+static ngx_uint_t ngx_http_upstream_least_time_usable(
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t i, time_t now);
+static void ngx_http_upstream_free_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_int_t ngx_http_upstream_least_time_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_least_time_add_variables(ngx_conf_t *cf);
+static void *ngx_http_upstream_least_time_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+/* both arguments are evaluated more than once */
+
+#define ngx_http_upstream_least_time_less(a, b)                               \
+    ((uint64_t) ((a)->response_time + 1) * ((a)->conns + 1) * (b)->weight     \
+     < (uint64_t) ((b)->response_time + 1) * ((b)->conns + 1) * (a)->weight)
+
+
+static ngx_command_t  ngx_http_upstream_least_time_commands[] = {
+
+    { ngx_string("least_time"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_least_time,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_least_time_module_ctx = {
+    ngx_http_upstream_least_time_add_variables, /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_least_time_create_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_least_time_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_least_time_module_ctx, /* module context */
+    ngx_http_upstream_least_time_commands, /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_variable_t  ngx_http_upstream_least_time_vars[] = {
+
+    { ngx_string("upstream_ewma_time"), NULL,
+      ngx_http_upstream_least_time_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+      ngx_http_null_variable
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_time(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init least time");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_least_time_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_time_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_least_time_peer_data_t  *lp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init least time peer");
+
+    lp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_least_time_peer_data_t));
+    if (lp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &lp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_least_time_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_least_time_peer;
+
+    lp->conf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_least_time_module);
+    lp->request = r;
+    lp->tries = 0;
+
+    /* the times are kept in the request context for $upstream_ewma_time */
+
+    lp->times = ngx_http_get_module_ctx(r, ngx_http_upstream_least_time_module);
+
+    if (lp->times == NULL) {
+        lp->times = ngx_array_create(r->pool, 2, sizeof(ngx_msec_t));
+        if (lp->times == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_set_ctx(r, lp->times, ngx_http_upstream_least_time_module);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_least_time_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_least_time_peer_data_t  *lp = data;
+
+    time_t                             now;
+    uintptr_t                          m;
+    ngx_int_t                          rc, p, q;
+    ngx_uint_t                         i, n;
+    ngx_http_upstream_rr_peer_t       *peer, *best, *second;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_data_t  *rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least time peer, try: %ui", pc->tries);
+
+    rrp = &lp->rrp;
+
+    if (rrp->peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    peers = rrp->peers;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (ngx_http_upstream_update_round_robin_peer(rrp) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        pc->name = peers->name;
+        return NGX_BUSY;
+    }
+#endif
+
+    /*
+     * power of two choices: two distinct usable peers are picked
+     * at random according to their weights, and the one with less
+     * average response time multiplied by the number of active
+     * connections is used
+     */
+
+    p = ngx_http_upstream_peek_least_time_peer(lp, &best, now);
+    q = -1;
+
+    if (p >= 0) {
+        q = ngx_http_upstream_peek_least_time_peer(lp, &second, now);
+
+        while (q == p) {
+            q = ngx_http_upstream_peek_least_time_peer(lp, &second, now);
+        }
+    }
+
+    if (p >= 0 && q >= 0 && q != p) {
+
+        if (ngx_http_upstream_least_time_less(second, best)) {
+            best = second;
+            p = q;
+        }
+
+        goto found;
+    }
+
+    /* fall back to the full scan */
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least time peer, scan");
+
+    best = NULL;
+
+#if (NGX_SUPPRESS_WARN)
+    p = 0;
+#endif
+
+    for (peer = peers->peer, i = 0;
+         peer;
+         peer = peer->next, i++)
+    {
+        if (!ngx_http_upstream_least_time_usable(rrp, peer, i, now)) {
+            continue;
+        }
+
+        if (best == NULL || ngx_http_upstream_least_time_less(peer, best)) {
+            best = peer;
+            p = i;
+        }
+    }
+
+    if (best == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get least time peer, no peer found");
+
+        goto failed;
+    }
+
+found:
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least time peer: %V %M %ui",
+                   &best->name, best->response_time, best->conns);
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    best->conns++;
+
+    rrp->current = best;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get least time peer, backup servers");
+
+        rrp->peers = peers->next;
+
+        n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
+                / (8 * sizeof(uintptr_t));
+
+        for (i = 0; i < n; i++) {
+            rrp->tried[i] = 0;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        rc = ngx_http_upstream_get_least_time_peer(pc, lp);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+
+        ngx_http_upstream_rr_peers_wlock(peers);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_peek_least_time_peer(
+    ngx_http_upstream_least_time_peer_data_t *lp,
+    ngx_http_upstream_rr_peer_t **peerp, time_t now)
+{
+    ngx_uint_t                     i, x;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = lp->rrp.peers;
+
+    if (peers->number < 2 || peers->total_weight == 0) {
+        return -1;
+    }
+
+    while (lp->tries++ < 20) {
+
+        x = ngx_random() % peers->total_weight;
+
+        for (peer = peers->peer, i = 0;
+             peer->next;
+             peer = peer->next, i++)
+        {
+            if (x < (ngx_uint_t) peer->weight) {
+                break;
+            }
+
+            x -= peer->weight;
+        }
+
+        if (ngx_http_upstream_least_time_usable(&lp->rrp, peer, i, now)) {
+            *peerp = peer;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_least_time_usable(ngx_http_upstream_rr_peer_data_t *rrp,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t i, time_t now)
+{
+    uintptr_t   m;
+    ngx_uint_t  n;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    if (rrp->tried[n] & m) {
+        return 0;
+    }
+
+    if (peer->down || peer->unhealthy) {
+        return 0;
+    }
+
+    if (peer->max_fails
+        && peer->fails >= peer->max_fails
+        && now - peer->checked <= peer->fail_timeout)
+    {
+        return 0;
+    }
+
+    if (peer->max_conns && peer->conns >= peer->max_conns) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void
+ngx_http_upstream_free_least_time_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_least_time_peer_data_t  *lp = data;
+
+    ngx_msec_t                    ms, *time;
+    ngx_msec_int_t                t;
+    ngx_http_upstream_t          *u;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    peer = lp->rrp.current;
+    u = lp->request->upstream;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free least time peer %ui", state);
+
+    if (lp->conf->mode == NGX_HTTP_UPSTREAM_LT_HEADER) {
+        ms = u->state->header_time;
+
+    } else {
+        ms = u->state->response_time;
+    }
+
+    if (ms == (ngx_msec_t) -1) {
+
+        /* failed attempts are accounted with the time spent */
+
+        if (!(state & NGX_PEER_FAILED)) {
+            goto done;
+        }
+
+        ms = ngx_current_msec - u->start_time;
+    }
+
+    ngx_http_upstream_rr_peers_rlock(lp->rrp.peers);
+    ngx_http_upstream_rr_peer_lock(lp->rrp.peers, peer);
+
+    /*
+     * exponentially weighted moving average with alpha 1/8,
+     * kept in microseconds to preserve precision
+     */
+
+    t = (ngx_msec_int_t) (ms * 1000 - peer->response_time) / 8;
+    peer->response_time += t;
+
+    ms = peer->response_time;
+
+    ngx_http_upstream_rr_peer_unlock(lp->rrp.peers, peer);
+    ngx_http_upstream_rr_peers_unlock(lp->rrp.peers);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "least time peer %V: %M", &peer->name, ms);
+
+    time = ngx_array_push(lp->times);
+    if (time) {
+        *time = ms;
+    }
+
+done:
+
+    ngx_http_upstream_free_round_robin_peer(pc, &lp->rrp, state);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_least_time_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char       *p;
+    size_t        len;
+    ngx_msec_t    ms, *time;
+    ngx_uint_t    i;
+    ngx_array_t  *times;
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    times = ngx_http_get_module_ctx(r, ngx_http_upstream_least_time_module);
+
+    if (times == NULL || times->nelts == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    len = times->nelts * (NGX_TIME_T_LEN + 4 + 2);
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->data = p;
+
+    time = times->elts;
+
+    for (i = 0; i < times->nelts; i++) {
+
+        if (i) {
+            *p++ = ',';
+            *p++ = ' ';
+        }
+
+        ms = time[i] / 1000;
+
+        p = ngx_sprintf(p, "%T.%03M", (time_t) ms / 1000, ms % 1000);
+    }
+
+    v->len = p - v->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_least_time_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_upstream_least_time_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_upstream_least_time_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_least_time_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_least_time_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->mode = NGX_HTTP_UPSTREAM_LT_HEADER;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_least_time_srv_conf_t  *ltcf = conf;
+
+    ngx_str_t                     *value;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "header") == 0) {
+        ltcf->mode = NGX_HTTP_UPSTREAM_LT_HEADER;
+
+    } else if (ngx_strcmp(value[1].data, "last_byte") == 0) {
+        ltcf->mode = NGX_HTTP_UPSTREAM_LT_LAST_BYTE;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_least_time;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_CONNS
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP
+                  |NGX_HTTP_UPSTREAM_MODIFY;
+
+    return NGX_CONF_OK;
+}
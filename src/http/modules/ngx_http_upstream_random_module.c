@@ -17,6 +17,9 @@ typedef struct {
 
 typedef struct {
     ngx_uint_t                            two;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                            config;
+#endif
     ngx_http_upstream_random_range_t     *ranges;
 } ngx_http_upstream_random_srv_conf_t;
 
@@ -144,8 +147,18 @@ ngx_http_upstream_update_random(ngx_pool_t *pool,
         total_weight += peer->weight;
     }
 
+    if (pool == NULL && rcf->ranges) {
+        ngx_free(rcf->ranges);
+    }
+
     rcf->ranges = ranges;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config) {
+        rcf->config = *peers->config;
+    }
+#endif
+
     return NGX_OK;
 }
 
@@ -186,7 +199,12 @@ ngx_http_upstream_init_random_peer(ngx_http_request_t *r,
     ngx_http_upstream_rr_peers_rlock(rp->rrp.peers);
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
-    if (rp->rrp.peers->shpool && rcf->ranges == NULL) {
+    if (rp->rrp.peers->shpool
+        && rp->rrp.peers->number
+        && (rcf->ranges == NULL
+            || (rp->rrp.peers->config
+                && rcf->config != *rp->rrp.peers->config)))
+    {
         if (ngx_http_upstream_update_random(NULL, us) != NGX_OK) {
             ngx_http_upstream_rr_peers_unlock(rp->rrp.peers);
             return NGX_ERROR;
@@ -220,7 +238,17 @@ ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_rlock(peers);
 
-    if (rp->tries > 20 || peers->single) {
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config
+        && (rrp->config != *peers->config
+            || rp->conf->config != *peers->config))
+    {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+#endif
+
+    if (rp->tries > 20 || peers->number < 2) {
         ngx_http_upstream_rr_peers_unlock(peers);
         return ngx_http_upstream_get_round_robin_peer(pc, rrp);
     }
@@ -245,7 +273,7 @@ ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
 
         ngx_http_upstream_rr_peer_lock(peers, peer);
 
-        if (peer->down) {
+        if (peer->down || peer->unhealthy) {
             ngx_http_upstream_rr_peer_unlock(peers, peer);
             goto next;
         }
@@ -314,7 +342,17 @@ ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(peers);
 
-    if (rp->tries > 20 || peers->single) {
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config
+        && (rrp->config != *peers->config
+            || rp->conf->config != *peers->config))
+    {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+#endif
+
+    if (rp->tries > 20 || peers->number < 2) {
         ngx_http_upstream_rr_peers_unlock(peers);
         return ngx_http_upstream_get_round_robin_peer(pc, rrp);
     }
@@ -347,7 +385,7 @@ ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
             goto next;
         }
 
-        if (peer->down) {
+        if (peer->down || peer->unhealthy) {
             goto next;
         }
 
@@ -471,7 +509,8 @@ ngx_http_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_HTTP_UPSTREAM_MAX_CONNS
                   |NGX_HTTP_UPSTREAM_MAX_FAILS
                   |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
-                  |NGX_HTTP_UPSTREAM_DOWN;
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_MODIFY;
 
     if (cf->args->nelts == 1) {
         return NGX_CONF_OK;
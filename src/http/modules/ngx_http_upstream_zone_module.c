@@ -10,14 +10,34 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_event_t                     event;
+    ngx_http_upstream_srv_conf_t   *uscf;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_rr_peer_t    *peer;
+} ngx_http_upstream_zone_resolve_t;
+
+
 static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
+static ngx_int_t ngx_http_upstream_zone_copy_resolve(
+    ngx_http_upstream_rr_peers_t *peers);
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
     ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
+static ngx_int_t ngx_http_upstream_zone_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle);
+static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *event);
+static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
+static void ngx_http_upstream_zone_update(ngx_http_upstream_zone_resolve_t *rs,
+    ngx_resolver_addr_t *addrs, ngx_uint_t naddrs);
+static ngx_uint_t ngx_http_upstream_zone_update_peers(
+    ngx_http_upstream_zone_resolve_t *rs, ngx_http_upstream_rr_peers_t *peers,
+    ngx_resolver_addr_t *addrs, ngx_uint_t naddrs, ngx_uint_t priority,
+    ngx_uint_t backup);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -35,7 +55,7 @@ static ngx_command_t  ngx_http_upstream_zone_commands[] = {
 
 static ngx_http_module_t  ngx_http_upstream_zone_module_ctx = {
     NULL,                                  /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_http_upstream_zone_init,           /* postconfiguration */
 
     NULL,                                  /* create main configuration */
     NULL,                                  /* init main configuration */
@@ -55,7 +75,7 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_zone_init_worker,    /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -188,6 +208,7 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     ngx_http_upstream_srv_conf_t *uscf)
 {
     ngx_str_t                     *name;
+    ngx_uint_t                    *config;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
 
@@ -225,6 +246,21 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
         *peerp = peer;
     }
 
+    if (ngx_http_upstream_zone_copy_resolve(peers) != NGX_OK) {
+        return NULL;
+    }
+
+    config = NULL;
+
+    if (peers->resolve || (peers->next && peers->next->resolve)) {
+        config = ngx_slab_calloc(shpool, sizeof(ngx_uint_t));
+        if (config == NULL) {
+            return NULL;
+        }
+    }
+
+    peers->config = config;
+
     if (peers->next == NULL) {
         goto done;
     }
@@ -250,6 +286,12 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
         *peerp = peer;
     }
 
+    if (ngx_http_upstream_zone_copy_resolve(backup) != NGX_OK) {
+        return NULL;
+    }
+
+    backup->config = config;
+
     peers->next = backup;
 
 done:
@@ -260,6 +302,48 @@ done:
 }
 
 
+static ngx_int_t
+ngx_http_upstream_zone_copy_resolve(ngx_http_upstream_rr_peers_t *peers)
+{
+    size_t                         size;
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_rr_peer_t   *peer, **peerp;
+
+    for (peerp = &peers->resolve; *peerp; peerp = &peer->next) {
+        /* pool is unlocked */
+        peer = ngx_http_upstream_zone_copy_peer(peers, *peerp);
+        if (peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        size = sizeof(ngx_http_upstream_host_t) + peer->host->name.len
+               + peer->host->service.len;
+
+        host = ngx_slab_alloc(peers->shpool, size);
+        if (host == NULL) {
+            return NGX_ERROR;
+        }
+
+        host->name.len = peer->host->name.len;
+        host->name.data = (u_char *) (host + 1);
+        ngx_memcpy(host->name.data, peer->host->name.data, host->name.len);
+
+        host->service.len = peer->host->service.len;
+        host->service.data = host->name.data + host->name.len;
+        ngx_memcpy(host->service.data, peer->host->service.data,
+                   host->service.len);
+
+        host->port = peer->host->port;
+
+        peer->host = host;
+
+        *peerp = peer;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_zone_copy_peer(ngx_http_upstream_rr_peers_t *peers,
     ngx_http_upstream_rr_peer_t *src)
@@ -292,8 +376,10 @@ ngx_http_upstream_zone_copy_peer(ngx_http_upstream_rr_peers_t *peers,
     }
 
     if (src) {
-        ngx_memcpy(dst->sockaddr, src->sockaddr, src->socklen);
-        ngx_memcpy(dst->name.data, src->name.data, src->name.len);
+        if (src->socklen) {
+            ngx_memcpy(dst->sockaddr, src->sockaddr, src->socklen);
+            ngx_memcpy(dst->name.data, src->name.data, src->name.len);
+        }
 
         dst->server.data = ngx_slab_alloc_locked(pool, src->server.len);
         if (dst->server.data == NULL) {
@@ -323,3 +409,435 @@ failed:
 
     return NULL;
 }
+
+
+void
+ngx_http_upstream_zone_free_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_slab_pool_t  *pool;
+
+    pool = peers->shpool;
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    if (peer->server.data) {
+        ngx_slab_free_locked(pool, peer->server.data);
+    }
+
+    if (peer->name.data) {
+        ngx_slab_free_locked(pool, peer->name.data);
+    }
+
+    if (peer->sockaddr) {
+        ngx_slab_free_locked(pool, peer->sockaddr);
+    }
+
+#if (NGX_HTTP_SSL)
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(pool, peer->ssl_session);
+    }
+#endif
+
+    ngx_slab_free_locked(pool, peer);
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                      i, j;
+    ngx_http_upstream_server_t     *server;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL || uscf->servers == NULL) {
+            continue;
+        }
+
+        server = uscf->servers->elts;
+
+        for (j = 0; j < uscf->servers->nelts; j++) {
+            if (server[j].host.len) {
+                break;
+            }
+        }
+
+        if (j == uscf->servers->nelts) {
+            continue;
+        }
+
+        if (clcf->resolver == NULL || clcf->resolver->connections.nelts == 0) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "no resolver defined to resolve names "
+                          "of upstream \"%V\" in %s:%ui",
+                          &uscf->host, uscf->file_name, uscf->line);
+            return NGX_ERROR;
+        }
+
+        uscf->resolver = clcf->resolver;
+        uscf->resolver_timeout =
+                            (clcf->resolver_timeout == NGX_CONF_UNSET_MSEC)
+                            ? 30000 : clcf->resolver_timeout;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                         i, n;
+    ngx_core_conf_t                   *ccf;
+    ngx_http_upstream_rr_peer_t       *peer;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_srv_conf_t      *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t     *umcf;
+    ngx_http_upstream_zone_resolve_t  *rs;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    /* names are distributed among worker processes */
+
+    n = 0;
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->resolver == NULL) {
+            continue;
+        }
+
+        for (peers = uscf->peer.data; peers; peers = peers->next) {
+
+            for (peer = peers->resolve; peer; peer = peer->next) {
+
+                if (ngx_process == NGX_PROCESS_WORKER
+                    && n++ % ccf->worker_processes != ngx_worker)
+                {
+                    continue;
+                }
+
+                rs = ngx_pcalloc(cycle->pool,
+                                 sizeof(ngx_http_upstream_zone_resolve_t));
+                if (rs == NULL) {
+                    return NGX_ERROR;
+                }
+
+                rs->uscf = uscf;
+                rs->peers = peers;
+                rs->peer = peer;
+
+                rs->event.handler = ngx_http_upstream_zone_resolve_timer;
+                rs->event.data = rs;
+                rs->event.log = cycle->log;
+                rs->event.cancelable = 1;
+
+                ngx_add_timer(&rs->event, 1);
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_timer(ngx_event_t *event)
+{
+    ngx_resolver_ctx_t                *ctx;
+    ngx_http_upstream_host_t          *host;
+    ngx_http_upstream_zone_resolve_t  *rs;
+
+    rs = event->data;
+    host = rs->peer->host;
+
+    ctx = ngx_resolve_start(rs->uscf->resolver, NULL);
+    if (ctx == NULL) {
+        goto retry;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "no resolver defined to resolve %V", &host->name);
+        return;
+    }
+
+    ctx->name = host->name;
+    ctx->service = host->service;
+    ctx->handler = ngx_http_upstream_zone_resolve_handler;
+    ctx->data = rs;
+    ctx->timeout = rs->uscf->resolver_timeout;
+    ctx->cancelable = 1;
+
+    if (ngx_resolve_name(ctx) == NGX_OK) {
+        return;
+    }
+
+retry:
+
+    ngx_add_timer(event, 10000);
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    time_t                             valid;
+    ngx_event_t                       *event;
+    ngx_http_upstream_host_t          *host;
+    ngx_http_upstream_zone_resolve_t  *rs;
+
+    rs = ctx->data;
+    event = &rs->event;
+    host = rs->peer->host;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "upstream \"%V\": %V could not be resolved (%i: %s)",
+                      &rs->uscf->host, &host->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        /* the servers are kept unless the name does not exist */
+
+        if (ctx->state == NGX_RESOLVE_NXDOMAIN) {
+            ngx_http_upstream_zone_update(rs, NULL, 0);
+        }
+
+    } else {
+        ngx_http_upstream_zone_update(rs, ctx->addrs, ctx->naddrs);
+    }
+
+    valid = ctx->valid - ngx_time();
+
+    ngx_resolve_name_done(ctx);
+
+    ngx_add_timer(event, (ngx_msec_t) ngx_max(valid, 1) * 1000);
+}
+
+
+static void
+ngx_http_upstream_zone_update(ngx_http_upstream_zone_resolve_t *rs,
+    ngx_resolver_addr_t *addrs, ngx_uint_t naddrs)
+{
+    ngx_uint_t                     i, priority, changed;
+    ngx_http_upstream_rr_peers_t  *primary, *backup;
+
+    primary = rs->uscf->peer.data;
+
+    /*
+     * SRV records of the highest priority are resolved as servers
+     * of the same kind as the server, and the rest of records are
+     * resolved as backup servers of a primary server
+     */
+
+    priority = 0;
+
+    if (rs->peer->host->service.len) {
+        priority = NGX_MAX_UINT32_VALUE;
+
+        for (i = 0; i < naddrs; i++) {
+            if (addrs[i].priority < priority) {
+                priority = addrs[i].priority;
+            }
+        }
+    }
+
+    backup = (rs->peers == primary && rs->peer->host->service.len)
+             ? primary->next : NULL;
+
+    ngx_http_upstream_rr_peers_wlock(primary);
+
+    if (primary->next) {
+        ngx_http_upstream_rr_peers_wlock(primary->next);
+    }
+
+    changed = ngx_http_upstream_zone_update_peers(rs, rs->peers, addrs,
+                                                  naddrs, priority, 0);
+
+    if (backup) {
+        changed |= ngx_http_upstream_zone_update_peers(rs, backup, addrs,
+                                                       naddrs, priority, 1);
+    }
+
+    if (changed) {
+        (*primary->config)++;
+    }
+
+    if (primary->next) {
+        ngx_http_upstream_rr_peers_unlock(primary->next);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(primary);
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_zone_update_peers(ngx_http_upstream_zone_resolve_t *rs,
+    ngx_http_upstream_rr_peers_t *peers, ngx_resolver_addr_t *addrs,
+    ngx_uint_t naddrs, ngx_uint_t priority, ngx_uint_t backup)
+{
+    u_char                        *used;
+    ngx_uint_t                     i, n, w, t, changed;
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_rr_peer_t   *peer, **peerp;
+
+    host = rs->peer->host;
+
+    used = NULL;
+
+    if (naddrs) {
+        used = ngx_calloc(naddrs, rs->event.log);
+        if (used == NULL) {
+            return 0;
+        }
+
+        /* the addresses which do not belong to the peers */
+
+        for (i = 0; i < naddrs; i++) {
+            if (host->service.len
+                && (addrs[i].priority == priority) == backup)
+            {
+                used[i] = 1;
+            }
+        }
+    }
+
+    changed = 0;
+
+    /* the peers of the addresses which are gone are removed */
+
+    for (peerp = &peers->peer; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->host != host) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        for (i = 0; i < naddrs; i++) {
+            if (!used[i]
+                && ngx_cmp_sockaddr(addrs[i].sockaddr, addrs[i].socklen,
+                                    peer->sockaddr, peer->socklen,
+                                    host->service.len ? 1 : 0)
+                   == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < naddrs) {
+            used[i] = 1;
+            peerp = &peer->next;
+            continue;
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, rs->event.log, 0,
+                       "upstream \"%V\": removed peer %V of %V",
+                       &rs->uscf->host, &peer->name, &host->name);
+
+        *peerp = peer->next;
+        changed = 1;
+
+        if (peer->conns) {
+            /* freed when the last connection is released */
+            peer->zombie = 1;
+
+        } else {
+            ngx_http_upstream_zone_free_peer(peers, peer);
+        }
+    }
+
+    /* the peers of new addresses are added */
+
+    for (i = 0; i < naddrs; i++) {
+
+        if (used[i]) {
+            continue;
+        }
+
+        ngx_shmtx_lock(&peers->shpool->mutex);
+        peer = ngx_http_upstream_zone_copy_peer(peers, rs->peer);
+        ngx_shmtx_unlock(&peers->shpool->mutex);
+
+        if (peer == NULL) {
+            break;
+        }
+
+        ngx_memcpy(peer->sockaddr, addrs[i].sockaddr, addrs[i].socklen);
+        peer->socklen = addrs[i].socklen;
+
+        if (host->service.len == 0) {
+            ngx_inet_set_port(peer->sockaddr, host->port);
+        }
+
+        peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->socklen,
+                                       peer->name.data, NGX_SOCKADDR_STRLEN,
+                                       1);
+        peer->next = NULL;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, rs->event.log, 0,
+                       "upstream \"%V\": added peer %V of %V",
+                       &rs->uscf->host, &peer->name, &host->name);
+
+        *peerp = peer;
+        peerp = &peer->next;
+
+        changed = 1;
+    }
+
+    if (used) {
+        ngx_free(used);
+    }
+
+    if (!changed) {
+        return 0;
+    }
+
+    n = 0;
+    w = 0;
+    t = 0;
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+        n++;
+        w += peer->weight;
+
+        if (!peer->down) {
+            t++;
+        }
+    }
+
+    peers->number = n;
+    peers->weighted = (w != n);
+    peers->total_weight = w;
+    peers->tries = t;
+    peers->single = (n == 1 && peers == rs->uscf->peer.data
+                     && peers->next == NULL);
+
+    return 1;
+}
@@ -1812,6 +1812,9 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ngx_listening_t           *ls;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
+#if (NGX_HTTP_V3)
+    ngx_http_v3_srv_conf_t    *h3scf;
+#endif
 
     ls = ngx_create_listening(cf, addr->opt.sockaddr, addr->opt.socklen);
     if (ls == NULL) {
@@ -1884,6 +1887,11 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
 
 #if (NGX_HTTP_V3)
     ls->quic = addr->opt.quic;
+
+    if (ls->quic) {
+        h3scf = cscf->ctx->srv_conf[ngx_http_v3_module.ctx_index];
+        ls->gro = h3scf->quic.gro_enabled;
+    }
 #endif
 
     return ls;
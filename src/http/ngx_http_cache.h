@@ -29,6 +29,12 @@
 
 #define NGX_HTTP_CACHE_VERSION       5
 
+#define NGX_HTTP_CACHE_REFRESH_QUEUE 32
+
+#define NGX_HTTP_CACHE_RAM_MISS      1
+#define NGX_HTTP_CACHE_RAM_HIT       2
+#define NGX_HTTP_CACHE_RAM_STORED    3
+
 
 typedef struct {
     ngx_uint_t                       status;
@@ -62,6 +68,33 @@ typedef struct {
 } ngx_http_file_cache_node_t;
 
 
+/*
+ * a copy of a whole cache file in the RAM zone; the fields up to the key
+ * match ngx_http_file_cache_node_t
+ */
+
+typedef struct {
+    ngx_queue_t                      queue;
+    ngx_pid_t                        pid;
+} ngx_http_file_cache_ram_ref_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    ngx_queue_t                      refs;
+    unsigned                         deleting:1;
+
+    ngx_file_uniq_t                  uniq;
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_ram_node_t;
+
+
 struct ngx_http_cache_s {
     ngx_file_t                       file;
     ngx_array_t                      keys;
@@ -95,6 +128,8 @@ struct ngx_http_cache_s {
 
     ngx_http_file_cache_t           *file_cache;
     ngx_http_file_cache_node_t      *node;
+    ngx_http_file_cache_ram_node_t  *ram;
+    ngx_http_file_cache_ram_ref_t   *ram_ref;
 
 #if (NGX_THREADS || NGX_COMPAT)
     ngx_thread_task_t               *thread_task;
@@ -122,6 +157,9 @@ struct ngx_http_cache_s {
 
     unsigned                         stale_updating:1;
     unsigned                         stale_error:1;
+
+    unsigned                         refresh:1;
+    unsigned                         ram_status:2;
 };
 
 
@@ -148,18 +186,50 @@ typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_queue_t                      queue;
-    ngx_atomic_t                     cold;
-    ngx_atomic_t                     loading;
     off_t                            size;
     ngx_uint_t                       count;
+} ngx_http_file_cache_part_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_uint_t                       uses;
+    ngx_msec_t                       time;
+} ngx_http_file_cache_refresh_t;
+
+
+typedef struct {
+    ngx_atomic_t                     cold;
+    ngx_atomic_t                     loading;
     ngx_uint_t                       watermark;
+    ngx_pid_t                       *updates;
+    ngx_uint_t                       nupdates;
+    ngx_http_file_cache_refresh_t    refresh[NGX_HTTP_CACHE_REFRESH_QUEUE];
+    ngx_http_file_cache_part_t       parts[1];
 } ngx_http_file_cache_sh_t;
 
 
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+    ngx_queue_t                      deleting;
+    size_t                           size;
+    time_t                           swept;
+    ngx_atomic_t                     hits;
+    ngx_atomic_t                     misses;
+    ngx_atomic_t                     stores;
+    ngx_atomic_t                     evictions;
+} ngx_http_file_cache_ram_sh_t;
+
+
 struct ngx_http_file_cache_s {
     ngx_http_file_cache_sh_t        *sh;
     ngx_slab_pool_t                 *shpool;
 
+    ngx_uint_t                       partitions;
+    ngx_shmtx_t                     *mutex;
+
     ngx_path_t                      *path;
 
     off_t                            min_free;
@@ -180,7 +250,23 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       manager_sleep;
     ngx_msec_t                       manager_threshold;
 
+    ngx_uint_t                       expire_part;
+    ngx_uint_t                       forced_part;
+
+    ngx_str_t                        index;
+    time_t                           index_time;
+
+    ngx_uint_t                       updates;
+    time_t                           refresh_ahead;
+    ngx_uint_t                       refresh_min_uses;
+
+    ngx_http_file_cache_ram_sh_t    *ram_sh;
+    ngx_slab_pool_t                 *ram_shpool;
+    size_t                           ram_max_size;
+    ngx_uint_t                       ram_min_uses;
+
     ngx_shm_zone_t                  *shm_zone;
+    ngx_shm_zone_t                  *ram_zone;
 
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
@@ -196,6 +282,7 @@ void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
+ngx_int_t ngx_http_file_cache_refresh(ngx_http_request_t *r);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
 
 char *ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -205,6 +292,7 @@ char *ngx_http_file_cache_valid_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
 
 
 extern ngx_str_t  ngx_http_cache_status[];
+extern ngx_str_t  ngx_http_cache_ram_status[];
 
 
 #endif /* _NGX_HTTP_CACHE_H_INCLUDED_ */
@@ -11,6 +11,48 @@
 #include <ngx_md5.h>
 
 
+/*
+ * The cache index is a snapshot of the keys zone: a header followed by
+ * fixed size entries in the order of the inactive queues, from the least
+ * recently used entries.  It is written by the master process on exit and
+ * is read by the cache loader instead of walking the cache directories.
+ * While the cache is in use, the cache manager removes the index.
+ */
+
+#define NGX_HTTP_CACHE_INDEX_VERSION  2
+#define NGX_HTTP_CACHE_INDEX_ENTRIES  4096
+
+#define NGX_HTTP_CACHE_REFRESH_QUEUE_TIME  1000
+
+
+typedef struct {
+    u_char                           magic[8];
+    uint32_t                         version;
+    uint32_t                         entry_size;
+    uint32_t                         clean;
+    uint64_t                         entries;
+    time_t                           time;
+    size_t                           bsize;
+    u_char                           level[NGX_MAX_PATH_LEVEL];
+} ngx_http_file_cache_index_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    time_t                           expire;
+    time_t                           valid_sec;
+    off_t                            fs_size;
+    uint32_t                         body_start;
+    uint32_t                         uses;
+} ngx_http_file_cache_index_entry_t;
+
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    ngx_uint_t                       slot;
+} ngx_http_file_cache_update_t;
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
@@ -33,7 +75,12 @@ static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
 static ngx_http_file_cache_node_t *
-    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_part_t *part, u_char *key);
+static ngx_uint_t ngx_http_file_cache_partition(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_shmtx_t *ngx_http_file_cache_mutex(ngx_http_file_cache_t *cache,
+    ngx_uint_t n);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static void ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary,
@@ -45,10 +92,41 @@ static ngx_int_t ngx_http_file_cache_reopen(ngx_http_request_t *r,
 static ngx_int_t ngx_http_file_cache_update_variant(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_cleanup(void *data);
+static ngx_int_t ngx_http_file_cache_init_updates(
+    ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_refresh_admit(
+    ngx_http_file_cache_t *cache, u_char *key, ngx_uint_t uses,
+    ngx_uint_t *slot);
+static void ngx_http_file_cache_refresh_cleanup(void *data);
+static ngx_int_t ngx_http_file_cache_ram_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_ram_store(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_ram_cleanup(void *data);
+static void ngx_http_file_cache_ram_release(ngx_http_cache_t *c);
+static void ngx_http_file_cache_ram_remove(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_http_file_cache_ram_node_t *ngx_http_file_cache_ram_lookup(
+    ngx_http_file_cache_t *cache, u_char *key);
+static ngx_http_file_cache_ram_node_t *ngx_http_file_cache_ram_alloc(
+    ngx_http_file_cache_t *cache, size_t size);
+static void ngx_http_file_cache_ram_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_ram_node_t *rn);
+static ngx_int_t ngx_http_file_cache_ram_sweep(ngx_http_file_cache_t *cache);
 static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_forced_expire_part(
+    ngx_http_file_cache_t *cache, ngx_uint_t n, u_char *name);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_expire_part(ngx_http_file_cache_t *cache,
+    ngx_uint_t n, u_char *name);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
-    ngx_queue_t *q, u_char *name);
+    ngx_uint_t n, ngx_queue_t *q, u_char *name);
+static ngx_http_file_cache_node_t *ngx_http_file_cache_alloc_node(
+    ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_free_node(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static off_t ngx_http_file_cache_size(ngx_http_file_cache_t *cache,
+    ngx_uint_t *count);
 static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
@@ -63,6 +141,19 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_save(void *data);
+static void ngx_http_file_cache_delete_index(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_write_index(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_write_index_part(
+    ngx_http_file_cache_t *cache, ngx_uint_t n, ngx_file_t *file,
+    uint64_t *entries);
+static ngx_int_t ngx_http_file_cache_read_index(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_add_entry(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_entry_t *entry);
+
+
+static u_char  ngx_http_file_cache_index_magic[] =
+    { 'n', 'g', 'x', 'c', 'i', 'd', 'x', 0 };
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -76,6 +167,13 @@ ngx_str_t  ngx_http_cache_status[] = {
 };
 
 
+ngx_str_t  ngx_http_cache_ram_status[] = {
+    ngx_string("MISS"),
+    ngx_string("HIT"),
+    ngx_string("STORED")
+};
+
+
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
@@ -84,9 +182,11 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_file_cache_t  *ocache = data;
 
-    size_t                  len;
-    ngx_uint_t              n;
-    ngx_http_file_cache_t  *cache;
+    size_t                       len;
+    ngx_uint_t                   n;
+    ngx_shmtx_sh_t              *lock;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_part_t  *part;
 
     cache = shm_zone->data;
 
@@ -110,9 +210,17 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->partitions != ocache->partitions) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different partitions",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
+        cache->mutex = ocache->mutex;
         cache->bsize = ocache->bsize;
 
         cache->max_size /= cache->bsize;
@@ -121,36 +229,76 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             cache->path->loader = NULL;
         }
 
-        return NGX_OK;
+        return ngx_http_file_cache_init_updates(cache);
     }
 
     cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
         cache->sh = cache->shpool->data;
+        cache->mutex = cache->shpool->locks;
         cache->bsize = ngx_fs_bsize(cache->path->name.data);
         cache->max_size /= cache->bsize;
 
         return NGX_OK;
     }
 
-    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_sh_t));
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_file_cache_sh_t)
+                               + (cache->partitions - 1)
+                                 * sizeof(ngx_http_file_cache_part_t));
     if (cache->sh == NULL) {
         return NGX_ERROR;
     }
 
     cache->shpool->data = cache->sh;
 
-    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
-                    ngx_http_file_cache_rbtree_insert_value);
+    for (n = 0; n < cache->partitions; n++) {
+        part = &cache->sh->parts[n];
+
+        ngx_rbtree_init(&part->rbtree, &part->sentinel,
+                        ngx_http_file_cache_rbtree_insert_value);
 
-    ngx_queue_init(&cache->sh->queue);
+        ngx_queue_init(&part->queue);
+
+        part->size = 0;
+        part->count = 0;
+    }
 
     cache->sh->cold = 1;
     cache->sh->loading = 0;
-    cache->sh->size = 0;
-    cache->sh->count = 0;
     cache->sh->watermark = (ngx_uint_t) -1;
+    cache->sh->updates = NULL;
+    cache->sh->nupdates = 0;
+
+    if (ngx_http_file_cache_init_updates(cache) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(cache->sh->refresh, sizeof(cache->sh->refresh));
+
+    if (cache->partitions > 1) {
+        cache->mutex = ngx_slab_calloc(cache->shpool,
+                                       cache->partitions * sizeof(ngx_shmtx_t));
+        if (cache->mutex == NULL) {
+            return NGX_ERROR;
+        }
+
+        lock = ngx_slab_calloc(cache->shpool,
+                               cache->partitions * sizeof(ngx_shmtx_sh_t));
+        if (lock == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (n = 0; n < cache->partitions; n++) {
+            if (ngx_shmtx_create(&cache->mutex[n], &lock[n], NULL) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        cache->shpool->locks = cache->mutex;
+        cache->shpool->nlocks = cache->partitions;
+    }
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
@@ -172,6 +320,66 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 }
 
 
+static ngx_int_t
+ngx_http_file_cache_ram_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_t  *ocache = data;
+
+    size_t                  len;
+    ngx_slab_pool_t        *shpool;
+    ngx_http_file_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->ram_sh = ocache->ram_sh;
+        cache->ram_shpool = ocache->ram_shpool;
+
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    cache->ram_shpool = shpool;
+
+    if (shm_zone->shm.exists) {
+        cache->ram_sh = shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->ram_sh = ngx_slab_calloc(shpool,
+                                    sizeof(ngx_http_file_cache_ram_sh_t));
+    if (cache->ram_sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = cache->ram_sh;
+
+    ngx_rbtree_init(&cache->ram_sh->rbtree, &cache->ram_sh->sentinel,
+                    ngx_http_file_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->ram_sh->queue);
+    ngx_queue_init(&cache->ram_sh->deleting);
+
+    len = sizeof(" in cache ram zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in cache ram zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* the least recently used copies are evicted on allocation failures */
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_file_cache_new(ngx_http_request_t *r)
 {
@@ -345,6 +553,18 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (c->exists && cache->ram_sh) {
+        rc = ngx_http_file_cache_ram_open(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return rc;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -404,7 +624,9 @@ done:
 static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    ngx_uint_t                 n;
     ngx_msec_t                 now, timer;
+    ngx_shmtx_t               *mutex;
     ngx_http_file_cache_t     *cache;
 
     if (!c->lock) {
@@ -415,7 +637,10 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     cache = c->file_cache;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+
+    ngx_shmtx_lock(mutex);
 
     timer = c->node->lock_time - now;
 
@@ -426,7 +651,7 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->lock_time = c->node->lock_time;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(mutex);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache lock u:%d wt:%M",
@@ -483,8 +708,9 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 static void
 ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_uint_t              wait;
+    ngx_uint_t              n, wait;
     ngx_msec_t              now, timer;
+    ngx_shmtx_t            *mutex;
     ngx_http_file_cache_t  *cache;
 
     now = ngx_current_msec;
@@ -501,7 +727,10 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
     cache = c->file_cache;
     wait = 0;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+
+    ngx_shmtx_lock(mutex);
 
     timer = c->node->lock_time - now;
 
@@ -509,7 +738,7 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
         wait = 1;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(mutex);
 
     if (wait) {
         ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
@@ -533,13 +762,20 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_str_t                     *key;
     ngx_int_t                      rc;
     ngx_uint_t                     i;
+    ngx_shmtx_t                   *mutex;
     ngx_http_file_cache_t         *cache;
     ngx_http_file_cache_header_t  *h;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    if (c->ram) {
+        n = ngx_min((size_t) c->length, c->body_start);
+        ngx_memcpy(c->buf->pos, c->ram->data, n);
 
-    if (n < 0) {
-        return n;
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
+
+        if (n < 0) {
+            return n;
+        }
     }
 
     if ((size_t) n < c->header_start) {
@@ -617,9 +853,12 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     cache = c->file_cache;
 
+    i = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, i);
+
     if (cache->sh->cold) {
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(mutex);
 
         if (!c->node->exists) {
             c->node->uses = 1;
@@ -628,10 +867,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             c->node->uniq = c->uniq;
             c->node->fs_size = c->fs_size;
 
-            cache->sh->size += c->fs_size;
+            cache->sh->parts[i].size += c->fs_size;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(mutex);
     }
 
     now = ngx_time();
@@ -640,7 +879,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->stale_updating = c->valid_sec + c->updating_sec >= now;
         c->stale_error = c->valid_sec + c->error_sec >= now;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(mutex);
 
         if (c->node->updating) {
             rc = NGX_HTTP_CACHE_UPDATING;
@@ -652,7 +891,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             rc = NGX_HTTP_CACHE_STALE;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(mutex);
 
         ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http file cache expired: %i %T %T",
@@ -661,6 +900,27 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (c->valid_sec - now < cache->refresh_ahead) {
+
+        /* the entry expires soon and may be refreshed in background */
+
+        c->refresh = 1;
+
+        if (r->background) {
+            ngx_shmtx_lock(mutex);
+            rc = c->node->updating;
+            ngx_shmtx_unlock(mutex);
+
+            if (rc) {
+                ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                               "http file cache refresh: %T %T",
+                               c->valid_sec, now);
+
+                return NGX_HTTP_CACHE_UPDATING;
+            }
+        }
+    }
+
     return NGX_OK;
 }
 
@@ -822,21 +1082,31 @@ static ngx_int_t
 ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
     ngx_int_t                    rc;
+    ngx_uint_t                   n;
+    ngx_shmtx_t                 *mutex;
     ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_part_t  *part;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+    part = &cache->sh->parts[n];
+
+    ngx_shmtx_lock(mutex);
 
     fcn = c->node;
 
     if (fcn == NULL) {
-        fcn = ngx_http_file_cache_lookup(cache, c->key);
+        fcn = ngx_http_file_cache_lookup(cache, part, c->key);
     }
 
     if (fcn) {
         ngx_queue_remove(&fcn->queue);
 
         if (c->node == NULL) {
-            fcn->uses++;
+            if (fcn->uses < 1023) {
+                fcn->uses++;
+            }
+
             fcn->count++;
         }
 
@@ -868,19 +1138,17 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         goto done;
     }
 
-    fcn = ngx_slab_calloc_locked(cache->shpool,
-                                 sizeof(ngx_http_file_cache_node_t));
+    fcn = ngx_http_file_cache_alloc_node(cache);
     if (fcn == NULL) {
         ngx_http_file_cache_set_watermark(cache);
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(mutex);
 
         (void) ngx_http_file_cache_forced_expire(cache);
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(mutex);
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
+        fcn = ngx_http_file_cache_alloc_node(cache);
         if (fcn == NULL) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                           "could not allocate node%s", cache->shpool->log_ctx);
@@ -889,14 +1157,14 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         }
     }
 
-    cache->sh->count++;
+    part->count++;
 
     ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
     ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    ngx_rbtree_insert(&part->rbtree, &fcn->node);
 
     fcn->uses = 1;
     fcn->count = 1;
@@ -917,7 +1185,7 @@ done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_queue_insert_head(&part->queue, &fcn->queue);
 
     c->uniq = fcn->uniq;
     c->error = fcn->error;
@@ -925,7 +1193,7 @@ done:
 
 failed:
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(mutex);
 
     return rc;
 }
@@ -967,7 +1235,8 @@ ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
 
 
 static ngx_http_file_cache_node_t *
-ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_part_t *part, u_char *key)
 {
     ngx_int_t                    rc;
     ngx_rbtree_key_t             node_key;
@@ -976,8 +1245,8 @@ ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
 
     ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    node = cache->sh->rbtree.root;
-    sentinel = cache->sh->rbtree.sentinel;
+    node = part->rbtree.root;
+    sentinel = part->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -1011,6 +1280,32 @@ ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
 }
 
 
+static ngx_uint_t
+ngx_http_file_cache_partition(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_rbtree_key_t  node_key;
+
+    if (cache->partitions == 1) {
+        return 0;
+    }
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    return node_key % cache->partitions;
+}
+
+
+static ngx_shmtx_t *
+ngx_http_file_cache_mutex(ngx_http_file_cache_t *cache, ngx_uint_t n)
+{
+    if (cache->mutex) {
+        return &cache->mutex[n];
+    }
+
+    return &cache->shpool->mutex;
+}
+
+
 static void
 ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
@@ -1209,6 +1504,8 @@ ngx_http_file_cache_vary_header(ngx_http_request_t *r, ngx_md5_t *md5,
 static ngx_int_t
 ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    ngx_uint_t              n;
+    ngx_shmtx_t            *mutex;
     ngx_http_file_cache_t  *cache;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
@@ -1223,12 +1520,17 @@ ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     cache = c->file_cache;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+
+    ngx_shmtx_lock(mutex);
 
     c->node->count--;
     c->node = NULL;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(mutex);
+
+    ngx_http_file_cache_ram_release(c);
 
     c->secondary = 1;
     c->file.name.len = 0;
@@ -1308,6 +1610,8 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 static ngx_int_t
 ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    ngx_uint_t              n;
+    ngx_shmtx_t            *mutex;
     ngx_http_file_cache_t  *cache;
 
     if (!c->secondary) {
@@ -1330,13 +1634,16 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache main key");
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+
+    ngx_shmtx_lock(mutex);
 
     c->node->count--;
     c->node->updating = 0;
     c->node = NULL;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(mutex);
 
     c->file.name.len = 0;
     c->update_variant = 1;
@@ -1360,6 +1667,8 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 {
     off_t                   fs_size;
     ngx_int_t               rc;
+    ngx_uint_t              n;
+    ngx_shmtx_t            *mutex;
     ngx_file_uniq_t         uniq;
     ngx_file_info_t         fi;
     ngx_http_cache_t        *c;
@@ -1410,14 +1719,17 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
         }
     }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+
+    ngx_shmtx_lock(mutex);
 
     c->node->count--;
     c->node->error = 0;
     c->node->uniq = uniq;
     c->node->body_start = c->body_start;
 
-    cache->sh->size += fs_size - c->node->fs_size;
+    cache->sh->parts[n].size += fs_size - c->node->fs_size;
     c->node->fs_size = fs_size;
 
     if (rc == NGX_OK) {
@@ -1426,7 +1738,9 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     c->node->updating = 0;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(mutex);
+
+    ngx_http_file_cache_ram_remove(cache, c->key);
 }
 
 
@@ -1553,6 +1867,8 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
     (void) ngx_write_file(&file, (u_char *) &h,
                           sizeof(ngx_http_file_cache_header_t), 0);
 
+    ngx_http_file_cache_ram_remove(c->file_cache, c->key);
+
 done:
 
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
@@ -1565,10 +1881,11 @@ done:
 ngx_int_t
 ngx_http_cache_send(ngx_http_request_t *r)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
+    ngx_int_t                      rc;
+    ngx_buf_t                     *b;
+    ngx_chain_t                    out;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_ram_sh_t  *sh;
 
     c = r->cache;
 
@@ -1582,9 +1899,27 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    sh = c->file_cache->ram_sh;
+
+    if (sh && c->ram == NULL) {
+        if (ngx_http_file_cache_ram_store(r, c) == NGX_ERROR) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (c->ram == NULL) {
+            c->ram_status = NGX_HTTP_CACHE_RAM_MISS;
+            (void) ngx_atomic_fetch_add(&sh->misses, 1);
+        }
+
+    } else if (c->ram && c->ram_status == NGX_HTTP_CACHE_RAM_HIT) {
+        (void) ngx_atomic_fetch_add(&sh->hits, 1);
+    }
+
+    if (c->ram == NULL) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
     }
 
     rc = ngx_http_send_header(r);
@@ -1593,17 +1928,27 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return rc;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
+    if (c->ram) {
+
+        /* the copy is kept in the RAM zone until the request is freed */
+
+        b->pos = c->ram->data + c->body_start;
+        b->last = c->ram->data + c->length;
+        b->memory = (c->length - c->body_start) ? 1 : 0;
+
+    } else {
+        b->file_pos = c->body_start;
+        b->file_last = c->length;
+        b->in_file = (c->length - c->body_start) ? 1 : 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+    }
 
-    b->in_file = (c->length - c->body_start) ? 1 : 0;
     b->last_buf = (r == r->main) ? 1 : 0;
     b->last_in_chain = 1;
-    b->sync = (b->last_buf || b->in_file) ? 0 : 1;
-
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    b->sync = (b->last_buf || b->in_file || b->memory) ? 0 : 1;
 
     out.buf = b;
     out.next = NULL;
@@ -1615,8 +1960,11 @@ ngx_http_cache_send(ngx_http_request_t *r)
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
+    ngx_uint_t                   n;
+    ngx_shmtx_t                 *mutex;
     ngx_http_file_cache_t       *cache;
     ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_part_t  *part;
 
     if (c->updated || c->node == NULL) {
         return;
@@ -1627,7 +1975,11 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache free, fd: %d", c->file.fd);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+    part = &cache->sh->parts[n];
+
+    ngx_shmtx_lock(mutex);
 
     fcn = c->node;
     fcn->count--;
@@ -1646,13 +1998,13 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
         ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
+        ngx_rbtree_delete(&part->rbtree, &fcn->node);
+        ngx_http_file_cache_free_node(cache, fcn);
+        part->count--;
         c->node = NULL;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(mutex);
 
     c->updated = 1;
     c->updating = 0;
@@ -1698,595 +2050,1970 @@ ngx_http_file_cache_cleanup(void *data)
 }
 
 
-static time_t
-ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+ngx_int_t
+ngx_http_file_cache_refresh(ngx_http_request_t *r)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       wait;
-    ngx_uint_t                   tries;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q, *sentinel;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
-
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache forced expire");
+    ngx_int_t                      rc;
+    ngx_uint_t                     n, uses, slot;
+    ngx_shmtx_t                   *mutex;
+    ngx_http_cache_t              *c;
+    ngx_pool_cleanup_t            *cln;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_update_t  *u;
 
-    path = cache->path;
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    c = r->cache;
+    cache = c->file_cache;
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_http_file_cache_update_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
 
-    wait = 10;
-    tries = 20;
-    sentinel = NULL;
+    ngx_shmtx_lock(mutex);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    uses = c->node->uses;
 
-    for ( ;; ) {
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            break;
-        }
+    if (!c->updating) {
 
-        q = ngx_queue_last(&cache->sh->queue);
+        /* an entry which is not yet expired */
 
-        if (q == sentinel) {
-            break;
+        if (c->node->updating || uses < cache->refresh_min_uses) {
+            ngx_shmtx_unlock(mutex);
+            return NGX_DECLINED;
         }
 
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+        c->node->updating = 1;
+        c->updating = 1;
+        c->lock_time = c->node->lock_time;
+    }
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
-                  fcn->count, fcn->exists,
-                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+    ngx_shmtx_unlock(mutex);
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            wait = 0;
-            break;
-        }
+    if (cache->updates == 0) {
+        return NGX_OK;
+    }
 
-        if (fcn->deleting) {
-            wait = 1;
-            break;
-        }
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        (void) ngx_hex_dump(p, fcn->key, len);
+    rc = ngx_http_file_cache_refresh_admit(cache, c->key, uses, &slot);
 
-        /*
-         * abnormally exited workers may leave locked cache entries,
-         * and although it may be safe to remove them completely,
-         * we prefer to just move them to the top of the inactive queue
-         */
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        ngx_queue_remove(q);
-        fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache refresh: %i, uses:%ui", rc, uses);
 
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "ignore long locked inactive cache entry %*s, count:%d",
-                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+    if (rc == NGX_OK) {
+        u = cln->data;
+        u->cache = cache;
+        u->slot = slot;
 
-        if (sentinel == NULL) {
-            sentinel = q;
-        }
+        cln->handler = ngx_http_file_cache_refresh_cleanup;
 
-        if (--tries) {
-            continue;
-        }
+        return NGX_OK;
+    }
 
-        wait = 1;
-        break;
+    /* let other requests retry the update */
+
+    ngx_shmtx_lock(mutex);
+
+    if (c->node->lock_time == c->lock_time) {
+        c->node->updating = 0;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(mutex);
 
-    ngx_free(name);
+    c->updating = 0;
 
-    return wait;
+    return NGX_DECLINED;
 }
 
 
-static time_t
-ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
+static ngx_int_t
+ngx_http_file_cache_init_updates(ngx_http_file_cache_t *cache)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_msec_t                   elapsed;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
-
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache expire");
+    ngx_pid_t  *updates;
 
-    path = cache->path;
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    /*
+     * background updates are accounted in slots with pids of the owners,
+     * so the slots of abnormally exited workers can be reclaimed;
+     * the slots are kept across reloads as old workers may still use them
+     */
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
+    if (cache->sh->nupdates >= cache->updates) {
+        return NGX_OK;
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
-
-    now = ngx_time();
-
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    for ( ;; ) {
+    updates = ngx_slab_calloc_locked(cache->shpool,
+                                     cache->updates * sizeof(ngx_pid_t));
 
-        if (ngx_quit || ngx_terminate) {
-            wait = 1;
-            break;
-        }
+    if (updates == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_ERROR;
+    }
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            wait = 10;
-            break;
-        }
+    if (cache->sh->updates) {
+        ngx_memcpy(updates, cache->sh->updates,
+                   cache->sh->nupdates * sizeof(ngx_pid_t));
 
-        q = ngx_queue_last(&cache->sh->queue);
+        ngx_slab_free_locked(cache->shpool, cache->sh->updates);
+    }
 
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    cache->sh->updates = updates;
+    cache->sh->nupdates = cache->updates;
 
-        wait = fcn->expire - now;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        if (wait > 0) {
-            wait = wait > 10 ? 10 : wait;
-            break;
-        }
+    return NGX_OK;
+}
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
-                       fcn->count, fcn->exists,
-                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            goto next;
-        }
+static ngx_int_t
+ngx_http_file_cache_refresh_admit(ngx_http_file_cache_t *cache, u_char *key,
+    ngx_uint_t uses, ngx_uint_t *slot)
+{
+    ngx_int_t                       found;
+    ngx_uint_t                      i, max, busy;
+    ngx_pid_t                       pid;
+    ngx_msec_t                      now;
+    ngx_http_file_cache_refresh_t  *rf, *self, *min;
 
-        if (fcn->deleting) {
-            wait = 1;
-            break;
-        }
+    /*
+     * background updates which could not be started as the limit
+     * was reached are queued along with number of the entry uses;
+     * once an update finishes, the next one is only started
+     * for an entry which is at least as popular as the queued ones
+     */
 
-        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        (void) ngx_hex_dump(p, fcn->key, len);
+    now = ngx_current_msec;
 
-        /*
-         * abnormally exited workers may leave locked cache entries,
-         * and although it may be safe to remove them completely,
-         * we prefer to just move them to the top of the inactive queue
-         */
+    max = 0;
+    self = NULL;
+    min = NULL;
 
-        ngx_queue_remove(q);
-        fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    for (i = 0; i < NGX_HTTP_CACHE_REFRESH_QUEUE; i++) {
+        rf = &cache->sh->refresh[i];
 
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "ignore long locked inactive cache entry %*s, count:%d",
-                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+        if (rf->uses
+            && (ngx_msec_int_t) (now - rf->time)
+               > NGX_HTTP_CACHE_REFRESH_QUEUE_TIME)
+        {
+            rf->uses = 0;
+        }
 
-next:
+        if (rf->uses == 0) {
+            if (min == NULL || min->uses) {
+                min = rf;
+            }
 
-        if (++cache->files >= cache->manager_files) {
-            wait = 0;
-            break;
+            continue;
         }
 
-        ngx_time_update();
+        if (ngx_memcmp(rf->key, key, NGX_HTTP_CACHE_KEY_LEN) == 0) {
+            self = rf;
+            continue;
+        }
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+        if (rf->uses > max) {
+            max = rf->uses;
+        }
 
-        if (elapsed >= cache->manager_threshold) {
-            wait = 0;
-            break;
+        if (min == NULL || rf->uses < min->uses) {
+            min = rf;
         }
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    busy = 0;
+    found = -1;
 
-    ngx_free(name);
+    for (i = 0; i < cache->sh->nupdates; i++) {
+        if (cache->sh->updates[i]) {
+            busy++;
 
-    return wait;
-}
+        } else if (found == -1) {
+            found = i;
+        }
+    }
 
+#if !(NGX_WIN32)
 
-static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
-{
-    u_char                      *p;
-    size_t                       len;
-    ngx_path_t                  *path;
-    ngx_http_file_cache_node_t  *fcn;
+    if (busy >= cache->updates && uses >= max) {
 
-    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+        /* reclaim slots of the workers which exited abnormally */
 
-    if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size;
+        for (i = 0; i < cache->sh->nupdates; i++) {
+            pid = cache->sh->updates[i];
 
-        path = cache->path;
-        p = name + path->name.len + 1 + path->len;
-        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        p = ngx_hex_dump(p, fcn->key, len);
-        *p = '\0';
+            if (pid == 0 || pid == ngx_pid
+                || kill(pid, 0) != -1 || ngx_errno != NGX_ESRCH)
+            {
+                continue;
+            }
 
-        fcn->count++;
-        fcn->deleting = 1;
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "cache \"%V\" background update of "
+                          "exited process %P reclaimed",
+                          &cache->shm_zone->shm.name, pid);
 
-        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
-        ngx_create_hashed_filename(path, name, len);
+            cache->sh->updates[i] = 0;
+            busy--;
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: \"%s\"", name);
+            if (found == -1) {
+                found = i;
+            }
+        }
+    }
 
-        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
-                          ngx_delete_file_n " \"%s\" failed", name);
+#endif
+
+    if (busy < cache->updates && found != -1 && uses >= max) {
+        cache->sh->updates[found] = ngx_pid;
+        *slot = found;
+
+        if (self) {
+            self->uses = 0;
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
-        fcn->count--;
-        fcn->deleting = 0;
+        return NGX_OK;
     }
 
-    if (fcn->count == 0) {
-        ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
+    if (self == NULL) {
+        if (min == NULL || (min->uses && min->uses >= uses)) {
+            return NGX_DECLINED;
+        }
+
+        self = min;
+        ngx_memcpy(self->key, key, NGX_HTTP_CACHE_KEY_LEN);
     }
+
+    self->uses = uses;
+    self->time = now;
+
+    return NGX_DECLINED;
 }
 
 
-static ngx_msec_t
-ngx_http_file_cache_manager(void *data)
+static void
+ngx_http_file_cache_refresh_cleanup(void *data)
 {
-    ngx_http_file_cache_t  *cache = data;
+    ngx_http_file_cache_update_t  *u = data;
 
-    off_t       size, free;
-    time_t      wait;
-    ngx_msec_t  elapsed, next;
-    ngx_uint_t  count, watermark;
+    ngx_http_file_cache_t  *cache;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    cache = u->cache;
 
-    next = (ngx_msec_t) ngx_http_file_cache_expire(cache) * 1000;
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    if (next == 0) {
-        next = cache->manager_sleep;
-        goto done;
+    if (u->slot < cache->sh->nupdates) {
+        cache->sh->updates[u->slot] = 0;
     }
 
-    for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
-
-        size = cache->sh->size;
-        count = cache->sh->count;
-        watermark = cache->sh->watermark;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache size: %O c:%ui w:%i",
-                       size, count, (ngx_int_t) watermark);
+static ngx_int_t
+ngx_http_file_cache_ram_open(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_pool_cleanup_t              *cln;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_ram_ref_t   *ref;
+    ngx_http_file_cache_ram_node_t  *rn;
 
-        if (size < cache->max_size && count < watermark) {
+    ngx_http_file_cache_ram_release(c);
 
-            if (!cache->min_free) {
-                break;
-            }
+    cache = c->file_cache;
 
-            free = ngx_fs_available(cache->path->name.data);
+    ngx_shmtx_lock(&cache->ram_shpool->mutex);
 
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                           "http file cache free: %O", free);
+    /* the reference is allocated first, as this may evict copies */
 
-            if (free > cache->min_free) {
-                break;
-            }
-        }
+    ref = (ngx_http_file_cache_ram_ref_t *)
+              ngx_http_file_cache_ram_alloc(cache,
+                                        sizeof(ngx_http_file_cache_ram_ref_t));
+    if (ref == NULL) {
+        ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+        return NGX_DECLINED;
+    }
 
-        wait = ngx_http_file_cache_forced_expire(cache);
+    rn = ngx_http_file_cache_ram_lookup(cache, c->key);
 
-        if (wait > 0) {
-            next = (ngx_msec_t) wait * 1000;
-            break;
-        }
+    if (rn == NULL || rn->uniq != c->uniq) {
+        ngx_slab_free_locked(cache->ram_shpool, ref);
+        ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+        return NGX_DECLINED;
+    }
 
-        if (ngx_quit || ngx_terminate) {
-            break;
-        }
+    ref->pid = ngx_pid;
+    ngx_queue_insert_tail(&rn->refs, &ref->queue);
 
-        if (++cache->files >= cache->manager_files) {
-            next = cache->manager_sleep;
-            break;
-        }
+    ngx_queue_remove(&rn->queue);
+    ngx_queue_insert_head(&cache->ram_sh->queue, &rn->queue);
 
-        ngx_time_update();
+    ngx_shmtx_unlock(&cache->ram_shpool->mutex);
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    c->ram = rn;
+    c->ram_ref = ref;
 
-        if (elapsed >= cache->manager_threshold) {
-            next = cache->manager_sleep;
-            break;
-        }
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        ngx_http_file_cache_ram_release(c);
+        return NGX_ERROR;
     }
 
-done:
+    cln->handler = ngx_http_file_cache_ram_cleanup;
+    cln->data = c;
 
-    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache ram: %uz", rn->len);
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache manager: %ui e:%M n:%M",
-                   cache->files, elapsed, next);
+    c->length = rn->len;
+    c->ram_status = NGX_HTTP_CACHE_RAM_HIT;
 
-    return next;
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
 }
 
 
-static void
-ngx_http_file_cache_loader(void *data)
+static ngx_int_t
+ngx_http_file_cache_ram_store(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_t  *cache = data;
+    size_t                           size;
+    ssize_t                          n;
+    ngx_uint_t                       i, uses;
+    ngx_shmtx_t                     *mutex;
+    ngx_pool_cleanup_t              *cln;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_ram_ref_t   *ref;
+    ngx_http_file_cache_ram_node_t  *rn;
 
-    ngx_tree_ctx_t  tree;
+    cache = c->file_cache;
 
-    if (!cache->sh->cold || cache->sh->loading) {
-        return;
+    if (c->node == NULL
+        || c->file.fd == NGX_INVALID_FILE
+        || c->length > (off_t) cache->ram_max_size
+        || c->valid_sec < ngx_time())
+    {
+        return NGX_DECLINED;
     }
 
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
-        return;
-    }
+    i = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, i);
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
+    ngx_shmtx_lock(mutex);
+    uses = c->node->uses;
+    ngx_shmtx_unlock(mutex);
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    tree.data = cache;
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+    if (uses < cache->ram_min_uses) {
+        return NGX_DECLINED;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_file_cache_ram_cleanup;
+    cln->data = c;
+
+    size = offsetof(ngx_http_file_cache_ram_node_t, data) + c->length;
+
+    ngx_shmtx_lock(&cache->ram_shpool->mutex);
+
+    rn = ngx_http_file_cache_ram_lookup(cache, c->key);
+
+    if (rn && rn->uniq == c->uniq) {
+        ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ref = (ngx_http_file_cache_ram_ref_t *)
+              ngx_http_file_cache_ram_alloc(cache,
+                                        sizeof(ngx_http_file_cache_ram_ref_t));
+    if (ref == NULL) {
+        ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    rn = ngx_http_file_cache_ram_alloc(cache, size);
+
+    if (rn == NULL) {
+        ngx_slab_free_locked(cache->ram_shpool, ref);
+        ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+
+    /* the copy is not in the tree yet and is read without the lock */
+
+    n = ngx_read_file(&c->file, rn->data, c->length, 0);
+
+    if (n != c->length) {
+        if (n != NGX_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                          ngx_read_file_n " read only %z of %O from \"%s\"",
+                          n, c->length, c->file.name.data);
+        }
+
+        ngx_shmtx_lock(&cache->ram_shpool->mutex);
+        ngx_slab_free_locked(cache->ram_shpool, ref);
+        ngx_slab_free_locked(cache->ram_shpool, rn);
+        ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+
+        return NGX_DECLINED;
+    }
+
+    ngx_memcpy((u_char *) &rn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(rn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_queue_init(&rn->refs);
+    rn->deleting = 0;
+    rn->uniq = c->uniq;
+    rn->len = c->length;
+
+    ref->pid = ngx_pid;
+    ngx_queue_insert_tail(&rn->refs, &ref->queue);
+
+    ngx_shmtx_lock(&cache->ram_shpool->mutex);
+
+    c->ram = ngx_http_file_cache_ram_lookup(cache, c->key);
+
+    if (c->ram) {
+        if (c->ram->uniq == c->uniq) {
+
+            /* stored by another process meanwhile */
+
+            c->ram = NULL;
+
+            ngx_slab_free_locked(cache->ram_shpool, ref);
+            ngx_slab_free_locked(cache->ram_shpool, rn);
+            ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+
+            return NGX_DECLINED;
+        }
+
+        ngx_http_file_cache_ram_delete(cache, c->ram);
+    }
+
+    ngx_rbtree_insert(&cache->ram_sh->rbtree, &rn->node);
+    ngx_queue_insert_head(&cache->ram_sh->queue, &rn->queue);
+
+    cache->ram_sh->size += rn->len;
+    cache->ram_sh->stores++;
+
+    ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache ram store: %uz", rn->len);
+
+    c->ram = rn;
+    c->ram_ref = ref;
+    c->ram_status = NGX_HTTP_CACHE_RAM_STORED;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_ram_cleanup(void *data)
+{
+    ngx_http_cache_t  *c = data;
+
+    ngx_http_file_cache_ram_release(c);
+}
+
+
+static void
+ngx_http_file_cache_ram_release(ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    rn = c->ram;
+
+    if (rn == NULL) {
+        return;
+    }
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->ram_shpool->mutex);
+
+    ngx_queue_remove(&c->ram_ref->queue);
+    ngx_slab_free_locked(cache->ram_shpool, c->ram_ref);
+
+    if (ngx_queue_empty(&rn->refs) && rn->deleting) {
+        ngx_queue_remove(&rn->queue);
+        ngx_slab_free_locked(cache->ram_shpool, rn);
+    }
+
+    ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+
+    c->ram = NULL;
+    c->ram_ref = NULL;
+}
+
+
+static void
+ngx_http_file_cache_ram_remove(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    if (cache->ram_sh == NULL) {
+        return;
+    }
+
+    ngx_shmtx_lock(&cache->ram_shpool->mutex);
+
+    rn = ngx_http_file_cache_ram_lookup(cache, key);
+
+    if (rn) {
+        ngx_http_file_cache_ram_delete(cache, rn);
+    }
+
+    ngx_shmtx_unlock(&cache->ram_shpool->mutex);
+}
+
+
+static ngx_http_file_cache_ram_node_t *
+ngx_http_file_cache_ram_lookup(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                        rc;
+    ngx_rbtree_key_t                 node_key;
+    ngx_rbtree_node_t               *node, *sentinel;
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->ram_sh->rbtree.root;
+    sentinel = cache->ram_sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        rn = (ngx_http_file_cache_ram_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], rn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return rn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static ngx_http_file_cache_ram_node_t *
+ngx_http_file_cache_ram_alloc(ngx_http_file_cache_t *cache, size_t size)
+{
+    ngx_uint_t                       swept;
+    ngx_queue_t                     *q, *prev;
+    ngx_http_file_cache_ram_node_t  *rn, *orn;
+
+    rn = ngx_slab_alloc_locked(cache->ram_shpool, size);
+
+    if (rn) {
+        return rn;
+    }
+
+    swept = 0;
+
+again:
+
+    /* evict the least recently used copies which are not being sent */
+
+    for (q = ngx_queue_last(&cache->ram_sh->queue);
+         q != ngx_queue_sentinel(&cache->ram_sh->queue);
+         q = prev)
+    {
+        prev = ngx_queue_prev(q);
+
+        orn = ngx_queue_data(q, ngx_http_file_cache_ram_node_t, queue);
+
+        if (!ngx_queue_empty(&orn->refs)) {
+            continue;
+        }
+
+        ngx_http_file_cache_ram_delete(cache, orn);
+
+        cache->ram_sh->evictions++;
+
+        rn = ngx_slab_alloc_locked(cache->ram_shpool, size);
+
+        if (rn) {
+            return rn;
+        }
+    }
+
+    if (!swept && ngx_http_file_cache_ram_sweep(cache) == NGX_OK) {
+        swept = 1;
+        goto again;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_ram_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_ram_node_t *rn)
+{
+    ngx_rbtree_delete(&cache->ram_sh->rbtree, &rn->node);
+    ngx_queue_remove(&rn->queue);
+
+    cache->ram_sh->size -= rn->len;
+
+    if (!ngx_queue_empty(&rn->refs)) {
+        rn->deleting = 1;
+        ngx_queue_insert_tail(&cache->ram_sh->deleting, &rn->queue);
+        return;
+    }
+
+    ngx_slab_free_locked(cache->ram_shpool, rn);
+}
+
+
+/*
+ * copies are referenced by the processes which send them; the references
+ * of processes which exited abnormally are dropped, at most once a second,
+ * when memory is needed and all copies are referenced
+ */
+
+static ngx_int_t
+ngx_http_file_cache_ram_sweep(ngx_http_file_cache_t *cache)
+{
+#if !(NGX_WIN32)
+
+    ngx_pid_t                        pid, alive, dead;
+    ngx_uint_t                       i, n;
+    ngx_queue_t                     *queue[2], *q, *next, *r, *rnext;
+    ngx_http_file_cache_ram_ref_t   *ref;
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    if (cache->ram_sh->swept == ngx_time()) {
+        return NGX_DECLINED;
+    }
+
+    cache->ram_sh->swept = ngx_time();
+
+    queue[0] = &cache->ram_sh->queue;
+    queue[1] = &cache->ram_sh->deleting;
+
+    alive = ngx_pid;
+    dead = 0;
+    n = 0;
+
+    for (i = 0; i < 2; i++) {
+
+        for (q = ngx_queue_head(queue[i]);
+             q != ngx_queue_sentinel(queue[i]);
+             q = next)
+        {
+            next = ngx_queue_next(q);
+
+            rn = ngx_queue_data(q, ngx_http_file_cache_ram_node_t, queue);
+
+            for (r = ngx_queue_head(&rn->refs);
+                 r != ngx_queue_sentinel(&rn->refs);
+                 r = rnext)
+            {
+                rnext = ngx_queue_next(r);
+
+                ref = ngx_queue_data(r, ngx_http_file_cache_ram_ref_t, queue);
+                pid = ref->pid;
+
+                if (pid == alive) {
+                    continue;
+                }
+
+                if (pid != dead) {
+                    if (kill(pid, 0) != -1 || ngx_errno != NGX_ESRCH) {
+                        alive = pid;
+                        continue;
+                    }
+
+                    dead = pid;
+                }
+
+                ngx_queue_remove(r);
+                ngx_slab_free_locked(cache->ram_shpool, ref);
+
+                n++;
+            }
+
+            if (rn->deleting && ngx_queue_empty(&rn->refs)) {
+                ngx_queue_remove(q);
+                ngx_slab_free_locked(cache->ram_shpool, rn);
+            }
+        }
+    }
+
+    if (n == 0) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "cache \"%V\" %ui ram references of exited processes "
+                  "reclaimed", &cache->shm_zone->shm.name, n);
+
+    return NGX_OK;
+
+#else
+
+    return NGX_DECLINED;
+
+#endif
+}
+
+
+static time_t
+ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+{
+    u_char      *name;
+    size_t       len;
+    time_t       wait, w;
+    ngx_uint_t   i;
+    ngx_path_t  *path;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache forced expire");
+
+    path = cache->path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    /* the partitions are tried in turn until an entry is deleted */
+
+    wait = 10;
+
+    for (i = 0; i < cache->partitions; i++) {
+
+        w = ngx_http_file_cache_forced_expire_part(cache, cache->forced_part,
+                                                   name);
+
+        cache->forced_part = (cache->forced_part + 1) % cache->partitions;
+
+        if (w < wait) {
+            wait = w;
+        }
+
+        if (wait == 0) {
+            break;
+        }
+    }
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_forced_expire_part(ngx_http_file_cache_t *cache,
+    ngx_uint_t n, u_char *name)
+{
+    u_char                      *p;
+    size_t                       len;
+    time_t                       wait;
+    ngx_uint_t                   tries;
+    ngx_queue_t                 *q, *sentinel;
+    ngx_shmtx_t                 *mutex;
+    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_part_t  *part;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    mutex = ngx_http_file_cache_mutex(cache, n);
+    part = &cache->sh->parts[n];
+
+    wait = 10;
+    tries = 20;
+    sentinel = NULL;
+
+    ngx_shmtx_lock(mutex);
+
+    for ( ;; ) {
+        if (ngx_queue_empty(&part->queue)) {
+            break;
+        }
+
+        q = ngx_queue_last(&part->queue);
+
+        if (q == sentinel) {
+            break;
+        }
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
+                  fcn->count, fcn->exists,
+                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        if (fcn->count == 0) {
+            ngx_http_file_cache_delete(cache, n, q, name);
+            wait = 0;
+            break;
+        }
+
+        if (fcn->deleting) {
+            wait = 1;
+            break;
+        }
+
+        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        (void) ngx_hex_dump(p, fcn->key, len);
+
+        /*
+         * abnormally exited workers may leave locked cache entries,
+         * and although it may be safe to remove them completely,
+         * we prefer to just move them to the top of the inactive queue
+         */
+
+        ngx_queue_remove(q);
+        fcn->expire = ngx_time() + cache->inactive;
+        ngx_queue_insert_head(&part->queue, &fcn->queue);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "ignore long locked inactive cache entry %*s, count:%d",
+                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+
+        if (sentinel == NULL) {
+            sentinel = q;
+        }
+
+        if (--tries) {
+            continue;
+        }
+
+        wait = 1;
+        break;
+    }
+
+    ngx_shmtx_unlock(mutex);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
+{
+    u_char      *name;
+    size_t       len;
+    time_t       wait, w;
+    ngx_uint_t   i;
+    ngx_path_t  *path;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache expire");
+
+    path = cache->path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    /*
+     * the partitions are processed in turn, and if the manager
+     * limits are reached, the next run continues with the same partition
+     */
+
+    wait = 10;
+
+    for (i = 0; i < cache->partitions; i++) {
+
+        w = ngx_http_file_cache_expire_part(cache, cache->expire_part, name);
+
+        if (w < wait) {
+            wait = w;
+        }
+
+        if (wait == 0 || ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        cache->expire_part = (cache->expire_part + 1) % cache->partitions;
+    }
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_expire_part(ngx_http_file_cache_t *cache, ngx_uint_t n,
+    u_char *name)
+{
+    u_char                      *p;
+    size_t                       len;
+    time_t                       now, wait;
+    ngx_msec_t                   elapsed;
+    ngx_queue_t                 *q;
+    ngx_shmtx_t                 *mutex;
+    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_part_t  *part;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    mutex = ngx_http_file_cache_mutex(cache, n);
+    part = &cache->sh->parts[n];
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(mutex);
+
+    for ( ;; ) {
+
+        if (ngx_quit || ngx_terminate) {
+            wait = 1;
+            break;
+        }
+
+        if (ngx_queue_empty(&part->queue)) {
+            wait = 10;
+            break;
+        }
+
+        q = ngx_queue_last(&part->queue);
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        wait = fcn->expire - now;
+
+        if (wait > 0) {
+            wait = wait > 10 ? 10 : wait;
+            break;
+        }
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
+                       fcn->count, fcn->exists,
+                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        if (fcn->count == 0) {
+            ngx_http_file_cache_delete(cache, n, q, name);
+            goto next;
+        }
+
+        if (fcn->deleting) {
+            wait = 1;
+            break;
+        }
+
+        p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        (void) ngx_hex_dump(p, fcn->key, len);
+
+        /*
+         * abnormally exited workers may leave locked cache entries,
+         * and although it may be safe to remove them completely,
+         * we prefer to just move them to the top of the inactive queue
+         */
+
+        ngx_queue_remove(q);
+        fcn->expire = ngx_time() + cache->inactive;
+        ngx_queue_insert_head(&part->queue, &fcn->queue);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "ignore long locked inactive cache entry %*s, count:%d",
+                      (size_t) 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+
+next:
+
+        if (++cache->files >= cache->manager_files) {
+            wait = 0;
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            wait = 0;
+            break;
+        }
+    }
+
+    ngx_shmtx_unlock(mutex);
+
+    return wait;
+}
+
+
+static void
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_uint_t n,
+    ngx_queue_t *q, u_char *name)
+{
+    u_char                      *p;
+    size_t                       len;
+    ngx_path_t                  *path;
+    ngx_shmtx_t                 *mutex;
+    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_part_t  *part;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
+
+    mutex = ngx_http_file_cache_mutex(cache, n);
+    part = &cache->sh->parts[n];
+
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    if (fcn->exists) {
+        part->size -= fcn->fs_size;
+
+        path = cache->path;
+        p = name + path->name.len + 1 + path->len;
+        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        p = ngx_hex_dump(p, fcn->key, len);
+        *p = '\0';
+
+        fcn->count++;
+        fcn->deleting = 1;
+        ngx_shmtx_unlock(mutex);
+
+        if (cache->ram_sh) {
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            ngx_http_file_cache_ram_remove(cache, key);
+        }
+
+        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+        ngx_create_hashed_filename(path, name, len);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: \"%s\"", name);
+
+        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+
+        ngx_shmtx_lock(mutex);
+        fcn->count--;
+        fcn->deleting = 0;
+    }
+
+    if (fcn->count == 0) {
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&part->rbtree, &fcn->node);
+        ngx_http_file_cache_free_node(cache, fcn);
+        part->count--;
+    }
+}
+
+
+static ngx_http_file_cache_node_t *
+ngx_http_file_cache_alloc_node(ngx_http_file_cache_t *cache)
+{
+    /* with partitions, the slab allocator locks the zone mutex itself */
+
+    if (cache->mutex) {
+        return ngx_slab_calloc(cache->shpool,
+                               sizeof(ngx_http_file_cache_node_t));
+    }
+
+    return ngx_slab_calloc_locked(cache->shpool,
+                                  sizeof(ngx_http_file_cache_node_t));
+}
+
+
+static void
+ngx_http_file_cache_free_node(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    if (cache->mutex) {
+        ngx_slab_free(cache->shpool, fcn);
+        return;
+    }
+
+    ngx_slab_free_locked(cache->shpool, fcn);
+}
+
+
+static off_t
+ngx_http_file_cache_size(ngx_http_file_cache_t *cache, ngx_uint_t *count)
+{
+    off_t         size;
+    ngx_uint_t    n;
+    ngx_shmtx_t  *mutex;
+
+    size = 0;
+    *count = 0;
+
+    for (n = 0; n < cache->partitions; n++) {
+        mutex = ngx_http_file_cache_mutex(cache, n);
+
+        ngx_shmtx_lock(mutex);
+
+        size += cache->sh->parts[n].size;
+        *count += cache->sh->parts[n].count;
+
+        ngx_shmtx_unlock(mutex);
+    }
+
+    return size;
+}
+
+
+static ngx_msec_t
+ngx_http_file_cache_manager(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    off_t       size, free;
+    time_t      wait;
+    ngx_msec_t  elapsed, next;
+    ngx_uint_t  count, watermark;
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+
+    next = (ngx_msec_t) ngx_http_file_cache_expire(cache) * 1000;
+
+    if (next == 0) {
+        next = cache->manager_sleep;
+        goto done;
+    }
+
+    for ( ;; ) {
+        size = ngx_http_file_cache_size(cache, &count);
+        watermark = cache->sh->watermark;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache size: %O c:%ui w:%i",
+                       size, count, (ngx_int_t) watermark);
+
+        if (size < cache->max_size && count < watermark) {
+
+            if (!cache->min_free) {
+                break;
+            }
+
+            free = ngx_fs_available(cache->path->name.data);
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                           "http file cache free: %O", free);
+
+            if (free > cache->min_free) {
+                break;
+            }
+        }
+
+        wait = ngx_http_file_cache_forced_expire(cache);
+
+        if (wait > 0) {
+            next = (ngx_msec_t) wait * 1000;
+            break;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        if (++cache->files >= cache->manager_files) {
+            next = cache->manager_sleep;
+            break;
+        }
+
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        if (elapsed >= cache->manager_threshold) {
+            next = cache->manager_sleep;
+            break;
+        }
+    }
+
+done:
+
+    if (cache->index.len && !cache->sh->cold) {
+        ngx_http_file_cache_delete_index(cache);
+    }
+
+    elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache manager: %ui e:%M n:%M",
+                   cache->files, elapsed, next);
+
+    return next;
+}
+
+
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    off_t           size;
+    ngx_int_t       rc;
+    ngx_uint_t      count;
+    ngx_tree_ctx_t  tree;
+
+    if (!cache->sh->cold || cache->sh->loading) {
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader");
+
+    if (cache->index.len) {
+        rc = ngx_http_file_cache_read_index(cache);
+
+        if (rc == NGX_ABORT) {
+            cache->sh->loading = 0;
+            return;
+        }
+
+        if (rc == NGX_OK) {
+            /*
+             * the cache is usable now, but the directories are still
+             * walked to add the files unknown to the index
+             */
+
+            cache->sh->cold = 0;
+        }
+    }
+
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_file_cache_manage_file;
+    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
+    tree.post_tree_handler = ngx_http_file_cache_noop;
+    tree.spec_handler = ngx_http_file_cache_delete_file;
+    tree.data = cache;
+    tree.alloc = 0;
+    tree.log = ngx_cycle->log;
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+
+    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
+        cache->sh->loading = 0;
+        return;
+    }
+
+    cache->sh->cold = 0;
+    cache->sh->loading = 0;
+
+    size = ngx_http_file_cache_size(cache, &count);
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz",
+                  &cache->path->name,
+                  ((double) size * cache->bsize) / (1024 * 1024),
+                  cache->bsize);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t              elapsed;
+    ngx_http_file_cache_t  *cache;
+
+    cache = ctx->data;
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
+    }
+
+    if (++cache->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(cache);
+
+    } else {
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(cache);
+        }
+    }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    if (path->len >= 5
+        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+{
+    ngx_msleep(cache->loader_sleep);
+
+    ngx_time_update();
 
     cache->last = ngx_current_msec;
     cache->files = 0;
+}
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
-        cache->sh->loading = 0;
-        return;
+
+static ngx_int_t
+ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+{
+    u_char                 *p;
+    ngx_int_t               n;
+    ngx_uint_t              i;
+    ngx_http_cache_t        c;
+    ngx_http_file_cache_t  *cache;
+
+    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
     }
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+    /*
+     * Temporary files in cache have a suffix consisting of a dot
+     * followed by 10 digits.
+     */
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
-                  cache->bsize);
+    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
+        && name->data[name->len - 10 - 1] == '.')
+    {
+        return NGX_OK;
+    }
+
+    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "cache file \"%s\" is too small", name->data);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+    cache = ctx->data;
+
+    c.length = ctx->size;
+    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+
+    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        p += 2;
+
+        c.key[i] = (u_char) n;
+    }
+
+    return ngx_http_file_cache_add(cache, &c);
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
+    ngx_uint_t                   n;
+    ngx_shmtx_t                 *mutex;
+    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_part_t  *part;
+
+    n = ngx_http_file_cache_partition(cache, c->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+    part = &cache->sh->parts[n];
+
+    ngx_shmtx_lock(mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, part, c->key);
+
+    if (fcn == NULL) {
+
+        fcn = ngx_http_file_cache_alloc_node(cache);
+        if (fcn == NULL) {
+            ngx_http_file_cache_set_watermark(cache);
+
+            if (cache->fail_time != ngx_time()) {
+                cache->fail_time = ngx_time();
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                           "could not allocate node%s", cache->shpool->log_ctx);
+            }
+
+            ngx_shmtx_unlock(mutex);
+            return NGX_ERROR;
+        }
+
+        part->count++;
+
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&part->rbtree, &fcn->node);
+
+        fcn->uses = 1;
+        fcn->exists = 1;
+        fcn->fs_size = c->fs_size;
+
+        part->size += c->fs_size;
+
+    } else {
+
+        if (!cache->sh->cold) {
+            /* the cache was loaded from the index */
+            ngx_shmtx_unlock(mutex);
+            return NGX_OK;
+        }
+
+        ngx_queue_remove(&fcn->queue);
+    }
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_queue_insert_head(&part->queue, &fcn->queue);
+
+    ngx_shmtx_unlock(mutex);
+
     return NGX_OK;
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 {
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
 
-    cache = ctx->data;
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+{
+    ngx_uint_t  n, count;
+
+    /* a partition lock is held, so other partitions are read without it */
+
+    count = 0;
+
+    for (n = 0; n < cache->partitions; n++) {
+        count += cache->sh->parts[n].count;
     }
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+    cache->sh->watermark = count - count / 8;
 
-    } else {
-        ngx_time_update();
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache watermark: %ui", cache->sh->watermark);
+}
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+static void
+ngx_http_file_cache_save(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    /* called by the master process on exit, after all other processes */
+
+    if (cache->index.len == 0 || cache->sh == NULL || cache->sh->cold) {
+        return;
+    }
+
+    ngx_http_file_cache_write_index(cache);
+}
+
+
+static void
+ngx_http_file_cache_delete_index(ngx_http_file_cache_t *cache)
+{
+    ngx_err_t  err;
+
+    /*
+     * the index describes the cache at the last exit, and is outdated
+     * once the cache is used, by this or by another master process
+     * after binary upgrade; the removal is tried once a second
+     */
+
+    if (cache->index_time == ngx_time()) {
+        return;
+    }
+
+    cache->index_time = ngx_time();
+
+    if (ngx_delete_file(cache->index.data) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                          ngx_delete_file_n " \"%V\" failed", &cache->index);
+        }
+
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index \"%V\" deleted", &cache->index);
+}
+
+
+static void
+ngx_http_file_cache_write_index(ngx_http_file_cache_t *cache)
+{
+    u_char                              *name;
+    uint64_t                             entries;
+    ngx_uint_t                           n;
+    ngx_file_t                           file;
+    ngx_http_file_cache_index_header_t   header;
+
+    name = ngx_alloc(cache->index.len + sizeof(".tmp"), ngx_cycle->log);
+    if (name == NULL) {
+        return;
+    }
+
+    (void) ngx_sprintf(name, "%V.tmp%Z", &cache->index);
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name.data = name;
+    file.name.len = cache->index.len + sizeof(".tmp") - 1;
+    file.log = ngx_cycle->log;
+
+    file.fd = ngx_open_file(name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                            NGX_FILE_DEFAULT_ACCESS);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        ngx_free(name);
+        return;
+    }
+
+    ngx_memzero(&header, sizeof(ngx_http_file_cache_index_header_t));
+
+    ngx_memcpy(header.magic, ngx_http_file_cache_index_magic,
+               sizeof(header.magic));
+    header.version = NGX_HTTP_CACHE_INDEX_VERSION;
+    header.entry_size = sizeof(ngx_http_file_cache_index_entry_t);
+    header.clean = 1;
+    header.time = ngx_time();
+    header.bsize = cache->bsize;
+
+    for (n = 0; n < NGX_MAX_PATH_LEVEL; n++) {
+        header.level[n] = (u_char) cache->path->level[n];
+    }
+
+    file.offset = sizeof(ngx_http_file_cache_index_header_t);
+
+    entries = 0;
+
+    for (n = 0; n < cache->partitions; n++) {
+        if (ngx_http_file_cache_write_index_part(cache, n, &file, &entries)
+            != NGX_OK)
+        {
+            goto failed;
+        }
+    }
+
+    header.entries = entries;
+
+    if (ngx_write_file(&file, (u_char *) &header,
+                       sizeof(ngx_http_file_cache_index_header_t), 0)
+        == NGX_ERROR)
+    {
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+        goto delete;
+    }
+
+    if (ngx_rename_file(name, cache->index.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%V\" failed",
+                      name, &cache->index);
+        goto delete;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index \"%V\": %uL entries",
+                   &cache->index, entries);
+
+    ngx_free(name);
+
+    return;
+
+failed:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+delete:
+
+    if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", name);
+    }
+
+    ngx_free(name);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_write_index_part(ngx_http_file_cache_t *cache,
+    ngx_uint_t n, ngx_file_t *file, uint64_t *entries)
+{
+    size_t                               size;
+    ngx_uint_t                           count, i;
+    ngx_queue_t                         *q;
+    ngx_shmtx_t                         *mutex;
+    ngx_http_file_cache_node_t          *fcn;
+    ngx_http_file_cache_part_t          *part;
+    ngx_http_file_cache_index_entry_t   *entry, *buf;
+
+    mutex = ngx_http_file_cache_mutex(cache, n);
+    part = &cache->sh->parts[n];
+
+    ngx_shmtx_lock(mutex);
+    count = part->count;
+    ngx_shmtx_unlock(mutex);
+
+    /* a room for entries added meanwhile */
+
+    count += count / 8 + 16;
+
+    buf = ngx_alloc(count * sizeof(ngx_http_file_cache_index_entry_t),
+                    ngx_cycle->log);
+    if (buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the entries are copied from the most recently used ones,
+     * and are stored from the least recently used ones
+     */
+
+    i = count;
+
+    ngx_shmtx_lock(mutex);
+
+    for (q = ngx_queue_head(&part->queue);
+         q != ngx_queue_sentinel(&part->queue) && i > 0;
+         q = ngx_queue_next(q))
+    {
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        if (!fcn->exists || fcn->deleting) {
+            continue;
+        }
+
+        entry = &buf[--i];
+
+        ngx_memcpy(entry->key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&entry->key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
-        }
+        entry->expire = fcn->expire;
+        entry->valid_sec = fcn->valid_sec;
+        entry->fs_size = fcn->fs_size;
+        entry->body_start = (uint32_t) fcn->body_start;
+        entry->uses = fcn->uses;
     }
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
-}
+    ngx_shmtx_unlock(mutex);
 
+    size = (count - i) * sizeof(ngx_http_file_cache_index_entry_t);
 
-static ngx_int_t
-ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    if (path->len >= 5
-        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
+    if (size
+        && ngx_write_file(file, (u_char *) &buf[i], size, file->offset)
+           == NGX_ERROR)
     {
-        return NGX_DECLINED;
+        ngx_free(buf);
+        return NGX_ERROR;
     }
 
+    *entries += count - i;
+
+    ngx_free(buf);
+
     return NGX_OK;
 }
 
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+static ngx_int_t
+ngx_http_file_cache_read_index(ngx_http_file_cache_t *cache)
 {
-    ngx_msleep(cache->loader_sleep);
-
-    ngx_time_update();
+    size_t                               size;
+    ssize_t                              n;
+    uint64_t                             entries;
+    ngx_int_t                            rc;
+    ngx_err_t                            err;
+    ngx_uint_t                           i;
+    ngx_file_t                           file;
+    ngx_file_info_t                      fi;
+    ngx_http_file_cache_index_header_t   header;
+    ngx_http_file_cache_index_entry_t   *buf;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
-}
+    ngx_memzero(&file, sizeof(ngx_file_t));
 
+    file.name = cache->index;
+    file.log = ngx_cycle->log;
 
-static ngx_int_t
-ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
-{
-    u_char                 *p;
-    ngx_int_t               n;
-    ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+    file.fd = ngx_open_file(cache->index.data, NGX_FILE_RDONLY,
+                            NGX_FILE_OPEN, 0);
 
-    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
-        return NGX_ERROR;
-    }
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
 
-    /*
-     * Temporary files in cache have a suffix consisting of a dot
-     * followed by 10 digits.
-     */
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                          ngx_open_file_n " \"%V\" failed", &cache->index);
+        }
 
-    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
-        && name->data[name->len - 10 - 1] == '.')
-    {
-        return NGX_OK;
+        return NGX_DECLINED;
     }
 
-    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "cache file \"%s\" is too small", name->data);
-        return NGX_ERROR;
-    }
+    rc = NGX_DECLINED;
+    buf = NULL;
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%V\" failed", &cache->index);
+        goto done;
+    }
 
-    c.length = ctx->size;
-    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+    n = ngx_read_file(&file, (u_char *) &header,
+                      sizeof(ngx_http_file_cache_index_header_t), 0);
 
-    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+    if (n == NGX_ERROR) {
+        goto done;
+    }
 
-    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
-        n = ngx_hextoi(p, 2);
+    if ((size_t) n != sizeof(ngx_http_file_cache_index_header_t)
+        || ngx_memcmp(header.magic, ngx_http_file_cache_index_magic,
+                      sizeof(header.magic))
+           != 0
+        || header.version != NGX_HTTP_CACHE_INDEX_VERSION
+        || header.entry_size != sizeof(ngx_http_file_cache_index_entry_t)
+        || header.bsize != cache->bsize
+        || ngx_file_size(&fi) != (off_t)
+               (sizeof(ngx_http_file_cache_index_header_t)
+                + header.entries * sizeof(ngx_http_file_cache_index_entry_t)))
+    {
+        goto invalid;
+    }
 
-        if (n == NGX_ERROR) {
-            return NGX_ERROR;
+    for (i = 0; i < NGX_MAX_PATH_LEVEL; i++) {
+        if (header.level[i] != cache->path->level[i]) {
+            goto invalid;
         }
-
-        p += 2;
-
-        c.key[i] = (u_char) n;
     }
 
-    return ngx_http_file_cache_add(cache, &c);
-}
+    /*
+     * an index not written on exit may miss files or list removed ones,
+     * and the cache files added after an outdated index was written are
+     * unknown to it, so the cache directories are walked instead
+     */
 
+    if (!header.clean) {
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "cache index \"%V\" was not written on exit",
+                      &cache->index);
+        goto done;
+    }
 
-static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
-{
-    ngx_http_file_cache_node_t  *fcn;
+    if (ngx_time() - header.time > cache->inactive) {
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "cache index \"%V\" is stale", &cache->index);
+        goto done;
+    }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    buf = ngx_alloc(NGX_HTTP_CACHE_INDEX_ENTRIES
+                    * sizeof(ngx_http_file_cache_index_entry_t),
+                    ngx_cycle->log);
+    if (buf == NULL) {
+        goto done;
+    }
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    for (entries = header.entries; entries; entries -= n) {
 
-    if (fcn == NULL) {
+        n = ngx_min(entries, NGX_HTTP_CACHE_INDEX_ENTRIES);
+        size = n * sizeof(ngx_http_file_cache_index_entry_t);
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_http_file_cache_set_watermark(cache);
+        if (ngx_read_file(&file, (u_char *) buf, size, file.offset)
+            != (ssize_t) size)
+        {
+            goto invalid;
+        }
 
-            if (cache->fail_time != ngx_time()) {
-                cache->fail_time = ngx_time();
-                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                           "could not allocate node%s", cache->shpool->log_ctx);
+        for (i = 0; i < (ngx_uint_t) n; i++) {
+            if (ngx_http_file_cache_add_entry(cache, &buf[i]) != NGX_OK) {
+                goto done;
             }
+        }
 
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
+        if (ngx_quit || ngx_terminate) {
+            rc = NGX_ABORT;
+            goto done;
         }
+    }
 
-        cache->sh->count++;
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V loaded from index \"%V\", "
+                  "%uL entries", &cache->path->name, &cache->index,
+                  header.entries);
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    rc = NGX_OK;
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+    goto done;
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+invalid:
 
-        fcn->uses = 1;
-        fcn->exists = 1;
-        fcn->fs_size = c->fs_size;
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "cache index \"%V\" is invalid", &cache->index);
 
-        cache->sh->size += c->fs_size;
+done:
 
-    } else {
-        ngx_queue_remove(&fcn->queue);
+    if (buf) {
+        ngx_free(buf);
     }
 
-    fcn->expire = ngx_time() + cache->inactive;
-
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
-
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &cache->index);
+    }
 
-    return NGX_OK;
+    return rc;
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_add_entry(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_entry_t *entry)
 {
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
+    ngx_uint_t                   n;
+    ngx_shmtx_t                 *mutex;
+    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_part_t  *part;
 
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
+    n = ngx_http_file_cache_partition(cache, entry->key);
+    mutex = ngx_http_file_cache_mutex(cache, n);
+    part = &cache->sh->parts[n];
+
+    ngx_shmtx_lock(mutex);
+
+    if (ngx_http_file_cache_lookup(cache, part, entry->key)) {
+        /* already added by a request */
+        ngx_shmtx_unlock(mutex);
+        return NGX_OK;
     }
 
-    return NGX_OK;
-}
+    fcn = ngx_http_file_cache_alloc_node(cache);
+    if (fcn == NULL) {
+        ngx_http_file_cache_set_watermark(cache);
 
+        ngx_shmtx_unlock(mutex);
 
-static void
-ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
-{
-    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "could not allocate node%s", cache->shpool->log_ctx);
+        return NGX_ERROR;
+    }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache watermark: %ui", cache->sh->watermark);
+    part->count++;
+
+    ngx_memcpy((u_char *) &fcn->node.key, entry->key,
+               sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(fcn->key, &entry->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_insert(&part->rbtree, &fcn->node);
+
+    fcn->uses = ngx_min(entry->uses, 1023);
+    fcn->exists = 1;
+    fcn->valid_sec = entry->valid_sec;
+    fcn->body_start = entry->body_start;
+    fcn->fs_size = entry->fs_size;
+    fcn->expire = entry->expire;
+
+    part->size += entry->fs_size;
+
+    ngx_queue_insert_head(&part->queue, &fcn->queue);
+
+    ngx_shmtx_unlock(mutex);
+
+    return NGX_OK;
 }
 
 
@@ -2324,11 +4051,14 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     off_t                   max_size, min_free;
     u_char                 *last, *p;
     time_t                  inactive;
-    ssize_t                 size;
+    ssize_t                 size, ram_size, ram_max_size;
     ngx_str_t               s, name, *value;
     ngx_int_t               loader_files, manager_files;
     ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
                             manager_threshold;
+    time_t                  refresh_ahead;
+    ngx_int_t               partitions, updates, refresh_min_uses,
+                            ram_min_uses;
     ngx_uint_t              i, n, use_temp_path;
     ngx_array_t            *caches;
     ngx_http_file_cache_t  *cache, **ce;
@@ -2355,6 +4085,16 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     manager_sleep = 50;
     manager_threshold = 200;
 
+    partitions = 1;
+
+    updates = 0;
+    refresh_ahead = 0;
+    refresh_min_uses = 1;
+
+    ram_size = 0;
+    ram_max_size = 65536;
+    ram_min_uses = 2;
+
     name.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
@@ -2601,6 +4341,132 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "index=", 6) == 0) {
+
+            cache->index.len = value[i].len - 6;
+            cache->index.data = value[i].data + 6;
+
+            if (ngx_conf_full_name(cf->cycle, &cache->index, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "partitions=", 11) == 0) {
+
+            partitions = ngx_atoi(value[i].data + 11, value[i].len - 11);
+            if (partitions <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid partitions value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+            if (partitions > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" is not supported "
+                                   "on this platform", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#endif
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "background_updates=", 19) == 0) {
+
+            updates = ngx_atoi(value[i].data + 19, value[i].len - 19);
+            if (updates == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid background_updates value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "refresh_ahead=", 14) == 0) {
+
+            s.len = value[i].len - 14;
+            s.data = value[i].data + 14;
+
+            refresh_ahead = ngx_parse_time(&s, 1);
+            if (refresh_ahead == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid refresh_ahead value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "refresh_min_uses=", 17) == 0) {
+
+            refresh_min_uses = ngx_atoi(value[i].data + 17,
+                                        value[i].len - 17);
+            if (refresh_min_uses <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid refresh_min_uses value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_zone=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            ram_size = ngx_parse_size(&s);
+
+            if (ram_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ram zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (ram_size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "ram zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_max_size=", 13) == 0) {
+
+            s.len = value[i].len - 13;
+            s.data = value[i].data + 13;
+
+            ram_max_size = ngx_parse_size(&s);
+            if (ram_max_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid ram_max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_min_uses=", 13) == 0) {
+
+            ram_min_uses = ngx_atoi(value[i].data + 13, value[i].len - 13);
+            if (ram_min_uses <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid ram_min_uses value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -2615,6 +4481,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
+    cache->path->saver = ngx_http_file_cache_save;
     cache->path->data = cache;
     cache->path->conf_file = cf->conf_file->file.name.data;
     cache->path->line = cf->conf_file->line;
@@ -2624,6 +4491,12 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->manager_files = manager_files;
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
+    cache->partitions = partitions;
+    cache->updates = updates;
+    cache->refresh_ahead = refresh_ahead;
+    cache->refresh_min_uses = refresh_min_uses;
+    cache->ram_max_size = ram_max_size;
+    cache->ram_min_uses = ram_min_uses;
 
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
@@ -2644,6 +4517,32 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
 
+    if (ram_size) {
+
+        if (ram_max_size >= ram_size / 2) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"ram_max_size\" must be less than "
+                               "half of the ram zone size");
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = name.len + sizeof(":ram") - 1;
+        s.data = ngx_pnalloc(cf->pool, s.len);
+        if (s.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(s.data, "%V:ram", &name);
+
+        cache->ram_zone = ngx_shared_memory_add(cf, &s, ram_size, cmd->post);
+        if (cache->ram_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->ram_zone->init = ngx_http_file_cache_ram_init;
+        cache->ram_zone->data = cache;
+    }
+
     cache->use_temp_path = use_temp_path;
 
     cache->inactive = inactive;
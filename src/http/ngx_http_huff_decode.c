@@ -18,6 +18,20 @@ typedef struct {
 } ngx_http_huff_decode_code_t;
 
 
+#if (NGX_HAVE_LITTLE_ENDIAN && NGX_HAVE_GCC_BSWAP64)
+#define ngx_http_huff_decode_buf(p)                                           \
+    __builtin_bswap64(*(uint64_t *) (p))
+#else
+#define ngx_http_huff_decode_buf(p)                                           \
+    ((uint64_t) (p)[0] << 56 | (uint64_t) (p)[1] << 48                        \
+     | (uint64_t) (p)[2] << 40 | (uint64_t) (p)[3] << 32                      \
+     | (uint64_t) (p)[4] << 24 | (uint64_t) (p)[5] << 16                      \
+     | (uint64_t) (p)[6] << 8 | (uint64_t) (p)[7])
+#endif
+
+
+static ngx_int_t ngx_http_huff_decode_fast(u_char *state, u_char *ending,
+    u_char **src, u_char *end, u_char **dst);
 static ngx_inline ngx_int_t ngx_http_huff_decode_bits(u_char *state,
     u_char *ending, ngx_uint_t bits, u_char **dst);
 
@@ -2639,6 +2653,415 @@ static ngx_http_huff_decode_code_t  ngx_http_huff_decode_codes[256][16] =
 };
 
 
+/*
+ * states of the above table after the first 1, 2, or 3 bits of a code,
+ * indexed by (1 << bits) - 2 + value
+ */
+
+static u_char  ngx_http_huff_decode_prefix[14] =
+{
+    0x01, 0x16, 0x02, 0x09, 0x17, 0x28, 0x03, 0x06, 0x0a, 0x0f, 0x18, 0x1f,
+    0x29, 0x38
+};
+
+
+/*
+ * the fast path decodes codes of up to 11 bits with a single lookup
+ * of the next 11 bits of input: an entry holds the first symbol, the
+ * second symbol if its code also fits, the length of the first code,
+ * the total length, and the flag of the second symbol; entries for
+ * longer codes are zero
+ */
+
+static uint32_t  ngx_http_huff_decode_lookup[2048] =
+{
+    0x8a053030, 0x8a053030, 0x8a053130, 0x8a053130, 0x8a053230, 0x8a053230,
+    0x8a056130, 0x8a056130, 0x8a056330, 0x8a056330, 0x8a056530, 0x8a056530,
+    0x8a056930, 0x8a056930, 0x8a056f30, 0x8a056f30, 0x8a057330, 0x8a057330,
+    0x8a057430, 0x8a057430, 0x8b052030, 0x8b052530, 0x8b052d30, 0x8b052e30,
+    0x8b052f30, 0x8b053330, 0x8b053430, 0x8b053530, 0x8b053630, 0x8b053730,
+    0x8b053830, 0x8b053930, 0x8b053d30, 0x8b054130, 0x8b055f30, 0x8b056230,
+    0x8b056430, 0x8b056630, 0x8b056730, 0x8b056830, 0x8b056c30, 0x8b056d30,
+    0x8b056e30, 0x8b057030, 0x8b057230, 0x8b057530, 0x05050030, 0x05050030,
+    0x05050030, 0x05050030, 0x05050030, 0x05050030, 0x05050030, 0x05050030,
+    0x05050030, 0x05050030, 0x05050030, 0x05050030, 0x05050030, 0x05050030,
+    0x05050030, 0x05050030, 0x05050030, 0x05050030, 0x8a053031, 0x8a053031,
+    0x8a053131, 0x8a053131, 0x8a053231, 0x8a053231, 0x8a056131, 0x8a056131,
+    0x8a056331, 0x8a056331, 0x8a056531, 0x8a056531, 0x8a056931, 0x8a056931,
+    0x8a056f31, 0x8a056f31, 0x8a057331, 0x8a057331, 0x8a057431, 0x8a057431,
+    0x8b052031, 0x8b052531, 0x8b052d31, 0x8b052e31, 0x8b052f31, 0x8b053331,
+    0x8b053431, 0x8b053531, 0x8b053631, 0x8b053731, 0x8b053831, 0x8b053931,
+    0x8b053d31, 0x8b054131, 0x8b055f31, 0x8b056231, 0x8b056431, 0x8b056631,
+    0x8b056731, 0x8b056831, 0x8b056c31, 0x8b056d31, 0x8b056e31, 0x8b057031,
+    0x8b057231, 0x8b057531, 0x05050031, 0x05050031, 0x05050031, 0x05050031,
+    0x05050031, 0x05050031, 0x05050031, 0x05050031, 0x05050031, 0x05050031,
+    0x05050031, 0x05050031, 0x05050031, 0x05050031, 0x05050031, 0x05050031,
+    0x05050031, 0x05050031, 0x8a053032, 0x8a053032, 0x8a053132, 0x8a053132,
+    0x8a053232, 0x8a053232, 0x8a056132, 0x8a056132, 0x8a056332, 0x8a056332,
+    0x8a056532, 0x8a056532, 0x8a056932, 0x8a056932, 0x8a056f32, 0x8a056f32,
+    0x8a057332, 0x8a057332, 0x8a057432, 0x8a057432, 0x8b052032, 0x8b052532,
+    0x8b052d32, 0x8b052e32, 0x8b052f32, 0x8b053332, 0x8b053432, 0x8b053532,
+    0x8b053632, 0x8b053732, 0x8b053832, 0x8b053932, 0x8b053d32, 0x8b054132,
+    0x8b055f32, 0x8b056232, 0x8b056432, 0x8b056632, 0x8b056732, 0x8b056832,
+    0x8b056c32, 0x8b056d32, 0x8b056e32, 0x8b057032, 0x8b057232, 0x8b057532,
+    0x05050032, 0x05050032, 0x05050032, 0x05050032, 0x05050032, 0x05050032,
+    0x05050032, 0x05050032, 0x05050032, 0x05050032, 0x05050032, 0x05050032,
+    0x05050032, 0x05050032, 0x05050032, 0x05050032, 0x05050032, 0x05050032,
+    0x8a053061, 0x8a053061, 0x8a053161, 0x8a053161, 0x8a053261, 0x8a053261,
+    0x8a056161, 0x8a056161, 0x8a056361, 0x8a056361, 0x8a056561, 0x8a056561,
+    0x8a056961, 0x8a056961, 0x8a056f61, 0x8a056f61, 0x8a057361, 0x8a057361,
+    0x8a057461, 0x8a057461, 0x8b052061, 0x8b052561, 0x8b052d61, 0x8b052e61,
+    0x8b052f61, 0x8b053361, 0x8b053461, 0x8b053561, 0x8b053661, 0x8b053761,
+    0x8b053861, 0x8b053961, 0x8b053d61, 0x8b054161, 0x8b055f61, 0x8b056261,
+    0x8b056461, 0x8b056661, 0x8b056761, 0x8b056861, 0x8b056c61, 0x8b056d61,
+    0x8b056e61, 0x8b057061, 0x8b057261, 0x8b057561, 0x05050061, 0x05050061,
+    0x05050061, 0x05050061, 0x05050061, 0x05050061, 0x05050061, 0x05050061,
+    0x05050061, 0x05050061, 0x05050061, 0x05050061, 0x05050061, 0x05050061,
+    0x05050061, 0x05050061, 0x05050061, 0x05050061, 0x8a053063, 0x8a053063,
+    0x8a053163, 0x8a053163, 0x8a053263, 0x8a053263, 0x8a056163, 0x8a056163,
+    0x8a056363, 0x8a056363, 0x8a056563, 0x8a056563, 0x8a056963, 0x8a056963,
+    0x8a056f63, 0x8a056f63, 0x8a057363, 0x8a057363, 0x8a057463, 0x8a057463,
+    0x8b052063, 0x8b052563, 0x8b052d63, 0x8b052e63, 0x8b052f63, 0x8b053363,
+    0x8b053463, 0x8b053563, 0x8b053663, 0x8b053763, 0x8b053863, 0x8b053963,
+    0x8b053d63, 0x8b054163, 0x8b055f63, 0x8b056263, 0x8b056463, 0x8b056663,
+    0x8b056763, 0x8b056863, 0x8b056c63, 0x8b056d63, 0x8b056e63, 0x8b057063,
+    0x8b057263, 0x8b057563, 0x05050063, 0x05050063, 0x05050063, 0x05050063,
+    0x05050063, 0x05050063, 0x05050063, 0x05050063, 0x05050063, 0x05050063,
+    0x05050063, 0x05050063, 0x05050063, 0x05050063, 0x05050063, 0x05050063,
+    0x05050063, 0x05050063, 0x8a053065, 0x8a053065, 0x8a053165, 0x8a053165,
+    0x8a053265, 0x8a053265, 0x8a056165, 0x8a056165, 0x8a056365, 0x8a056365,
+    0x8a056565, 0x8a056565, 0x8a056965, 0x8a056965, 0x8a056f65, 0x8a056f65,
+    0x8a057365, 0x8a057365, 0x8a057465, 0x8a057465, 0x8b052065, 0x8b052565,
+    0x8b052d65, 0x8b052e65, 0x8b052f65, 0x8b053365, 0x8b053465, 0x8b053565,
+    0x8b053665, 0x8b053765, 0x8b053865, 0x8b053965, 0x8b053d65, 0x8b054165,
+    0x8b055f65, 0x8b056265, 0x8b056465, 0x8b056665, 0x8b056765, 0x8b056865,
+    0x8b056c65, 0x8b056d65, 0x8b056e65, 0x8b057065, 0x8b057265, 0x8b057565,
+    0x05050065, 0x05050065, 0x05050065, 0x05050065, 0x05050065, 0x05050065,
+    0x05050065, 0x05050065, 0x05050065, 0x05050065, 0x05050065, 0x05050065,
+    0x05050065, 0x05050065, 0x05050065, 0x05050065, 0x05050065, 0x05050065,
+    0x8a053069, 0x8a053069, 0x8a053169, 0x8a053169, 0x8a053269, 0x8a053269,
+    0x8a056169, 0x8a056169, 0x8a056369, 0x8a056369, 0x8a056569, 0x8a056569,
+    0x8a056969, 0x8a056969, 0x8a056f69, 0x8a056f69, 0x8a057369, 0x8a057369,
+    0x8a057469, 0x8a057469, 0x8b052069, 0x8b052569, 0x8b052d69, 0x8b052e69,
+    0x8b052f69, 0x8b053369, 0x8b053469, 0x8b053569, 0x8b053669, 0x8b053769,
+    0x8b053869, 0x8b053969, 0x8b053d69, 0x8b054169, 0x8b055f69, 0x8b056269,
+    0x8b056469, 0x8b056669, 0x8b056769, 0x8b056869, 0x8b056c69, 0x8b056d69,
+    0x8b056e69, 0x8b057069, 0x8b057269, 0x8b057569, 0x05050069, 0x05050069,
+    0x05050069, 0x05050069, 0x05050069, 0x05050069, 0x05050069, 0x05050069,
+    0x05050069, 0x05050069, 0x05050069, 0x05050069, 0x05050069, 0x05050069,
+    0x05050069, 0x05050069, 0x05050069, 0x05050069, 0x8a05306f, 0x8a05306f,
+    0x8a05316f, 0x8a05316f, 0x8a05326f, 0x8a05326f, 0x8a05616f, 0x8a05616f,
+    0x8a05636f, 0x8a05636f, 0x8a05656f, 0x8a05656f, 0x8a05696f, 0x8a05696f,
+    0x8a056f6f, 0x8a056f6f, 0x8a05736f, 0x8a05736f, 0x8a05746f, 0x8a05746f,
+    0x8b05206f, 0x8b05256f, 0x8b052d6f, 0x8b052e6f, 0x8b052f6f, 0x8b05336f,
+    0x8b05346f, 0x8b05356f, 0x8b05366f, 0x8b05376f, 0x8b05386f, 0x8b05396f,
+    0x8b053d6f, 0x8b05416f, 0x8b055f6f, 0x8b05626f, 0x8b05646f, 0x8b05666f,
+    0x8b05676f, 0x8b05686f, 0x8b056c6f, 0x8b056d6f, 0x8b056e6f, 0x8b05706f,
+    0x8b05726f, 0x8b05756f, 0x0505006f, 0x0505006f, 0x0505006f, 0x0505006f,
+    0x0505006f, 0x0505006f, 0x0505006f, 0x0505006f, 0x0505006f, 0x0505006f,
+    0x0505006f, 0x0505006f, 0x0505006f, 0x0505006f, 0x0505006f, 0x0505006f,
+    0x0505006f, 0x0505006f, 0x8a053073, 0x8a053073, 0x8a053173, 0x8a053173,
+    0x8a053273, 0x8a053273, 0x8a056173, 0x8a056173, 0x8a056373, 0x8a056373,
+    0x8a056573, 0x8a056573, 0x8a056973, 0x8a056973, 0x8a056f73, 0x8a056f73,
+    0x8a057373, 0x8a057373, 0x8a057473, 0x8a057473, 0x8b052073, 0x8b052573,
+    0x8b052d73, 0x8b052e73, 0x8b052f73, 0x8b053373, 0x8b053473, 0x8b053573,
+    0x8b053673, 0x8b053773, 0x8b053873, 0x8b053973, 0x8b053d73, 0x8b054173,
+    0x8b055f73, 0x8b056273, 0x8b056473, 0x8b056673, 0x8b056773, 0x8b056873,
+    0x8b056c73, 0x8b056d73, 0x8b056e73, 0x8b057073, 0x8b057273, 0x8b057573,
+    0x05050073, 0x05050073, 0x05050073, 0x05050073, 0x05050073, 0x05050073,
+    0x05050073, 0x05050073, 0x05050073, 0x05050073, 0x05050073, 0x05050073,
+    0x05050073, 0x05050073, 0x05050073, 0x05050073, 0x05050073, 0x05050073,
+    0x8a053074, 0x8a053074, 0x8a053174, 0x8a053174, 0x8a053274, 0x8a053274,
+    0x8a056174, 0x8a056174, 0x8a056374, 0x8a056374, 0x8a056574, 0x8a056574,
+    0x8a056974, 0x8a056974, 0x8a056f74, 0x8a056f74, 0x8a057374, 0x8a057374,
+    0x8a057474, 0x8a057474, 0x8b052074, 0x8b052574, 0x8b052d74, 0x8b052e74,
+    0x8b052f74, 0x8b053374, 0x8b053474, 0x8b053574, 0x8b053674, 0x8b053774,
+    0x8b053874, 0x8b053974, 0x8b053d74, 0x8b054174, 0x8b055f74, 0x8b056274,
+    0x8b056474, 0x8b056674, 0x8b056774, 0x8b056874, 0x8b056c74, 0x8b056d74,
+    0x8b056e74, 0x8b057074, 0x8b057274, 0x8b057574, 0x05050074, 0x05050074,
+    0x05050074, 0x05050074, 0x05050074, 0x05050074, 0x05050074, 0x05050074,
+    0x05050074, 0x05050074, 0x05050074, 0x05050074, 0x05050074, 0x05050074,
+    0x05050074, 0x05050074, 0x05050074, 0x05050074, 0x8b063020, 0x8b063120,
+    0x8b063220, 0x8b066120, 0x8b066320, 0x8b066520, 0x8b066920, 0x8b066f20,
+    0x8b067320, 0x8b067420, 0x06060020, 0x06060020, 0x06060020, 0x06060020,
+    0x06060020, 0x06060020, 0x06060020, 0x06060020, 0x06060020, 0x06060020,
+    0x06060020, 0x06060020, 0x06060020, 0x06060020, 0x06060020, 0x06060020,
+    0x06060020, 0x06060020, 0x06060020, 0x06060020, 0x06060020, 0x06060020,
+    0x8b063025, 0x8b063125, 0x8b063225, 0x8b066125, 0x8b066325, 0x8b066525,
+    0x8b066925, 0x8b066f25, 0x8b067325, 0x8b067425, 0x06060025, 0x06060025,
+    0x06060025, 0x06060025, 0x06060025, 0x06060025, 0x06060025, 0x06060025,
+    0x06060025, 0x06060025, 0x06060025, 0x06060025, 0x06060025, 0x06060025,
+    0x06060025, 0x06060025, 0x06060025, 0x06060025, 0x06060025, 0x06060025,
+    0x06060025, 0x06060025, 0x8b06302d, 0x8b06312d, 0x8b06322d, 0x8b06612d,
+    0x8b06632d, 0x8b06652d, 0x8b06692d, 0x8b066f2d, 0x8b06732d, 0x8b06742d,
+    0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d,
+    0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d,
+    0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d,
+    0x0606002d, 0x0606002d, 0x0606002d, 0x0606002d, 0x8b06302e, 0x8b06312e,
+    0x8b06322e, 0x8b06612e, 0x8b06632e, 0x8b06652e, 0x8b06692e, 0x8b066f2e,
+    0x8b06732e, 0x8b06742e, 0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e,
+    0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e,
+    0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e,
+    0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e, 0x0606002e,
+    0x8b06302f, 0x8b06312f, 0x8b06322f, 0x8b06612f, 0x8b06632f, 0x8b06652f,
+    0x8b06692f, 0x8b066f2f, 0x8b06732f, 0x8b06742f, 0x0606002f, 0x0606002f,
+    0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f,
+    0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f,
+    0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f, 0x0606002f,
+    0x0606002f, 0x0606002f, 0x8b063033, 0x8b063133, 0x8b063233, 0x8b066133,
+    0x8b066333, 0x8b066533, 0x8b066933, 0x8b066f33, 0x8b067333, 0x8b067433,
+    0x06060033, 0x06060033, 0x06060033, 0x06060033, 0x06060033, 0x06060033,
+    0x06060033, 0x06060033, 0x06060033, 0x06060033, 0x06060033, 0x06060033,
+    0x06060033, 0x06060033, 0x06060033, 0x06060033, 0x06060033, 0x06060033,
+    0x06060033, 0x06060033, 0x06060033, 0x06060033, 0x8b063034, 0x8b063134,
+    0x8b063234, 0x8b066134, 0x8b066334, 0x8b066534, 0x8b066934, 0x8b066f34,
+    0x8b067334, 0x8b067434, 0x06060034, 0x06060034, 0x06060034, 0x06060034,
+    0x06060034, 0x06060034, 0x06060034, 0x06060034, 0x06060034, 0x06060034,
+    0x06060034, 0x06060034, 0x06060034, 0x06060034, 0x06060034, 0x06060034,
+    0x06060034, 0x06060034, 0x06060034, 0x06060034, 0x06060034, 0x06060034,
+    0x8b063035, 0x8b063135, 0x8b063235, 0x8b066135, 0x8b066335, 0x8b066535,
+    0x8b066935, 0x8b066f35, 0x8b067335, 0x8b067435, 0x06060035, 0x06060035,
+    0x06060035, 0x06060035, 0x06060035, 0x06060035, 0x06060035, 0x06060035,
+    0x06060035, 0x06060035, 0x06060035, 0x06060035, 0x06060035, 0x06060035,
+    0x06060035, 0x06060035, 0x06060035, 0x06060035, 0x06060035, 0x06060035,
+    0x06060035, 0x06060035, 0x8b063036, 0x8b063136, 0x8b063236, 0x8b066136,
+    0x8b066336, 0x8b066536, 0x8b066936, 0x8b066f36, 0x8b067336, 0x8b067436,
+    0x06060036, 0x06060036, 0x06060036, 0x06060036, 0x06060036, 0x06060036,
+    0x06060036, 0x06060036, 0x06060036, 0x06060036, 0x06060036, 0x06060036,
+    0x06060036, 0x06060036, 0x06060036, 0x06060036, 0x06060036, 0x06060036,
+    0x06060036, 0x06060036, 0x06060036, 0x06060036, 0x8b063037, 0x8b063137,
+    0x8b063237, 0x8b066137, 0x8b066337, 0x8b066537, 0x8b066937, 0x8b066f37,
+    0x8b067337, 0x8b067437, 0x06060037, 0x06060037, 0x06060037, 0x06060037,
+    0x06060037, 0x06060037, 0x06060037, 0x06060037, 0x06060037, 0x06060037,
+    0x06060037, 0x06060037, 0x06060037, 0x06060037, 0x06060037, 0x06060037,
+    0x06060037, 0x06060037, 0x06060037, 0x06060037, 0x06060037, 0x06060037,
+    0x8b063038, 0x8b063138, 0x8b063238, 0x8b066138, 0x8b066338, 0x8b066538,
+    0x8b066938, 0x8b066f38, 0x8b067338, 0x8b067438, 0x06060038, 0x06060038,
+    0x06060038, 0x06060038, 0x06060038, 0x06060038, 0x06060038, 0x06060038,
+    0x06060038, 0x06060038, 0x06060038, 0x06060038, 0x06060038, 0x06060038,
+    0x06060038, 0x06060038, 0x06060038, 0x06060038, 0x06060038, 0x06060038,
+    0x06060038, 0x06060038, 0x8b063039, 0x8b063139, 0x8b063239, 0x8b066139,
+    0x8b066339, 0x8b066539, 0x8b066939, 0x8b066f39, 0x8b067339, 0x8b067439,
+    0x06060039, 0x06060039, 0x06060039, 0x06060039, 0x06060039, 0x06060039,
+    0x06060039, 0x06060039, 0x06060039, 0x06060039, 0x06060039, 0x06060039,
+    0x06060039, 0x06060039, 0x06060039, 0x06060039, 0x06060039, 0x06060039,
+    0x06060039, 0x06060039, 0x06060039, 0x06060039, 0x8b06303d, 0x8b06313d,
+    0x8b06323d, 0x8b06613d, 0x8b06633d, 0x8b06653d, 0x8b06693d, 0x8b066f3d,
+    0x8b06733d, 0x8b06743d, 0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d,
+    0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d,
+    0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d,
+    0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d, 0x0606003d,
+    0x8b063041, 0x8b063141, 0x8b063241, 0x8b066141, 0x8b066341, 0x8b066541,
+    0x8b066941, 0x8b066f41, 0x8b067341, 0x8b067441, 0x06060041, 0x06060041,
+    0x06060041, 0x06060041, 0x06060041, 0x06060041, 0x06060041, 0x06060041,
+    0x06060041, 0x06060041, 0x06060041, 0x06060041, 0x06060041, 0x06060041,
+    0x06060041, 0x06060041, 0x06060041, 0x06060041, 0x06060041, 0x06060041,
+    0x06060041, 0x06060041, 0x8b06305f, 0x8b06315f, 0x8b06325f, 0x8b06615f,
+    0x8b06635f, 0x8b06655f, 0x8b06695f, 0x8b066f5f, 0x8b06735f, 0x8b06745f,
+    0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f,
+    0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f,
+    0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f,
+    0x0606005f, 0x0606005f, 0x0606005f, 0x0606005f, 0x8b063062, 0x8b063162,
+    0x8b063262, 0x8b066162, 0x8b066362, 0x8b066562, 0x8b066962, 0x8b066f62,
+    0x8b067362, 0x8b067462, 0x06060062, 0x06060062, 0x06060062, 0x06060062,
+    0x06060062, 0x06060062, 0x06060062, 0x06060062, 0x06060062, 0x06060062,
+    0x06060062, 0x06060062, 0x06060062, 0x06060062, 0x06060062, 0x06060062,
+    0x06060062, 0x06060062, 0x06060062, 0x06060062, 0x06060062, 0x06060062,
+    0x8b063064, 0x8b063164, 0x8b063264, 0x8b066164, 0x8b066364, 0x8b066564,
+    0x8b066964, 0x8b066f64, 0x8b067364, 0x8b067464, 0x06060064, 0x06060064,
+    0x06060064, 0x06060064, 0x06060064, 0x06060064, 0x06060064, 0x06060064,
+    0x06060064, 0x06060064, 0x06060064, 0x06060064, 0x06060064, 0x06060064,
+    0x06060064, 0x06060064, 0x06060064, 0x06060064, 0x06060064, 0x06060064,
+    0x06060064, 0x06060064, 0x8b063066, 0x8b063166, 0x8b063266, 0x8b066166,
+    0x8b066366, 0x8b066566, 0x8b066966, 0x8b066f66, 0x8b067366, 0x8b067466,
+    0x06060066, 0x06060066, 0x06060066, 0x06060066, 0x06060066, 0x06060066,
+    0x06060066, 0x06060066, 0x06060066, 0x06060066, 0x06060066, 0x06060066,
+    0x06060066, 0x06060066, 0x06060066, 0x06060066, 0x06060066, 0x06060066,
+    0x06060066, 0x06060066, 0x06060066, 0x06060066, 0x8b063067, 0x8b063167,
+    0x8b063267, 0x8b066167, 0x8b066367, 0x8b066567, 0x8b066967, 0x8b066f67,
+    0x8b067367, 0x8b067467, 0x06060067, 0x06060067, 0x06060067, 0x06060067,
+    0x06060067, 0x06060067, 0x06060067, 0x06060067, 0x06060067, 0x06060067,
+    0x06060067, 0x06060067, 0x06060067, 0x06060067, 0x06060067, 0x06060067,
+    0x06060067, 0x06060067, 0x06060067, 0x06060067, 0x06060067, 0x06060067,
+    0x8b063068, 0x8b063168, 0x8b063268, 0x8b066168, 0x8b066368, 0x8b066568,
+    0x8b066968, 0x8b066f68, 0x8b067368, 0x8b067468, 0x06060068, 0x06060068,
+    0x06060068, 0x06060068, 0x06060068, 0x06060068, 0x06060068, 0x06060068,
+    0x06060068, 0x06060068, 0x06060068, 0x06060068, 0x06060068, 0x06060068,
+    0x06060068, 0x06060068, 0x06060068, 0x06060068, 0x06060068, 0x06060068,
+    0x06060068, 0x06060068, 0x8b06306c, 0x8b06316c, 0x8b06326c, 0x8b06616c,
+    0x8b06636c, 0x8b06656c, 0x8b06696c, 0x8b066f6c, 0x8b06736c, 0x8b06746c,
+    0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c,
+    0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c,
+    0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c,
+    0x0606006c, 0x0606006c, 0x0606006c, 0x0606006c, 0x8b06306d, 0x8b06316d,
+    0x8b06326d, 0x8b06616d, 0x8b06636d, 0x8b06656d, 0x8b06696d, 0x8b066f6d,
+    0x8b06736d, 0x8b06746d, 0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d,
+    0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d,
+    0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d,
+    0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d, 0x0606006d,
+    0x8b06306e, 0x8b06316e, 0x8b06326e, 0x8b06616e, 0x8b06636e, 0x8b06656e,
+    0x8b06696e, 0x8b066f6e, 0x8b06736e, 0x8b06746e, 0x0606006e, 0x0606006e,
+    0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e,
+    0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e,
+    0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e, 0x0606006e,
+    0x0606006e, 0x0606006e, 0x8b063070, 0x8b063170, 0x8b063270, 0x8b066170,
+    0x8b066370, 0x8b066570, 0x8b066970, 0x8b066f70, 0x8b067370, 0x8b067470,
+    0x06060070, 0x06060070, 0x06060070, 0x06060070, 0x06060070, 0x06060070,
+    0x06060070, 0x06060070, 0x06060070, 0x06060070, 0x06060070, 0x06060070,
+    0x06060070, 0x06060070, 0x06060070, 0x06060070, 0x06060070, 0x06060070,
+    0x06060070, 0x06060070, 0x06060070, 0x06060070, 0x8b063072, 0x8b063172,
+    0x8b063272, 0x8b066172, 0x8b066372, 0x8b066572, 0x8b066972, 0x8b066f72,
+    0x8b067372, 0x8b067472, 0x06060072, 0x06060072, 0x06060072, 0x06060072,
+    0x06060072, 0x06060072, 0x06060072, 0x06060072, 0x06060072, 0x06060072,
+    0x06060072, 0x06060072, 0x06060072, 0x06060072, 0x06060072, 0x06060072,
+    0x06060072, 0x06060072, 0x06060072, 0x06060072, 0x06060072, 0x06060072,
+    0x8b063075, 0x8b063175, 0x8b063275, 0x8b066175, 0x8b066375, 0x8b066575,
+    0x8b066975, 0x8b066f75, 0x8b067375, 0x8b067475, 0x06060075, 0x06060075,
+    0x06060075, 0x06060075, 0x06060075, 0x06060075, 0x06060075, 0x06060075,
+    0x06060075, 0x06060075, 0x06060075, 0x06060075, 0x06060075, 0x06060075,
+    0x06060075, 0x06060075, 0x06060075, 0x06060075, 0x06060075, 0x06060075,
+    0x06060075, 0x06060075, 0x0707003a, 0x0707003a, 0x0707003a, 0x0707003a,
+    0x0707003a, 0x0707003a, 0x0707003a, 0x0707003a, 0x0707003a, 0x0707003a,
+    0x0707003a, 0x0707003a, 0x0707003a, 0x0707003a, 0x0707003a, 0x0707003a,
+    0x07070042, 0x07070042, 0x07070042, 0x07070042, 0x07070042, 0x07070042,
+    0x07070042, 0x07070042, 0x07070042, 0x07070042, 0x07070042, 0x07070042,
+    0x07070042, 0x07070042, 0x07070042, 0x07070042, 0x07070043, 0x07070043,
+    0x07070043, 0x07070043, 0x07070043, 0x07070043, 0x07070043, 0x07070043,
+    0x07070043, 0x07070043, 0x07070043, 0x07070043, 0x07070043, 0x07070043,
+    0x07070043, 0x07070043, 0x07070044, 0x07070044, 0x07070044, 0x07070044,
+    0x07070044, 0x07070044, 0x07070044, 0x07070044, 0x07070044, 0x07070044,
+    0x07070044, 0x07070044, 0x07070044, 0x07070044, 0x07070044, 0x07070044,
+    0x07070045, 0x07070045, 0x07070045, 0x07070045, 0x07070045, 0x07070045,
+    0x07070045, 0x07070045, 0x07070045, 0x07070045, 0x07070045, 0x07070045,
+    0x07070045, 0x07070045, 0x07070045, 0x07070045, 0x07070046, 0x07070046,
+    0x07070046, 0x07070046, 0x07070046, 0x07070046, 0x07070046, 0x07070046,
+    0x07070046, 0x07070046, 0x07070046, 0x07070046, 0x07070046, 0x07070046,
+    0x07070046, 0x07070046, 0x07070047, 0x07070047, 0x07070047, 0x07070047,
+    0x07070047, 0x07070047, 0x07070047, 0x07070047, 0x07070047, 0x07070047,
+    0x07070047, 0x07070047, 0x07070047, 0x07070047, 0x07070047, 0x07070047,
+    0x07070048, 0x07070048, 0x07070048, 0x07070048, 0x07070048, 0x07070048,
+    0x07070048, 0x07070048, 0x07070048, 0x07070048, 0x07070048, 0x07070048,
+    0x07070048, 0x07070048, 0x07070048, 0x07070048, 0x07070049, 0x07070049,
+    0x07070049, 0x07070049, 0x07070049, 0x07070049, 0x07070049, 0x07070049,
+    0x07070049, 0x07070049, 0x07070049, 0x07070049, 0x07070049, 0x07070049,
+    0x07070049, 0x07070049, 0x0707004a, 0x0707004a, 0x0707004a, 0x0707004a,
+    0x0707004a, 0x0707004a, 0x0707004a, 0x0707004a, 0x0707004a, 0x0707004a,
+    0x0707004a, 0x0707004a, 0x0707004a, 0x0707004a, 0x0707004a, 0x0707004a,
+    0x0707004b, 0x0707004b, 0x0707004b, 0x0707004b, 0x0707004b, 0x0707004b,
+    0x0707004b, 0x0707004b, 0x0707004b, 0x0707004b, 0x0707004b, 0x0707004b,
+    0x0707004b, 0x0707004b, 0x0707004b, 0x0707004b, 0x0707004c, 0x0707004c,
+    0x0707004c, 0x0707004c, 0x0707004c, 0x0707004c, 0x0707004c, 0x0707004c,
+    0x0707004c, 0x0707004c, 0x0707004c, 0x0707004c, 0x0707004c, 0x0707004c,
+    0x0707004c, 0x0707004c, 0x0707004d, 0x0707004d, 0x0707004d, 0x0707004d,
+    0x0707004d, 0x0707004d, 0x0707004d, 0x0707004d, 0x0707004d, 0x0707004d,
+    0x0707004d, 0x0707004d, 0x0707004d, 0x0707004d, 0x0707004d, 0x0707004d,
+    0x0707004e, 0x0707004e, 0x0707004e, 0x0707004e, 0x0707004e, 0x0707004e,
+    0x0707004e, 0x0707004e, 0x0707004e, 0x0707004e, 0x0707004e, 0x0707004e,
+    0x0707004e, 0x0707004e, 0x0707004e, 0x0707004e, 0x0707004f, 0x0707004f,
+    0x0707004f, 0x0707004f, 0x0707004f, 0x0707004f, 0x0707004f, 0x0707004f,
+    0x0707004f, 0x0707004f, 0x0707004f, 0x0707004f, 0x0707004f, 0x0707004f,
+    0x0707004f, 0x0707004f, 0x07070050, 0x07070050, 0x07070050, 0x07070050,
+    0x07070050, 0x07070050, 0x07070050, 0x07070050, 0x07070050, 0x07070050,
+    0x07070050, 0x07070050, 0x07070050, 0x07070050, 0x07070050, 0x07070050,
+    0x07070051, 0x07070051, 0x07070051, 0x07070051, 0x07070051, 0x07070051,
+    0x07070051, 0x07070051, 0x07070051, 0x07070051, 0x07070051, 0x07070051,
+    0x07070051, 0x07070051, 0x07070051, 0x07070051, 0x07070052, 0x07070052,
+    0x07070052, 0x07070052, 0x07070052, 0x07070052, 0x07070052, 0x07070052,
+    0x07070052, 0x07070052, 0x07070052, 0x07070052, 0x07070052, 0x07070052,
+    0x07070052, 0x07070052, 0x07070053, 0x07070053, 0x07070053, 0x07070053,
+    0x07070053, 0x07070053, 0x07070053, 0x07070053, 0x07070053, 0x07070053,
+    0x07070053, 0x07070053, 0x07070053, 0x07070053, 0x07070053, 0x07070053,
+    0x07070054, 0x07070054, 0x07070054, 0x07070054, 0x07070054, 0x07070054,
+    0x07070054, 0x07070054, 0x07070054, 0x07070054, 0x07070054, 0x07070054,
+    0x07070054, 0x07070054, 0x07070054, 0x07070054, 0x07070055, 0x07070055,
+    0x07070055, 0x07070055, 0x07070055, 0x07070055, 0x07070055, 0x07070055,
+    0x07070055, 0x07070055, 0x07070055, 0x07070055, 0x07070055, 0x07070055,
+    0x07070055, 0x07070055, 0x07070056, 0x07070056, 0x07070056, 0x07070056,
+    0x07070056, 0x07070056, 0x07070056, 0x07070056, 0x07070056, 0x07070056,
+    0x07070056, 0x07070056, 0x07070056, 0x07070056, 0x07070056, 0x07070056,
+    0x07070057, 0x07070057, 0x07070057, 0x07070057, 0x07070057, 0x07070057,
+    0x07070057, 0x07070057, 0x07070057, 0x07070057, 0x07070057, 0x07070057,
+    0x07070057, 0x07070057, 0x07070057, 0x07070057, 0x07070059, 0x07070059,
+    0x07070059, 0x07070059, 0x07070059, 0x07070059, 0x07070059, 0x07070059,
+    0x07070059, 0x07070059, 0x07070059, 0x07070059, 0x07070059, 0x07070059,
+    0x07070059, 0x07070059, 0x0707006a, 0x0707006a, 0x0707006a, 0x0707006a,
+    0x0707006a, 0x0707006a, 0x0707006a, 0x0707006a, 0x0707006a, 0x0707006a,
+    0x0707006a, 0x0707006a, 0x0707006a, 0x0707006a, 0x0707006a, 0x0707006a,
+    0x0707006b, 0x0707006b, 0x0707006b, 0x0707006b, 0x0707006b, 0x0707006b,
+    0x0707006b, 0x0707006b, 0x0707006b, 0x0707006b, 0x0707006b, 0x0707006b,
+    0x0707006b, 0x0707006b, 0x0707006b, 0x0707006b, 0x07070071, 0x07070071,
+    0x07070071, 0x07070071, 0x07070071, 0x07070071, 0x07070071, 0x07070071,
+    0x07070071, 0x07070071, 0x07070071, 0x07070071, 0x07070071, 0x07070071,
+    0x07070071, 0x07070071, 0x07070076, 0x07070076, 0x07070076, 0x07070076,
+    0x07070076, 0x07070076, 0x07070076, 0x07070076, 0x07070076, 0x07070076,
+    0x07070076, 0x07070076, 0x07070076, 0x07070076, 0x07070076, 0x07070076,
+    0x07070077, 0x07070077, 0x07070077, 0x07070077, 0x07070077, 0x07070077,
+    0x07070077, 0x07070077, 0x07070077, 0x07070077, 0x07070077, 0x07070077,
+    0x07070077, 0x07070077, 0x07070077, 0x07070077, 0x07070078, 0x07070078,
+    0x07070078, 0x07070078, 0x07070078, 0x07070078, 0x07070078, 0x07070078,
+    0x07070078, 0x07070078, 0x07070078, 0x07070078, 0x07070078, 0x07070078,
+    0x07070078, 0x07070078, 0x07070079, 0x07070079, 0x07070079, 0x07070079,
+    0x07070079, 0x07070079, 0x07070079, 0x07070079, 0x07070079, 0x07070079,
+    0x07070079, 0x07070079, 0x07070079, 0x07070079, 0x07070079, 0x07070079,
+    0x0707007a, 0x0707007a, 0x0707007a, 0x0707007a, 0x0707007a, 0x0707007a,
+    0x0707007a, 0x0707007a, 0x0707007a, 0x0707007a, 0x0707007a, 0x0707007a,
+    0x0707007a, 0x0707007a, 0x0707007a, 0x0707007a, 0x08080026, 0x08080026,
+    0x08080026, 0x08080026, 0x08080026, 0x08080026, 0x08080026, 0x08080026,
+    0x0808002a, 0x0808002a, 0x0808002a, 0x0808002a, 0x0808002a, 0x0808002a,
+    0x0808002a, 0x0808002a, 0x0808002c, 0x0808002c, 0x0808002c, 0x0808002c,
+    0x0808002c, 0x0808002c, 0x0808002c, 0x0808002c, 0x0808003b, 0x0808003b,
+    0x0808003b, 0x0808003b, 0x0808003b, 0x0808003b, 0x0808003b, 0x0808003b,
+    0x08080058, 0x08080058, 0x08080058, 0x08080058, 0x08080058, 0x08080058,
+    0x08080058, 0x08080058, 0x0808005a, 0x0808005a, 0x0808005a, 0x0808005a,
+    0x0808005a, 0x0808005a, 0x0808005a, 0x0808005a, 0x0a0a0021, 0x0a0a0021,
+    0x0a0a0022, 0x0a0a0022, 0x0a0a0028, 0x0a0a0028, 0x0a0a0029, 0x0a0a0029,
+    0x0a0a003f, 0x0a0a003f, 0x0b0b0027, 0x0b0b002b, 0x0b0b007c, 0x00000000,
+    0x00000000, 0x00000000
+};
+
+
+/* longer codes are canonical, symbols sorted by code length */
+
+static uint32_t  ngx_http_huff_decode_limit[18] =
+{
+    0xffc00000, 0xfff00000, 0xfff80000, 0xfffe0000, 0xfffe0000, 0xfffe0000,
+    0xfffe0000, 0xfffe6000, 0xfffee000, 0xffff4800, 0xffffb000, 0xffffea00,
+    0xfffff600, 0xfffff800, 0xfffffbc0, 0xfffffe20, 0xfffffff0, 0xfffffff0
+};
+
+
+static uint32_t  ngx_http_huff_decode_base[19] =
+{
+    0x00000ffa, 0x00001ff6, 0x00003ff4, 0x00007ff2, 0x00000000, 0x00000000,
+    0x00000000, 0x0007ffe3, 0x000fffd6, 0x001fffc4, 0x003fffad, 0x007fff99,
+    0x00ffff8e, 0x01ffff84, 0x03ffff74, 0x07ffff63, 0x0fffff54, 0x00000000,
+    0x3fffff51
+};
+
+
+static uint16_t  ngx_http_huff_decode_symbols[175] =
+{
+    0x23, 0x3e, 0x00, 0x24, 0x40, 0x5b, 0x5d, 0x7e, 0x5e, 0x7d,
+    0x3c, 0x60, 0x7b, 0x5c, 0xc3, 0xd0, 0x80, 0x82, 0x83, 0xa2,
+    0xb8, 0xc2, 0xe0, 0xe2, 0x99, 0xa1, 0xa7, 0xac, 0xb0, 0xb1,
+    0xb3, 0xd1, 0xd8, 0xd9, 0xe3, 0xe5, 0xe6, 0x81, 0x84, 0x85,
+    0x86, 0x88, 0x92, 0x9a, 0x9c, 0xa0, 0xa3, 0xa4, 0xa9, 0xaa,
+    0xad, 0xb2, 0xb5, 0xb9, 0xba, 0xbb, 0xbd, 0xbe, 0xc4, 0xc6,
+    0xe4, 0xe8, 0xe9, 0x01, 0x87, 0x89, 0x8a, 0x8b, 0x8c, 0x8d,
+    0x8f, 0x93, 0x95, 0x96, 0x97, 0x98, 0x9b, 0x9d, 0x9e, 0xa5,
+    0xa6, 0xa8, 0xae, 0xaf, 0xb4, 0xb6, 0xb7, 0xbc, 0xbf, 0xc5,
+    0xe7, 0xef, 0x09, 0x8e, 0x90, 0x91, 0x94, 0x9f, 0xab, 0xce,
+    0xd7, 0xe1, 0xec, 0xed, 0xc7, 0xcf, 0xea, 0xeb, 0xc0, 0xc1,
+    0xc8, 0xc9, 0xca, 0xcd, 0xd2, 0xd5, 0xda, 0xdb, 0xee, 0xf0,
+    0xf2, 0xf3, 0xff, 0xcb, 0xcc, 0xd3, 0xd4, 0xd6, 0xdd, 0xde,
+    0xdf, 0xf1, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xfa, 0xfb, 0xfc,
+    0xfd, 0xfe, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x0b,
+    0x0c, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x7f, 0xdc,
+    0xf9, 0x0a, 0x0d, 0x16, 0x100
+};
+
+
 ngx_int_t
 ngx_http_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
     ngx_uint_t last, ngx_log_t *log)
@@ -2650,6 +3073,21 @@ ngx_http_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
 
     end = src + len;
 
+    if (*state == 0 && len) {
+        if (ngx_http_huff_decode_fast(state, &ending, &src, end, dst)
+            != NGX_OK)
+        {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0,
+                           "http2 huffman decoding error: bad code");
+
+            return NGX_ERROR;
+        }
+
+        if (src == end) {
+            ch = *(end - 1);
+        }
+    }
+
     while (src != end) {
         ch = *src++;
 
@@ -2690,6 +3128,125 @@ ngx_http_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
 }
 
 
+static ngx_int_t
+ngx_http_huff_decode_fast(u_char *state, u_char *ending, u_char **src,
+    u_char *end, u_char **dst)
+{
+    u_char      *p, *d;
+    uint32_t     code, w;
+    uint64_t     buf;
+    ngx_uint_t   bits, n, v;
+
+    p = *src;
+    d = *dst;
+
+    buf = 0;
+    bits = 0;
+
+    for ( ;; ) {
+
+        if (end - p >= 8) {
+            buf |= ngx_http_huff_decode_buf(p) >> bits;
+            p += (63 - bits) >> 3;
+            bits |= 56;
+
+        } else {
+            while (bits <= 56 && p != end) {
+                buf |= (uint64_t) *p++ << (56 - bits);
+                bits += 8;
+            }
+        }
+
+        /* near the end, only codes within the remaining bits are decoded */
+
+        code = ngx_http_huff_decode_lookup[buf >> 53];
+
+        if (code) {
+            n = (code >> 24) & 0x7f;
+
+            if (n <= bits) {
+
+                /*
+                 * the second byte is written unconditionally, callers
+                 * always reserve a byte for the terminating null
+                 */
+
+                d[0] = (u_char) code;
+                d[1] = (u_char) (code >> 8);
+                d += 1 + (code >> 31);
+
+            } else {
+                n = (code >> 16) & 0xff;
+
+                if (n > bits) {
+                    break;
+                }
+
+                *d++ = (u_char) code;
+            }
+
+        } else {
+            w = (uint32_t) (buf >> 32);
+
+            for (n = 12; n < 30; n++) {
+                if (w < ngx_http_huff_decode_limit[n - 12]) {
+                    break;
+                }
+            }
+
+            if (n > bits) {
+                break;
+            }
+
+            w = (w >> (32 - n)) - ngx_http_huff_decode_base[n - 12];
+            code = ngx_http_huff_decode_symbols[w];
+
+            if (code == 256) {
+                /* EOS */
+                return NGX_ERROR;
+            }
+
+            *d++ = (u_char) code;
+        }
+
+        buf <<= n;
+        bits -= n;
+    }
+
+    /* the rest is passed to the state machine, starting at a nibble */
+
+    n = (p - *src) * 8 - bits;
+    p = *src + n / 8;
+    n %= 8;
+
+    if (n) {
+        if (n < 4) {
+            v = (*p >> 4) & ((1 << (4 - n)) - 1);
+            *state = ngx_http_huff_decode_prefix[(1 << (4 - n)) - 2 + v];
+        }
+
+        if (n <= 4) {
+            if (ngx_http_huff_decode_bits(state, ending, *p & 0xf, &d)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+        } else {
+            v = *p & ((1 << (8 - n)) - 1);
+            *state = ngx_http_huff_decode_prefix[(1 << (8 - n)) - 2 + v];
+            *ending = (v == (ngx_uint_t) (1 << (8 - n)) - 1);
+        }
+
+        p++;
+    }
+
+    *src = p;
+    *dst = d;
+
+    return NGX_OK;
+}
+
 
 static ngx_inline ngx_int_t
 ngx_http_huff_decode_bits(u_char *state, u_char *ending, ngx_uint_t bits,
@@ -98,12 +98,85 @@ static uint32_t  usual[] = {
 #endif
 
 
+#if (NGX_HAVE_SSE42 || NGX_HAVE_AVX2)
+
+#include <immintrin.h>
+
+#define NGX_HTTP_PARSE_SIMD  1
+
+
+/*
+ * the bytes which stop the vectorized scans, as pairs of inclusive bounds
+ * in the format of the SSE4.2 range comparison
+ */
+
+typedef struct {
+    int                              len;
+    u_char                           data[16];
+#if (NGX_HAVE_AVX2)
+    ngx_int_t                        nibbles;
+    u_char                           lo[16];
+    u_char                           hi[16];
+#endif
+} ngx_http_parse_ranges_t;
+
+#if (NGX_HAVE_AVX2)
+#define ngx_http_parse_ranges(len, data)  { len, data, 0, { 0 }, { 0 } }
+#else
+#define ngx_http_parse_ranges(len, data)  { len, data }
+#endif
+
+static ngx_http_parse_ranges_t  ngx_http_parse_check_uri_ranges =
+#if (NGX_WIN32)
+    ngx_http_parse_ranges(16,
+        "\x00\x20" "##" "%%" "++" "./" "??" "\x7f\x7f" "\\\\");
+#else
+    ngx_http_parse_ranges(14,
+        "\x00\x20" "##" "%%" "++" "./" "??" "\x7f\x7f");
+#endif
+
+static ngx_http_parse_ranges_t  ngx_http_parse_uri_ranges =
+    ngx_http_parse_ranges(6, "\x00\x20" "##" "\x7f\x7f");
+
+static ngx_http_parse_ranges_t  ngx_http_parse_value_ranges =
+    ngx_http_parse_ranges(6, "\x00\x00" "\n\n" "\r\r");
+
+
+/*
+ * the scans are declared pure, so the parsers may keep b->last and
+ * the like in registers across the calls; the only memory written is
+ * the lazily built tables of the static ranges, which the parsers
+ * never read
+ */
+
+static ngx_inline u_char *ngx_http_parse_skip(u_char *p, u_char *last,
+    ngx_http_parse_ranges_t *ranges);
+#if (NGX_HAVE_SSE42)
+static u_char *ngx_http_parse_skip_sse42(u_char *p, u_char *last,
+    ngx_http_parse_ranges_t *ranges) __attribute__ ((target ("sse4.2"), pure));
+#endif
+#if (NGX_HAVE_AVX2)
+static u_char *ngx_http_parse_skip_avx2(u_char *p, u_char *last,
+    ngx_http_parse_ranges_t *ranges) __attribute__ ((target ("avx2"), pure));
+#endif
+
+#endif
+
+static u_char *ngx_http_parse_sf_key(u_char *p, u_char *last);
+static u_char *ngx_http_parse_sf_item(u_char *p, u_char *last,
+    ngx_int_t *integer, ngx_int_t *boolean);
+static u_char *ngx_http_parse_sf_params(u_char *p, u_char *last);
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
 ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
 {
-    u_char  c, ch, *p, *m;
+    u_char      c, ch, *p, *m;
+#if (NGX_HTTP_PARSE_SIMD)
+    ngx_uint_t  simd;
+#endif
     enum {
         sw_start = 0,
         sw_method,
@@ -134,6 +207,10 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
 
     state = r->state;
 
+#if (NGX_HTTP_PARSE_SIMD)
+    simd = ngx_cpu_sse42 | ngx_cpu_avx2;
+#endif
+
     for (p = b->pos; p < b->last; p++) {
         ch = *p;
 
@@ -540,6 +617,14 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* check "/", "%" and "\" (Win32) in URI */
         case sw_check_uri:
 
+#if (NGX_HTTP_PARSE_SIMD)
+            if (simd && b->last - p >= 16) {
+                p = ngx_http_parse_skip(p, b->last,
+                                        &ngx_http_parse_check_uri_ranges);
+                ch = *p;
+            }
+#endif
+
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
                 break;
             }
@@ -604,6 +689,14 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* URI */
         case sw_uri:
 
+#if (NGX_HTTP_PARSE_SIMD)
+            if (simd && b->last - p >= 16) {
+                p = ngx_http_parse_skip(p, b->last,
+                                        &ngx_http_parse_uri_ranges);
+                ch = *p;
+            }
+#endif
+
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
                 break;
             }
@@ -821,6 +914,10 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char      c, ch, *p;
     ngx_uint_t  hash, i;
+#if (NGX_HTTP_PARSE_SIMD)
+    u_char     *q, *e;
+    ngx_uint_t  simd;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -848,6 +945,10 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
     hash = r->header_hash;
     i = r->lowcase_index;
 
+#if (NGX_HTTP_PARSE_SIMD)
+    simd = ngx_cpu_sse42 | ngx_cpu_avx2;
+#endif
+
     for (p = b->pos; p < b->last; p++) {
         ch = *p;
 
@@ -991,6 +1092,34 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
             default:
                 r->header_start = p;
                 state = sw_value;
+
+#if (NGX_HTTP_PARSE_SIMD)
+
+                /*
+                 * the value is scanned once as it starts rather than on
+                 * each byte in the sw_value state
+                 */
+
+                if (simd && b->last - p >= 16) {
+                    q = ngx_http_parse_skip(p, b->last,
+                                            &ngx_http_parse_value_ranges);
+
+                    if (q != p) {
+
+                        /* trailing spaces are handled as in sw_value */
+
+                        for (e = q; e[-1] == ' '; e--) { /* void */ }
+
+                        if (e != q) {
+                            r->header_end = e;
+                            state = sw_space_after_value;
+                        }
+
+                        p = q - 1;
+                    }
+                }
+#endif
+
                 break;
             }
             break;
@@ -2078,6 +2207,320 @@ ngx_http_parse_set_cookie_lines(ngx_http_request_t *r,
 }
 
 
+/*
+ * parses the "Priority" header field or the PRIORITY_UPDATE frame
+ * value, a structured field dictionary (RFC 8941) with the "u" and "i"
+ * parameters (RFC 9218); unknown members and parameters are ignored,
+ * the urgency and incremental values are only updated if the whole
+ * dictionary is valid
+ */
+
+ngx_int_t
+ngx_http_parse_priority(ngx_str_t *value, ngx_uint_t *urgency,
+    ngx_uint_t *incremental)
+{
+    u_char      *p, *last, *key;
+    size_t       len;
+    ngx_int_t    integer, boolean;
+    ngx_uint_t   u, i;
+
+    u = *urgency;
+    i = *incremental;
+
+    p = value->data;
+    last = p + value->len;
+
+    while (p < last && *p == ' ') { p++; }
+
+    while (p < last) {
+
+        key = p;
+
+        p = ngx_http_parse_sf_key(p, last);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        len = p - key;
+
+        integer = -1;
+        boolean = 1;
+
+        if (p < last && *p == '=') {
+            p++;
+
+            boolean = -1;
+
+            if (p < last && *p == '(') {
+
+                /* inner list */
+
+                for (p++; /* void */ ; /* void */ ) {
+
+                    while (p < last && *p == ' ') { p++; }
+
+                    if (p == last) {
+                        return NGX_ERROR;
+                    }
+
+                    if (*p == ')') {
+                        p++;
+                        break;
+                    }
+
+                    p = ngx_http_parse_sf_item(p, last, NULL, NULL);
+                    if (p == NULL) {
+                        return NGX_ERROR;
+                    }
+
+                    p = ngx_http_parse_sf_params(p, last);
+                    if (p == NULL) {
+                        return NGX_ERROR;
+                    }
+
+                    if (p < last && *p != ' ' && *p != ')') {
+                        return NGX_ERROR;
+                    }
+                }
+
+            } else {
+                p = ngx_http_parse_sf_item(p, last, &integer, &boolean);
+                if (p == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+        }
+
+        p = ngx_http_parse_sf_params(p, last);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (len == 1) {
+
+            /* members of other types are ignored */
+
+            if (key[0] == 'u'
+                && integer >= 0 && integer <= NGX_HTTP_MAX_URGENCY)
+            {
+                u = integer;
+
+            } else if (key[0] == 'i' && boolean != -1) {
+                i = boolean;
+            }
+        }
+
+        while (p < last && (*p == ' ' || *p == '\t')) { p++; }
+
+        if (p == last) {
+            break;
+        }
+
+        if (*p++ != ',') {
+            return NGX_ERROR;
+        }
+
+        while (p < last && (*p == ' ' || *p == '\t')) { p++; }
+
+        if (p == last) {
+            return NGX_ERROR;
+        }
+    }
+
+    *urgency = u;
+    *incremental = i;
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_parse_sf_key(u_char *p, u_char *last)
+{
+    u_char  ch;
+
+    if (p == last || !((*p >= 'a' && *p <= 'z') || *p == '*')) {
+        return NULL;
+    }
+
+    for (p++; p < last; p++) {
+        ch = *p;
+
+        if ((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9')
+            || ch == '_' || ch == '-' || ch == '.' || ch == '*')
+        {
+            continue;
+        }
+
+        break;
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_parse_sf_item(u_char *p, u_char *last, ngx_int_t *integer,
+    ngx_int_t *boolean)
+{
+    u_char      ch, *start;
+    ngx_int_t   n;
+    ngx_uint_t  negative;
+
+    if (p == last) {
+        return NULL;
+    }
+
+    switch (*p) {
+
+    case '?':
+        if (last - p < 2 || (p[1] != '0' && p[1] != '1')) {
+            return NULL;
+        }
+
+        if (boolean) {
+            *boolean = p[1] - '0';
+        }
+
+        return p + 2;
+
+    case '"':
+        for (p++; p < last; p++) {
+            ch = *p;
+
+            if (ch == '"') {
+                return p + 1;
+            }
+
+            if (ch == '\\') {
+                if (++p == last || (*p != '"' && *p != '\\')) {
+                    return NULL;
+                }
+
+                continue;
+            }
+
+            if (ch < 0x20 || ch >= 0x7f) {
+                return NULL;
+            }
+        }
+
+        return NULL;
+
+    case ':':
+        for (p++; p < last; p++) {
+            ch = *p;
+
+            if (ch == ':') {
+                return p + 1;
+            }
+
+            if (!((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z')
+                  || (ch >= '0' && ch <= '9')
+                  || ch == '+' || ch == '/' || ch == '='))
+            {
+                return NULL;
+            }
+        }
+
+        return NULL;
+    }
+
+    if (*p == '-' || (*p >= '0' && *p <= '9')) {
+
+        negative = (*p == '-');
+
+        if (negative) {
+            p++;
+        }
+
+        n = 0;
+
+        for (start = p; p < last && *p >= '0' && *p <= '9'; p++) {
+            if (p - start == 15) {
+                return NULL;
+            }
+
+            if (n <= NGX_HTTP_MAX_URGENCY) {
+                n = n * 10 + (*p - '0');
+            }
+        }
+
+        if (p == start) {
+            return NULL;
+        }
+
+        if (p < last && *p == '.') {
+
+            /* decimal */
+
+            if (p - start > 12) {
+                return NULL;
+            }
+
+            for (start = ++p; p < last && *p >= '0' && *p <= '9'; p++) {
+                /* void */
+            }
+
+            if (p == start || p - start > 3) {
+                return NULL;
+            }
+
+            return p;
+        }
+
+        if (integer && !negative) {
+            *integer = n;
+        }
+
+        return p;
+    }
+
+    if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '*') {
+
+        /* token */
+
+        for (p++; p < last; p++) {
+            ch = *p;
+
+            if (ch <= 0x20 || ch >= 0x7f
+                || ngx_strchr("\"(),;<=>?@[\\]{}", ch) != NULL)
+            {
+                break;
+            }
+        }
+
+        return p;
+    }
+
+    return NULL;
+}
+
+
+static u_char *
+ngx_http_parse_sf_params(u_char *p, u_char *last)
+{
+    while (p < last && *p == ';') {
+
+        for (p++; p < last && *p == ' '; p++) { /* void */ }
+
+        p = ngx_http_parse_sf_key(p, last);
+        if (p == NULL) {
+            return NULL;
+        }
+
+        if (p < last && *p == '=') {
+            p = ngx_http_parse_sf_item(p + 1, last, NULL, NULL);
+            if (p == NULL) {
+                return NULL;
+            }
+        }
+    }
+
+    return p;
+}
+
+
 ngx_int_t
 ngx_http_arg(ngx_http_request_t *r, u_char *name, size_t len, ngx_str_t *value)
 {
@@ -2407,3 +2850,208 @@ invalid:
 
     return NGX_ERROR;
 }
+
+
+#if (NGX_HTTP_PARSE_SIMD)
+
+/*
+ * returns the first byte within the given ranges, or the position where
+ * the vectorized scan stopped; the last byte is always left to the caller
+ */
+
+static ngx_inline u_char *
+ngx_http_parse_skip(u_char *p, u_char *last, ngx_http_parse_ranges_t *ranges)
+{
+#if (NGX_HAVE_AVX2)
+
+    if (ngx_cpu_avx2) {
+        return ngx_http_parse_skip_avx2(p, last, ranges);
+    }
+
+#endif
+
+#if (NGX_HAVE_SSE42)
+
+    if (ngx_cpu_sse42) {
+        return ngx_http_parse_skip_sse42(p, last, ranges);
+    }
+
+#endif
+
+    return p;
+}
+
+
+#if (NGX_HAVE_SSE42)
+
+static u_char *
+ngx_http_parse_skip_sse42(u_char *p, u_char *last,
+    ngx_http_parse_ranges_t *ranges)
+{
+    int      n;
+    __m128i  r, v;
+
+    r = _mm_loadu_si128((__m128i *) ranges->data);
+
+    while (last - p > 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        n = _mm_cmpestri(r, ranges->len, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                         |_SIDD_LEAST_SIGNIFICANT);
+
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+#endif
+
+
+#if (NGX_HAVE_AVX2)
+
+/*
+ * the ranges are converted to a pair of 16-byte tables indexed by low
+ * and high nibbles of a byte: a byte is within the ranges if the entries
+ * for its nibbles have a common bit, one bit per distinct set of low
+ * nibbles allowed with a high nibble
+ */
+
+static ngx_int_t
+ngx_http_parse_nibbles(ngx_http_parse_ranges_t *ranges)
+{
+    ngx_uint_t  c, i, k, n, bit;
+    uint16_t    rows[16], classes[8];
+
+    ngx_memzero(rows, sizeof(rows));
+
+    for (i = 0; i < (ngx_uint_t) ranges->len; i += 2) {
+        for (c = ranges->data[i]; c <= ranges->data[i + 1]; c++) {
+            rows[c >> 4] |= 1 << (c & 0xf);
+        }
+    }
+
+    ngx_memzero(ranges->lo, sizeof(ranges->lo));
+    ngx_memzero(ranges->hi, sizeof(ranges->hi));
+
+    n = 0;
+
+    for (i = 0; i < 16; i++) {
+        if (rows[i] == 0) {
+            continue;
+        }
+
+        for (k = 0; k < n; k++) {
+            if (classes[k] == rows[i]) {
+                break;
+            }
+        }
+
+        if (k == n) {
+            if (n == 8) {
+                return NGX_ERROR;
+            }
+
+            classes[n++] = rows[i];
+        }
+
+        bit = 1 << k;
+
+        ranges->hi[i] = (u_char) bit;
+
+        for (c = 0; c < 16; c++) {
+            if (rows[i] & (1 << c)) {
+                ranges->lo[c] |= (u_char) bit;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_parse_skip_avx2(u_char *p, u_char *last,
+    ngx_http_parse_ranges_t *ranges)
+{
+    uint32_t  mask;
+    __m128i   v, lo, hi, nibble;
+    __m256i   v2, lo2, hi2, nibble2;
+
+    if (ranges->nibbles == 0) {
+        ranges->nibbles = (ngx_http_parse_nibbles(ranges) == NGX_OK) ? 1 : -1;
+    }
+
+    if (ranges->nibbles == -1) {
+        return ngx_http_parse_skip_sse42(p, last, ranges);
+    }
+
+    lo = _mm_loadu_si128((__m128i *) ranges->lo);
+    hi = _mm_loadu_si128((__m128i *) ranges->hi);
+    nibble = _mm_set1_epi8(0x0f);
+
+    if (last - p > 32) {
+        lo2 = _mm256_broadcastsi128_si256(lo);
+        hi2 = _mm256_broadcastsi128_si256(hi);
+        nibble2 = _mm256_set1_epi8(0x0f);
+
+        do {
+            v2 = _mm256_loadu_si256((__m256i *) p);
+
+            v2 = _mm256_and_si256(
+                     _mm256_shuffle_epi8(lo2, _mm256_and_si256(v2, nibble2)),
+                     _mm256_shuffle_epi8(hi2,
+                         _mm256_and_si256(_mm256_srli_epi16(v2, 4), nibble2)));
+
+            mask = ~(uint32_t) _mm256_movemask_epi8(
+                       _mm256_cmpeq_epi8(v2, _mm256_setzero_si256()));
+
+            if (mask) {
+                p += __builtin_ctz(mask);
+                break;
+            }
+
+            p += 32;
+
+        } while (last - p > 32);
+
+        /* avoid penalties of the following SSE code */
+
+        _mm256_zeroupper();
+
+        if (mask) {
+            return p;
+        }
+    }
+
+    /* the tail is tested with the same tables in 16-byte halves */
+
+    while (last - p > 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        v = _mm_and_si128(
+                _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble)),
+                _mm_shuffle_epi8(hi,
+                    _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+
+        mask = ~(uint32_t) _mm_movemask_epi8(
+                   _mm_cmpeq_epi8(v, _mm_setzero_si128())) & 0xffff;
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+#endif
+
+#endif
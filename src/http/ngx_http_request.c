@@ -138,6 +138,10 @@ ngx_http_header_t  ngx_http_headers_in[] = {
                  offsetof(ngx_http_headers_in_t, upgrade),
                  ngx_http_process_header_line },
 
+    { ngx_string("Priority"),
+                 offsetof(ngx_http_headers_in_t, priority),
+                 ngx_http_process_header_line },
+
 #if (NGX_HTTP_GZIP || NGX_HTTP_HEADERS)
     { ngx_string("Accept-Encoding"),
                  offsetof(ngx_http_headers_in_t, accept_encoding),
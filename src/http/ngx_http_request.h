@@ -19,6 +19,10 @@
 #define NGX_HTTP_DISCARD_BUFFER_SIZE       4096
 #define NGX_HTTP_LINGERING_BUFFER_SIZE     4096
 
+/* RFC 9218 */
+#define NGX_HTTP_DEFAULT_URGENCY           3
+#define NGX_HTTP_MAX_URGENCY               7
+
 
 #define NGX_HTTP_VERSION_9                 9
 #define NGX_HTTP_VERSION_10                1000
@@ -202,6 +206,7 @@ typedef struct {
     ngx_table_elt_t                  *te;
     ngx_table_elt_t                  *expect;
     ngx_table_elt_t                  *upgrade;
+    ngx_table_elt_t                  *priority;
 
 #if (NGX_HTTP_GZIP || NGX_HTTP_HEADERS)
     ngx_table_elt_t                  *accept_encoding;
@@ -10,6 +10,73 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_UPSTREAM_COLLAPSE_PENDING  0
+#define NGX_HTTP_UPSTREAM_COLLAPSE_DONE     1
+#define NGX_HTTP_UPSTREAM_COLLAPSE_FAILED   2
+
+#define NGX_HTTP_UPSTREAM_COLLAPSE_POLL     50
+
+
+typedef struct {
+    ngx_str_node_t                       sn;
+    ngx_uint_t                           count;
+    ngx_uint_t                           generation;
+    ngx_uint_t                           state;
+    ngx_msec_t                           expire;
+    u_char                              *data;
+    size_t                               header;
+    size_t                               size;
+} ngx_http_upstream_collapse_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                         rbtree;
+    ngx_rbtree_node_t                    sentinel;
+    ngx_uint_t                           generation;
+} ngx_http_upstream_collapse_shctx_t;
+
+
+typedef struct {
+    ngx_http_upstream_collapse_shctx_t  *sh;
+    ngx_slab_pool_t                     *shpool;
+} ngx_http_upstream_collapse_ctx_t;
+
+
+struct ngx_http_upstream_collapse_s {
+    ngx_str_node_t                       sn;
+
+    ngx_rbtree_t                        *tree;
+    ngx_pool_t                          *pool;
+    ngx_http_request_t                  *leader;
+    ngx_queue_t                          waiters;
+    ngx_uint_t                           count;
+
+    ngx_str_t                            header;
+    ngx_chain_t                         *body;
+    ngx_chain_t                        **last;
+    size_t                               size;
+    size_t                               max_size;
+
+    ngx_shm_zone_t                      *shm_zone;
+    ngx_http_upstream_collapse_node_t   *node;
+    ngx_uint_t                           generation;
+    ngx_event_t                          event;
+
+    unsigned                             in_tree:1;
+    unsigned                             done:1;
+    unsigned                             failed:1;
+};
+
+
+typedef struct {
+    ngx_queue_t                          queue;
+    ngx_http_request_t                  *request;
+    ngx_http_upstream_collapse_t        *collapse;
+    ngx_event_t                          event;
+    unsigned                             queued:1;
+} ngx_http_upstream_collapse_wait_t;
+
+
 #if (NGX_HTTP_CACHE)
 static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
@@ -23,12 +90,42 @@ static ngx_int_t ngx_http_upstream_cache_check_range(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_status(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_ram_status(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_ram_stats(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_upstream_cache_etag(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 #endif
 
+static ngx_int_t ngx_http_upstream_collapse(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_collapse_send(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_collapse_header(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_collapse_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_chain_t *in);
+static void ngx_http_upstream_collapse_finish(ngx_http_upstream_collapse_t *co,
+    ngx_uint_t done);
+static void ngx_http_upstream_collapse_wakeup(ngx_http_upstream_collapse_t *co);
+static void ngx_http_upstream_collapse_wait_handler(ngx_event_t *ev);
+static void ngx_http_upstream_collapse_poll_handler(ngx_event_t *ev);
+static void ngx_http_upstream_collapse_cleanup(void *data);
+static void ngx_http_upstream_collapse_release(
+    ngx_http_upstream_collapse_t *co);
+static ngx_int_t ngx_http_upstream_collapse_shm_open(
+    ngx_http_upstream_collapse_t *co, ngx_msec_t timeout);
+static void ngx_http_upstream_collapse_shm_store(
+    ngx_http_upstream_collapse_t *co);
+static void ngx_http_upstream_collapse_shm_unref(
+    ngx_http_upstream_collapse_ctx_t *ctx,
+    ngx_http_upstream_collapse_node_t *node);
+static ngx_int_t ngx_http_upstream_collapse_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
 static void ngx_http_upstream_init_request(ngx_http_request_t *r);
 static void ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx);
 static void ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r);
@@ -183,8 +280,6 @@ static void ngx_http_upstream_ssl_handshake_handler(ngx_connection_t *c);
 static void ngx_http_upstream_ssl_handshake(ngx_http_request_t *,
     ngx_http_upstream_t *u, ngx_connection_t *c);
 static void ngx_http_upstream_ssl_save_session(ngx_connection_t *c);
-static ngx_int_t ngx_http_upstream_ssl_name(ngx_http_request_t *r,
-    ngx_http_upstream_t *u, ngx_connection_t *c);
 static ngx_int_t ngx_http_upstream_ssl_certificate(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_connection_t *c);
 #endif
@@ -414,6 +509,14 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_upstream_cache_status, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("upstream_cache_ram_status"), NULL,
+      ngx_http_upstream_cache_ram_status, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_cache_ram_stats"), NULL,
+      ngx_http_upstream_cache_ram_stats, 0,
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
     { ngx_string("upstream_cache_last_modified"), NULL,
       ngx_http_upstream_cache_last_modified, 0,
       NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
@@ -609,6 +712,44 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
 
 #endif
 
+    if (u->conf->collapse) {
+        ngx_int_t  rc;
+
+        rc = ngx_http_upstream_collapse(r, u);
+
+        if (rc == NGX_BUSY) {
+            r->write_event_handler = ngx_http_upstream_init_request;
+            return;
+        }
+
+        r->write_event_handler = ngx_http_request_empty_handler;
+
+        if (rc == NGX_ERROR) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        if (rc == NGX_OK) {
+            rc = ngx_http_upstream_collapse_send(r, u);
+
+            if (rc == NGX_DONE) {
+                return;
+            }
+
+            if (rc == NGX_HTTP_UPSTREAM_INVALID_HEADER) {
+                rc = NGX_DECLINED;
+                u->buffer.start = NULL;
+                u->collapse = NULL;
+                u->collapse_bypass = 1;
+            }
+        }
+
+        if (rc != NGX_DECLINED) {
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
+    }
+
     u->store = u->conf->store;
 
     if (!u->store && !r->post_action && !u->conf->ignore_client_abort) {
@@ -911,13 +1052,25 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
              || c->stale_updating) && !r->background
             && u->conf->cache_background_update)
         {
-            if (ngx_http_upstream_cache_background_update(r, u) == NGX_OK) {
-                r->cache->background = 1;
-                u->cache_status = rc;
-                rc = NGX_OK;
+            u->cache_status = rc;
 
-            } else {
-                rc = NGX_ERROR;
+            rc = ngx_http_file_cache_refresh(r);
+
+            if (rc == NGX_OK) {
+                if (ngx_http_upstream_cache_background_update(r, u)
+                    == NGX_OK)
+                {
+                    r->cache->background = 1;
+
+                } else {
+                    rc = NGX_ERROR;
+                }
+
+            } else if (rc == NGX_DECLINED) {
+
+                /* too many background updates, the stale response is used */
+
+                rc = NGX_OK;
             }
         }
 
@@ -939,6 +1092,24 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     case NGX_OK:
         u->cache_status = NGX_HTTP_CACHE_HIT;
+
+        if (c->refresh && !r->background && u->conf->cache_background_update) {
+            rc = ngx_http_file_cache_refresh(r);
+
+            if (rc == NGX_OK) {
+                if (ngx_http_upstream_cache_background_update(r, u)
+                    == NGX_OK)
+                {
+                    r->cache->background = 1;
+
+                } else {
+                    rc = NGX_ERROR;
+                }
+
+            } else if (rc == NGX_DECLINED) {
+                rc = NGX_OK;
+            }
+        }
     }
 
     switch (rc) {
@@ -1138,55 +1309,795 @@ ngx_http_upstream_cache_background_update(ngx_http_request_t *r,
 }
 
 
-static ngx_int_t
-ngx_http_upstream_cache_check_range(ngx_http_request_t *r,
-    ngx_http_upstream_t *u)
-{
-    off_t             offset;
-    u_char           *p, *start;
-    ngx_table_elt_t  *h;
+static ngx_int_t
+ngx_http_upstream_cache_check_range(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    off_t             offset;
+    u_char           *p, *start;
+    ngx_table_elt_t  *h;
+
+    h = r->headers_in.range;
+
+    if (h == NULL
+        || !u->cacheable
+        || u->conf->cache_max_range_offset == NGX_MAX_OFF_T_VALUE)
+    {
+        return NGX_OK;
+    }
+
+    if (u->conf->cache_max_range_offset == 0) {
+        return NGX_DECLINED;
+    }
+
+    if (h->value.len < 7
+        || ngx_strncasecmp(h->value.data, (u_char *) "bytes=", 6) != 0)
+    {
+        return NGX_OK;
+    }
+
+    p = h->value.data + 6;
+
+    while (*p == ' ') { p++; }
+
+    if (*p == '-') {
+        return NGX_DECLINED;
+    }
+
+    start = p;
+
+    while (*p >= '0' && *p <= '9') { p++; }
+
+    offset = ngx_atoof(start, p - start);
+
+    if (offset >= u->conf->cache_max_range_offset) {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_upstream_collapse(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    uint32_t                            hash;
+    ngx_str_t                           key;
+    ngx_int_t                           rc;
+    ngx_pool_t                         *pool;
+    ngx_str_node_t                     *sn;
+    ngx_pool_cleanup_t                 *cln;
+    ngx_http_upstream_collapse_t       *co;
+    ngx_http_upstream_main_conf_t      *umcf;
+    ngx_http_upstream_collapse_wait_t  *w;
+
+    if (u->collapse_waiting) {
+        return NGX_BUSY;
+    }
+
+    if (u->collapse) {
+        return u->collapse->done ? NGX_OK : NGX_DECLINED;
+    }
+
+    if (u->collapse_bypass
+        || r->method != NGX_HTTP_GET
+        || r->subrequest_in_memory
+        || r->post_action
+        || r->headers_in.content_length_n > 0
+        || r->headers_in.chunked)
+    {
+        return NGX_DECLINED;
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    if (r->cache) {
+        return NGX_DECLINED;
+    }
+
+#endif
+
+    if (ngx_http_complex_value(r, u->conf->collapse, &key) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (key.len == 0) {
+        return NGX_DECLINED;
+    }
+
+    hash = ngx_crc32_long(key.data, key.len);
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    sn = ngx_str_rbtree_lookup(&umcf->collapse, &key, hash);
+
+    if (sn == NULL
+        && (r->headers_in.if_modified_since
+            || r->headers_in.if_unmodified_since
+            || r->headers_in.if_match
+            || r->headers_in.if_none_match
+            || r->headers_in.if_range
+            || r->headers_in.range))
+    {
+        /*
+         * conditional and range requests are passed to an upstream
+         * as is, so their responses cannot be shared with others
+         */
+
+        return NGX_DECLINED;
+    }
+
+    w = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_collapse_wait_t));
+    if (w == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_upstream_collapse_cleanup;
+    cln->data = w;
+
+    w->request = r;
+
+    if (sn) {
+        co = (ngx_http_upstream_collapse_t *) sn;
+        goto wait;
+    }
+
+    pool = ngx_create_pool(1024, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    co = ngx_pcalloc(pool, sizeof(ngx_http_upstream_collapse_t));
+    if (co == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    co->sn.str.data = ngx_pnalloc(pool, key.len);
+    if (co->sn.str.data == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(co->sn.str.data, key.data, key.len);
+    co->sn.str.len = key.len;
+    co->sn.node.key = hash;
+
+    co->tree = &umcf->collapse;
+    co->pool = pool;
+    co->last = &co->body;
+    co->max_size = u->conf->collapse_max_size;
+    co->shm_zone = u->conf->collapse_zone;
+
+    co->event.handler = ngx_http_upstream_collapse_poll_handler;
+    co->event.data = co;
+    co->event.log = ngx_cycle->log;
+
+    ngx_queue_init(&co->waiters);
+
+    ngx_rbtree_insert(co->tree, &co->sn.node);
+    co->in_tree = 1;
+
+    if (co->shm_zone) {
+        rc = ngx_http_upstream_collapse_shm_open(co, u->conf->collapse_timeout);
+
+        if (rc == NGX_BUSY) {
+
+            /* another worker process is fetching the response */
+
+            ngx_add_timer(&co->event, NGX_HTTP_UPSTREAM_COLLAPSE_POLL);
+            goto wait;
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream collapse leader: \"%V\"", &key);
+
+    co->leader = r;
+    co->count = 1;
+
+    w->collapse = co;
+    u->collapse = co;
+
+    return NGX_DECLINED;
+
+wait:
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream collapse wait: \"%V\"", &key);
+
+    w->collapse = co;
+    w->event.handler = ngx_http_upstream_collapse_wait_handler;
+    w->event.data = w;
+    w->event.log = r->connection->log;
+
+    ngx_queue_insert_tail(&co->waiters, &w->queue);
+    w->queued = 1;
+    co->count++;
+
+    ngx_add_timer(&w->event, u->conf->collapse_timeout);
+
+    u->collapse = co;
+    u->collapse_waiting = 1;
+
+    r->main->blocked++;
+
+    return NGX_BUSY;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_collapse_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_int_t                      rc;
+    ngx_buf_t                     *b;
+    ngx_chain_t                   *cl, *out, **ll;
+    ngx_http_upstream_collapse_t  *co;
+
+    co = u->collapse;
+
+    u->buffer.start = co->header.data;
+    u->buffer.pos = co->header.data;
+    u->buffer.last = co->header.data + co->header.len;
+    u->buffer.end = u->buffer.last;
+
+    ngx_memzero(&u->headers_in, sizeof(ngx_http_upstream_headers_in_t));
+    u->headers_in.content_length_n = -1;
+    u->headers_in.last_modified_time = -1;
+
+    if (ngx_list_init(&u->headers_in.headers, r->pool, 8,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_list_init(&u->headers_in.trailers, r->pool, 2,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rc = u->process_header(r);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "collapsed response contains invalid header");
+
+        return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+    }
+
+    if (ngx_http_upstream_process_headers(r, u) != NGX_OK) {
+        return NGX_DONE;
+    }
+
+    r->headers_out.content_length_n = co->size;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    if (co->body == NULL) {
+        return ngx_http_send_special(r, NGX_HTTP_LAST);
+    }
+
+    out = NULL;
+    ll = &out;
+    b = NULL;
+
+    for (cl = co->body; cl; cl = cl->next) {
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = cl->buf->pos;
+        b->last = cl->buf->last;
+        b->memory = 1;
+
+        *ll = ngx_alloc_chain_link(r->pool);
+        if (*ll == NULL) {
+            return NGX_ERROR;
+        }
+
+        (*ll)->buf = b;
+        ll = &(*ll)->next;
+    }
+
+    *ll = NULL;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    return ngx_http_output_filter(r, out);
+}
+
+
+static void
+ngx_http_upstream_collapse_header(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    size_t                         len;
+    ngx_http_upstream_collapse_t  *co;
+
+    co = u->collapse;
+
+    if (co == NULL || co->leader != r) {
+        return;
+    }
+
+    len = u->buffer.pos - u->buffer.start;
+
+    if (u->upgrade || len == 0) {
+        ngx_http_upstream_collapse_finish(co, 0);
+        return;
+    }
+
+    co->header.data = ngx_pnalloc(co->pool, len);
+    if (co->header.data == NULL) {
+        ngx_http_upstream_collapse_finish(co, 0);
+        return;
+    }
+
+    ngx_memcpy(co->header.data, u->buffer.start, len);
+    co->header.len = len;
+}
+
+
+static void
+ngx_http_upstream_collapse_body(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_chain_t *in)
+{
+    size_t                         size;
+    ngx_buf_t                     *b;
+    ngx_chain_t                   *cl;
+    ngx_http_upstream_collapse_t  *co;
+
+    co = u->collapse;
+
+    if (co == NULL || co->leader != r) {
+        return;
+    }
+
+    for ( /* void */ ; in; in = in->next) {
+
+        if (!ngx_buf_in_memory(in->buf)) {
+
+            if (ngx_buf_special(in->buf)) {
+                continue;
+            }
+
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http upstream collapse: response buffered "
+                           "to a temporary file");
+            goto failed;
+        }
+
+        size = in->buf->last - in->buf->pos;
+
+        if (size == 0) {
+            continue;
+        }
+
+        if (co->size + size > co->max_size) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http upstream collapse: response too large");
+            goto failed;
+        }
+
+        b = ngx_create_temp_buf(co->pool, size);
+        if (b == NULL) {
+            goto failed;
+        }
+
+        b->last = ngx_cpymem(b->pos, in->buf->pos, size);
+
+        cl = ngx_alloc_chain_link(co->pool);
+        if (cl == NULL) {
+            goto failed;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+
+        *co->last = cl;
+        co->last = &cl->next;
+
+        co->size += size;
+    }
+
+    return;
+
+failed:
+
+    ngx_http_upstream_collapse_finish(co, 0);
+}
+
+
+static void
+ngx_http_upstream_collapse_finish(ngx_http_upstream_collapse_t *co,
+    ngx_uint_t done)
+{
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http upstream collapse finish: %ui, size:%uz count:%ui",
+                   done, co->size, co->count);
+
+    co->leader = NULL;
+
+    if (done) {
+        co->done = 1;
+
+    } else {
+        co->failed = 1;
+    }
+
+    if (co->node) {
+        ngx_http_upstream_collapse_shm_store(co);
+    }
+
+    ngx_http_upstream_collapse_wakeup(co);
+}
+
+
+static void
+ngx_http_upstream_collapse_wakeup(ngx_http_upstream_collapse_t *co)
+{
+    ngx_queue_t                        *q;
+    ngx_http_upstream_collapse_wait_t  *w;
+
+    if (co->in_tree) {
+        ngx_rbtree_delete(co->tree, &co->sn.node);
+        co->in_tree = 0;
+    }
+
+    while (!ngx_queue_empty(&co->waiters)) {
+        q = ngx_queue_head(&co->waiters);
+        ngx_queue_remove(q);
+
+        w = ngx_queue_data(q, ngx_http_upstream_collapse_wait_t, queue);
+        w->queued = 0;
+
+        if (w->event.timer_set) {
+            ngx_del_timer(&w->event);
+        }
+
+        ngx_post_event(&w->event, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_upstream_collapse_wait_handler(ngx_event_t *ev)
+{
+    ngx_connection_t                   *c;
+    ngx_http_request_t                 *r;
+    ngx_http_upstream_t                *u;
+    ngx_http_upstream_collapse_t       *co;
+    ngx_http_upstream_collapse_wait_t  *w;
+
+    w = ev->data;
+    r = w->request;
+    c = r->connection;
+    u = r->upstream;
+    co = w->collapse;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream collapse wakeup: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    if (w->queued) {
+        ngx_queue_remove(&w->queue);
+        w->queued = 0;
+
+        ngx_log_error(NGX_LOG_INFO, c->log, 0, "upstream collapse timeout");
+    }
+
+    if (!co->done) {
+        w->collapse = NULL;
+        u->collapse = NULL;
+        u->collapse_bypass = 1;
+
+        ngx_http_upstream_collapse_release(co);
+    }
+
+    u->collapse_waiting = 0;
+    r->main->blocked--;
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_upstream_collapse_poll_handler(ngx_event_t *ev)
+{
+    u_char                             *p;
+    ngx_buf_t                          *b;
+    ngx_chain_t                        *cl;
+    ngx_http_upstream_collapse_t       *co;
+    ngx_http_upstream_collapse_ctx_t   *ctx;
+    ngx_http_upstream_collapse_node_t  *node;
+
+    co = ev->data;
+    ctx = co->shm_zone->data;
+    node = co->node;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    if (node->state == NGX_HTTP_UPSTREAM_COLLAPSE_PENDING
+        && (ngx_msec_int_t) (node->expire - ngx_current_msec) > 0)
+    {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+        ngx_add_timer(ev, NGX_HTTP_UPSTREAM_COLLAPSE_POLL);
+        return;
+    }
+
+    if (node->state == NGX_HTTP_UPSTREAM_COLLAPSE_DONE) {
+
+        p = ngx_pnalloc(co->pool, node->header + node->size);
+        b = ngx_calloc_buf(co->pool);
+        cl = ngx_alloc_chain_link(co->pool);
+
+        if (p && b && cl) {
+            ngx_memcpy(p, node->data, node->header + node->size);
+
+            co->header.data = p;
+            co->header.len = node->header;
+
+            if (node->size) {
+                b->pos = p + node->header;
+                b->last = b->pos + node->size;
+                b->memory = 1;
+
+                cl->buf = b;
+                cl->next = NULL;
+
+                co->body = cl;
+                co->last = &cl->next;
+                co->size = node->size;
+            }
+
+            co->done = 1;
+        }
+    }
+
+    if (!co->done) {
+        co->failed = 1;
+    }
+
+    co->node = NULL;
+
+    ngx_http_upstream_collapse_shm_unref(ctx, node);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http upstream collapse shared: %ui, size:%uz",
+                   (ngx_uint_t) co->done, co->size);
+
+    ngx_http_upstream_collapse_wakeup(co);
+}
+
+
+static void
+ngx_http_upstream_collapse_cleanup(void *data)
+{
+    ngx_http_upstream_collapse_wait_t  *w = data;
+
+    ngx_http_upstream_collapse_t  *co;
+
+    co = w->collapse;
+
+    if (co == NULL) {
+        return;
+    }
+
+    if (w->event.timer_set) {
+        ngx_del_timer(&w->event);
+    }
+
+    if (w->event.posted) {
+        ngx_delete_posted_event(&w->event);
+    }
+
+    if (w->queued) {
+        ngx_queue_remove(&w->queue);
+        w->queued = 0;
+    }
+
+    if (co->leader == w->request) {
+        ngx_http_upstream_collapse_finish(co, 0);
+    }
+
+    w->collapse = NULL;
+
+    ngx_http_upstream_collapse_release(co);
+}
+
+
+static void
+ngx_http_upstream_collapse_release(ngx_http_upstream_collapse_t *co)
+{
+    ngx_http_upstream_collapse_ctx_t  *ctx;
+
+    if (--co->count) {
+        return;
+    }
+
+    if (co->in_tree) {
+        ngx_rbtree_delete(co->tree, &co->sn.node);
+    }
+
+    if (co->event.timer_set) {
+        ngx_del_timer(&co->event);
+    }
+
+    if (co->node) {
+        ctx = co->shm_zone->data;
+
+        ngx_shmtx_lock(&ctx->shpool->mutex);
+        ngx_http_upstream_collapse_shm_unref(ctx, co->node);
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+    }
+
+    ngx_destroy_pool(co->pool);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_collapse_shm_open(ngx_http_upstream_collapse_t *co,
+    ngx_msec_t timeout)
+{
+    ngx_msec_t                          now;
+    ngx_http_upstream_collapse_ctx_t   *ctx;
+    ngx_http_upstream_collapse_node_t  *node;
+
+    ctx = co->shm_zone->data;
+    now = ngx_current_msec;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    node = (ngx_http_upstream_collapse_node_t *)
+               ngx_str_rbtree_lookup(&ctx->sh->rbtree, &co->sn.str,
+                                     co->sn.node.key);
+
+    if (node == NULL) {
+        node = ngx_slab_alloc_locked(ctx->shpool,
+                                 sizeof(ngx_http_upstream_collapse_node_t)
+                                 + co->sn.str.len);
+        if (node == NULL) {
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "could not allocate node in upstream collapse "
+                          "zone \"%V\"", &co->shm_zone->shm.name);
+
+            return NGX_DECLINED;
+        }
+
+        node->sn.str.data = (u_char *) node
+                            + sizeof(ngx_http_upstream_collapse_node_t);
+        node->sn.str.len = co->sn.str.len;
+        node->sn.node.key = co->sn.node.key;
+
+        ngx_memcpy(node->sn.str.data, co->sn.str.data, co->sn.str.len);
+
+        node->count = 0;
+        node->data = NULL;
+
+        ngx_rbtree_insert(&ctx->sh->rbtree, &node->sn.node);
+
+    } else if (node->state != NGX_HTTP_UPSTREAM_COLLAPSE_FAILED
+               && (ngx_msec_int_t) (node->expire - now) > 0)
+    {
+        node->count++;
+        co->node = node;
+
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+        return NGX_BUSY;
+
+    } else if (node->data) {
+        ngx_slab_free_locked(ctx->shpool, node->data);
+        node->data = NULL;
+    }
+
+    node->count++;
+    node->state = NGX_HTTP_UPSTREAM_COLLAPSE_PENDING;
+    node->generation = ++ctx->sh->generation;
+    node->expire = now + timeout;
+
+    co->node = node;
+    co->generation = node->generation;
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_collapse_shm_store(ngx_http_upstream_collapse_t *co)
+{
+    u_char                             *p;
+    ngx_chain_t                        *cl;
+    ngx_http_upstream_collapse_ctx_t   *ctx;
+    ngx_http_upstream_collapse_node_t  *node;
+
+    ctx = co->shm_zone->data;
+    node = co->node;
+
+    co->node = NULL;
 
-    h = r->headers_in.range;
+    ngx_shmtx_lock(&ctx->shpool->mutex);
 
-    if (h == NULL
-        || !u->cacheable
-        || u->conf->cache_max_range_offset == NGX_MAX_OFF_T_VALUE)
+    if (node->generation == co->generation
+        && node->state == NGX_HTTP_UPSTREAM_COLLAPSE_PENDING)
     {
-        return NGX_OK;
-    }
+        node->state = NGX_HTTP_UPSTREAM_COLLAPSE_FAILED;
 
-    if (u->conf->cache_max_range_offset == 0) {
-        return NGX_DECLINED;
-    }
+        if (co->done && node->count > 1) {
 
-    if (h->value.len < 7
-        || ngx_strncasecmp(h->value.data, (u_char *) "bytes=", 6) != 0)
-    {
-        return NGX_OK;
-    }
+            p = ngx_slab_alloc_locked(ctx->shpool, co->header.len + co->size);
 
-    p = h->value.data + 6;
+            if (p) {
+                node->data = p;
+                node->header = co->header.len;
+                node->size = co->size;
 
-    while (*p == ' ') { p++; }
+                p = ngx_cpymem(p, co->header.data, co->header.len);
 
-    if (*p == '-') {
-        return NGX_DECLINED;
+                for (cl = co->body; cl; cl = cl->next) {
+                    p = ngx_cpymem(p, cl->buf->pos,
+                                   cl->buf->last - cl->buf->pos);
+                }
+
+                node->state = NGX_HTTP_UPSTREAM_COLLAPSE_DONE;
+            }
+        }
     }
 
-    start = p;
+    ngx_http_upstream_collapse_shm_unref(ctx, node);
 
-    while (*p >= '0' && *p <= '9') { p++; }
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+}
 
-    offset = ngx_atoof(start, p - start);
 
-    if (offset >= u->conf->cache_max_range_offset) {
-        return NGX_DECLINED;
+static void
+ngx_http_upstream_collapse_shm_unref(ngx_http_upstream_collapse_ctx_t *ctx,
+    ngx_http_upstream_collapse_node_t *node)
+{
+    if (--node->count) {
+        return;
     }
 
-    return NGX_OK;
-}
+    if (node->data) {
+        ngx_slab_free_locked(ctx->shpool, node->data);
+    }
 
-#endif
+    ngx_rbtree_delete(&ctx->sh->rbtree, &node->sn.node);
+
+    ngx_slab_free_locked(ctx->shpool, node);
+}
 
 
 static void
@@ -1565,6 +2476,30 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     u->state->peer = u->peer.name;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (u->upstream && u->upstream->resolver) {
+
+        /* peers of the upstream may be freed before the request ends */
+
+        u->state->peer = ngx_palloc(r->pool,
+                                    sizeof(ngx_str_t) + u->peer.name->len);
+        if (u->state->peer == NULL) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        u->state->peer->len = u->peer.name->len;
+        u->state->peer->data = (u_char *) (u->state->peer + 1);
+        ngx_memcpy(u->state->peer->data, u->peer.name->data,
+                   u->peer.name->len);
+
+        u->peer.name = u->state->peer;
+    }
+
+#endif
+
     if (rc == NGX_BUSY) {
         ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "no live upstreams");
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_NOLIVE);
@@ -1854,7 +2789,7 @@ ngx_http_upstream_ssl_save_session(ngx_connection_t *c)
 }
 
 
-static ngx_int_t
+ngx_int_t
 ngx_http_upstream_ssl_name(ngx_http_request_t *r, ngx_http_upstream_t *u,
     ngx_connection_t *c)
 {
@@ -3019,6 +3954,10 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     ngx_connection_t          *c;
     ngx_http_core_loc_conf_t  *clcf;
 
+    if (u->collapse) {
+        ngx_http_upstream_collapse_header(r, u);
+    }
+
     rc = ngx_http_send_header(r);
 
     if (rc == NGX_ERROR || rc > NGX_OK || r->post_action) {
@@ -3708,6 +4647,11 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
         if (do_write) {
 
             if (u->out_bufs || u->busy_bufs || downstream->buffered) {
+
+                if (u->collapse) {
+                    ngx_http_upstream_collapse_body(r, u, u->out_bufs);
+                }
+
                 rc = ngx_http_output_filter(r, u->out_bufs);
 
                 if (rc == NGX_ERROR) {
@@ -4012,6 +4956,10 @@ ngx_http_upstream_output_filter(void *data, ngx_chain_t *chain)
     r = data;
     p = r->upstream->pipe;
 
+    if (r->upstream->collapse) {
+        ngx_http_upstream_collapse_body(r, r->upstream, chain);
+    }
+
     rc = ngx_http_output_filter(r, chain);
 
     p->aio = r->aio;
@@ -4488,7 +5436,7 @@ static void
 ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_int_t rc)
 {
-    ngx_uint_t  flush;
+    ngx_uint_t  flush, done;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "finalize http upstream request: %i", rc);
@@ -4523,6 +5471,13 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
 
     u->finalize_request(r, rc);
 
+    if (u->collapse && u->collapse->leader == r) {
+        done = (rc == 0 && u->collapse->header.len && !r->header_only
+                && !(u->pipe && u->pipe->downstream_error));
+
+        ngx_http_upstream_collapse_finish(u->collapse, done);
+    }
+
     if (u->peer.free && u->peer.sockaddr) {
         u->peer.free(&u->peer, u->peer.data, 0);
         u->peer.sockaddr = NULL;
@@ -5973,6 +6928,69 @@ ngx_http_upstream_cache_status(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_upstream_cache_ram_status(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_uint_t  n;
+
+    if (r->upstream == NULL
+        || r->cache == NULL
+        || r->cache->ram_status == 0)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    n = r->cache->ram_status - 1;
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = ngx_http_cache_ram_status[n].len;
+    v->data = ngx_http_cache_ram_status[n].data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cache_ram_stats(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                        *p;
+    ngx_http_file_cache_ram_sh_t  *sh;
+
+    if (r->upstream == NULL
+        || r->cache == NULL
+        || r->cache->file_cache == NULL
+        || r->cache->file_cache->ram_sh == NULL)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    sh = r->cache->file_cache->ram_sh;
+
+    p = ngx_pnalloc(r->pool, sizeof("hits= misses= stores= evictions= size=")
+                             - 1 + 4 * NGX_ATOMIC_T_LEN + NGX_SIZE_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "hits=%uA misses=%uA stores=%uA evictions=%uA "
+                         "size=%uz", sh->hits, sh->misses, sh->stores,
+                         sh->evictions, sh->size)
+             - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -6054,7 +7072,8 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
                                          |NGX_HTTP_UPSTREAM_MAX_FAILS
                                          |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
                                          |NGX_HTTP_UPSTREAM_DOWN
-                                         |NGX_HTTP_UPSTREAM_BACKUP);
+                                         |NGX_HTTP_UPSTREAM_BACKUP
+                                         |NGX_HTTP_UPSTREAM_MODIFY);
     if (uscf == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -6153,7 +7172,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                   *value, s;
     ngx_url_t                    u;
     ngx_int_t                    weight, max_conns, max_fails;
-    ngx_uint_t                   i;
+    ngx_uint_t                   i, resolve;
     ngx_http_upstream_server_t  *us;
 
     us = ngx_array_push(uscf->servers);
@@ -6169,6 +7188,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_conns = 0;
     max_fails = 1;
     fail_timeout = 10;
+    resolve = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
 
@@ -6257,6 +7277,37 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+        if (ngx_strcmp(value[i].data, "resolve") == 0) {
+
+            if (!(uscf->flags & NGX_HTTP_UPSTREAM_MODIFY)) {
+                goto not_supported;
+            }
+
+            resolve = 1;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "service=", 8) == 0) {
+
+            if (!(uscf->flags & NGX_HTTP_UPSTREAM_MODIFY)) {
+                goto not_supported;
+            }
+
+            us->service.len = value[i].len - 8;
+            us->service.data = &value[i].data[8];
+
+            if (us->service.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+#endif
+
         goto invalid;
     }
 
@@ -6264,6 +7315,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     u.url = value[1];
     u.default_port = 80;
+    u.no_resolve = resolve;
 
     if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
         if (u.err) {
@@ -6274,6 +7326,34 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (us->service.len && !resolve) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" requires "
+                           "\"resolve\" parameter", &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    if (resolve && u.naddrs == 0) {
+
+        /* the name is resolved at run time */
+
+        if (us->service.len && !u.no_port) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "service upstream \"%V\" may not have port",
+                               &u.url);
+            return NGX_CONF_ERROR;
+        }
+
+        us->host = u.host;
+        us->port = u.port;
+
+    } else if (us->service.len) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" requires domain name",
+                           &u.url);
+        return NGX_CONF_ERROR;
+    }
+
     us->name = u.url;
     us->addrs = u.addrs;
     us->naddrs = u.naddrs;
@@ -6609,6 +7689,174 @@ ngx_http_upstream_param_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+char *
+ngx_http_upstream_collapse_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    char  *p = conf;
+
+    u_char                            *last;
+    ssize_t                            size;
+    ngx_str_t                         *value, name, s;
+    ngx_uint_t                         i;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_upstream_conf_t          *ucf;
+    ngx_http_compile_complex_value_t   ccv;
+    ngx_http_upstream_collapse_ctx_t  *ctx;
+
+    ucf = (ngx_http_upstream_conf_t *) (p + cmd->offset);
+
+    if (ucf->collapse != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2 && ngx_strcmp(value[1].data, "off") == 0) {
+        ucf->collapse = NULL;
+        return NGX_CONF_OK;
+    }
+
+    ucf->collapse = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (ucf->collapse == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = ucf->collapse;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_str_null(&name);
+    size = 0;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            last = (u_char *) ngx_strchr(name.data, ':');
+
+            if (last == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = last - name.data;
+
+            s.data = last + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ucf->collapse_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_upstream_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data == NULL) {
+        ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_collapse_ctx_t));
+        if (ctx == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shm_zone->init = ngx_http_upstream_collapse_init_zone;
+        shm_zone->data = ctx;
+    }
+
+    ucf->collapse_zone = shm_zone;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_collapse_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_collapse_ctx_t  *octx = data;
+
+    size_t                             len;
+    ngx_http_upstream_collapse_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool,
+                             sizeof(ngx_http_upstream_collapse_shctx_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ctx->sh->generation = 0;
+
+    len = sizeof(" in upstream collapse zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in upstream collapse zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    ctx->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
@@ -6749,6 +7997,9 @@ ngx_http_upstream_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    ngx_rbtree_init(&umcf->collapse, &umcf->collapse_sentinel,
+                    ngx_str_rbtree_insert_value);
+
     return umcf;
 }
 
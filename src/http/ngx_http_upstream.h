@@ -74,6 +74,9 @@ typedef struct {
     ngx_hash_t                       headers_in_hash;
     ngx_array_t                      upstreams;
                                              /* ngx_http_upstream_srv_conf_t */
+
+    ngx_rbtree_t                     collapse;
+    ngx_rbtree_node_t                collapse_sentinel;
 } ngx_http_upstream_main_conf_t;
 
 typedef struct ngx_http_upstream_srv_conf_s  ngx_http_upstream_srv_conf_t;
@@ -102,9 +105,13 @@ typedef struct {
     ngx_msec_t                       slow_start;
     ngx_uint_t                       down;
 
+    ngx_str_t                        host;
+    ngx_str_t                        service;
+    in_port_t                        port;
+
     unsigned                         backup:1;
 
-    NGX_COMPAT_BEGIN(6)
+    NGX_COMPAT_BEGIN(1)
     NGX_COMPAT_END
 } ngx_http_upstream_server_t;
 
@@ -116,6 +123,7 @@ typedef struct {
 #define NGX_HTTP_UPSTREAM_DOWN          0x0010
 #define NGX_HTTP_UPSTREAM_BACKUP        0x0020
 #define NGX_HTTP_UPSTREAM_MAX_CONNS     0x0100
+#define NGX_HTTP_UPSTREAM_MODIFY        0x0200
 
 
 struct ngx_http_upstream_srv_conf_s {
@@ -133,6 +141,8 @@ struct ngx_http_upstream_srv_conf_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
+    ngx_resolver_t                  *resolver;
+    ngx_msec_t                       resolver_timeout;
 #endif
 };
 
@@ -218,6 +228,11 @@ typedef struct {
     ngx_array_t                     *store_lengths;
     ngx_array_t                     *store_values;
 
+    ngx_http_complex_value_t        *collapse;
+    ngx_shm_zone_t                  *collapse_zone;
+    ngx_msec_t                       collapse_timeout;
+    size_t                           collapse_max_size;
+
 #if (NGX_HTTP_CACHE)
     signed                           cache:2;
 #endif
@@ -318,6 +333,9 @@ typedef void (*ngx_http_upstream_handler_pt)(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 
 
+typedef struct ngx_http_upstream_collapse_s  ngx_http_upstream_collapse_t;
+
+
 struct ngx_http_upstream_s {
     ngx_http_upstream_handler_pt     read_event_handler;
     ngx_http_upstream_handler_pt     write_event_handler;
@@ -382,6 +400,8 @@ struct ngx_http_upstream_s {
 
     ngx_http_cleanup_pt             *cleanup;
 
+    ngx_http_upstream_collapse_t    *collapse;
+
     unsigned                         store:1;
     unsigned                         cacheable:1;
     unsigned                         accel:1;
@@ -399,6 +419,9 @@ struct ngx_http_upstream_s {
     unsigned                         request_body_sent:1;
     unsigned                         request_body_blocked:1;
     unsigned                         header_sent:1;
+
+    unsigned                         collapse_waiting:1;
+    unsigned                         collapse_bypass:1;
 };
 
 
@@ -425,10 +448,17 @@ char *ngx_http_upstream_bind_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 char *ngx_http_upstream_param_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+char *ngx_http_upstream_collapse_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 ngx_int_t ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
     ngx_str_t *default_hide_headers, ngx_hash_init_t *hash);
 
+#if (NGX_HTTP_SSL)
+ngx_int_t ngx_http_upstream_ssl_name(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_connection_t *c);
+#endif
+
 
 #define ngx_http_conf_upstream_srv_conf(uscf, module)                         \
     uscf->srv_conf[module.ctx_index]
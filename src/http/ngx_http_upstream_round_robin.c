@@ -17,6 +17,14 @@
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t ngx_http_upstream_init_resolve_peers(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t backup);
+
+#endif
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t ngx_http_upstream_empty_set_session(ngx_peer_connection_t *pc,
@@ -32,7 +40,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
     ngx_url_t                      u;
-    ngx_uint_t                     i, j, n, w, t;
+    ngx_uint_t                     i, j, n, w, t, r, s;
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
@@ -45,12 +53,24 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         n = 0;
         w = 0;
         t = 0;
+        r = 0;
+        s = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (server[i].backup) {
                 continue;
             }
 
+            if (server[i].host.len) {
+                r++;
+
+                if (server[i].service.len) {
+                    s++;
+                }
+
+                continue;
+            }
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
 
@@ -59,13 +79,26 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
             }
         }
 
-        if (n == 0) {
+        if (n + r == 0) {
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
                           "no servers in upstream \"%V\" in %s:%ui",
                           &us->host, us->file_name, us->line);
             return NGX_ERROR;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+        if (r && us->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "resolving names at run time requires "
+                          "upstream \"%V\" in %s:%ui "
+                          "to be in shared memory",
+                          &us->host, us->file_name, us->line);
+            return NGX_ERROR;
+        }
+
+#endif
+
         peers = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peers_t));
         if (peers == NULL) {
             return NGX_ERROR;
@@ -112,17 +145,33 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         us->peer.data = peers;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+        if (r && ngx_http_upstream_init_resolve_peers(cf, us, peers, 0)
+                 != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+#endif
+
         /* backup servers */
 
         n = 0;
         w = 0;
         t = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (!server[i].backup) {
                 continue;
             }
 
+            if (server[i].host.len) {
+                r++;
+                continue;
+            }
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
 
@@ -131,7 +180,14 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
             }
         }
 
-        if (n == 0) {
+        /*
+         * SRV records of lower priority are resolved as backup servers,
+         * hence the backup peers are created if there are services
+         */
+
+        if (n + r == 0
+            && (s == 0 || !(us->flags & NGX_HTTP_UPSTREAM_BACKUP)))
+        {
             return NGX_OK;
         }
 
@@ -182,6 +238,16 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         peers->next = backup;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+        if (r && ngx_http_upstream_init_resolve_peers(cf, us, backup, 1)
+                 != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+#endif
+
         return NGX_OK;
     }
 
@@ -253,11 +319,69 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_http_upstream_init_resolve_peers(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t backup)
+{
+    ngx_uint_t                    i;
+    ngx_http_upstream_host_t     *host;
+    ngx_http_upstream_server_t   *server;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /*
+     * servers resolved at run time are kept as template peers,
+     * the peers of their addresses are created in shared memory
+     */
+
+    server = us->servers->elts;
+
+    for (i = 0; i < us->servers->nelts; i++) {
+
+        if (server[i].host.len == 0 || server[i].backup != backup) {
+            continue;
+        }
+
+        peer = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peer_t));
+        if (peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        host = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_host_t));
+        if (host == NULL) {
+            return NGX_ERROR;
+        }
+
+        host->name = server[i].host;
+        host->service = server[i].service;
+        host->port = server[i].port;
+
+        peer->weight = server[i].weight;
+        peer->effective_weight = server[i].weight;
+        peer->max_conns = server[i].max_conns;
+        peer->max_fails = server[i].max_fails;
+        peer->fail_timeout = server[i].fail_timeout;
+        peer->down = server[i].down;
+        peer->server = server[i].name;
+        peer->host = host;
+
+        peer->next = peers->resolve;
+        peers->resolve = peer;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_uint_t                         n;
+    ngx_uint_t                         n, tries;
     ngx_http_upstream_rr_peer_data_t  *rrp;
 
     rrp = r->upstream->peer.data;
@@ -275,12 +399,24 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     rrp->current = NULL;
     rrp->config = 0;
 
+    ngx_http_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (rrp->peers->config) {
+        rrp->config = *rrp->peers->config;
+    }
+#endif
+
     n = rrp->peers->number;
 
     if (rrp->peers->next && rrp->peers->next->number > n) {
         n = rrp->peers->next->number;
     }
 
+    tries = ngx_http_upstream_tries(rrp->peers);
+
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
     if (n <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
@@ -296,7 +432,7 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
 
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
-    r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
+    r->upstream->peer.tries = tries;
 #if (NGX_HTTP_SSL)
     r->upstream->peer.set_session =
                                ngx_http_upstream_set_round_robin_peer_session;
@@ -446,10 +582,18 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_http_upstream_rr_peers_wlock(peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (ngx_http_upstream_update_round_robin_peer(rrp) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        pc->name = peers->name;
+        return NGX_BUSY;
+    }
+#endif
+
     if (peers->single) {
         peer = peers->peer;
 
-        if (peer->down) {
+        if (peer->down || peer->unhealthy) {
             goto failed;
         }
 
@@ -547,7 +691,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
-        if (peer->down) {
+        if (peer->down || peer->unhealthy) {
             continue;
         }
 
@@ -596,6 +740,47 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+ngx_int_t
+ngx_http_upstream_update_round_robin_peer(
+    ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    ngx_uint_t                     n;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    /* the peers are locked */
+
+    peers = rrp->peers;
+
+    if (peers->config == NULL || rrp->config == *peers->config) {
+        return NGX_OK;
+    }
+
+    /*
+     * the peers were changed since the peer data were initialized,
+     * the tried peers are forgotten if the bitmap is still large enough
+     */
+
+    n = peers->number;
+
+    if (peers->next && peers->next->number > n) {
+        n = peers->next->number;
+    }
+
+    if (rrp->tried != &rrp->data || n > 8 * sizeof(uintptr_t)) {
+        return NGX_BUSY;
+    }
+
+    rrp->data = 0;
+    rrp->config = *peers->config;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 void
 ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
@@ -618,11 +803,17 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     if (rrp->peers->single) {
 
         peer->conns--;
+        pc->tries = 0;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (peer->zombie && peer->conns == 0) {
+            goto zombie;
+        }
+#endif
 
         ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
         ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
-        pc->tries = 0;
         return;
     }
 
@@ -661,12 +852,40 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
     peer->conns--;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peer->zombie && peer->conns == 0) {
+        goto zombie;
+    }
+#endif
+
+    ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
+    if (pc->tries) {
+        pc->tries--;
+    }
+
+    return;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+zombie:
+
+    /* the peer was removed from the peers while in use */
+
     ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
+
+    ngx_http_upstream_zone_free_peer(rrp->peers, peer);
+
     ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
+    rrp->current = NULL;
+
     if (pc->tries) {
         pc->tries--;
     }
+
+#endif
 }
 
 
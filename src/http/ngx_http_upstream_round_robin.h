@@ -16,6 +16,13 @@
 
 typedef struct ngx_http_upstream_rr_peer_s   ngx_http_upstream_rr_peer_t;
 
+
+typedef struct {
+    ngx_str_t                       name;
+    ngx_str_t                       service;
+    in_port_t                       port;
+} ngx_http_upstream_host_t;
+
 struct ngx_http_upstream_rr_peer_s {
     struct sockaddr                *sockaddr;
     socklen_t                       socklen;
@@ -37,8 +44,10 @@ struct ngx_http_upstream_rr_peer_s {
     time_t                          fail_timeout;
     ngx_msec_t                      slow_start;
     ngx_msec_t                      start_time;
+    ngx_msec_t                      response_time;
 
     ngx_uint_t                      down;
+    ngx_uint_t                      unhealthy;
 
 #if (NGX_HTTP_SSL || NGX_COMPAT)
     void                           *ssl_session;
@@ -47,11 +56,17 @@ struct ngx_http_upstream_rr_peer_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_atomic_t                    lock;
+    ngx_http_upstream_host_t       *host;
+    ngx_uint_t                      zombie;  /* unsigned  zombie:1; */
+
+    ngx_msec_t                      probed;
+    ngx_uint_t                      probe_fails;
+    ngx_uint_t                      probe_passes;
 #endif
 
     ngx_http_upstream_rr_peer_t    *next;
 
-    NGX_COMPAT_BEGIN(32)
+    NGX_COMPAT_BEGIN(25)
     NGX_COMPAT_END
 };
 
@@ -64,6 +79,8 @@ struct ngx_http_upstream_rr_peers_s {
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_slab_pool_t                *shpool;
     ngx_atomic_t                    rwlock;
+    ngx_uint_t                     *config;
+    ngx_http_upstream_rr_peer_t    *resolve;
     ngx_http_upstream_rr_peers_t   *zone_next;
 #endif
 
@@ -145,6 +162,13 @@ ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+ngx_int_t ngx_http_upstream_update_round_robin_peer(
+    ngx_http_upstream_rr_peer_data_t *rrp);
+void ngx_http_upstream_zone_free_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer);
+#endif
+
 #if (NGX_HTTP_SSL)
 ngx_int_t
     ngx_http_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
@@ -46,6 +46,10 @@ static ngx_int_t ngx_http_variable_argument(ngx_http_request_t *r,
 static ngx_int_t ngx_http_variable_tcpinfo(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 #endif
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+static ngx_int_t ngx_http_variable_listen_queue(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+#endif
 
 static ngx_int_t ngx_http_variable_content_length(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -383,6 +387,14 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 #endif
 
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+    { ngx_string("listen_queue"), NULL, ngx_http_variable_listen_queue,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("listen_backlog"), NULL, ngx_http_variable_listen_queue,
+      1, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+#endif
+
     { ngx_string("http_"), NULL, ngx_http_variable_unknown_header_in,
       0, NGX_HTTP_VAR_PREFIX, 0 },
 
@@ -1178,6 +1190,47 @@ ngx_http_variable_tcpinfo(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 #endif
 
 
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+
+static ngx_int_t
+ngx_http_variable_listen_queue(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    uint32_t          value;
+    socklen_t         len;
+    struct tcp_info   ti;
+    ngx_listening_t  *ls;
+
+    ls = r->connection->listening;
+
+    /* Linux reports the accept queue of a listening socket */
+
+    len = sizeof(struct tcp_info);
+    if (ls->type != SOCK_STREAM
+        || getsockopt(ls->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = ngx_pnalloc(r->pool, NGX_INT32_LEN);
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    value = data ? ti.tcpi_sacked : ti.tcpi_unacked;
+
+    v->len = ngx_sprintf(v->data, "%uD", value) - v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_variable_content_length(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
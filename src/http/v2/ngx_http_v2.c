@@ -31,6 +31,7 @@
 #define NGX_HTTP_V2_SETTINGS_ACK_SIZE            0
 #define NGX_HTTP_V2_RST_STREAM_SIZE              4
 #define NGX_HTTP_V2_PRIORITY_SIZE                5
+#define NGX_HTTP_V2_PRIORITY_UPDATE_SIZE         4
 #define NGX_HTTP_V2_PING_SIZE                    8
 #define NGX_HTTP_V2_GOAWAY_SIZE                  8
 #define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
@@ -51,6 +52,8 @@
 
 static void ngx_http_v2_read_handler(ngx_event_t *rev);
 static void ngx_http_v2_write_handler(ngx_event_t *wev);
+static ngx_http_v2_out_frame_t *ngx_http_v2_hold_frames(
+    ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *out);
 static void ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c);
 static void ngx_http_v2_lingering_close(ngx_connection_t *c);
 static void ngx_http_v2_lingering_close_handler(ngx_event_t *rev);
@@ -85,6 +88,8 @@ static u_char *ngx_http_v2_handle_continuation(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end, ngx_http_v2_handler_pt handler);
 static u_char *ngx_http_v2_state_priority(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
+static u_char *ngx_http_v2_state_priority_update(
+    ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_settings(ngx_http_v2_connection_t *h2c,
@@ -126,6 +131,11 @@ static ngx_http_v2_node_t *ngx_http_v2_get_closed_node(
 #define ngx_http_v2_index_size(h2scf)  (h2scf->streams_index_mask + 1)
 #define ngx_http_v2_index(h2scf, sid)  ((sid >> 1) & h2scf->streams_index_mask)
 
+#define ngx_http_v2_precedes(a, b)                                            \
+    ((a)->urgency < (b)->urgency                                              \
+     || ((a)->urgency == (b)->urgency && !(a)->incremental                    \
+         && !(b)->incremental && (a)->id < (b)->id))
+
 static ngx_int_t ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c);
 static ngx_int_t ngx_http_v2_settings_frame_handler(
     ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
@@ -158,6 +168,7 @@ static ngx_int_t ngx_http_v2_construct_request_line(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v2_cookie(ngx_http_request_t *r,
     ngx_http_v2_header_t *header);
 static ngx_int_t ngx_http_v2_construct_cookie_header(ngx_http_request_t *r);
+static void ngx_http_v2_set_priority(ngx_http_request_t *r);
 static void ngx_http_v2_run_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v2_process_request_body(ngx_http_request_t *r,
     u_char *pos, size_t size, ngx_uint_t last, ngx_uint_t flush);
@@ -249,6 +260,11 @@ ngx_http_v2_init(ngx_event_t *rev)
 
     h2c->priority_limit = ngx_max(h2scf->concurrent_streams, 100);
 
+    h2c->hpack_enc.limit = h2scf->hpack_table_size;
+    h2c->hpack_enc.size = ngx_min(h2scf->hpack_table_size,
+                                  NGX_HTTP_V2_TABLE_SIZE);
+    h2c->hpack_enc.free = h2c->hpack_enc.size;
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -507,7 +523,7 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
     ngx_chain_t               *cl;
     ngx_event_t               *wev;
     ngx_connection_t          *c;
-    ngx_http_v2_out_frame_t   *out, *frame, *fn;
+    ngx_http_v2_out_frame_t   *out, *frame, *fn, *held;
     ngx_http_core_loc_conf_t  *clcf;
 
     c = h2c->connection;
@@ -538,6 +554,12 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
                        out->blocked, out->length);
     }
 
+    held = ngx_http_v2_hold_frames(h2c, out);
+
+    if (held == out) {
+        cl = NULL;
+    }
+
     cl = c->send_chain(c, cl, 0);
 
     if (cl == NGX_CHAIN_ERROR) {
@@ -568,7 +590,7 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
         goto error;
     }
 
-    for ( /* void */ ; out; out = fn) {
+    for ( /* void */ ; out && out != held; out = fn) {
         fn = out->next;
 
         if (out->handler(h2c, out) != NGX_OK) {
@@ -597,6 +619,11 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
         return NGX_AGAIN;
     }
 
+    if (held) {
+        /* let more urgent streams queue their next frames first */
+        ngx_post_event(wev, &ngx_posted_next_events);
+    }
+
     if (wev->timer_set) {
         ngx_del_timer(wev);
     }
@@ -615,6 +642,58 @@ error:
 }
 
 
+static ngx_http_v2_out_frame_t *
+ngx_http_v2_hold_frames(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *out)
+{
+    ngx_http_v2_node_t       *node, *first;
+    ngx_http_v2_out_frame_t  *frame, *prev;
+
+    /*
+     * RFC 9218: data of a stream is held while a stream which precedes it
+     * either has frames queued before it, or was the most urgent stream
+     * sent last time and is about to queue more frames
+     */
+
+    first = h2c->urgent;
+
+    if (first
+        && (first->stream == NULL
+            || !first->stream->request->connection->write->posted))
+    {
+        first = NULL;
+    }
+
+    prev = NULL;
+
+    for (frame = out; frame; prev = frame, frame = frame->next) {
+
+        if (frame->stream == NULL) {
+            continue;
+        }
+
+        node = frame->stream->node;
+
+        if (first == NULL || ngx_http_v2_precedes(node, first)) {
+            first = node;
+            continue;
+        }
+
+        if (!frame->blocked && ngx_http_v2_precedes(first, node)) {
+            if (prev) {
+                prev->last->next = NULL;
+            }
+
+            break;
+        }
+    }
+
+    h2c->urgent = first;
+
+    return frame;
+}
+
+
 static void
 ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
 {
@@ -901,6 +980,10 @@ ngx_http_v2_state_head(ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end)
                    "http2 frame type:%ui f:%Xd l:%uz sid:%ui",
                    type, h2c->state.flags, h2c->state.length, h2c->state.sid);
 
+    if (type == NGX_HTTP_V2_PRIORITY_UPDATE_FRAME) {
+        return ngx_http_v2_state_priority_update(h2c, pos, end);
+    }
+
     if (type >= NGX_HTTP_V2_FRAME_STATES) {
         ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
                       "client sent frame with unknown type %ui", type);
@@ -2034,6 +2117,114 @@ ngx_http_v2_state_priority(ngx_http_v2_connection_t *h2c, u_char *pos,
 }
 
 
+static u_char *
+ngx_http_v2_state_priority_update(ngx_http_v2_connection_t *h2c, u_char *pos,
+    u_char *end)
+{
+    ngx_str_t            value;
+    ngx_uint_t           sid, urgency, incremental;
+    ngx_http_v2_node_t  *node;
+
+    if (h2c->state.length < NGX_HTTP_V2_PRIORITY_UPDATE_SIZE) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect length %uz", h2c->state.length);
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR);
+    }
+
+    if (h2c->state.sid) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect identifier");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    if ((size_t) (end - pos) < h2c->state.length) {
+
+        if (h2c->state.length > NGX_HTTP_V2_STATE_BUFFER_SIZE) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                           "http2 PRIORITY_UPDATE frame length:%uz ignored",
+                           h2c->state.length);
+
+            return ngx_http_v2_state_skip(h2c, pos, end);
+        }
+
+        return ngx_http_v2_state_save(h2c, pos, end,
+                                      ngx_http_v2_state_priority_update);
+    }
+
+    if (--h2c->priority_limit == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent too many PRIORITY_UPDATE frames");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_ENHANCE_YOUR_CALM);
+    }
+
+    sid = ngx_http_v2_parse_sid(pos);
+
+    value.data = pos + NGX_HTTP_V2_PRIORITY_UPDATE_SIZE;
+    value.len = h2c->state.length - NGX_HTTP_V2_PRIORITY_UPDATE_SIZE;
+
+    pos += h2c->state.length;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 PRIORITY_UPDATE frame sid:%ui \"%V\"", sid, &value);
+
+    if (sid == 0 || sid % 2 == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "for incorrect stream %ui", sid);
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    urgency = NGX_HTTP_DEFAULT_URGENCY;
+    incremental = 0;
+
+    if (ngx_http_parse_priority(&value, &urgency, &incremental) != NGX_OK) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent invalid priority update: \"%V\"", &value);
+
+        return ngx_http_v2_state_complete(h2c, pos, end);
+    }
+
+    /*
+     * RFC 9218, 7.  an update for a stream not yet opened is kept
+     * in an idle node, as with PRIORITY frames, and is applied when
+     * the stream is created
+     */
+
+    node = ngx_http_v2_get_node_by_id(h2c, sid, sid > h2c->last_sid);
+
+    if (node == NULL) {
+
+        if (sid > h2c->last_sid) {
+            return ngx_http_v2_connection_error(h2c,
+                                                NGX_HTTP_V2_INTERNAL_ERROR);
+        }
+
+        return ngx_http_v2_state_complete(h2c, pos, end);
+    }
+
+    if (node->stream == NULL && node->parent == NULL) {
+        node->weight = NGX_HTTP_V2_DEFAULT_WEIGHT;
+
+        h2c->closed_nodes++;
+        ngx_queue_insert_tail(&h2c->closed, &node->reuse);
+
+        ngx_http_v2_set_dependency(h2c, node, 0, 0);
+    }
+
+    node->urgency = urgency;
+    node->incremental = incremental;
+    node->priority_update = 1;
+
+    return ngx_http_v2_state_complete(h2c, pos, end);
+}
+
+
 static u_char *
 ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c, u_char *pos,
     u_char *end)
@@ -2228,7 +2419,7 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
 
-            h2c->table_update = 1;
+            ngx_http_v2_table_resize(h2c, value);
             break;
 
         default:
@@ -3124,6 +3315,14 @@ ngx_http_v2_get_node_by_id(ngx_http_v2_connection_t *h2c, ngx_uint_t sid,
 
     node->id = sid;
 
+    /*
+     * streams without priority signals are served as incremental,
+     * interleaved according to the RFC 7540 dependency tree
+     */
+
+    node->urgency = NGX_HTTP_DEFAULT_URGENCY;
+    node->incremental = 1;
+
     ngx_queue_init(&node->children);
 
     node->index = h2c->streams_index[index];
@@ -3716,6 +3915,36 @@ ngx_http_v2_construct_cookie_header(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_v2_set_priority(ngx_http_request_t *r)
+{
+    ngx_uint_t        urgency, incremental;
+    ngx_table_elt_t  *h;
+
+    urgency = NGX_HTTP_DEFAULT_URGENCY;
+    incremental = 0;
+
+    for (h = r->headers_in.priority; h; h = h->next) {
+
+        if (ngx_http_parse_priority(&h->value, &urgency, &incremental)
+            != NGX_OK)
+        {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent invalid \"Priority\" header: \"%V\"",
+                          &h->value);
+            return;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 priority urgency:%ui incremental:%ui",
+                   urgency, incremental);
+
+    r->stream->node->urgency = urgency;
+    r->stream->node->incremental = incremental;
+}
+
+
 static void
 ngx_http_v2_run_request(ngx_http_request_t *r)
 {
@@ -3750,6 +3979,15 @@ ngx_http_v2_run_request(ngx_http_request_t *r)
         goto failed;
     }
 
+    /*
+     * RFC 9218, 7.  a PRIORITY_UPDATE frame received before the request
+     * takes precedence over the "Priority" header
+     */
+
+    if (r->headers_in.priority && !r->stream->node->priority_update) {
+        ngx_http_v2_set_priority(r);
+    }
+
     if (r->headers_in.content_length_n > 0 && r->stream->in_closed) {
         ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
                       "client prematurely closed stream");
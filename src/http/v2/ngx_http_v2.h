@@ -27,16 +27,17 @@
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
 
 /* frame types */
-#define NGX_HTTP_V2_DATA_FRAME           0x0
-#define NGX_HTTP_V2_HEADERS_FRAME        0x1
-#define NGX_HTTP_V2_PRIORITY_FRAME       0x2
-#define NGX_HTTP_V2_RST_STREAM_FRAME     0x3
-#define NGX_HTTP_V2_SETTINGS_FRAME       0x4
-#define NGX_HTTP_V2_PUSH_PROMISE_FRAME   0x5
-#define NGX_HTTP_V2_PING_FRAME           0x6
-#define NGX_HTTP_V2_GOAWAY_FRAME         0x7
-#define NGX_HTTP_V2_WINDOW_UPDATE_FRAME  0x8
-#define NGX_HTTP_V2_CONTINUATION_FRAME   0x9
+#define NGX_HTTP_V2_DATA_FRAME             0x0
+#define NGX_HTTP_V2_HEADERS_FRAME          0x1
+#define NGX_HTTP_V2_PRIORITY_FRAME         0x2
+#define NGX_HTTP_V2_RST_STREAM_FRAME       0x3
+#define NGX_HTTP_V2_SETTINGS_FRAME         0x4
+#define NGX_HTTP_V2_PUSH_PROMISE_FRAME     0x5
+#define NGX_HTTP_V2_PING_FRAME             0x6
+#define NGX_HTTP_V2_GOAWAY_FRAME           0x7
+#define NGX_HTTP_V2_WINDOW_UPDATE_FRAME    0x8
+#define NGX_HTTP_V2_CONTINUATION_FRAME     0x9
+#define NGX_HTTP_V2_PRIORITY_UPDATE_FRAME  0x10
 
 /* frame flags */
 #define NGX_HTTP_V2_NO_FLAG              0x00
@@ -51,6 +52,9 @@
 
 #define NGX_HTTP_V2_DEFAULT_WEIGHT       16
 
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
+
 
 typedef struct ngx_http_v2_connection_s   ngx_http_v2_connection_t;
 typedef struct ngx_http_v2_node_s         ngx_http_v2_node_t;
@@ -67,6 +71,7 @@ typedef struct {
     ngx_uint_t                       concurrent_streams;
     size_t                           preread_size;
     ngx_uint_t                       streams_index_mask;
+    size_t                           hpack_table_size;
 } ngx_http_v2_srv_conf_t;
 
 
@@ -121,6 +126,24 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    ngx_http_v2_header_t            *entries;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    size_t                           size;
+    size_t                           free;
+    size_t                           limit;
+    size_t                           update;
+    u_char                          *storage;
+    u_char                          *pos;
+
+    unsigned                         size_update:1;
+} ngx_http_v2_hpack_enc_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -144,6 +167,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
 
@@ -153,6 +177,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_node_t             **streams_index;
 
     ngx_http_v2_out_frame_t         *last_out;
+    ngx_http_v2_node_t              *urgent;
 
     ngx_queue_t                      dependencies;
     ngx_queue_t                      closed;
@@ -163,7 +188,6 @@ struct ngx_http_v2_connection_s {
     time_t                           lingering_time;
 
     unsigned                         settings_ack:1;
-    unsigned                         table_update:1;
     unsigned                         blocked:1;
     unsigned                         goaway:1;
 };
@@ -180,6 +204,11 @@ struct ngx_http_v2_node_s {
     ngx_uint_t                       weight;
     double                           rel_weight;
     ngx_http_v2_stream_t            *stream;
+
+    /* RFC 9218 */
+    unsigned                         urgency:3;
+    unsigned                         incremental:1;
+    unsigned                         priority_update:1;
 };
 
 
@@ -241,19 +270,55 @@ static ngx_inline void
 ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
+    ngx_http_v2_node_t        *node, *prev;
     ngx_http_v2_out_frame_t  **out;
 
+    node = frame->stream->node;
+
     for (out = &h2c->last_out; *out; out = &(*out)->next) {
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
+        if ((*out)->stream == NULL) {
             break;
         }
 
-        if ((*out)->stream->node->rank < frame->stream->node->rank
-            || ((*out)->stream->node->rank == frame->stream->node->rank
-                && (*out)->stream->node->rel_weight
-                   >= frame->stream->node->rel_weight))
-        {
+        /*
+         * DATA frames may pass HEADERS frames of less urgent streams,
+         * but not the first frame, which may be partially sent
+         */
+
+        if ((*out)->blocked && (frame->blocked || (*out)->next == NULL)) {
+            break;
+        }
+
+        prev = (*out)->stream->node;
+
+        if (prev->urgency != node->urgency) {
+            if (prev->urgency < node->urgency) {
+                break;
+            }
+
+            continue;
+        }
+
+        if (prev->rank != node->rank) {
+            if (prev->rank < node->rank) {
+                break;
+            }
+
+            continue;
+        }
+
+        if (prev->rel_weight != node->rel_weight) {
+            if (prev->rel_weight > node->rel_weight) {
+                break;
+            }
+
+            continue;
+        }
+
+        /* non-incremental streams are sent sequentially */
+
+        if (prev->incremental || node->incremental || prev->id <= node->id) {
             break;
         }
     }
@@ -309,6 +374,12 @@ ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
+ngx_int_t ngx_http_v2_table_find(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t *index);
+ngx_int_t ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value);
+void ngx_http_v2_table_resize(ngx_http_v2_connection_t *h2c, size_t size);
+
 
 #define ngx_http_v2_prefix(bits)  ((1 << (bits)) - 1)
 
@@ -399,9 +470,11 @@ ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 #define NGX_HTTP_V2_CONTENT_LENGTH_INDEX  28
 #define NGX_HTTP_V2_CONTENT_TYPE_INDEX    31
 #define NGX_HTTP_V2_DATE_INDEX            33
+#define NGX_HTTP_V2_ETAG_INDEX            34
 #define NGX_HTTP_V2_LAST_MODIFIED_INDEX   44
 #define NGX_HTTP_V2_LOCATION_INDEX        46
 #define NGX_HTTP_V2_SERVER_INDEX          54
+#define NGX_HTTP_V2_SET_COOKIE_INDEX      55
 #define NGX_HTTP_V2_VARY_INDEX            59
 
 #define NGX_HTTP_V2_PREFACE_START         "PRI * HTTP/2.0\r\n"
@@ -412,6 +485,10 @@ ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
 u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
+u_char *ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp);
+u_char *ngx_http_v2_write_table_size(ngx_http_v2_connection_t *h2c,
+    u_char *pos);
 
 
 extern ngx_module_t  ngx_http_v2_module;
@@ -40,6 +40,97 @@ ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len, u_char *tmp,
 }
 
 
+u_char *
+ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp)
+{
+    ngx_int_t   rc;
+    ngx_uint_t  prefix;
+
+    if (name == NULL) {
+        name = ngx_http_v2_get_static_name(index);
+    }
+
+    if (ngx_http_v2_table_find(h2c, name, value, &index) == NGX_OK) {
+        /* indexed header field */
+        *pos = 0x80;
+        return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), index);
+    }
+
+    switch (index) {
+
+    case NGX_HTTP_V2_CONTENT_LENGTH_INDEX:
+    case NGX_HTTP_V2_ETAG_INDEX:
+    case NGX_HTTP_V2_LAST_MODIFIED_INDEX:
+    case NGX_HTTP_V2_LOCATION_INDEX:
+    case NGX_HTTP_V2_SET_COOKIE_INDEX:
+
+        /* the values are either unique or sensitive */
+
+        rc = NGX_DECLINED;
+        break;
+
+    default:
+
+        /* large fields would flush the table */
+
+        if (32 + name->len + value->len > h2c->hpack_enc.size / 4 * 3) {
+            rc = NGX_DECLINED;
+            break;
+        }
+
+        rc = ngx_http_v2_table_insert(h2c, name, value);
+    }
+
+    if (rc == NGX_OK) {
+        /* literal header field with incremental indexing */
+        *pos = 0x40;
+        prefix = ngx_http_v2_prefix(6);
+
+    } else {
+        /* literal header field without indexing */
+        *pos = 0;
+        prefix = ngx_http_v2_prefix(4);
+    }
+
+    if (index) {
+        pos = ngx_http_v2_write_int(pos, prefix, index);
+
+    } else {
+        pos = ngx_http_v2_write_name(pos + 1, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+}
+
+
+u_char *
+ngx_http_v2_write_table_size(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    if (enc->update < enc->size) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: %uz", enc->update);
+
+        *pos = 0x20;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), enc->update);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table size update: %uz", enc->size);
+
+    *pos = 0x20;
+    pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), enc->size);
+
+    enc->size_update = 0;
+
+    return pos;
+}
+
+
 static u_char *
 ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
 {
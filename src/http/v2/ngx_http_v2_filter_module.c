@@ -102,7 +102,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
     u_char                     status, *pos, *start, *p, *tmp;
     size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
+    ngx_str_t                  host, location, value;
     ngx_uint_t                 i, port, fin;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
@@ -114,19 +114,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
-
-    static const u_char nginx[5] = "\x84\xaa\x63\x55\xe7";
-#if (NGX_HTTP_GZIP)
-    static const u_char accept_encoding[12] =
-        "\x8b\x84\x84\x2d\x69\x5b\x05\x44\x3c\x86\xaa\x6f";
-#endif
-
-    static size_t nginx_ver_len = ngx_http_v2_literal_size(NGINX_VER);
-    static u_char nginx_ver[ngx_http_v2_literal_size(NGINX_VER)];
-
-    static size_t nginx_ver_build_len =
-                                  ngx_http_v2_literal_size(NGINX_VER_BUILD);
-    static u_char nginx_ver_build[ngx_http_v2_literal_size(NGINX_VER_BUILD)];
+    u_char                     buf[sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1];
 
     stream = r->stream;
 
@@ -211,7 +199,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     h2c = stream->connection;
 
-    len = h2c->table_update ? 1 : 0;
+    len = h2c->hpack_enc.size_update ? 2 * NGX_HTTP_V2_INT_OCTETS : 0;
 
     len += status ? 1 : 1 + ngx_http_v2_literal_size("418");
 
@@ -220,13 +208,13 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (r->headers_out.server == NULL) {
 
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            len += 1 + nginx_ver_len;
+            len += 1 + NGX_HTTP_V2_INT_OCTETS + sizeof(NGINX_VER) - 1;
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            len += 1 + nginx_ver_build_len;
+            len += 1 + NGX_HTTP_V2_INT_OCTETS + sizeof(NGINX_VER_BUILD) - 1;
 
         } else {
-            len += 1 + sizeof(nginx);
+            len += 1 + NGX_HTTP_V2_INT_OCTETS + sizeof("nginx") - 1;
         }
     }
 
@@ -235,13 +223,34 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     }
 
     if (r->headers_out.content_type.len) {
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
         {
-            len += sizeof("; charset=") - 1 + r->headers_out.charset.len;
+            value.len = r->headers_out.content_type.len
+                        + sizeof("; charset=") - 1 + r->headers_out.charset.len;
+
+            p = ngx_pnalloc(r->pool, value.len);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            value.data = p;
+
+            p = ngx_cpymem(p, r->headers_out.content_type.data,
+                           r->headers_out.content_type.len);
+
+            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
+
+            ngx_memcpy(p, r->headers_out.charset.data,
+                       r->headers_out.charset.len);
+
+            /* updated r->headers_out.content_type is also needed for logging */
+
+            r->headers_out.content_type = value;
         }
+
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
     }
 
     if (r->headers_out.content_length == NULL
@@ -334,12 +343,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
     }
 
-    tmp_len = len;
-
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
         if (clcf->gzip_vary) {
-            len += 1 + sizeof(accept_encoding);
+            len += 1 + ngx_http_v2_literal_size("Accept-Encoding");
 
         } else {
             r->gzip_vary = 0;
@@ -347,6 +354,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     }
 #endif
 
+    tmp_len = len;
+
     part = &r->headers_out.headers.part;
     header = part->elts;
 
@@ -401,11 +410,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     start = pos;
 
-    if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
+    if (h2c->hpack_enc.size_update) {
+        pos = ngx_http_v2_write_table_size(h2c, pos);
     }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
@@ -416,98 +422,50 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         *pos++ = status;
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
-        pos = ngx_sprintf(pos, "%03ui", r->headers_out.status);
+        value.len = ngx_sprintf(buf, "%03ui", r->headers_out.status) - buf;
+        value.data = buf;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                       NULL, &value, tmp);
     }
 
     if (r->headers_out.server == NULL) {
 
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER);
+            ngx_str_set(&value, NGINX_VER);
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER_BUILD);
+            ngx_str_set(&value, NGINX_VER_BUILD);
 
         } else {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: nginx\"");
+            ngx_str_set(&value, "nginx");
         }
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
-
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            if (nginx_ver[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver, (u_char *) NGINX_VER,
-                                            sizeof(NGINX_VER) - 1, tmp);
-                nginx_ver_len = p - nginx_ver;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
-
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            if (nginx_ver_build[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver_build,
-                                            (u_char *) NGINX_VER_BUILD,
-                                            sizeof(NGINX_VER_BUILD) - 1, tmp);
-                nginx_ver_build_len = p - nginx_ver_build;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"server: %V\"", &value);
 
-        } else {
-            pos = ngx_cpymem(pos, nginx, sizeof(nginx));
-        }
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                       NULL, &value, tmp);
     }
 
     if (r->headers_out.date == NULL) {
+        value = ngx_cached_http_time;
+
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"date: %V\"",
-                       &ngx_cached_http_time);
+                       "http2 output header: \"date: %V\"", &value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
-                                      ngx_cached_http_time.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_DATE_INDEX,
+                                       NULL, &value, tmp);
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
-
-        if (r->headers_out.content_type_len == r->headers_out.content_type.len
-            && r->headers_out.charset.len)
-        {
-            len = r->headers_out.content_type.len + sizeof("; charset=") - 1
-                  + r->headers_out.charset.len;
-
-            p = ngx_pnalloc(r->pool, len);
-            if (p == NULL) {
-                return NGX_ERROR;
-            }
-
-            p = ngx_cpymem(p, r->headers_out.content_type.data,
-                           r->headers_out.content_type.len);
-
-            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
-
-            p = ngx_cpymem(p, r->headers_out.charset.data,
-                           r->headers_out.charset.len);
-
-            /* updated r->headers_out.content_type is also needed for logging */
-
-            r->headers_out.content_type.len = len;
-            r->headers_out.content_type.data = p - len;
-        }
-
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_TYPE_INDEX, NULL,
+                                       &r->headers_out.content_type, tmp);
     }
 
     if (r->headers_out.content_length == NULL
@@ -517,30 +475,28 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        value.len = ngx_sprintf(buf, "%O", r->headers_out.content_length_n)
+                    - buf;
+        value.data = buf;
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_LENGTH_INDEX, NULL,
+                                       &value, tmp);
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+        value.len = ngx_http_time(buf, r->headers_out.last_modified_time)
+                    - buf;
+        value.data = buf;
 
-        ngx_http_time(pos, r->headers_out.last_modified_time);
-        len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
-
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"last-modified: %*s\"",
-                       len, pos);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"last-modified: %V\"", &value);
 
-        /*
-         * Date will always be encoded using huffman in the temporary buffer,
-         * so it's safe here to use src and dst pointing to the same address.
-         */
-        pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_LAST_MODIFIED_INDEX, NULL,
+                                       &value, tmp);
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -548,9 +504,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_LOCATION_INDEX,
+                                       NULL, &r->headers_out.location->value,
+                                       tmp);
     }
 
 #if (NGX_HTTP_GZIP)
@@ -558,8 +514,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        ngx_str_set(&value, "Accept-Encoding");
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                       NULL, &value, tmp);
     }
 #endif
 
@@ -592,13 +550,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
 #endif
 
-        *pos++ = 0;
-
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
-
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &header[i].key,
+                                       &header[i].value, tmp);
     }
 
     fin = r->header_only
@@ -606,6 +559,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     frame = ngx_http_v2_create_headers_frame(r, start, pos, fin);
     if (frame == NULL) {
+        /* the encoder state already includes this header block */
+        h2c->connection->error = 1;
         return NGX_ERROR;
     }
 
@@ -737,14 +692,17 @@ ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
 static ngx_http_v2_out_frame_t *
 ngx_http_v2_create_trailers_frame(ngx_http_request_t *r)
 {
-    u_char            *pos, *start, *tmp;
-    size_t             len, tmp_len;
-    ngx_uint_t         i;
-    ngx_list_part_t   *part;
-    ngx_table_elt_t   *header;
-    ngx_connection_t  *fc;
+    u_char                    *pos, *start, *tmp;
+    size_t                     len, tmp_len;
+    ngx_uint_t                 i;
+    ngx_list_part_t           *part;
+    ngx_table_elt_t           *header;
+    ngx_connection_t          *fc;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
 
     fc = r->connection;
+    h2c = r->stream->connection;
     len = 0;
     tmp_len = 0;
 
@@ -797,6 +755,10 @@ ngx_http_v2_create_trailers_frame(ngx_http_request_t *r)
         return NGX_HTTP_V2_NO_TRAILERS;
     }
 
+    if (h2c->hpack_enc.size_update) {
+        len += 2 * NGX_HTTP_V2_INT_OCTETS;
+    }
+
     tmp = ngx_palloc(r->pool, tmp_len);
     pos = ngx_pnalloc(r->pool, len);
 
@@ -806,6 +768,10 @@ ngx_http_v2_create_trailers_frame(ngx_http_request_t *r)
 
     start = pos;
 
+    if (h2c->hpack_enc.size_update) {
+        pos = ngx_http_v2_write_table_size(h2c, pos);
+    }
+
     part = &r->headers_out.trailers.part;
     header = part->elts;
 
@@ -835,16 +801,17 @@ ngx_http_v2_create_trailers_frame(ngx_http_request_t *r)
         }
 #endif
 
-        *pos++ = 0;
-
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &header[i].key,
+                                       &header[i].value, tmp);
+    }
 
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+    frame = ngx_http_v2_create_headers_frame(r, start, pos, 1);
+    if (frame == NULL) {
+        h2c->connection->error = 1;
+        return NULL;
     }
 
-    return ngx_http_v2_create_headers_frame(r, start, pos, 1);
+    return frame;
 }
 
 
@@ -1022,6 +989,12 @@ ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in, off_t limit)
             frame = ngx_http_v2_filter_get_data_frame(stream, frame_size,
                                                       out, cl);
             if (frame == NULL) {
+
+                if (trailers != NGX_HTTP_V2_NO_TRAILERS) {
+                    /* the trailers were already encoded */
+                    h2c->connection->error = 1;
+                }
+
                 return NGX_CHAIN_ERROR;
             }
 
@@ -10,11 +10,12 @@
 #include <ngx_http.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
+static ngx_int_t ngx_http_v2_table_cmp(ngx_http_v2_hpack_enc_t *enc,
+    u_char *p, u_char *s, size_t len, ngx_uint_t lower);
+static u_char *ngx_http_v2_table_copy(ngx_http_v2_hpack_enc_t *enc,
+    u_char *src, size_t len, ngx_uint_t lower);
 
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
@@ -361,3 +362,238 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+ngx_int_t
+ngx_http_v2_table_find(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value, ngx_uint_t *index)
+{
+    ngx_uint_t                i, found;
+    ngx_http_v2_header_t     *entry;
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+    found = 0;
+
+    for (i = enc->added; i != enc->deleted; /* void */) {
+        entry = &enc->entries[--i % enc->allocated];
+
+        if (entry->name.len != name->len
+            || ngx_http_v2_table_cmp(enc, entry->name.data, name->data,
+                                     name->len, 1)
+               != NGX_OK)
+        {
+            continue;
+        }
+
+        if (entry->value.len == value->len
+            && ngx_http_v2_table_cmp(enc, entry->value.data, value->data,
+                                     value->len, 0)
+               == NGX_OK)
+        {
+            *index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + enc->added - i;
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                           "http2 table found: %ui", *index);
+
+            return NGX_OK;
+        }
+
+        if (found == 0) {
+            found = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + enc->added - i;
+        }
+    }
+
+    if (*index) {
+        return NGX_DECLINED;
+    }
+
+    /* pseudo-header fields are never looked up by name */
+
+    for (i = NGX_HTTP_V2_STATUS_500_INDEX;
+         i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES;
+         i++)
+    {
+        if (ngx_http_v2_static_table[i].name.len == name->len
+            && ngx_strncasecmp(ngx_http_v2_static_table[i].name.data,
+                               name->data, name->len)
+               == 0)
+        {
+            *index = i + 1;
+            return NGX_DECLINED;
+        }
+    }
+
+    *index = found;
+
+    return NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    size_t                    size;
+    u_char                   *storage;
+    ngx_http_v2_header_t     *entry, *entries;
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    size = 32 + name->len + value->len;
+
+    if (size > enc->size) {
+        return NGX_DECLINED;
+    }
+
+    if (enc->entries == NULL) {
+        entries = ngx_palloc(h2c->connection->pool,
+                             sizeof(ngx_http_v2_header_t) * (enc->limit / 32));
+        if (entries == NULL) {
+            return NGX_ERROR;
+        }
+
+        storage = ngx_palloc(h2c->connection->pool, enc->limit);
+        if (storage == NULL) {
+            return NGX_ERROR;
+        }
+
+        enc->entries = entries;
+        enc->allocated = enc->limit / 32;
+        enc->storage = storage;
+        enc->pos = storage;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table insert: \"%V: %V\"", name, value);
+
+    while (size > enc->free) {
+        entry = &enc->entries[enc->deleted++ % enc->allocated];
+        enc->free += 32 + entry->name.len + entry->value.len;
+    }
+
+    enc->free -= size;
+
+    entry = &enc->entries[enc->added++ % enc->allocated];
+
+    entry->name.len = name->len;
+    entry->name.data = ngx_http_v2_table_copy(enc, name->data, name->len, 1);
+
+    entry->value.len = value->len;
+    entry->value.data = ngx_http_v2_table_copy(enc, value->data, value->len, 0);
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v2_table_resize(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_header_t     *entry;
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    if (size > enc->limit) {
+        size = enc->limit;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 encoder table size: %uz was:%uz", size, enc->size);
+
+    while (enc->size - enc->free > size) {
+        entry = &enc->entries[enc->deleted++ % enc->allocated];
+        enc->free += 32 + entry->name.len + entry->value.len;
+    }
+
+    enc->free = size - (enc->size - enc->free);
+    enc->size = size;
+
+    /*
+     * a change of the decoder limit is always acknowledged with a table
+     * size update, even if the size in use stays the same; if the size
+     * was reduced and then increased again before the next header block,
+     * both the smallest and the final sizes are signaled
+     */
+
+    if (!enc->size_update || size < enc->update) {
+        enc->update = size;
+    }
+
+    enc->size_update = 1;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_cmp(ngx_http_v2_hpack_enc_t *enc, u_char *p, u_char *s,
+    size_t len, ngx_uint_t lower)
+{
+    size_t  i, n, rest;
+
+    rest = enc->storage + enc->limit - p;
+
+    for ( ;; ) {
+        n = ngx_min(len, rest);
+
+        if (lower) {
+            for (i = 0; i < n; i++) {
+                if (p[i] != ngx_tolower(s[i])) {
+                    return NGX_DECLINED;
+                }
+            }
+
+        } else if (ngx_memcmp(p, s, n) != 0) {
+            return NGX_DECLINED;
+        }
+
+        if (n == len) {
+            return NGX_OK;
+        }
+
+        p = enc->storage;
+        s += n;
+        len -= n;
+        rest = enc->limit;
+    }
+}
+
+
+static u_char *
+ngx_http_v2_table_copy(ngx_http_v2_hpack_enc_t *enc, u_char *src, size_t len,
+    ngx_uint_t lower)
+{
+    size_t   n, rest;
+    u_char  *start;
+
+    start = enc->pos;
+    rest = enc->storage + enc->limit - enc->pos;
+
+    for ( ;; ) {
+        n = ngx_min(len, rest);
+
+        if (lower) {
+            ngx_strlow(enc->pos, src, n);
+
+        } else {
+            ngx_memcpy(enc->pos, src, n);
+        }
+
+        enc->pos += n;
+
+        if (n == len) {
+            break;
+        }
+
+        enc->pos = enc->storage;
+        src += n;
+        len -= n;
+        rest = enc->limit;
+    }
+
+    if (enc->pos == enc->storage + enc->limit) {
+        enc->pos = enc->storage;
+    }
+
+    return start;
+}
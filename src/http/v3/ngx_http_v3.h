@@ -14,9 +14,9 @@
 #include <ngx_http.h>
 
 #include <ngx_http_v3_parse.h>
+#include <ngx_http_v3_table.h>
 #include <ngx_http_v3_encode.h>
 #include <ngx_http_v3_uni.h>
-#include <ngx_http_v3_table.h>
 
 
 #define NGX_HTTP_V3_ALPN_PROTO                     "\x02h3"
@@ -38,12 +38,16 @@
 #define NGX_HTTP_V3_FRAME_PUSH_PROMISE             0x05
 #define NGX_HTTP_V3_FRAME_GOAWAY                   0x07
 #define NGX_HTTP_V3_FRAME_MAX_PUSH_ID              0x0d
+#define NGX_HTTP_V3_FRAME_PRIORITY_UPDATE          0xf0700
+#define NGX_HTTP_V3_FRAME_PRIORITY_UPDATE_PUSH     0xf0701
 
 #define NGX_HTTP_V3_PARAM_MAX_TABLE_CAPACITY       0x01
 #define NGX_HTTP_V3_PARAM_MAX_FIELD_SECTION_SIZE   0x06
 #define NGX_HTTP_V3_PARAM_BLOCKED_STREAMS          0x07
 
 #define NGX_HTTP_V3_MAX_TABLE_CAPACITY             4096
+#define NGX_HTTP_V3_ENCODER_TABLE_CAPACITY         4096
+#define NGX_HTTP_V3_MAX_ENCODER_TABLE_CAPACITY     65536
 
 #define NGX_HTTP_V3_STREAM_CLIENT_CONTROL          0
 #define NGX_HTTP_V3_STREAM_SERVER_CONTROL          1
@@ -54,6 +58,8 @@
 #define NGX_HTTP_V3_MAX_KNOWN_STREAM               6
 #define NGX_HTTP_V3_MAX_UNI_STREAMS                3
 
+#define NGX_HTTP_V3_MAX_PRIORITY_UPDATES           8
+
 /* HTTP/3 errors */
 #define NGX_HTTP_V3_ERR_NO_ERROR                   0x100
 #define NGX_HTTP_V3_ERR_GENERAL_PROTOCOL_ERROR     0x101
@@ -107,11 +113,19 @@ typedef struct {
     ngx_flag_t                    enable_hq;
     size_t                        max_table_capacity;
     ngx_uint_t                    max_blocked_streams;
+    size_t                        encoder_table_capacity;
     ngx_uint_t                    max_concurrent_streams;
     ngx_quic_conf_t               quic;
 } ngx_http_v3_srv_conf_t;
 
 
+typedef struct {
+    uint64_t                      id;
+    ngx_uint_t                    urgency;
+    ngx_uint_t                    incremental;
+} ngx_http_v3_priority_t;
+
+
 struct ngx_http_v3_parse_s {
     size_t                        header_limit;
     ngx_http_v3_parse_headers_t   headers;
@@ -124,6 +138,7 @@ struct ngx_http_v3_session_s {
     ngx_http_connection_t        *http_connection;
 
     ngx_http_v3_dynamic_table_t   table;
+    ngx_http_v3_encoder_t         encoder;
 
     ngx_event_t                   keepalive;
     ngx_uint_t                    nrequests;
@@ -140,6 +155,10 @@ struct ngx_http_v3_session_s {
     unsigned                      hq:1;
 
     ngx_connection_t             *known_streams[NGX_HTTP_V3_MAX_KNOWN_STREAM];
+
+    /* RFC 9218, 7.  PRIORITY_UPDATE frames received before the request */
+    ngx_http_v3_priority_t        priorities[NGX_HTTP_V3_MAX_PRIORITY_UPDATES];
+    ngx_uint_t                    npriorities;
 };
 
 
@@ -150,6 +169,8 @@ ngx_int_t ngx_http_v3_check_flood(ngx_connection_t *c);
 ngx_int_t ngx_http_v3_init(ngx_connection_t *c);
 void ngx_http_v3_shutdown(ngx_connection_t *c);
 
+ngx_int_t ngx_http_v3_priority_update(ngx_connection_t *c, uint64_t id,
+    ngx_str_t *value);
 ngx_int_t ngx_http_v3_read_request_body(ngx_http_request_t *r);
 ngx_int_t ngx_http_v3_read_unbuffered_request_body(ngx_http_request_t *r);
 
@@ -10,6 +10,11 @@
 #include <ngx_http.h>
 
 
+static uintptr_t ngx_http_v3_encode_string(u_char *p, u_char *data,
+    size_t len, ngx_uint_t prefix, ngx_uint_t lower);
+static ngx_uint_t ngx_http_v3_indexable(ngx_str_t *name);
+
+
 uintptr_t
 ngx_http_v3_encode_varlen_int(u_char *p, uint64_t value)
 {
@@ -302,3 +307,232 @@ ngx_http_v3_encode_field_lpbi(u_char *p, ngx_uint_t index, u_char *data,
 
     return (uintptr_t) p;
 }
+
+
+uintptr_t
+ngx_http_v3_encode_set_capacity(u_char *p, ngx_uint_t capacity)
+{
+    /* Set Dynamic Table Capacity */
+
+    if (p == NULL) {
+        return ngx_http_v3_encode_prefix_int(NULL, capacity, 5);
+    }
+
+    *p = 0x20;
+
+    return ngx_http_v3_encode_prefix_int(p, capacity, 5);
+}
+
+
+uintptr_t
+ngx_http_v3_encode_insert_ref(u_char *p, ngx_uint_t index, u_char *data,
+    size_t len)
+{
+    /* Insert with Name Reference, static table only */
+
+    if (p == NULL) {
+        return ngx_http_v3_encode_prefix_int(NULL, index, 6)
+               + ngx_http_v3_encode_prefix_int(NULL, len, 7)
+               + len;
+    }
+
+    *p = 0xc0;
+    p = (u_char *) ngx_http_v3_encode_prefix_int(p, index, 6);
+
+    *p = 0;
+    return ngx_http_v3_encode_string(p, data, len, 7, 0);
+}
+
+
+uintptr_t
+ngx_http_v3_encode_duplicate(u_char *p, ngx_uint_t index)
+{
+    /* Duplicate */
+
+    if (p == NULL) {
+        return ngx_http_v3_encode_prefix_int(NULL, index, 5);
+    }
+
+    *p = 0;
+
+    return ngx_http_v3_encode_prefix_int(p, index, 5);
+}
+
+
+uintptr_t
+ngx_http_v3_encode_insert(u_char *p, ngx_str_t *name, ngx_str_t *value)
+{
+    /* Insert with Literal Name */
+
+    if (p == NULL) {
+        return ngx_http_v3_encode_prefix_int(NULL, name->len, 5)
+               + name->len
+               + ngx_http_v3_encode_prefix_int(NULL, value->len, 7)
+               + value->len;
+    }
+
+    *p = 0x40;
+    p = (u_char *) ngx_http_v3_encode_string(p, name->data, name->len, 5, 1);
+
+    *p = 0;
+    return ngx_http_v3_encode_string(p, value->data, value->len, 7, 0);
+}
+
+
+static uintptr_t
+ngx_http_v3_encode_string(u_char *p, u_char *data, size_t len,
+    ngx_uint_t prefix, ngx_uint_t lower)
+{
+    size_t   hlen;
+    u_char   flags, *p1, *p2;
+
+    /* the caller sets the bits above the Huffman flag */
+
+    flags = *p;
+    p1 = p;
+    p = (u_char *) ngx_http_v3_encode_prefix_int(p, len, prefix);
+
+    p2 = p;
+    hlen = ngx_http_huff_encode(data, len, p, lower);
+
+    if (hlen) {
+        p = p1;
+        *p = flags | (1 << prefix);
+        p = (u_char *) ngx_http_v3_encode_prefix_int(p, hlen, prefix);
+
+        if (p != p2) {
+            ngx_memmove(p, p2, hlen);
+        }
+
+        return (uintptr_t) (p + hlen);
+    }
+
+    if (lower) {
+        ngx_strlow(p, data, len);
+        return (uintptr_t) (p + len);
+    }
+
+    return (uintptr_t) ngx_cpymem(p, data, len);
+}
+
+
+u_char *
+ngx_http_v3_write_field(ngx_connection_t *c, ngx_http_v3_section_t *s,
+    u_char *p, ngx_uint_t index, ngx_str_t *name, ngx_str_t *value)
+{
+    uint64_t    ref;
+    ngx_int_t   rc;
+    ngx_str_t   sname;
+
+    /*
+     * index is a static table name index, used when name is NULL;
+     * the output never exceeds the size of the static table encoding
+     */
+
+    if (name == NULL) {
+        (void) ngx_http_v3_lookup_static(c, index, &sname, NULL);
+        name = &sname;
+
+    } else {
+        index = NGX_HTTP_V3_NO_INDEX;
+    }
+
+    rc = ngx_http_v3_encoder_lookup(c, s, name, value, &ref);
+
+    if (rc == NGX_OK) {
+        goto indexed;
+    }
+
+    if (rc == NGX_ERROR) {
+        return NULL;
+    }
+
+    if (rc == NGX_DECLINED && ngx_http_v3_indexable(name)) {
+        rc = ngx_http_v3_encoder_insert(c, s, index, name, value);
+        if (rc == NGX_ERROR) {
+            return NULL;
+        }
+
+        if (rc == NGX_OK) {
+            rc = ngx_http_v3_encoder_lookup(c, s, name, value, &ref);
+
+            if (rc == NGX_OK) {
+                goto indexed;
+            }
+
+            if (rc == NGX_ERROR) {
+                return NULL;
+            }
+        }
+    }
+
+    if (index != NGX_HTTP_V3_NO_INDEX) {
+        return (u_char *) ngx_http_v3_encode_field_lri(p, 0, index,
+                                                       value->data, value->len);
+    }
+
+    return (u_char *) ngx_http_v3_encode_field_l(p, name, value);
+
+indexed:
+
+    if (ref < s->base) {
+        return (u_char *) ngx_http_v3_encode_field_ri(p, 1, s->base - 1 - ref);
+    }
+
+    return (u_char *) ngx_http_v3_encode_field_pbi(p, ref - s->base);
+}
+
+
+uintptr_t
+ngx_http_v3_write_section_prefix(ngx_connection_t *c, ngx_http_v3_section_t *s,
+    u_char *p)
+{
+    uint64_t                max_entries;
+    ngx_http_v3_session_t  *h3c;
+
+    if (s->insert_count == 0) {
+        return ngx_http_v3_encode_field_section_prefix(p, 0, 0, 0);
+    }
+
+    h3c = ngx_http_v3_get_session(c);
+    max_entries = h3c->encoder.max_capacity / 32;
+
+    if (s->insert_count > s->base) {
+        return ngx_http_v3_encode_field_section_prefix(p,
+                                 s->insert_count % (2 * max_entries) + 1,
+                                 1, s->insert_count - s->base - 1);
+    }
+
+    return ngx_http_v3_encode_field_section_prefix(p,
+                                 s->insert_count % (2 * max_entries) + 1,
+                                 0, s->base - s->insert_count);
+}
+
+
+static ngx_uint_t
+ngx_http_v3_indexable(ngx_str_t *name)
+{
+    /* the values are either unique or sensitive */
+
+    switch (name->len) {
+
+    case 4:
+        return ngx_strncasecmp(name->data, (u_char *) "etag", 4) != 0;
+
+    case 8:
+        return ngx_strncasecmp(name->data, (u_char *) "location", 8) != 0;
+
+    case 10:
+        return ngx_strncasecmp(name->data, (u_char *) "set-cookie", 10) != 0;
+
+    case 13:
+        return ngx_strncasecmp(name->data, (u_char *) "last-modified", 13)
+               != 0;
+
+    case 14:
+        return ngx_strncasecmp(name->data, (u_char *) "content-length", 14)
+               != 0;
+    }
+
+    return 1;
+}
@@ -84,17 +84,19 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
     u_char                    *p;
     size_t                     len, n;
     ngx_buf_t                 *b;
-    ngx_str_t                  host, location;
+    ngx_str_t                  host, location, value;
     ngx_uint_t                 i, port;
     ngx_chain_t               *out, *hl, *cl, **ll;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
     ngx_connection_t          *c;
+    ngx_http_v3_section_t      section;
     ngx_http_v3_session_t     *h3c;
     ngx_http_v3_filter_ctx_t  *ctx;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
+    u_char                     status[NGX_INT_T_LEN];
 
     if (r->http_version != NGX_HTTP_VERSION_30) {
         return ngx_http_next_header_filter(r);
@@ -144,7 +146,9 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
     out = NULL;
     ll = &out;
 
-    len = ngx_http_v3_encode_field_section_prefix(NULL, 0, 0, 0);
+    /* the field section prefix is written last */
+
+    len = NGX_HTTP_V3_PREFIX_INT_LEN * 2;
 
     if (r->headers_out.status == NGX_HTTP_OK) {
         len += ngx_http_v3_encode_field_ri(NULL, 0,
@@ -321,8 +325,10 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    b->last = (u_char *) ngx_http_v3_encode_field_section_prefix(b->last,
-                                                                 0, 0, 0);
+    b->pos += NGX_HTTP_V3_PREFIX_INT_LEN * 2;
+    b->last = b->pos;
+
+    ngx_http_v3_init_section(c, &section);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http3 output header: \":status: %03ui\"",
@@ -333,10 +339,16 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
                                                 NGX_HTTP_V3_HEADER_STATUS_200);
 
     } else {
-        b->last = (u_char *) ngx_http_v3_encode_field_lri(b->last, 0,
-                                                 NGX_HTTP_V3_HEADER_STATUS_200,
-                                                 NULL, 3);
-        b->last = ngx_sprintf(b->last, "%03ui", r->headers_out.status);
+        value.data = status;
+        value.len = ngx_sprintf(status, "%03ui", r->headers_out.status)
+                    - status;
+
+        b->last = ngx_http_v3_write_field(c, &section, b->last,
+                                          NGX_HTTP_V3_HEADER_STATUS_200,
+                                          NULL, &value);
+        if (b->last == NULL) {
+            return NGX_ERROR;
+        }
     }
 
     if (r->headers_out.server == NULL) {
@@ -356,9 +368,15 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                        "http3 output header: \"server: %*s\"", n, p);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_lri(b->last, 0,
-                                                     NGX_HTTP_V3_HEADER_SERVER,
-                                                     p, n);
+        value.data = p;
+        value.len = n;
+
+        b->last = ngx_http_v3_write_field(c, &section, b->last,
+                                          NGX_HTTP_V3_HEADER_SERVER,
+                                          NULL, &value);
+        if (b->last == NULL) {
+            return NGX_ERROR;
+        }
     }
 
     if (r->headers_out.date == NULL) {
@@ -366,10 +384,15 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
                        "http3 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_lri(b->last, 0,
-                                                     NGX_HTTP_V3_HEADER_DATE,
-                                                     ngx_cached_http_time.data,
-                                                     ngx_cached_http_time.len);
+        value.data = ngx_cached_http_time.data;
+        value.len = ngx_cached_http_time.len;
+
+        b->last = ngx_http_v3_write_field(c, &section, b->last,
+                                          NGX_HTTP_V3_HEADER_DATE,
+                                          NULL, &value);
+        if (b->last == NULL) {
+            return NGX_ERROR;
+        }
     }
 
     if (r->headers_out.content_type.len) {
@@ -402,10 +425,12 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
                        "http3 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_lri(b->last, 0,
+        b->last = ngx_http_v3_write_field(c, &section, b->last,
                                     NGX_HTTP_V3_HEADER_CONTENT_TYPE_TEXT_PLAIN,
-                                    r->headers_out.content_type.data,
-                                    r->headers_out.content_type.len);
+                                    NULL, &r->headers_out.content_type);
+        if (b->last == NULL) {
+            return NGX_ERROR;
+        }
     }
 
     if (r->headers_out.content_length == NULL
@@ -496,11 +521,20 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
                        "http3 output header: \"%V: %V\"",
                        &header[i].key, &header[i].value);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_l(b->last,
-                                                        &header[i].key,
-                                                        &header[i].value);
+        b->last = ngx_http_v3_write_field(c, &section, b->last, 0,
+                                          &header[i].key, &header[i].value);
+        if (b->last == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (ngx_http_v3_add_section(c, &section) != NGX_OK) {
+        return NGX_ERROR;
     }
 
+    b->pos -= ngx_http_v3_write_section_prefix(c, &section, NULL);
+    (void) ngx_http_v3_write_section_prefix(c, &section, b->pos);
+
     if (r->header_only) {
         b->last_buf = 1;
     }
@@ -716,9 +750,12 @@ ngx_http_v3_create_trailers(ngx_http_request_t *r,
     ngx_chain_t            *cl, *hl;
     ngx_list_part_t        *part;
     ngx_table_elt_t        *header;
+    ngx_connection_t       *c;
+    ngx_http_v3_section_t   section;
     ngx_http_v3_session_t  *h3c;
 
-    h3c = ngx_http_v3_get_session(r->connection);
+    c = r->connection;
+    h3c = ngx_http_v3_get_session(c);
 
     len = 0;
 
@@ -764,15 +801,17 @@ ngx_http_v3_create_trailers(ngx_http_request_t *r,
 
     b->temporary = 1;
 
-    len += ngx_http_v3_encode_field_section_prefix(NULL, 0, 0, 0);
+    len += NGX_HTTP_V3_PREFIX_INT_LEN * 2;
 
     b->pos = ngx_palloc(r->pool, len);
     if (b->pos == NULL) {
         return NULL;
     }
 
-    b->last = (u_char *) ngx_http_v3_encode_field_section_prefix(b->pos,
-                                                                 0, 0, 0);
+    b->pos += NGX_HTTP_V3_PREFIX_INT_LEN * 2;
+    b->last = b->pos;
+
+    ngx_http_v3_init_section(c, &section);
 
     part = &r->headers_out.trailers.part;
     header = part->elts;
@@ -793,15 +832,24 @@ ngx_http_v3_create_trailers(ngx_http_request_t *r,
             continue;
         }
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                        "http3 output trailer: \"%V: %V\"",
                        &header[i].key, &header[i].value);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_l(b->last,
-                                                        &header[i].key,
-                                                        &header[i].value);
+        b->last = ngx_http_v3_write_field(c, &section, b->last, 0,
+                                          &header[i].key, &header[i].value);
+        if (b->last == NULL) {
+            return NULL;
+        }
+    }
+
+    if (ngx_http_v3_add_section(c, &section) != NGX_OK) {
+        return NULL;
     }
 
+    b->pos -= ngx_http_v3_write_section_prefix(c, &section, NULL);
+    (void) ngx_http_v3_write_section_prefix(c, &section, b->pos);
+
     n = b->last - b->pos;
 
     h3c->payload_bytes += n;
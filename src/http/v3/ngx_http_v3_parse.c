@@ -594,7 +594,6 @@ static ngx_int_t
 ngx_http_v3_parse_literal(ngx_connection_t *c, ngx_http_v3_parse_literal_t *st,
     ngx_buf_t *b)
 {
-    u_char                     ch;
     ngx_uint_t                 n;
     ngx_http_core_srv_conf_t  *cscf;
     enum {
@@ -643,21 +642,24 @@ ngx_http_v3_parse_literal(ngx_connection_t *c, ngx_http_v3_parse_literal_t *st,
                 return NGX_AGAIN;
             }
 
-            ch = *b->pos++;
+            n = ngx_min((ngx_uint_t) (b->last - b->pos), st->length);
 
             if (st->huffman) {
-                if (ngx_http_huff_decode(&st->huffstate, &ch, 1, &st->last,
-                                         st->length == 1, c->log)
+                if (ngx_http_huff_decode(&st->huffstate, b->pos, n, &st->last,
+                                         n == st->length, c->log)
                     != NGX_OK)
                 {
                     return NGX_ERROR;
                 }
 
             } else {
-                *st->last++ = ch;
+                st->last = ngx_cpymem(st->last, b->pos, n);
             }
 
-            if (--st->length) {
+            b->pos += n;
+            st->length -= n;
+
+            if (st->length) {
                 break;
             }
 
@@ -1152,7 +1154,9 @@ static ngx_int_t
 ngx_http_v3_parse_control(ngx_connection_t *c, ngx_http_v3_parse_control_t *st,
     ngx_buf_t *b)
 {
+    size_t     n;
     ngx_buf_t  loc;
+    ngx_str_t  value;
     ngx_int_t  rc;
     enum {
         sw_start = 0,
@@ -1160,6 +1164,8 @@ ngx_http_v3_parse_control(ngx_connection_t *c, ngx_http_v3_parse_control_t *st,
         sw_type,
         sw_length,
         sw_settings,
+        sw_priority_id,
+        sw_priority_value,
         sw_skip
     };
 
@@ -1209,7 +1215,9 @@ ngx_http_v3_parse_control(ngx_connection_t *c, ngx_http_v3_parse_control_t *st,
                 return NGX_HTTP_V3_ERR_FRAME_UNEXPECTED;
             }
 
-            if (st->type == NGX_HTTP_V3_FRAME_CANCEL_PUSH) {
+            if (st->type == NGX_HTTP_V3_FRAME_CANCEL_PUSH
+                || st->type == NGX_HTTP_V3_FRAME_PRIORITY_UPDATE_PUSH)
+            {
                 return NGX_HTTP_V3_ERR_ID_ERROR;
             }
 
@@ -1227,6 +1235,13 @@ ngx_http_v3_parse_control(ngx_connection_t *c, ngx_http_v3_parse_control_t *st,
                            "http3 parse frame len:%uL", st->vlint.value);
 
             st->length = st->vlint.value;
+
+            if (st->length == 0
+                && st->type == NGX_HTTP_V3_FRAME_PRIORITY_UPDATE)
+            {
+                return NGX_HTTP_V3_ERR_FRAME_ERROR;
+            }
+
             if (st->length == 0) {
                 st->state = sw_type;
                 break;
@@ -1238,6 +1253,10 @@ ngx_http_v3_parse_control(ngx_connection_t *c, ngx_http_v3_parse_control_t *st,
                 st->state = sw_settings;
                 break;
 
+            case NGX_HTTP_V3_FRAME_PRIORITY_UPDATE:
+                st->state = sw_priority_id;
+                break;
+
             default:
                 ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
                                "http3 parse skip unknown frame");
@@ -1268,6 +1287,74 @@ ngx_http_v3_parse_control(ngx_connection_t *c, ngx_http_v3_parse_control_t *st,
 
             break;
 
+        case sw_priority_id:
+
+            ngx_http_v3_parse_start_local(b, &loc, st->length);
+
+            rc = ngx_http_v3_parse_varlen_int(c, &st->vlint, &loc);
+
+            ngx_http_v3_parse_end_local(b, &loc, &st->length);
+
+            if (st->length == 0 && rc == NGX_AGAIN) {
+                return NGX_HTTP_V3_ERR_FRAME_ERROR;
+            }
+
+            if (rc != NGX_DONE) {
+                return rc;
+            }
+
+            st->id = st->vlint.value;
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "http3 parse priority update id:%uL", st->id);
+
+            if (st->id & (NGX_QUIC_STREAM_UNIDIRECTIONAL
+                          |NGX_QUIC_STREAM_SERVER_INITIATED))
+            {
+                return NGX_HTTP_V3_ERR_ID_ERROR;
+            }
+
+            st->priority_len = 0;
+            st->state = sw_priority_value;
+
+            /* fall through */
+
+        case sw_priority_value:
+
+            n = ngx_min((size_t) (b->last - b->pos), st->length);
+
+            if (st->priority_len < NGX_HTTP_V3_PRIORITY_SIZE) {
+                ngx_memcpy(st->priority + st->priority_len, b->pos,
+                           ngx_min(n, NGX_HTTP_V3_PRIORITY_SIZE
+                                      - st->priority_len));
+            }
+
+            st->priority_len += n;
+            st->length -= n;
+            b->pos += n;
+
+            if (st->length) {
+                return NGX_AGAIN;
+            }
+
+            if (st->priority_len <= NGX_HTTP_V3_PRIORITY_SIZE) {
+                value.data = st->priority;
+                value.len = st->priority_len;
+
+                rc = ngx_http_v3_priority_update(c, st->id, &value);
+                if (rc != NGX_OK) {
+                    return rc;
+                }
+
+            } else {
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                               "http3 priority update length:%uz ignored",
+                               st->priority_len);
+            }
+
+            st->state = sw_type;
+            break;
+
         case sw_skip:
 
             rc = ngx_http_v3_parse_skip(b, &st->length);
@@ -14,6 +14,9 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_V3_PRIORITY_SIZE  64
+
+
 typedef struct {
     ngx_uint_t                      state;
     uint64_t                        value;
@@ -103,6 +106,9 @@ typedef struct {
     ngx_uint_t                      length;
     ngx_http_v3_parse_varlen_int_t  vlint;
     ngx_http_v3_parse_settings_t    settings;
+    uint64_t                        id;
+    size_t                          priority_len;
+    u_char                          priority[NGX_HTTP_V3_PRIORITY_SIZE];
 } ngx_http_v3_parse_control_t;
 
 
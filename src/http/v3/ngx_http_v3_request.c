@@ -25,6 +25,7 @@ static ngx_int_t ngx_http_v3_init_pseudo_headers(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v3_process_request_header(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v3_cookie(ngx_http_request_t *r, ngx_str_t *value);
 static ngx_int_t ngx_http_v3_construct_cookie_header(ngx_http_request_t *r);
+static void ngx_http_v3_set_priority(ngx_http_request_t *r);
 static void ngx_http_v3_read_client_request_body_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v3_do_read_client_request_body(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v3_request_body_filter(ngx_http_request_t *r,
@@ -1074,6 +1075,8 @@ ngx_http_v3_process_request_header(ngx_http_request_t *r)
         }
     }
 
+    ngx_http_v3_set_priority(r);
+
     if (r->method == NGX_HTTP_CONNECT) {
         ngx_log_error(NGX_LOG_INFO, c->log, 0, "client sent CONNECT method");
         ngx_http_finalize_request(r, NGX_HTTP_NOT_ALLOWED);
@@ -1214,6 +1217,142 @@ ngx_http_v3_construct_cookie_header(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_v3_set_priority(ngx_http_request_t *r)
+{
+    ngx_uint_t               i, urgency, incremental;
+    ngx_table_elt_t         *h;
+    ngx_connection_t        *c;
+    ngx_http_v3_session_t   *h3c;
+    ngx_http_v3_priority_t  *p;
+
+    c = r->connection;
+    h3c = ngx_http_v3_get_session(c);
+
+    /*
+     * RFC 9218, 7.  a PRIORITY_UPDATE frame received before the request
+     * takes precedence over the "Priority" header
+     */
+
+    for (i = 0; i < h3c->npriorities; i++) {
+        p = &h3c->priorities[i];
+
+        if (p->id != c->quic->id) {
+            continue;
+        }
+
+        urgency = p->urgency;
+        incremental = p->incremental;
+
+        *p = h3c->priorities[--h3c->npriorities];
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http3 priority update applied urgency:%ui "
+                       "incremental:%ui", urgency, incremental);
+
+        (void) ngx_quic_set_stream_priority(c, c->quic->id, urgency,
+                                            incremental);
+        return;
+    }
+
+    if (r->headers_in.priority == NULL) {
+        return;
+    }
+
+    urgency = NGX_HTTP_DEFAULT_URGENCY;
+    incremental = 0;
+
+    for (h = r->headers_in.priority; h; h = h->next) {
+
+        if (ngx_http_parse_priority(&h->value, &urgency, &incremental)
+            != NGX_OK)
+        {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "client sent invalid \"Priority\" header: \"%V\"",
+                          &h->value);
+            return;
+        }
+    }
+
+    (void) ngx_quic_set_stream_priority(c, c->quic->id, urgency, incremental);
+}
+
+
+ngx_int_t
+ngx_http_v3_priority_update(ngx_connection_t *c, uint64_t id,
+    ngx_str_t *value)
+{
+    ngx_int_t                rc;
+    ngx_uint_t               i, urgency, incremental;
+    ngx_http_v3_session_t   *h3c;
+    ngx_http_v3_priority_t  *p;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 priority update id:%uL \"%V\"", id, value);
+
+    urgency = NGX_HTTP_DEFAULT_URGENCY;
+    incremental = 0;
+
+    if (ngx_http_parse_priority(value, &urgency, &incremental) != NGX_OK) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "client sent invalid priority update: \"%V\"", value);
+        return NGX_OK;
+    }
+
+    rc = ngx_quic_set_stream_priority(c, id, urgency, incremental);
+
+    h3c = ngx_http_v3_get_session(c);
+
+    if (rc == NGX_DECLINED && id < h3c->next_request_id) {
+
+        /* the stream is already closed */
+
+        return NGX_OK;
+    }
+
+    /*
+     * the update is kept until the request header is processed, since
+     * it may arrive before the stream is opened or before the header
+     */
+
+    for (i = 0; i < h3c->npriorities; i++) {
+        if (h3c->priorities[i].id == id) {
+            break;
+        }
+    }
+
+    if (i == NGX_HTTP_V3_MAX_PRIORITY_UPDATES) {
+
+        /* replace the oldest stream, likely one already processed */
+
+        i = 0;
+
+        for (p = h3c->priorities; p < &h3c->priorities[h3c->npriorities];
+             p++)
+        {
+            if (p->id < h3c->priorities[i].id) {
+                i = p - h3c->priorities;
+            }
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http3 priority update id:%uL dropped",
+                       h3c->priorities[i].id);
+
+    } else if (i == h3c->npriorities) {
+        h3c->npriorities++;
+    }
+
+    p = &h3c->priorities[i];
+
+    p->id = id;
+    p->urgency = urgency;
+    p->incremental = incremental;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_v3_read_request_body(ngx_http_request_t *r)
 {
@@ -13,7 +13,19 @@
 #define ngx_http_v3_table_entry_size(n, v) ((n)->len + (v)->len + 32)
 
 
-static ngx_int_t ngx_http_v3_evict(ngx_connection_t *c, size_t target);
+static ngx_int_t ngx_http_v3_evict(ngx_connection_t *c,
+    ngx_http_v3_dynamic_table_t *dt, size_t target);
+static ngx_int_t ngx_http_v3_add_field(ngx_connection_t *c,
+    ngx_http_v3_dynamic_table_t *dt, ngx_str_t *name, ngx_str_t *value);
+static void ngx_http_v3_free_table(ngx_http_v3_dynamic_table_t *dt);
+static ngx_int_t ngx_http_v3_encoder_duplicate(ngx_connection_t *c,
+    ngx_http_v3_section_t *s, uint64_t index);
+static ngx_uint_t ngx_http_v3_draining(ngx_http_v3_dynamic_table_t *dt,
+    ngx_uint_t i);
+static ngx_uint_t ngx_http_v3_encoder_room(ngx_http_v3_encoder_t *enc,
+    ngx_http_v3_section_t *s, size_t size);
+static ngx_uint_t ngx_http_v3_blocked_sections(ngx_http_v3_encoder_t *enc);
+static uint64_t ngx_http_v3_min_ref(ngx_http_v3_encoder_t *enc);
 static void ngx_http_v3_unblock(void *data);
 static ngx_int_t ngx_http_v3_new_entry(ngx_connection_t *c);
 
@@ -196,9 +208,7 @@ ngx_http_v3_ref_insert(ngx_connection_t *c, ngx_uint_t dynamic,
 ngx_int_t
 ngx_http_v3_insert(ngx_connection_t *c, ngx_str_t *name, ngx_str_t *value)
 {
-    u_char                       *p;
     size_t                        size;
-    ngx_http_v3_field_t          *field;
     ngx_http_v3_session_t        *h3c;
     ngx_http_v3_dynamic_table_t  *dt;
 
@@ -217,6 +227,31 @@ ngx_http_v3_insert(ngx_connection_t *c, ngx_str_t *name, ngx_str_t *value)
                    "http3 insert [%ui] \"%V\":\"%V\", size:%uz",
                    dt->base + dt->nelts, name, value, size);
 
+    if (ngx_http_v3_add_field(c, dt, name, value) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_v3_evict(c, dt, dt->capacity) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_post_event(&dt->send_insert_count, &ngx_posted_events);
+
+    if (ngx_http_v3_new_entry(c) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v3_add_field(ngx_connection_t *c, ngx_http_v3_dynamic_table_t *dt,
+    ngx_str_t *name, ngx_str_t *value)
+{
+    u_char               *p;
+    ngx_http_v3_field_t  *field;
+
     p = ngx_alloc(sizeof(ngx_http_v3_field_t) + name->len + value->len,
                   c->log);
     if (p == NULL) {
@@ -232,20 +267,10 @@ ngx_http_v3_insert(ngx_connection_t *c, ngx_str_t *name, ngx_str_t *value)
     ngx_memcpy(field->value.data, value->data, value->len);
 
     dt->elts[dt->nelts++] = field;
-    dt->size += size;
+    dt->size += ngx_http_v3_table_entry_size(name, value);
 
     dt->insert_count++;
 
-    if (ngx_http_v3_evict(c, dt->capacity) != NGX_OK) {
-        return NGX_ERROR;
-    }
-
-    ngx_post_event(&dt->send_insert_count, &ngx_posted_events);
-
-    if (ngx_http_v3_new_entry(c) != NGX_OK) {
-        return NGX_ERROR;
-    }
-
     return NGX_OK;
 }
 
@@ -299,11 +324,12 @@ ngx_http_v3_set_capacity(ngx_connection_t *c, ngx_uint_t capacity)
         return NGX_HTTP_V3_ERR_ENCODER_STREAM_ERROR;
     }
 
-    if (ngx_http_v3_evict(c, capacity) != NGX_OK) {
+    dt = &h3c->table;
+
+    if (ngx_http_v3_evict(c, dt, capacity) != NGX_OK) {
         return NGX_HTTP_V3_ERR_ENCODER_STREAM_ERROR;
     }
 
-    dt = &h3c->table;
     max = capacity / 32;
     prev_max = dt->capacity / 32;
 
@@ -330,10 +356,15 @@ ngx_http_v3_set_capacity(ngx_connection_t *c, ngx_uint_t capacity)
 void
 ngx_http_v3_cleanup_table(ngx_http_v3_session_t *h3c)
 {
-    ngx_uint_t                    n;
-    ngx_http_v3_dynamic_table_t  *dt;
+    ngx_http_v3_free_table(&h3c->table);
+    ngx_http_v3_free_table(&h3c->encoder.table);
+}
 
-    dt = &h3c->table;
+
+static void
+ngx_http_v3_free_table(ngx_http_v3_dynamic_table_t *dt)
+{
+    ngx_uint_t  n;
 
     if (dt->elts == NULL) {
         return;
@@ -348,16 +379,13 @@ ngx_http_v3_cleanup_table(ngx_http_v3_session_t *h3c)
 
 
 static ngx_int_t
-ngx_http_v3_evict(ngx_connection_t *c, size_t target)
+ngx_http_v3_evict(ngx_connection_t *c, ngx_http_v3_dynamic_table_t *dt,
+    size_t target)
 {
-    size_t                        size;
-    ngx_uint_t                    n;
-    ngx_http_v3_field_t          *field;
-    ngx_http_v3_session_t        *h3c;
-    ngx_http_v3_dynamic_table_t  *dt;
+    size_t                size;
+    ngx_uint_t            n;
+    ngx_http_v3_field_t  *field;
 
-    h3c = ngx_http_v3_get_session(c);
-    dt = &h3c->table;
     n = 0;
 
     while (dt->size > target) {
@@ -411,10 +439,36 @@ ngx_http_v3_duplicate(ngx_connection_t *c, ngx_uint_t index)
 ngx_int_t
 ngx_http_v3_ack_section(ngx_connection_t *c, ngx_uint_t stream_id)
 {
+    ngx_queue_t             *q;
+    ngx_http_v3_section_t   *s;
+    ngx_http_v3_session_t   *h3c;
+    ngx_http_v3_encoder_t   *enc;
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http3 ack section %ui", stream_id);
 
-    /* we do not use dynamic tables */
+    h3c = ngx_http_v3_get_session(c);
+    enc = &h3c->encoder;
+
+    for (q = ngx_queue_head(&enc->sections);
+         q != ngx_queue_sentinel(&enc->sections);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+        if (s->stream_id != stream_id) {
+            continue;
+        }
+
+        if (enc->table.ack_insert_count < s->insert_count) {
+            enc->table.ack_insert_count = s->insert_count;
+        }
+
+        ngx_queue_remove(q);
+        ngx_queue_insert_head(&enc->free, q);
+
+        return NGX_OK;
+    }
 
     return NGX_HTTP_V3_ERR_DECODER_STREAM_ERROR;
 }
@@ -423,12 +477,419 @@ ngx_http_v3_ack_section(ngx_connection_t *c, ngx_uint_t stream_id)
 ngx_int_t
 ngx_http_v3_inc_insert_count(ngx_connection_t *c, ngx_uint_t inc)
 {
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_dynamic_table_t  *dt;
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http3 increment insert count %ui", inc);
 
-    /* we do not use dynamic tables */
+    h3c = ngx_http_v3_get_session(c);
+    dt = &h3c->encoder.table;
 
-    return NGX_HTTP_V3_ERR_DECODER_STREAM_ERROR;
+    if (inc == 0 || inc > dt->insert_count - dt->ack_insert_count) {
+        return NGX_HTTP_V3_ERR_DECODER_STREAM_ERROR;
+    }
+
+    dt->ack_insert_count += inc;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_v3_cancel_stream(ngx_connection_t *c, ngx_uint_t stream_id)
+{
+    ngx_queue_t            *q, *next;
+    ngx_http_v3_section_t  *s;
+    ngx_http_v3_session_t  *h3c;
+    ngx_http_v3_encoder_t  *enc;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 cancel stream %ui", stream_id);
+
+    h3c = ngx_http_v3_get_session(c);
+    enc = &h3c->encoder;
+
+    for (q = ngx_queue_head(&enc->sections);
+         q != ngx_queue_sentinel(&enc->sections);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+        s = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+        if (s->stream_id == stream_id) {
+            ngx_queue_remove(q);
+            ngx_queue_insert_head(&enc->free, q);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v3_init_section(ngx_connection_t *c, ngx_http_v3_section_t *s)
+{
+    ngx_http_v3_session_t  *h3c;
+
+    h3c = ngx_http_v3_get_session(c);
+
+    s->stream_id = c->quic->id;
+    s->base = h3c->encoder.table.insert_count;
+    s->insert_count = 0;
+    s->min_index = (uint64_t) -1;
+}
+
+
+ngx_int_t
+ngx_http_v3_add_section(ngx_connection_t *c, ngx_http_v3_section_t *s)
+{
+    ngx_queue_t            *q;
+    ngx_http_v3_section_t  *ps;
+    ngx_http_v3_session_t  *h3c;
+    ngx_http_v3_encoder_t  *enc;
+
+    if (s->insert_count == 0) {
+        /* no acknowledgement is sent for such sections */
+        return NGX_OK;
+    }
+
+    h3c = ngx_http_v3_get_session(c);
+    enc = &h3c->encoder;
+
+    if (!ngx_queue_empty(&enc->free)) {
+        q = ngx_queue_head(&enc->free);
+        ngx_queue_remove(q);
+        ps = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+    } else {
+        ps = ngx_palloc(c->quic->parent->pool, sizeof(ngx_http_v3_section_t));
+        if (ps == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    *ps = *s;
+
+    ngx_queue_insert_tail(&enc->sections, &ps->queue);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 add section stream:%ui ric:%uL base:%uL",
+                   s->stream_id, s->insert_count, s->base);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_v3_encoder_lookup(ngx_connection_t *c, ngx_http_v3_section_t *s,
+    ngx_str_t *name, ngx_str_t *value, uint64_t *index)
+{
+    uint64_t                      n;
+    ngx_int_t                     rc;
+    ngx_uint_t                    i;
+    ngx_http_v3_field_t          *field;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_t        *enc;
+    ngx_http_v3_dynamic_table_t  *dt;
+
+    h3c = ngx_http_v3_get_session(c);
+    enc = &h3c->encoder;
+    dt = &enc->table;
+
+    for (i = dt->nelts; i-- > 0; /* void */) {
+        field = dt->elts[i];
+
+        if (field->name.len == name->len
+            && field->value.len == value->len
+            && ngx_strncasecmp(field->name.data, name->data, name->len) == 0
+            && ngx_strncmp(field->value.data, value->data, value->len) == 0)
+        {
+            goto found;
+        }
+    }
+
+    return NGX_DECLINED;
+
+found:
+
+    n = dt->base + i;
+
+    if (ngx_http_v3_draining(dt, i)) {
+
+        /*
+         * a reference would keep the entry from being evicted,
+         * so the entry is copied to the newer end of the table
+         */
+
+        rc = ngx_http_v3_encoder_duplicate(c, s, n);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_OK) {
+            n = dt->insert_count - 1;
+        }
+    }
+
+    if (n >= dt->ack_insert_count
+        && s->insert_count <= dt->ack_insert_count
+        && ngx_http_v3_blocked_sections(enc) >= enc->max_blocked)
+    {
+        /* the reference would block one more stream */
+        return NGX_BUSY;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 encoder ref [%uL] \"%V\":\"%V\"", n, name, value);
+
+    if (s->insert_count < n + 1) {
+        s->insert_count = n + 1;
+    }
+
+    if (s->min_index > n) {
+        s->min_index = n;
+    }
+
+    *index = n;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_v3_encoder_insert(ngx_connection_t *c, ngx_http_v3_section_t *s,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value)
+{
+    size_t                        size, capacity;
+    ngx_int_t                     rc;
+    ngx_http_v3_field_t         **elts;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_t        *enc;
+    ngx_http_v3_srv_conf_t       *h3scf;
+    ngx_http_v3_dynamic_table_t  *dt;
+
+    h3c = ngx_http_v3_get_session(c);
+    enc = &h3c->encoder;
+    dt = &enc->table;
+
+    if (dt->elts == NULL) {
+        h3scf = ngx_http_v3_get_module_srv_conf(c, ngx_http_v3_module);
+
+        capacity = ngx_min(enc->max_capacity, h3scf->encoder_table_capacity);
+
+        if (capacity < 32) {
+            return NGX_DECLINED;
+        }
+
+        elts = ngx_alloc(capacity / 32 * sizeof(void *), c->log);
+        if (elts == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_v3_send_set_capacity(c, capacity) != NGX_OK) {
+            ngx_free(elts);
+            return NGX_ERROR;
+        }
+
+        dt->elts = elts;
+        dt->capacity = capacity;
+    }
+
+    size = ngx_http_v3_table_entry_size(name, value);
+
+    if (size > dt->capacity / 4 * 3) {
+        /* large fields would flush the table */
+        return NGX_DECLINED;
+    }
+
+    if (!ngx_http_v3_encoder_room(enc, s, size)) {
+        return NGX_DECLINED;
+    }
+
+    rc = ngx_http_v3_send_insert(c, index, name, value);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 encoder insert [%uL] \"%V\":\"%V\", size:%uz",
+                   dt->insert_count, name, value, size);
+
+    if (ngx_http_v3_evict(c, dt, dt->capacity - size) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_v3_add_field(c, dt, name, value);
+}
+
+
+static ngx_int_t
+ngx_http_v3_encoder_duplicate(ngx_connection_t *c, ngx_http_v3_section_t *s,
+    uint64_t index)
+{
+    size_t                        size;
+    ngx_int_t                     rc;
+    ngx_str_t                     name, value;
+    ngx_http_v3_field_t          *field;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_t        *enc;
+    ngx_http_v3_dynamic_table_t  *dt;
+
+    h3c = ngx_http_v3_get_session(c);
+    enc = &h3c->encoder;
+    dt = &enc->table;
+
+    field = dt->elts[index - dt->base];
+    size = ngx_http_v3_table_entry_size(&field->name, &field->value);
+
+    if (!ngx_http_v3_encoder_room(enc, s, size)) {
+        return NGX_DECLINED;
+    }
+
+    rc = ngx_http_v3_send_duplicate(c, dt->insert_count - 1 - index);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 encoder duplicate [%uL] \"%V\":\"%V\"",
+                   index, &field->name, &field->value);
+
+    /* the entry itself may be evicted to make room for its copy */
+
+    name.len = field->name.len + field->value.len;
+    name.data = ngx_pnalloc(c->pool, name.len);
+    if (name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    value.data = ngx_cpymem(name.data, field->name.data, field->name.len);
+    value.len = field->value.len;
+    ngx_memcpy(value.data, field->value.data, value.len);
+
+    name.len = field->name.len;
+
+    if (ngx_http_v3_evict(c, dt, dt->capacity - size) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_v3_add_field(c, dt, &name, &value);
+}
+
+
+static ngx_uint_t
+ngx_http_v3_draining(ngx_http_v3_dynamic_table_t *dt, ngx_uint_t i)
+{
+    size_t       size, target;
+    ngx_uint_t   n;
+
+    /*
+     * an entry is draining if it would be evicted by inserting
+     * a quarter of the table capacity
+     */
+
+    if (dt->size + dt->capacity / 4 <= dt->capacity) {
+        return 0;
+    }
+
+    target = dt->size + dt->capacity / 4 - dt->capacity;
+    size = 0;
+
+    for (n = 0; n < i; n++) {
+        size += ngx_http_v3_table_entry_size(&dt->elts[n]->name,
+                                             &dt->elts[n]->value);
+
+        if (size >= target) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static ngx_uint_t
+ngx_http_v3_encoder_room(ngx_http_v3_encoder_t *enc, ngx_http_v3_section_t *s,
+    size_t size)
+{
+    size_t                        avail;
+    uint64_t                      min;
+    ngx_uint_t                    n;
+    ngx_http_v3_field_t          *field;
+    ngx_http_v3_dynamic_table_t  *dt;
+
+    /*
+     * only entries with acknowledged insertion and no references
+     * from unacknowledged field sections can be evicted
+     */
+
+    dt = &enc->table;
+
+    min = ngx_min(dt->ack_insert_count, ngx_http_v3_min_ref(enc));
+    min = ngx_min(min, s->min_index);
+
+    avail = dt->capacity - dt->size;
+
+    for (n = 0; avail < size; n++) {
+        if (n == dt->nelts || dt->base + n >= min) {
+            return 0;
+        }
+
+        field = dt->elts[n];
+        avail += ngx_http_v3_table_entry_size(&field->name, &field->value);
+    }
+
+    return 1;
+}
+
+
+static ngx_uint_t
+ngx_http_v3_blocked_sections(ngx_http_v3_encoder_t *enc)
+{
+    ngx_uint_t              n;
+    ngx_queue_t            *q;
+    ngx_http_v3_section_t  *s;
+
+    n = 0;
+
+    for (q = ngx_queue_head(&enc->sections);
+         q != ngx_queue_sentinel(&enc->sections);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+        if (s->insert_count > enc->table.ack_insert_count) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+
+static uint64_t
+ngx_http_v3_min_ref(ngx_http_v3_encoder_t *enc)
+{
+    uint64_t                min;
+    ngx_queue_t            *q;
+    ngx_http_v3_section_t  *s;
+
+    min = (uint64_t) -1;
+
+    for (q = ngx_queue_head(&enc->sections);
+         q != ngx_queue_sentinel(&enc->sections);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+        if (min > s->min_index) {
+            min = s->min_index;
+        }
+    }
+
+    return min;
 }
 
 
@@ -687,11 +1148,16 @@ ngx_http_v3_new_entry(ngx_connection_t *c)
 ngx_int_t
 ngx_http_v3_set_param(ngx_connection_t *c, uint64_t id, uint64_t value)
 {
+    ngx_http_v3_session_t  *h3c;
+
     switch (id) {
 
     case NGX_HTTP_V3_PARAM_MAX_TABLE_CAPACITY:
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                        "http3 param QPACK_MAX_TABLE_CAPACITY:%uL", value);
+
+        h3c = ngx_http_v3_get_session(c);
+        h3c->encoder.max_capacity = value;
         break;
 
     case NGX_HTTP_V3_PARAM_MAX_FIELD_SECTION_SIZE:
@@ -703,6 +1169,9 @@ ngx_http_v3_set_param(ngx_connection_t *c, uint64_t id, uint64_t value)
     case NGX_HTTP_V3_PARAM_BLOCKED_STREAMS:
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                        "http3 param QPACK_BLOCKED_STREAMS:%uL", value);
+
+        h3c = ngx_http_v3_get_session(c);
+        h3c->encoder.max_blocked = value;
         break;
 
     default:
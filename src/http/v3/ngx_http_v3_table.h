@@ -14,6 +14,9 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_V3_NO_INDEX          (ngx_uint_t) -1
+
+
 typedef struct {
     ngx_str_t                     name;
     ngx_str_t                     value;
@@ -32,6 +35,24 @@ typedef struct {
 } ngx_http_v3_dynamic_table_t;
 
 
+typedef struct {
+    ngx_queue_t                   queue;
+    ngx_uint_t                    stream_id;
+    uint64_t                      base;
+    uint64_t                      insert_count;
+    uint64_t                      min_index;
+} ngx_http_v3_section_t;
+
+
+typedef struct {
+    ngx_http_v3_dynamic_table_t   table;
+    uint64_t                      max_capacity;
+    uint64_t                      max_blocked;
+    ngx_queue_t                   sections;
+    ngx_queue_t                   free;
+} ngx_http_v3_encoder_t;
+
+
 void ngx_http_v3_inc_insert_count_handler(ngx_event_t *ev);
 void ngx_http_v3_cleanup_table(ngx_http_v3_session_t *h3c);
 ngx_int_t ngx_http_v3_ref_insert(ngx_connection_t *c, ngx_uint_t dynamic,
@@ -42,6 +63,16 @@ ngx_int_t ngx_http_v3_set_capacity(ngx_connection_t *c, ngx_uint_t capacity);
 ngx_int_t ngx_http_v3_duplicate(ngx_connection_t *c, ngx_uint_t index);
 ngx_int_t ngx_http_v3_ack_section(ngx_connection_t *c, ngx_uint_t stream_id);
 ngx_int_t ngx_http_v3_inc_insert_count(ngx_connection_t *c, ngx_uint_t inc);
+ngx_int_t ngx_http_v3_cancel_stream(ngx_connection_t *c, ngx_uint_t stream_id);
+void ngx_http_v3_init_section(ngx_connection_t *c, ngx_http_v3_section_t *s);
+ngx_int_t ngx_http_v3_add_section(ngx_connection_t *c,
+    ngx_http_v3_section_t *s);
+ngx_int_t ngx_http_v3_encoder_lookup(ngx_connection_t *c,
+    ngx_http_v3_section_t *s, ngx_str_t *name, ngx_str_t *value,
+    uint64_t *index);
+ngx_int_t ngx_http_v3_encoder_insert(ngx_connection_t *c,
+    ngx_http_v3_section_t *s, ngx_uint_t index, ngx_str_t *name,
+    ngx_str_t *value);
 ngx_int_t ngx_http_v3_lookup_static(ngx_connection_t *c, ngx_uint_t index,
     ngx_str_t *name, ngx_str_t *value);
 ngx_int_t ngx_http_v3_lookup(ngx_connection_t *c, ngx_uint_t index,
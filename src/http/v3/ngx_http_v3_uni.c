@@ -346,6 +346,10 @@ ngx_http_v3_get_uni_stream(ngx_connection_t *c, ngx_uint_t type)
 
     ngx_quic_cancelable_stream(sc);
 
+    /* control and QPACK instructions precede request stream data */
+
+    (void) ngx_quic_set_stream_priority(sc, sc->quic->id, 0, 1);
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http3 create uni stream, type:%ui", type);
 
@@ -612,13 +616,163 @@ failed:
 }
 
 
+
 ngx_int_t
-ngx_http_v3_cancel_stream(ngx_connection_t *c, ngx_uint_t stream_id)
+ngx_http_v3_send_set_capacity(ngx_connection_t *c, ngx_uint_t capacity)
 {
+    u_char                  buf[NGX_HTTP_V3_PREFIX_INT_LEN];
+    size_t                  n;
+    ngx_connection_t       *ec;
+    ngx_http_v3_session_t  *h3c;
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
-                   "http3 cancel stream %ui", stream_id);
+                   "http3 send set capacity %ui", capacity);
 
-    /* we do not use dynamic tables */
+    ec = ngx_http_v3_get_uni_stream(c, NGX_HTTP_V3_STREAM_ENCODER);
+    if (ec == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = (u_char *) ngx_http_v3_encode_set_capacity(buf, capacity) - buf;
+
+    h3c = ngx_http_v3_get_session(c);
+    h3c->total_bytes += n;
+
+    if (ec->send(ec, buf, n) != (ssize_t) n) {
+        goto failed;
+    }
 
     return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_ERR, c->log, 0, "failed to send set capacity");
+
+    ngx_http_v3_finalize_connection(c, NGX_HTTP_V3_ERR_EXCESSIVE_LOAD,
+                                    "failed to send set capacity");
+    ngx_http_v3_close_uni_stream(ec);
+
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_http_v3_send_insert(ngx_connection_t *c, ngx_uint_t index,
+    ngx_str_t *name, ngx_str_t *value)
+{
+    u_char                  *p;
+    size_t                   n;
+    ngx_connection_t        *ec;
+    ngx_http_v3_session_t   *h3c;
+    ngx_http_v3_srv_conf_t  *h3scf;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 send insert \"%V\":\"%V\"", name, value);
+
+    ec = ngx_http_v3_get_uni_stream(c, NGX_HTTP_V3_STREAM_ENCODER);
+    if (ec == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (index != NGX_HTTP_V3_NO_INDEX) {
+        n = ngx_http_v3_encode_insert_ref(NULL, index, NULL, value->len);
+
+    } else {
+        n = ngx_http_v3_encode_insert(NULL, name, value);
+    }
+
+    /*
+     * a partially sent instruction cannot be completed later,
+     * so the insertion is skipped if the stream buffer is full
+     */
+
+    h3scf = ngx_http_v3_get_module_srv_conf(c, ngx_http_v3_module);
+
+    if (ec->quic->sent - ec->quic->acked + n > h3scf->quic.stream_buffer_size)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http3 encoder stream buffer is full");
+        return NGX_DECLINED;
+    }
+
+    p = ngx_pnalloc(c->pool, n);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (index != NGX_HTTP_V3_NO_INDEX) {
+        n = (u_char *) ngx_http_v3_encode_insert_ref(p, index, value->data,
+                                                     value->len) - p;
+
+    } else {
+        n = (u_char *) ngx_http_v3_encode_insert(p, name, value) - p;
+    }
+
+    h3c = ngx_http_v3_get_session(c);
+    h3c->total_bytes += n;
+
+    if (ec->send(ec, p, n) != (ssize_t) n) {
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_ERR, c->log, 0, "failed to send insert");
+
+    ngx_http_v3_finalize_connection(c, NGX_HTTP_V3_ERR_EXCESSIVE_LOAD,
+                                    "failed to send insert");
+    ngx_http_v3_close_uni_stream(ec);
+
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_http_v3_send_duplicate(ngx_connection_t *c, ngx_uint_t index)
+{
+    u_char                   buf[NGX_HTTP_V3_PREFIX_INT_LEN];
+    size_t                   n;
+    ngx_connection_t        *ec;
+    ngx_http_v3_session_t   *h3c;
+    ngx_http_v3_srv_conf_t  *h3scf;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 send duplicate %ui", index);
+
+    ec = ngx_http_v3_get_uni_stream(c, NGX_HTTP_V3_STREAM_ENCODER);
+    if (ec == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = (u_char *) ngx_http_v3_encode_duplicate(buf, index) - buf;
+
+    h3scf = ngx_http_v3_get_module_srv_conf(c, ngx_http_v3_module);
+
+    if (ec->quic->sent - ec->quic->acked + n > h3scf->quic.stream_buffer_size)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http3 encoder stream buffer is full");
+        return NGX_DECLINED;
+    }
+
+    h3c = ngx_http_v3_get_session(c);
+    h3c->total_bytes += n;
+
+    if (ec->send(ec, buf, n) != (ssize_t) n) {
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_ERR, c->log, 0, "failed to send duplicate");
+
+    ngx_http_v3_finalize_connection(c, NGX_HTTP_V3_ERR_EXCESSIVE_LOAD,
+                                    "failed to send duplicate");
+    ngx_http_v3_close_uni_stream(ec);
+
+    return NGX_ERROR;
 }
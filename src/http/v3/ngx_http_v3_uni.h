@@ -17,8 +17,6 @@
 void ngx_http_v3_init_uni_stream(ngx_connection_t *c);
 ngx_int_t ngx_http_v3_register_uni_stream(ngx_connection_t *c, uint64_t type);
 
-ngx_int_t ngx_http_v3_cancel_stream(ngx_connection_t *c, ngx_uint_t stream_id);
-
 ngx_int_t ngx_http_v3_send_settings(ngx_connection_t *c);
 ngx_int_t ngx_http_v3_send_goaway(ngx_connection_t *c, uint64_t id);
 ngx_int_t ngx_http_v3_send_ack_section(ngx_connection_t *c,
@@ -27,6 +25,11 @@ ngx_int_t ngx_http_v3_send_cancel_stream(ngx_connection_t *c,
     ngx_uint_t stream_id);
 ngx_int_t ngx_http_v3_send_inc_insert_count(ngx_connection_t *c,
     ngx_uint_t inc);
+ngx_int_t ngx_http_v3_send_set_capacity(ngx_connection_t *c,
+    ngx_uint_t capacity);
+ngx_int_t ngx_http_v3_send_insert(ngx_connection_t *c, ngx_uint_t index,
+    ngx_str_t *name, ngx_str_t *value);
+ngx_int_t ngx_http_v3_send_duplicate(ngx_connection_t *c, ngx_uint_t index);
 
 
 #endif /* _NGX_HTTP_V3_UNI_H_INCLUDED_ */
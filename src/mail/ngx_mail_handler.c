@@ -283,15 +283,30 @@ ngx_mail_init_session_handler(ngx_event_t *rev)
 
     s = c->data;
 
+    sslcf = ngx_mail_get_module_srv_conf(s, ngx_mail_ssl_module);
+
     if (s->ssl) {
         c->log->action = "SSL handshaking";
 
-        sslcf = ngx_mail_get_module_srv_conf(s, ngx_mail_ssl_module);
-
         ngx_mail_ssl_init_connection(&sslcf->ssl, c);
         return;
     }
 
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (sslcf->starttls) {
+
+        /*
+         * the socket is passed to OpenSSL after STARTTLS,
+         * so the data must not be read ahead by io_uring
+         */
+
+        c->recv = ngx_os_io.recv;
+        c->recv_chain = ngx_os_io.recv_chain;
+    }
+
+#endif
+
     }
 #endif
 
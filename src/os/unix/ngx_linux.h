@@ -9,6 +9,34 @@
 #define _NGX_LINUX_H_INCLUDED_
 
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+#define NGX_ZEROCOPY_SENDS  64
+
+
+typedef struct {
+    size_t                 size;
+    uint32_t               id;
+    unsigned               zerocopy:1;
+    unsigned               done:1;
+} ngx_zerocopy_send_t;
+
+
+struct ngx_zerocopy_s {
+    size_t                 min_size;
+    off_t                  pending;
+    uint32_t               next_id;
+    ngx_uint_t             head;
+    ngx_uint_t             nsends;
+    ngx_zerocopy_send_t    sends[NGX_ZEROCOPY_SENDS];
+};
+
+
+ngx_int_t ngx_linux_set_zerocopy(ngx_connection_t *c, size_t min_size);
+
+#endif
+
+
 ngx_chain_t *ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in,
     off_t limit);
 
@@ -89,6 +89,11 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IO_URING)
+#include <linux/io_uring.h>
+#endif
+
+
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
@@ -107,6 +112,10 @@ typedef struct iocb  ngx_aiocb_t;
 #include <netinet/udp.h>
 #endif
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#endif
+
 
 #define NGX_LISTEN_BACKLOG        511
 
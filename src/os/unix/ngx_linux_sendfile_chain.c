@@ -13,6 +13,14 @@
 static ssize_t ngx_linux_sendfile(ngx_connection_t *c, ngx_buf_t *file,
     size_t size);
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+static ssize_t ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_iovec_t *vec);
+static void ngx_linux_zerocopy_add(ngx_zerocopy_t *zc, size_t size,
+    ngx_uint_t zerocopy);
+static off_t ngx_linux_zerocopy_complete(ngx_connection_t *c);
+static void ngx_linux_zerocopy_skip(ngx_iovec_t *vec, size_t skip);
+#endif
+
 #if (NGX_THREADS)
 #include <ngx_thread_pool.h>
 
@@ -49,16 +57,21 @@ static void ngx_linux_sendfile_thread_handler(void *data, ngx_log_t *log);
 ngx_chain_t *
 ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
-    int            tcp_nodelay;
-    off_t          send, prev_send;
-    size_t         file_size, sent;
-    ssize_t        n;
-    ngx_err_t      err;
-    ngx_buf_t     *file;
-    ngx_event_t   *wev;
-    ngx_chain_t   *cl;
-    ngx_iovec_t    header;
-    struct iovec   headers[NGX_IOVS_PREALLOCATE];
+    int               tcp_nodelay;
+    off_t             send, prev_send, skip;
+    size_t            file_size, sent;
+    ssize_t           n;
+    ngx_err_t         err;
+    ngx_buf_t        *file;
+    ngx_event_t      *wev;
+    ngx_chain_t      *cl;
+    ngx_iovec_t       header;
+    struct iovec      headers[NGX_IOVS_PREALLOCATE];
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    off_t             done;
+    ngx_uint_t        zerocopy;
+    ngx_zerocopy_t   *zc;
+#endif
 
     wev = c->write;
 
@@ -73,6 +86,38 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         limit = NGX_SENDFILE_MAXSIZE - ngx_pagesize;
     }
 
+    /*
+     * bytes already passed to the kernel with MSG_ZEROCOPY stay in
+     * the chain until their completions are received from the socket
+     * error queue, and are skipped when sending
+     */
+
+    skip = 0;
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+    zc = c->zerocopy;
+
+    if (zc && zc->nsends) {
+        done = ngx_linux_zerocopy_complete(c);
+
+        if (done == NGX_ERROR) {
+            wev->error = 1;
+            return NGX_CHAIN_ERROR;
+        }
+
+        c->sent += done;
+
+        in = ngx_chain_update_sent(in, done);
+
+        if (in == NULL) {
+            return NULL;
+        }
+
+        skip = zc->pending;
+    }
+
+#endif
 
     send = 0;
 
@@ -84,12 +129,28 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
         /* create the iovec and coalesce the neighbouring bufs */
 
-        cl = ngx_output_chain_to_iovec(&header, in, limit - send, c->log);
+        cl = ngx_output_chain_to_iovec(&header, in, limit - send + skip,
+                                       c->log);
 
         if (cl == NGX_CHAIN_ERROR) {
             return NGX_CHAIN_ERROR;
         }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+        if (skip) {
+
+            if ((off_t) header.size <= skip) {
+                /* wait for completions */
+                wev->ready = 0;
+                return in;
+            }
+
+            ngx_linux_zerocopy_skip(&header, skip);
+        }
+
+#endif
+
         send += header.size;
 
         /* set TCP_CORK if there is a header before a file */
@@ -157,6 +218,10 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             }
         }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+        zerocopy = 0;
+#endif
+
         /* get the file buf */
 
         if (header.count == 0 && cl && cl->buf->in_file && send < limit) {
@@ -188,7 +253,35 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             sent = (n == NGX_AGAIN) ? 0 : n;
 
         } else {
-            n = ngx_writev(c, &header);
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+            if (zc && (zc->min_size || zc->nsends)) {
+
+                if (zc->nsends == NGX_ZEROCOPY_SENDS) {
+                    /* wait for completions */
+                    wev->ready = 0;
+                    return in;
+                }
+
+                zerocopy = (zc->min_size && header.size >= zc->min_size);
+            }
+
+            n = NGX_DECLINED;
+
+            if (zerocopy) {
+                n = ngx_linux_zerocopy_send(c, &header);
+
+                if (n == NGX_DECLINED) {
+                    zerocopy = 0;
+                }
+            }
+
+            if (n == NGX_DECLINED)
+#endif
+            {
+                n = ngx_writev(c, &header);
+            }
 
             if (n == NGX_ERROR) {
                 return NGX_CHAIN_ERROR;
@@ -197,9 +290,26 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             sent = (n == NGX_AGAIN) ? 0 : n;
         }
 
-        c->sent += sent;
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+        if (sent && (zerocopy || (zc && zc->nsends))) {
+
+            /*
+             * data sent after zerocopy data are confirmed in order,
+             * after completions of the preceding zerocopy sends
+             */
+
+            ngx_linux_zerocopy_add(zc, sent, zerocopy);
 
-        in = ngx_chain_update_sent(in, sent);
+            skip += sent;
+
+        } else
+#endif
+        {
+            c->sent += sent;
+
+            in = ngx_chain_update_sent(in, sent);
+        }
 
         if (n == NGX_AGAIN) {
             wev->ready = 0;
@@ -433,3 +543,260 @@ again:
 }
 
 #endif /* NGX_THREADS */
+
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+ngx_int_t
+ngx_linux_set_zerocopy(ngx_connection_t *c, size_t min_size)
+{
+    int              zerocopy;
+    ngx_zerocopy_t  *zc;
+
+    zc = c->zerocopy;
+
+    if (zc == NULL) {
+        if (min_size == 0) {
+            return NGX_OK;
+        }
+
+        zerocopy = 1;
+
+        if (setsockopt(c->fd, SOL_SOCKET, SO_ZEROCOPY,
+                       (const void *) &zerocopy, sizeof(int))
+            == -1)
+        {
+            ngx_connection_error(c, ngx_socket_errno,
+                                 "setsockopt(SO_ZEROCOPY) failed, ignored");
+            return NGX_DECLINED;
+        }
+
+        zc = ngx_pcalloc(c->pool, sizeof(ngx_zerocopy_t));
+        if (zc == NULL) {
+            return NGX_ERROR;
+        }
+
+        c->zerocopy = zc;
+    }
+
+    zc->min_size = min_size;
+
+    return NGX_OK;
+}
+
+
+static ssize_t
+ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_iovec_t *vec)
+{
+    ssize_t        n;
+    ngx_err_t      err;
+    struct msghdr  msg;
+
+    ngx_memzero(&msg, sizeof(struct msghdr));
+
+    msg.msg_iov = vec->iovs;
+    msg.msg_iovlen = vec->count;
+
+eintr:
+
+    n = sendmsg(c->fd, &msg, MSG_ZEROCOPY);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "sendmsg zerocopy: %z of %uz", n, vec->size);
+
+    if (n == -1) {
+        err = ngx_errno;
+
+        switch (err) {
+        case NGX_EAGAIN:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() not ready");
+            return NGX_AGAIN;
+
+        case NGX_EINTR:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() was interrupted");
+            goto eintr;
+
+        case ENOBUFS:
+
+            /* the optmem limit is reached, the data are to be copied */
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() zerocopy not available");
+            return NGX_DECLINED;
+
+        default:
+            c->write->error = 1;
+            ngx_connection_error(c, err, "sendmsg() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return n;
+}
+
+
+static void
+ngx_linux_zerocopy_add(ngx_zerocopy_t *zc, size_t size, ngx_uint_t zerocopy)
+{
+    ngx_zerocopy_send_t  *s;
+
+    s = &zc->sends[(zc->head + zc->nsends) % NGX_ZEROCOPY_SENDS];
+
+    s->size = size;
+    s->zerocopy = zerocopy;
+    s->done = !zerocopy;
+
+    if (zerocopy) {
+        s->id = zc->next_id++;
+    }
+
+    zc->nsends++;
+    zc->pending += size;
+}
+
+
+static off_t
+ngx_linux_zerocopy_complete(ngx_connection_t *c)
+{
+    off_t                      done;
+    ssize_t                    n;
+    uint32_t                   lo, hi;
+    ngx_err_t                  err;
+    ngx_uint_t                 i;
+    struct msghdr              msg;
+    struct cmsghdr            *cmsg;
+    ngx_zerocopy_t            *zc;
+    ngx_zerocopy_send_t       *s;
+    struct sock_extended_err  *serr;
+    u_char                     control[CMSG_SPACE(
+                                           sizeof(struct sock_extended_err)
+                                           + sizeof(struct sockaddr_in6))];
+
+    zc = c->zerocopy;
+
+    for ( ;; ) {
+        ngx_memzero(&msg, sizeof(struct msghdr));
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        n = recvmsg(c->fd, &msg, MSG_ERRQUEUE);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                break;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_connection_error(c, err, "recvmsg(MSG_ERRQUEUE) failed");
+            return NGX_ERROR;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!((cmsg->cmsg_level == SOL_IP
+                   && cmsg->cmsg_type == IP_RECVERR)
+                  || (cmsg->cmsg_level == SOL_IPV6
+                      && cmsg->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            if (serr->ee_errno != 0) {
+                ngx_connection_error(c, serr->ee_errno,
+                                     "zerocopy completion failed");
+                return NGX_ERROR;
+            }
+
+            lo = serr->ee_info;
+            hi = serr->ee_data;
+
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "zerocopy completion: %uD-%uD copied:%d",
+                           lo, hi,
+                           serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+
+#if (NGX_STAT_STUB)
+            (void) ngx_atomic_fetch_add(
+                             (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                             ? ngx_stat_zerocopy_copied
+                             : ngx_stat_zerocopy_completed,
+                             hi - lo + 1);
+#endif
+
+            for (i = 0; i < zc->nsends; i++) {
+                s = &zc->sends[(zc->head + i) % NGX_ZEROCOPY_SENDS];
+
+                if (s->zerocopy && s->id - lo <= hi - lo) {
+                    s->done = 1;
+                }
+            }
+        }
+    }
+
+    /* confirm the completed sends in order */
+
+    done = 0;
+
+    while (zc->nsends) {
+        s = &zc->sends[zc->head];
+
+        if (!s->done) {
+            break;
+        }
+
+        done += s->size;
+
+        zc->head = (zc->head + 1) % NGX_ZEROCOPY_SENDS;
+        zc->nsends--;
+    }
+
+    zc->pending -= done;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "zerocopy confirmed: %O, pending: %O", done, zc->pending);
+
+    return done;
+}
+
+
+static void
+ngx_linux_zerocopy_skip(ngx_iovec_t *vec, size_t skip)
+{
+    ngx_uint_t     i;
+    struct iovec  *iov;
+
+    iov = vec->iovs;
+
+    for (i = 0; i < vec->count && skip >= iov[i].iov_len; i++) {
+        skip -= iov[i].iov_len;
+        vec->size -= iov[i].iov_len;
+    }
+
+    vec->count -= i;
+
+    ngx_memmove(iov, &iov[i], vec->count * sizeof(struct iovec));
+
+    if (vec->count) {
+        iov[0].iov_base = (u_char *) iov[0].iov_base + skip;
+        iov[0].iov_len -= skip;
+        vec->size -= skip;
+    }
+}
+
+#endif
@@ -564,7 +564,7 @@ ngx_process_get_status(void)
 static void
 ngx_unlock_mutexes(ngx_pid_t pid)
 {
-    ngx_uint_t        i;
+    ngx_uint_t        i, n;
     ngx_shm_zone_t   *shm_zone;
     ngx_list_part_t  *part;
     ngx_slab_pool_t  *sp;
@@ -604,6 +604,17 @@ ngx_unlock_mutexes(ngx_pid_t pid)
                           "shared memory zone \"%V\" was locked by %P",
                           &shm_zone[i].shm.name, pid);
         }
+
+        for (n = 0; n < sp->nlocks; n++) {
+            if (ngx_shmtx_force_unlock(&sp->locks[n], pid)) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                              "shared memory zone \"%V\" lock %ui "
+                              "was locked by %P",
+                              &shm_zone[i].shm.name, n, pid);
+            }
+        }
+
+        ngx_slab_reclaim(sp, pid);
     }
 }
 
@@ -655,12 +655,22 @@ ngx_reap_children(ngx_cycle_t *cycle)
 static void
 ngx_master_process_exit(ngx_cycle_t *cycle)
 {
-    ngx_uint_t  i;
+    ngx_uint_t    i;
+    ngx_path_t  **path;
 
     ngx_delete_pidfile(cycle);
 
     ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exit");
 
+    /* all other processes have exited, so the paths' state is final */
+
+    path = cycle->paths.elts;
+    for (i = 0; i < cycle->paths.nelts; i++) {
+        if (path[i]->saver) {
+            path[i]->saver(path[i]->data);
+        }
+    }
+
     for (i = 0; cycle->modules[i]; i++) {
         if (cycle->modules[i]->exit_master) {
             cycle->modules[i]->exit_master(cycle);
@@ -940,6 +950,8 @@ static void
 ngx_worker_process_exit(ngx_cycle_t *cycle)
 {
     ngx_uint_t         i;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_list_part_t   *part;
     ngx_connection_t  *c;
 
     for (i = 0; cycle->modules[i]; i++) {
@@ -948,6 +960,25 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    /* return the chunks kept in the slab magazines of the worker */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        ngx_slab_flush((ngx_slab_pool_t *) shm_zone[i].shm.addr);
+    }
+
     if (ngx_exiting) {
         c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {
@@ -280,7 +280,8 @@ typedef struct {
         NULL)
 
 
-#define NGX_STREAM_WRITE_BUFFERED  0x10
+#define NGX_STREAM_WRITE_BUFFERED   0x10
+#define NGX_STREAM_SPLICE_BUFFERED  0x20
 
 
 void ngx_stream_core_run_phases(ngx_stream_session_t *s);
@@ -309,4 +310,8 @@ typedef ngx_int_t (*ngx_stream_filter_pt)(ngx_stream_session_t *s,
 extern ngx_stream_filter_pt  ngx_stream_top_filter;
 
 
+ngx_int_t ngx_stream_write_filter(ngx_stream_session_t *s, ngx_chain_t *in,
+    ngx_uint_t from_upstream);
+
+
 #endif /* _NGX_STREAM_H_INCLUDED_ */
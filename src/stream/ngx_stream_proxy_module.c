@@ -32,6 +32,7 @@ typedef struct {
     ngx_flag_t                       next_upstream;
     ngx_flag_t                       proxy_protocol;
     ngx_flag_t                       half_close;
+    ngx_flag_t                       splice;
     ngx_stream_upstream_local_t     *local;
     ngx_flag_t                       socket_keepalive;
 
@@ -76,6 +77,11 @@ static void ngx_stream_proxy_connect_handler(ngx_event_t *ev);
 static ngx_int_t ngx_stream_proxy_test_connect(ngx_connection_t *c);
 static void ngx_stream_proxy_process(ngx_stream_session_t *s,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_stream_proxy_splice(ngx_stream_session_t *s,
+    ngx_uint_t from_upstream);
+static void ngx_stream_proxy_splice_cleanup(void *data);
+#endif
 static ngx_int_t ngx_stream_proxy_test_finalize(ngx_stream_session_t *s,
     ngx_uint_t from_upstream);
 static void ngx_stream_proxy_next_upstream(ngx_stream_session_t *s);
@@ -255,6 +261,13 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       offsetof(ngx_stream_proxy_srv_conf_t, half_close),
       NULL },
 
+    { ngx_string("proxy_splice"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, splice),
+      NULL },
+
 #if (NGX_STREAM_SSL)
 
     { ngx_string("proxy_ssl"),
@@ -440,6 +453,17 @@ ngx_stream_proxy_handler(ngx_stream_session_t *s)
     c->write->handler = ngx_stream_proxy_downstream_handler;
     c->read->handler = ngx_stream_proxy_downstream_handler;
 
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (pscf->splice) {
+
+        /* the data to be spliced must not be read ahead by io_uring */
+
+        (void) ngx_io_uring_disable_recv(c);
+    }
+
+#endif
+
     s->upstream_states = ngx_array_create(c->pool, 1,
                                           sizeof(ngx_stream_upstream_state_t));
     if (s->upstream_states == NULL) {
@@ -742,6 +766,29 @@ ngx_stream_proxy_connect(ngx_stream_session_t *s)
 
     u->state->peer = u->peer.name;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+    if (u->upstream && u->upstream->resolver) {
+
+        /* peers of the upstream may be freed before the session ends */
+
+        u->state->peer = ngx_palloc(c->pool,
+                                    sizeof(ngx_str_t) + u->peer.name->len);
+        if (u->state->peer == NULL) {
+            ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        u->state->peer->len = u->peer.name->len;
+        u->state->peer->data = (u_char *) (u->state->peer + 1);
+        ngx_memcpy(u->state->peer->data, u->peer.name->data,
+                   u->peer.name->len);
+
+        u->peer.name = u->state->peer;
+    }
+
+#endif
+
     if (rc == NGX_BUSY) {
         ngx_log_error(NGX_LOG_ERR, c->log, 0, "no live upstreams");
         ngx_stream_proxy_finalize(s, NGX_STREAM_BAD_GATEWAY);
@@ -823,6 +870,32 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
 
     c = s->connection;
 
+#if (NGX_HAVE_SPLICE)
+
+    /*
+     * the data are spliced between the sockets only if they are passed
+     * to the sockets as is, that is, without TLS and stream filters,
+     * and if no client data were read ahead by io_uring
+     */
+
+    if (pscf->splice
+        && c->type == SOCK_STREAM
+        && pc->type == SOCK_STREAM
+#if (NGX_STREAM_SSL)
+        && c->ssl == NULL
+        && pc->ssl == NULL
+#endif
+        && ngx_stream_top_filter == ngx_stream_write_filter
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+        && ngx_io_uring_disable_recv(c) == NGX_OK
+#endif
+        )
+    {
+        u->splice = 1;
+    }
+
+#endif
+
     if (c->log->log_level >= NGX_LOG_INFO) {
         ngx_str_t  str;
         u_char     addr[NGX_SOCKADDR_STRLEN];
@@ -1653,7 +1726,9 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
 
         if (do_write && dst) {
 
-            if (*out || *busy || dst->buffered) {
+            if (*out || *busy
+                || (dst->buffered & ~NGX_STREAM_SPLICE_BUFFERED))
+            {
                 c->log->action = send_action;
 
                 rc = ngx_stream_top_filter(s, *out, from_upstream);
@@ -1673,6 +1748,26 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
             }
         }
 
+#if (NGX_HAVE_SPLICE)
+
+        if (u->splice && *out == NULL && *busy == NULL) {
+
+            rc = ngx_stream_proxy_splice(s, from_upstream);
+
+            if (rc == NGX_ERROR) {
+                ngx_stream_proxy_finalize(s, NGX_STREAM_OK);
+                return;
+            }
+
+            if (rc == NGX_OK) {
+                break;
+            }
+
+            /* rc == NGX_DECLINED */
+        }
+
+#endif
+
         size = b->end - b->last;
 
         if (size && src->read->ready && !src->read->delayed) {
@@ -1801,6 +1896,223 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_stream_proxy_splice(ngx_stream_session_t *s, ngx_uint_t from_upstream)
+{
+    off_t                        *received, limit;
+    size_t                        size, limit_rate;
+    ssize_t                       n;
+    ngx_err_t                     err;
+    ngx_uint_t                   *packets;
+    ngx_msec_t                    delay;
+    ngx_connection_t             *c, *src, *dst;
+    ngx_pool_cleanup_t           *cln;
+    ngx_stream_upstream_t        *u;
+    ngx_stream_upstream_pipe_t   *p;
+    ngx_stream_proxy_srv_conf_t  *pscf;
+
+    u = s->upstream;
+    c = s->connection;
+
+    if (from_upstream) {
+        src = u->peer.connection;
+        dst = c;
+        limit_rate = u->download_rate;
+        received = &u->received;
+        packets = &u->responses;
+
+    } else {
+        src = c;
+        dst = u->peer.connection;
+        limit_rate = u->upload_rate;
+        received = &s->received;
+        packets = &u->requests;
+    }
+
+    if (u->pipes == NULL) {
+        u->pipes = ngx_palloc(c->pool, 2 * sizeof(ngx_stream_upstream_pipe_t));
+        if (u->pipes == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(c->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (pipe2(u->pipes[0].fd, O_NONBLOCK|O_CLOEXEC) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno, "pipe2() failed");
+            u->splice = 0;
+            return NGX_DECLINED;
+        }
+
+        if (pipe2(u->pipes[1].fd, O_NONBLOCK|O_CLOEXEC) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno, "pipe2() failed");
+            (void) close(u->pipes[0].fd[0]);
+            (void) close(u->pipes[0].fd[1]);
+            u->splice = 0;
+            return NGX_DECLINED;
+        }
+
+        u->pipes[0].size = 0;
+        u->pipes[1].size = 0;
+
+        cln->handler = ngx_stream_proxy_splice_cleanup;
+        cln->data = u->pipes;
+    }
+
+    p = &u->pipes[from_upstream];
+
+    pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
+
+    for ( ;; ) {
+
+        if (p->size && dst->write->ready) {
+
+            n = splice(p->fd[0], NULL, dst->fd, NULL, p->size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug3(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                           "splice to %d: %z of %uz", dst->fd, n, p->size);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err != NGX_EAGAIN) {
+                    dst->error = 1;
+                    (void) ngx_connection_error(dst, err, "splice() failed");
+                    return NGX_ERROR;
+                }
+
+                dst->write->ready = 0;
+
+            } else {
+                p->size -= n;
+                dst->sent += n;
+
+                if (p->size == 0) {
+                    dst->buffered &= ~NGX_STREAM_SPLICE_BUFFERED;
+                }
+
+                continue;
+            }
+        }
+
+        size = pscf->buffer_size - p->size;
+
+        if (size == 0 || src->read->eof || !src->read->ready
+            || src->read->delayed)
+        {
+            return NGX_OK;
+        }
+
+        if (limit_rate) {
+            limit = (off_t) limit_rate * (ngx_time() - u->start_sec + 1)
+                    - *received;
+
+            if (limit <= 0) {
+                src->read->delayed = 1;
+                delay = (ngx_msec_t) (- limit * 1000 / limit_rate + 1);
+                ngx_add_timer(src->read, delay);
+                return NGX_OK;
+            }
+
+            if ((off_t) size > limit) {
+                size = (size_t) limit;
+            }
+        }
+
+        n = splice(src->fd, NULL, p->fd[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "splice from %d: %z of %uz", src->fd, n, size);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+
+                if (p->size == 0) {
+                    src->read->ready = 0;
+                    return NGX_OK;
+                }
+
+                /* the pipe may be full */
+
+                if (dst->write->ready) {
+                    continue;
+                }
+
+                return NGX_OK;
+            }
+
+            if ((err == NGX_EINVAL || err == NGX_ENOSYS)
+                && *received == 0 && p->size == 0)
+            {
+                /* the sockets do not support splicing */
+
+                ngx_log_error(NGX_LOG_INFO, c->log, err,
+                              "splice() failed, using buffered proxying");
+
+                u->splice = 0;
+                return NGX_DECLINED;
+            }
+
+            src->read->eof = 1;
+            src->read->error = 1;
+            (void) ngx_connection_error(src, err, "splice() failed");
+
+            continue;
+        }
+
+        if (n == 0) {
+            src->read->eof = 1;
+            continue;
+        }
+
+        if (limit_rate) {
+            delay = (ngx_msec_t) (n * 1000 / limit_rate);
+
+            if (delay > 0) {
+                src->read->delayed = 1;
+                ngx_add_timer(src->read, delay);
+            }
+        }
+
+        if (from_upstream) {
+            if (u->state->first_byte_time == (ngx_msec_t) -1) {
+                u->state->first_byte_time = ngx_current_msec - u->start_time;
+            }
+        }
+
+        (*packets)++;
+        *received += n;
+
+        p->size += n;
+        dst->buffered |= NGX_STREAM_SPLICE_BUFFERED;
+    }
+}
+
+
+static void
+ngx_stream_proxy_splice_cleanup(void *data)
+{
+    ngx_stream_upstream_pipe_t  *pipes = data;
+
+    ngx_uint_t  i;
+
+    for (i = 0; i < 2; i++) {
+        (void) close(pipes[i].fd[0]);
+        (void) close(pipes[i].fd[1]);
+    }
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_stream_proxy_test_finalize(ngx_stream_session_t *s,
     ngx_uint_t from_upstream)
@@ -2091,6 +2403,7 @@ ngx_stream_proxy_create_srv_conf(ngx_conf_t *cf)
     conf->local = NGX_CONF_UNSET_PTR;
     conf->socket_keepalive = NGX_CONF_UNSET;
     conf->half_close = NGX_CONF_UNSET;
+    conf->splice = NGX_CONF_UNSET;
 
 #if (NGX_STREAM_SSL)
     conf->ssl_enable = NGX_CONF_UNSET;
@@ -2151,6 +2464,19 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->half_close, prev->half_close, 0);
 
+    ngx_conf_merge_value(conf->splice, prev->splice, 0);
+
+#if !(NGX_HAVE_SPLICE)
+
+    if (conf->splice) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"proxy_splice\" is not supported "
+                           "on this platform, ignored");
+        conf->splice = 0;
+    }
+
+#endif
+
 #if (NGX_STREAM_SSL)
 
     if (ngx_stream_proxy_merge_ssl(cf, conf, prev) != NGX_OK) {
@@ -324,7 +324,8 @@ ngx_stream_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
                                            |NGX_STREAM_UPSTREAM_MAX_FAILS
                                            |NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
                                            |NGX_STREAM_UPSTREAM_DOWN
-                                           |NGX_STREAM_UPSTREAM_BACKUP);
+                                           |NGX_STREAM_UPSTREAM_BACKUP
+                                           |NGX_STREAM_UPSTREAM_MODIFY);
     if (uscf == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -407,7 +408,7 @@ ngx_stream_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                     *value, s;
     ngx_url_t                      u;
     ngx_int_t                      weight, max_conns, max_fails;
-    ngx_uint_t                     i;
+    ngx_uint_t                     i, resolve;
     ngx_stream_upstream_server_t  *us;
 
     us = ngx_array_push(uscf->servers);
@@ -423,6 +424,7 @@ ngx_stream_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_conns = 0;
     max_fails = 1;
     fail_timeout = 10;
+    resolve = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
 
@@ -511,12 +513,44 @@ ngx_stream_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+        if (ngx_strcmp(value[i].data, "resolve") == 0) {
+
+            if (!(uscf->flags & NGX_STREAM_UPSTREAM_MODIFY)) {
+                goto not_supported;
+            }
+
+            resolve = 1;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "service=", 8) == 0) {
+
+            if (!(uscf->flags & NGX_STREAM_UPSTREAM_MODIFY)) {
+                goto not_supported;
+            }
+
+            us->service.len = value[i].len - 8;
+            us->service.data = &value[i].data[8];
+
+            if (us->service.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+#endif
+
         goto invalid;
     }
 
     ngx_memzero(&u, sizeof(ngx_url_t));
 
     u.url = value[1];
+    u.no_resolve = resolve;
 
     if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
         if (u.err) {
@@ -527,7 +561,35 @@ ngx_stream_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
-    if (u.no_port) {
+    if (us->service.len && !resolve) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" requires "
+                           "\"resolve\" parameter", &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    if (resolve && u.naddrs == 0) {
+
+        /* the name is resolved at run time */
+
+        if (us->service.len && !u.no_port) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "service upstream \"%V\" may not have port",
+                               &u.url);
+            return NGX_CONF_ERROR;
+        }
+
+        us->host = u.host;
+        us->port = u.port;
+
+    } else if (us->service.len) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" requires domain name",
+                           &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    if (u.no_port && us->service.len == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no port in upstream \"%V\"", &u.url);
         return NGX_CONF_ERROR;
@@ -22,6 +22,7 @@
 #define NGX_STREAM_UPSTREAM_DOWN          0x0010
 #define NGX_STREAM_UPSTREAM_BACKUP        0x0020
 #define NGX_STREAM_UPSTREAM_MAX_CONNS     0x0100
+#define NGX_STREAM_UPSTREAM_MODIFY        0x0200
 
 
 #define NGX_STREAM_UPSTREAM_NOTIFY_CONNECT     0x1
@@ -60,9 +61,13 @@ typedef struct {
     ngx_msec_t                         slow_start;
     ngx_uint_t                         down;
 
+    ngx_str_t                          host;
+    ngx_str_t                          service;
+    in_port_t                          port;
+
     unsigned                           backup:1;
 
-    NGX_COMPAT_BEGIN(4)
+    NGX_COMPAT_BEGIN(0)
     NGX_COMPAT_END
 } ngx_stream_upstream_server_t;
 
@@ -83,6 +88,8 @@ struct ngx_stream_upstream_srv_conf_s {
 
 #if (NGX_STREAM_UPSTREAM_ZONE)
     ngx_shm_zone_t                    *shm_zone;
+    ngx_resolver_t                    *resolver;
+    ngx_msec_t                         resolver_timeout;
 #endif
 };
 
@@ -114,6 +121,16 @@ typedef struct {
 } ngx_stream_upstream_resolved_t;
 
 
+#if (NGX_HAVE_SPLICE)
+
+typedef struct {
+    ngx_fd_t                           fd[2];
+    size_t                             size;
+} ngx_stream_upstream_pipe_t;
+
+#endif
+
+
 typedef struct {
     ngx_peer_connection_t              peer;
 
@@ -126,6 +143,10 @@ typedef struct {
     ngx_chain_t                       *downstream_out;
     ngx_chain_t                       *downstream_busy;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_stream_upstream_pipe_t        *pipes;
+#endif
+
     off_t                              received;
     time_t                             start_sec;
     ngx_uint_t                         requests;
@@ -143,6 +164,7 @@ typedef struct {
     unsigned                           connected:1;
     unsigned                           proxy_protocol:1;
     unsigned                           half_closed:1;
+    unsigned                           splice:1;
 } ngx_stream_upstream_t;
 
 
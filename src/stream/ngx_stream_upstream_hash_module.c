@@ -22,9 +22,20 @@ typedef struct {
 } ngx_stream_upstream_chash_points_t;
 
 
+typedef struct {
+    ngx_str_t                            *server;
+    uint32_t                              offset;
+    uint32_t                              skip;
+    uint32_t                              next;
+    ngx_int_t                             weight;
+} ngx_stream_upstream_maglev_server_t;
+
+
 typedef struct {
     ngx_stream_complex_value_t            key;
     ngx_stream_upstream_chash_points_t   *points;
+    ngx_uint_t                            maglev;
+    ngx_uint_t                            bound;
 } ngx_stream_upstream_hash_srv_conf_t;
 
 
@@ -53,6 +64,8 @@ static int ngx_libc_cdecl
     ngx_stream_upstream_chash_cmp_points(const void *one, const void *two);
 static ngx_uint_t ngx_stream_upstream_find_chash_point(
     ngx_stream_upstream_chash_points_t *points, uint32_t hash);
+static ngx_int_t ngx_stream_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us);
 static ngx_int_t ngx_stream_upstream_init_chash_peer(ngx_stream_session_t *s,
     ngx_stream_upstream_srv_conf_t *us);
 static ngx_int_t ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc,
@@ -66,7 +79,7 @@ static char *ngx_stream_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_stream_upstream_hash_commands[] = {
 
     { ngx_string("hash"),
-      NGX_STREAM_UPS_CONF|NGX_CONF_TAKE12,
+      NGX_STREAM_UPS_CONF|NGX_CONF_1MORE,
       ngx_stream_upstream_hash,
       NGX_STREAM_SRV_CONF_OFFSET,
       0,
@@ -178,7 +191,14 @@ ngx_stream_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_rlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config && hp->rrp.config != *hp->rrp.peers->config) {
+        ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+#endif
+
+    if (hp->tries > 20 || hp->rrp.peers->number < 2 || hp->key.len == 0) {
         ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -294,6 +314,9 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
     ngx_stream_upstream_rr_peers_t       *peers;
     ngx_stream_upstream_chash_points_t   *points;
     ngx_stream_upstream_hash_srv_conf_t  *hcf;
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    ngx_stream_upstream_rr_peer_t        *resolve;
+#endif
     union {
         uint32_t                          value;
         u_char                            byte[4];
@@ -308,6 +331,12 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
     peers = us->peer.data;
     npoints = peers->total_weight * 160;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    for (peer = peers->resolve; peer; peer = peer->next) {
+        npoints += peer->weight * 160;
+    }
+#endif
+
     size = sizeof(ngx_stream_upstream_chash_points_t)
            + sizeof(ngx_stream_upstream_chash_point_t) * (npoints - 1);
 
@@ -318,7 +347,26 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
 
     points->number = 0;
 
-    for (peer = peers->peer; peer; peer = peer->next) {
+    peer = peers->peer;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    resolve = peers->resolve;
+#endif
+
+    for ( ;; ) {
+
+        if (peer == NULL) {
+#if (NGX_STREAM_UPSTREAM_ZONE)
+            if (resolve) {
+                /* servers resolved at run time share the points by name */
+                peer = resolve;
+                resolve = NULL;
+                continue;
+            }
+#endif
+            break;
+        }
+
         server = &peer->server;
 
         /*
@@ -386,6 +434,8 @@ ngx_stream_upstream_init_chash(ngx_conf_t *cf,
             prev_hash.byte[3] = (u_char) ((hash >> 24) & 0xff);
 #endif
         }
+
+        peer = peer->next;
     }
 
     ngx_qsort(points->point,
@@ -429,6 +479,145 @@ ngx_stream_upstream_chash_cmp_points(const void *one, const void *two)
 }
 
 
+static ngx_int_t
+ngx_stream_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us)
+{
+    size_t                                size;
+    uint32_t                              c;
+    ngx_uint_t                            number, nservers, total, filled,
+                                          i, j, k;
+    ngx_stream_upstream_rr_peer_t        *peer;
+    ngx_stream_upstream_rr_peers_t       *peers;
+    ngx_stream_upstream_chash_point_t    *point;
+    ngx_stream_upstream_chash_points_t   *points;
+    ngx_stream_upstream_hash_srv_conf_t  *hcf;
+    ngx_stream_upstream_maglev_server_t  *servers;
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    ngx_stream_upstream_rr_peer_t        *resolve;
+#endif
+
+    /*
+     * Maglev hashing: each server fills the lookup table following its own
+     * permutation of the table slots, proportionally to its weight, so that
+     * a key is mapped to a server with a single table lookup
+     */
+
+    if (ngx_stream_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_stream_upstream_init_chash_peer;
+
+    peers = us->peer.data;
+
+    nservers = peers->number;
+    total = peers->total_weight;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    for (peer = peers->resolve; peer; peer = peer->next) {
+        nservers++;
+        total += peer->weight;
+    }
+#endif
+
+    servers = ngx_palloc(cf->temp_pool,
+                        nservers * sizeof(ngx_stream_upstream_maglev_server_t));
+    if (servers == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the table size is a prime number, at least 100 slots per weight unit */
+
+    for (number = ngx_max(total * 100, 257); /* void */; number++) {
+
+        for (k = 2; k * k <= number; k++) {
+            if (number % k == 0) {
+                break;
+            }
+        }
+
+        if (k * k > number) {
+            break;
+        }
+    }
+
+    peer = peers->peer;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    resolve = peers->resolve;
+#endif
+
+    for (i = 0; i < nservers; i++) {
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+        if (peer == NULL) {
+            /* servers resolved at run time share the slots by name */
+            peer = resolve;
+            resolve = NULL;
+        }
+#endif
+
+        servers[i].server = &peer->server;
+        servers[i].offset = ngx_crc32_long(peer->server.data, peer->server.len)
+                            % number;
+        servers[i].skip = ngx_murmur_hash2(peer->server.data, peer->server.len)
+                          % (number - 1) + 1;
+        servers[i].next = 0;
+        servers[i].weight = peer->weight;
+
+        peer = peer->next;
+    }
+
+    size = sizeof(ngx_stream_upstream_chash_points_t)
+           + sizeof(ngx_stream_upstream_chash_point_t) * (number - 1);
+
+    points = ngx_palloc(cf->pool, size);
+    if (points == NULL) {
+        return NGX_ERROR;
+    }
+
+    points->number = number;
+    point = points->point;
+
+    for (j = 0; j < number; j++) {
+        point[j].hash = j;
+        point[j].server = NULL;
+    }
+
+    filled = 0;
+
+    for ( ;; ) {
+        for (i = 0; i < nservers; i++) {
+            for (k = 0; k < (ngx_uint_t) servers[i].weight; k++) {
+
+                do {
+                    c = (servers[i].offset
+                         + (uint64_t) servers[i].next * servers[i].skip)
+                        % number;
+                    servers[i].next++;
+
+                } while (point[c].server);
+
+                point[c].server = servers[i].server;
+
+                if (++filled == number) {
+                    goto done;
+                }
+            }
+        }
+    }
+
+done:
+
+    hcf = ngx_stream_conf_upstream_srv_conf(us,
+                                            ngx_stream_upstream_hash_module);
+    hcf->points = points;
+
+    return NGX_OK;
+}
+
+
 static ngx_uint_t
 ngx_stream_upstream_find_chash_point(ngx_stream_upstream_chash_points_t *points,
     uint32_t hash)
@@ -481,6 +670,11 @@ ngx_stream_upstream_init_chash_peer(ngx_stream_session_t *s,
 
     hash = ngx_crc32_long(hp->key.data, hp->key.len);
 
+    if (hcf->maglev) {
+        hp->hash = hash % hcf->points->number;
+        return NGX_OK;
+    }
+
     ngx_stream_upstream_rr_peers_rlock(hp->rrp.peers);
 
     hp->hash = ngx_stream_upstream_find_chash_point(hcf->points, hash);
@@ -500,7 +694,8 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     intptr_t                              m;
     ngx_str_t                            *server;
     ngx_int_t                             total;
-    ngx_uint_t                            i, n, best_i;
+    ngx_uint_t                            i, n, best_i, conns, overloaded,
+                                          walked;
     ngx_stream_upstream_rr_peer_t        *peer, *best;
     ngx_stream_upstream_chash_point_t    *point;
     ngx_stream_upstream_chash_points_t   *points;
@@ -511,7 +706,14 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_wlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config && hp->rrp.config != *hp->rrp.peers->config) {
+        ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+#endif
+
+    if (hp->tries > 20 || hp->rrp.peers->number < 2 || hp->key.len == 0) {
         ngx_stream_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -524,6 +726,23 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     points = hcf->points;
     point = &points->point[0];
 
+    /*
+     * consistent hashing with bounded loads: a server with more than
+     * "bounded" times its weighted share of active connections is skipped
+     * in favour of the next point; the bound is ignored after walking
+     * 20 points per server
+     */
+
+    conns = 0;
+
+    if (hcf->bound) {
+        for (peer = hp->rrp.peers->peer; peer; peer = peer->next) {
+            conns += peer->conns;
+        }
+    }
+
+    walked = 0;
+
     for ( ;; ) {
         server = point[hp->hash % points->number].server;
 
@@ -534,6 +753,7 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
         best = NULL;
         best_i = 0;
         total = 0;
+        overloaded = 0;
 
         for (peer = hp->rrp.peers->peer, i = 0;
              peer;
@@ -568,6 +788,15 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
+            if (hcf->bound
+                && walked < 20 * hp->rrp.peers->number
+                && peer->conns * hp->rrp.peers->total_weight * 100
+                   >= hcf->bound * (conns + 1) * peer->weight)
+            {
+                overloaded = 1;
+                continue;
+            }
+
             peer->current_weight += peer->effective_weight;
             total += peer->effective_weight;
 
@@ -587,6 +816,12 @@ ngx_stream_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
         }
 
         hp->hash++;
+
+        if (overloaded) {
+            walked++;
+            continue;
+        }
+
         hp->tries++;
 
         if (hp->tries > 20) {
@@ -629,6 +864,8 @@ ngx_stream_upstream_hash_create_conf(ngx_conf_t *cf)
     }
 
     conf->points = NULL;
+    conf->maglev = 0;
+    conf->bound = 0;
 
     return conf;
 }
@@ -639,7 +876,9 @@ ngx_stream_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_stream_upstream_hash_srv_conf_t  *hcf = conf;
 
+    ngx_int_t                            n;
     ngx_str_t                           *value;
+    ngx_uint_t                           i;
     ngx_stream_upstream_srv_conf_t      *uscf;
     ngx_stream_compile_complex_value_t   ccv;
 
@@ -667,19 +906,52 @@ ngx_stream_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_STREAM_UPSTREAM_MAX_CONNS
                   |NGX_STREAM_UPSTREAM_MAX_FAILS
                   |NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
-                  |NGX_STREAM_UPSTREAM_DOWN;
+                  |NGX_STREAM_UPSTREAM_DOWN
+                  |NGX_STREAM_UPSTREAM_MODIFY;
 
     if (cf->args->nelts == 2) {
         uscf->peer.init_upstream = ngx_stream_upstream_init_hash;
+        return NGX_CONF_OK;
+    }
 
-    } else if (ngx_strcmp(value[2].data, "consistent") == 0) {
-        uscf->peer.init_upstream = ngx_stream_upstream_init_chash;
-
-    } else {
+    if (ngx_strcmp(value[2].data, "consistent") != 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[2]);
         return NGX_CONF_ERROR;
     }
 
+    for (i = 3; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "maglev") == 0) {
+            hcf->maglev = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "bounded=", 8) == 0) {
+
+            n = ngx_atofp(value[i].data + 8, value[i].len - 8, 2);
+
+            if (n == NGX_ERROR || n <= 100) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid load bound \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            hcf->bound = n;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (hcf->maglev) {
+        uscf->peer.init_upstream = ngx_stream_upstream_init_maglev;
+
+    } else {
+        uscf->peer.init_upstream = ngx_stream_upstream_init_chash;
+    }
+
     return NGX_CONF_OK;
 }
@@ -120,6 +120,14 @@ ngx_stream_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_stream_upstream_rr_peers_wlock(peers);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (ngx_stream_upstream_update_round_robin_peer(rrp) != NGX_OK) {
+        ngx_stream_upstream_rr_peers_unlock(peers);
+        pc->name = peers->name;
+        return NGX_BUSY;
+    }
+#endif
+
     best = NULL;
     total = 0;
 
@@ -304,7 +312,8 @@ ngx_stream_upstream_least_conn(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                   |NGX_STREAM_UPSTREAM_MAX_FAILS
                   |NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
                   |NGX_STREAM_UPSTREAM_DOWN
-                  |NGX_STREAM_UPSTREAM_BACKUP;
+                  |NGX_STREAM_UPSTREAM_BACKUP
+                  |NGX_STREAM_UPSTREAM_MODIFY;
 
     return NGX_CONF_OK;
 }
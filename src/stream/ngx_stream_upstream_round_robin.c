@@ -19,6 +19,14 @@ static ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_get_peer(
 static void ngx_stream_upstream_notify_round_robin_peer(
     ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+static ngx_int_t ngx_stream_upstream_init_resolve_peers(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us, ngx_stream_upstream_rr_peers_t *peers,
+    ngx_uint_t backup);
+
+#endif
+
 #if (NGX_STREAM_SSL)
 
 static ngx_int_t ngx_stream_upstream_set_round_robin_peer_session(
@@ -38,7 +46,7 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_stream_upstream_srv_conf_t *us)
 {
     ngx_url_t                        u;
-    ngx_uint_t                       i, j, n, w, t;
+    ngx_uint_t                       i, j, n, w, t, r, s;
     ngx_stream_upstream_server_t    *server;
     ngx_stream_upstream_rr_peer_t   *peer, **peerp;
     ngx_stream_upstream_rr_peers_t  *peers, *backup;
@@ -51,12 +59,24 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
         n = 0;
         w = 0;
         t = 0;
+        r = 0;
+        s = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (server[i].backup) {
                 continue;
             }
 
+            if (server[i].host.len) {
+                r++;
+
+                if (server[i].service.len) {
+                    s++;
+                }
+
+                continue;
+            }
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
 
@@ -65,13 +85,26 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
             }
         }
 
-        if (n == 0) {
+        if (n + r == 0) {
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
                           "no servers in upstream \"%V\" in %s:%ui",
                           &us->host, us->file_name, us->line);
             return NGX_ERROR;
         }
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+        if (r && us->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "resolving names at run time requires "
+                          "upstream \"%V\" in %s:%ui "
+                          "to be in shared memory",
+                          &us->host, us->file_name, us->line);
+            return NGX_ERROR;
+        }
+
+#endif
+
         peers = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_rr_peers_t));
         if (peers == NULL) {
             return NGX_ERROR;
@@ -118,17 +151,33 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
 
         us->peer.data = peers;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+        if (r && ngx_stream_upstream_init_resolve_peers(cf, us, peers, 0)
+                 != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+#endif
+
         /* backup servers */
 
         n = 0;
         w = 0;
         t = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (!server[i].backup) {
                 continue;
             }
 
+            if (server[i].host.len) {
+                r++;
+                continue;
+            }
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
 
@@ -137,7 +186,14 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
             }
         }
 
-        if (n == 0) {
+        /*
+         * SRV records of lower priority are resolved as backup servers,
+         * hence the backup peers are created if there are services
+         */
+
+        if (n + r == 0
+            && (s == 0 || !(us->flags & NGX_STREAM_UPSTREAM_BACKUP)))
+        {
             return NGX_OK;
         }
 
@@ -188,6 +244,16 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
 
         peers->next = backup;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+        if (r && ngx_stream_upstream_init_resolve_peers(cf, us, backup, 1)
+                 != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+#endif
+
         return NGX_OK;
     }
 
@@ -259,11 +325,69 @@ ngx_stream_upstream_init_round_robin(ngx_conf_t *cf,
 }
 
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_stream_upstream_init_resolve_peers(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us, ngx_stream_upstream_rr_peers_t *peers,
+    ngx_uint_t backup)
+{
+    ngx_uint_t                      i;
+    ngx_stream_upstream_host_t     *host;
+    ngx_stream_upstream_server_t   *server;
+    ngx_stream_upstream_rr_peer_t  *peer;
+
+    /*
+     * servers resolved at run time are kept as template peers,
+     * the peers of their addresses are created in shared memory
+     */
+
+    server = us->servers->elts;
+
+    for (i = 0; i < us->servers->nelts; i++) {
+
+        if (server[i].host.len == 0 || server[i].backup != backup) {
+            continue;
+        }
+
+        peer = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_rr_peer_t));
+        if (peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        host = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_host_t));
+        if (host == NULL) {
+            return NGX_ERROR;
+        }
+
+        host->name = server[i].host;
+        host->service = server[i].service;
+        host->port = server[i].port;
+
+        peer->weight = server[i].weight;
+        peer->effective_weight = server[i].weight;
+        peer->max_conns = server[i].max_conns;
+        peer->max_fails = server[i].max_fails;
+        peer->fail_timeout = server[i].fail_timeout;
+        peer->down = server[i].down;
+        peer->server = server[i].name;
+        peer->host = host;
+
+        peer->next = peers->resolve;
+        peers->resolve = peer;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
     ngx_stream_upstream_srv_conf_t *us)
 {
-    ngx_uint_t                           n;
+    ngx_uint_t                           n, tries;
     ngx_stream_upstream_rr_peer_data_t  *rrp;
 
     rrp = s->upstream->peer.data;
@@ -282,12 +406,24 @@ ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
     rrp->current = NULL;
     rrp->config = 0;
 
+    ngx_stream_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (rrp->peers->config) {
+        rrp->config = *rrp->peers->config;
+    }
+#endif
+
     n = rrp->peers->number;
 
     if (rrp->peers->next && rrp->peers->next->number > n) {
         n = rrp->peers->next->number;
     }
 
+    tries = ngx_stream_upstream_tries(rrp->peers);
+
+    ngx_stream_upstream_rr_peers_unlock(rrp->peers);
+
     if (n <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
@@ -304,7 +440,7 @@ ngx_stream_upstream_init_round_robin_peer(ngx_stream_session_t *s,
     s->upstream->peer.get = ngx_stream_upstream_get_round_robin_peer;
     s->upstream->peer.free = ngx_stream_upstream_free_round_robin_peer;
     s->upstream->peer.notify = ngx_stream_upstream_notify_round_robin_peer;
-    s->upstream->peer.tries = ngx_stream_upstream_tries(rrp->peers);
+    s->upstream->peer.tries = tries;
 #if (NGX_STREAM_SSL)
     s->upstream->peer.set_session =
                              ngx_stream_upstream_set_round_robin_peer_session;
@@ -455,6 +591,14 @@ ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_stream_upstream_rr_peers_wlock(peers);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (ngx_stream_upstream_update_round_robin_peer(rrp) != NGX_OK) {
+        ngx_stream_upstream_rr_peers_unlock(peers);
+        pc->name = peers->name;
+        return NGX_BUSY;
+    }
+#endif
+
     if (peers->single) {
         peer = peers->peer;
 
@@ -605,6 +749,47 @@ ngx_stream_upstream_get_peer(ngx_stream_upstream_rr_peer_data_t *rrp)
 }
 
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+ngx_int_t
+ngx_stream_upstream_update_round_robin_peer(
+    ngx_stream_upstream_rr_peer_data_t *rrp)
+{
+    ngx_uint_t                       n;
+    ngx_stream_upstream_rr_peers_t  *peers;
+
+    /* the peers are locked */
+
+    peers = rrp->peers;
+
+    if (peers->config == NULL || rrp->config == *peers->config) {
+        return NGX_OK;
+    }
+
+    /*
+     * the peers were changed since the peer data were initialized,
+     * the tried peers are forgotten if the bitmap is still large enough
+     */
+
+    n = peers->number;
+
+    if (peers->next && peers->next->number > n) {
+        n = peers->next->number;
+    }
+
+    if (rrp->tried != &rrp->data || n > 8 * sizeof(uintptr_t)) {
+        return NGX_BUSY;
+    }
+
+    rrp->data = 0;
+    rrp->config = *peers->config;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 void
 ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
@@ -624,11 +809,17 @@ ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
     if (rrp->peers->single) {
         peer->conns--;
+        pc->tries = 0;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+        if (peer->zombie && peer->conns == 0) {
+            goto zombie;
+        }
+#endif
 
         ngx_stream_upstream_rr_peer_unlock(rrp->peers, peer);
         ngx_stream_upstream_rr_peers_unlock(rrp->peers);
 
-        pc->tries = 0;
         return;
     }
 
@@ -667,12 +858,40 @@ ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
     peer->conns--;
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+    if (peer->zombie && peer->conns == 0) {
+        goto zombie;
+    }
+#endif
+
+    ngx_stream_upstream_rr_peer_unlock(rrp->peers, peer);
+    ngx_stream_upstream_rr_peers_unlock(rrp->peers);
+
+    if (pc->tries) {
+        pc->tries--;
+    }
+
+    return;
+
+#if (NGX_STREAM_UPSTREAM_ZONE)
+
+zombie:
+
+    /* the peer was removed from the peers while in use */
+
     ngx_stream_upstream_rr_peer_unlock(rrp->peers, peer);
+
+    ngx_stream_upstream_zone_free_peer(rrp->peers, peer);
+
     ngx_stream_upstream_rr_peers_unlock(rrp->peers);
 
+    rrp->current = NULL;
+
     if (pc->tries) {
         pc->tries--;
     }
+
+#endif
 }
 
 
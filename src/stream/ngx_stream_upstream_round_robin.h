@@ -16,6 +16,13 @@
 
 typedef struct ngx_stream_upstream_rr_peer_s   ngx_stream_upstream_rr_peer_t;
 
+
+typedef struct {
+    ngx_str_t                        name;
+    ngx_str_t                        service;
+    in_port_t                        port;
+} ngx_stream_upstream_host_t;
+
 struct ngx_stream_upstream_rr_peer_s {
     struct sockaddr                 *sockaddr;
     socklen_t                        socklen;
@@ -37,6 +44,7 @@ struct ngx_stream_upstream_rr_peer_s {
     time_t                           fail_timeout;
     ngx_msec_t                       slow_start;
     ngx_msec_t                       start_time;
+    ngx_msec_t                       response_time;
 
     ngx_uint_t                       down;
 
@@ -45,11 +53,13 @@ struct ngx_stream_upstream_rr_peer_s {
 
 #if (NGX_STREAM_UPSTREAM_ZONE)
     ngx_atomic_t                     lock;
+    ngx_stream_upstream_host_t      *host;
+    ngx_uint_t                       zombie;  /* unsigned  zombie:1; */
 #endif
 
     ngx_stream_upstream_rr_peer_t   *next;
 
-    NGX_COMPAT_BEGIN(25)
+    NGX_COMPAT_BEGIN(22)
     NGX_COMPAT_END
 };
 
@@ -62,6 +72,8 @@ struct ngx_stream_upstream_rr_peers_s {
 #if (NGX_STREAM_UPSTREAM_ZONE)
     ngx_slab_pool_t                 *shpool;
     ngx_atomic_t                     rwlock;
+    ngx_uint_t                      *config;
+    ngx_stream_upstream_rr_peer_t   *resolve;
     ngx_stream_upstream_rr_peers_t  *zone_next;
 #endif
 
@@ -143,5 +155,12 @@ ngx_int_t ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
 void ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
 
+#if (NGX_STREAM_UPSTREAM_ZONE)
+ngx_int_t ngx_stream_upstream_update_round_robin_peer(
+    ngx_stream_upstream_rr_peer_data_t *rrp);
+void ngx_stream_upstream_zone_free_peer(ngx_stream_upstream_rr_peers_t *peers,
+    ngx_stream_upstream_rr_peer_t *peer);
+#endif
+
 
 #endif /* _NGX_STREAM_UPSTREAM_ROUND_ROBIN_H_INCLUDED_ */
@@ -37,6 +37,10 @@ static ngx_int_t ngx_stream_variable_status(ngx_stream_session_t *s,
     ngx_stream_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_stream_variable_connection(ngx_stream_session_t *s,
     ngx_stream_variable_value_t *v, uintptr_t data);
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+static ngx_int_t ngx_stream_variable_listen_queue(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data);
+#endif
 
 static ngx_int_t ngx_stream_variable_nginx_version(ngx_stream_session_t *s,
     ngx_stream_variable_value_t *v, uintptr_t data);
@@ -106,6 +110,14 @@ static ngx_stream_variable_t  ngx_stream_core_variables[] = {
     { ngx_string("connection"), NULL,
       ngx_stream_variable_connection, 0, 0, 0 },
 
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+    { ngx_string("listen_queue"), NULL, ngx_stream_variable_listen_queue,
+      0, NGX_STREAM_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("listen_backlog"), NULL, ngx_stream_variable_listen_queue,
+      1, NGX_STREAM_VAR_NOCACHEABLE, 0 },
+#endif
+
     { ngx_string("nginx_version"), NULL, ngx_stream_variable_nginx_version,
       0, 0, 0 },
 
@@ -816,6 +828,47 @@ ngx_stream_variable_connection(ngx_stream_session_t *s,
 }
 
 
+#if (NGX_LINUX && NGX_HAVE_TCP_INFO)
+
+static ngx_int_t
+ngx_stream_variable_listen_queue(ngx_stream_session_t *s,
+    ngx_stream_variable_value_t *v, uintptr_t data)
+{
+    uint32_t          value;
+    socklen_t         len;
+    struct tcp_info   ti;
+    ngx_listening_t  *ls;
+
+    ls = s->connection->listening;
+
+    /* Linux reports the accept queue of a listening socket */
+
+    len = sizeof(struct tcp_info);
+    if (ls->type != SOCK_STREAM
+        || getsockopt(ls->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = ngx_pnalloc(s->connection->pool, NGX_INT32_LEN);
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    value = data ? ti.tcpi_sacked : ti.tcpi_unacked;
+
+    v->len = ngx_sprintf(v->data, "%uD", value) - v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_stream_variable_nginx_version(ngx_stream_session_t *s,
     ngx_stream_variable_value_t *v, uintptr_t data)